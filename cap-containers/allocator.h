@@ -0,0 +1,84 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_ALLOCATOR_H
+#define CAP_ALLOCATOR_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+/**
+ * Allocator a container takes it's memory from. The sizes given to realloc
+ * and free are the ones the memory was allocated with, so an arena or a pool
+ * does not have to keep a header. A zeroed cap_allocator (or NULL at init)
+ * selects malloc/realloc/free. realloc may be NULL, the memory is then moved
+ * with alloc, memcpy and free
+ */
+typedef struct {
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t old_size,
+			 size_t new_size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+} cap_allocator;
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static void *_cap_allocator_alloc(const cap_allocator *allocator,
+				  size_t size) {
+	if (!allocator || !allocator->alloc) return malloc(size);
+	return allocator->alloc(allocator->ctx, size);
+}
+
+static void *_cap_allocator_calloc(const cap_allocator *allocator,
+				   size_t count, size_t size) {
+	if (!allocator || !allocator->alloc) return calloc(count, size);
+	if (size && count > SIZE_MAX / size) return NULL;
+	void *ptr = allocator->alloc(allocator->ctx, count * size);
+	if (ptr) memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void *_cap_allocator_realloc(const cap_allocator *allocator,
+				    void *ptr, size_t old_size,
+				    size_t new_size) {
+	if (!allocator || !allocator->alloc) return realloc(ptr, new_size);
+	if (allocator->realloc)
+		return allocator->realloc(allocator->ctx, ptr, old_size,
+					  new_size);
+	void *new_ptr = allocator->alloc(allocator->ctx, new_size);
+	if (!new_ptr) return NULL;
+	if (ptr) {
+		memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+		allocator->free(allocator->ctx, ptr, old_size);
+	}
+	return new_ptr;
+}
+
+static void _cap_allocator_free(const cap_allocator *allocator, void *ptr,
+				size_t size) {
+	if (!allocator || !allocator->alloc) {
+		free(ptr);
+		return;
+	}
+	if (ptr) allocator->free(allocator->ctx, ptr, size);
+}
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+#endif // !CAP_ALLOCATOR_H
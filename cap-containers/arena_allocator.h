@@ -21,16 +21,142 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_ARENA_ALLOCATOR
 #define CAP_ARENA_ALLOCATOR
+#include "allocator.h"
 #include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef CAP_ARENA_DEBUG
+#if defined(__SANITIZE_ADDRESS__)
+#define CAP_ARENA_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define CAP_ARENA_ASAN
+#endif
+#endif
+#ifdef CAP_ARENA_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+// Alignment of cap_arena_alloc(), suitable for any scalar type
+#define CAP_ARENA_DEFAULT_ALIGNMENT _Alignof(max_align_t)
+// A mapped arena commits at least this much at once, in pages or huge pages
+#define CAP_ARENA_COMMIT_SIZE (1 << 16)
+#define CAP_ARENA_HUGE_PAGE_SIZE (1 << 21)
+// Byte the debug mode fills the memory which isn't allocated with
+#define CAP_ARENA_POISON_BYTE 0xdd
+
+/**
+ * Options of a mapped arena allocator
+ *
+ * CAP_ARENA_MAP_HUGETLB backs the arena with explicit huge pages, from the
+ * system's huge page pool, which are reserved for the whole arena up front. If
+ * the pool can't provide them, the arena falls back to transparent huge pages.
+ *
+ * CAP_ARENA_MAP_HUGEPAGE asks for transparent huge pages with
+ * madvise(MADV_HUGEPAGE), and aligns the reservation to the huge page size so
+ * the whole of it is eligible.
+ */
+typedef enum {
+	CAP_ARENA_MAP_DEFAULT = 0,
+	CAP_ARENA_MAP_HUGETLB = 1 << 0,
+	CAP_ARENA_MAP_HUGEPAGE = 1 << 1
+} cap_arena_map_flags;
+
+// Block of arena memory, the blocks of a growable arena are chained from the
+// newest to the oldest
+typedef struct _cap_arena_block {
+	struct _cap_arena_block *_prev;
+	unsigned char *_mem;
+	size_t _size;
+#ifdef CAP_ARENA_DEBUG
+	// Mapping of the memory and it's guard pages
+	unsigned char *_map;
+	size_t _map_size;
+#endif
+} _cap_arena_block;
 
 typedef struct {
+	// Memory of the current block, and the offset of it's free space
 	unsigned char *_mem_ptr;
+	size_t _offset;
+	// Sum of the sizes of the blocks, and of the bytes used within them
 	size_t _total_arena_size;
 	size_t _current_arena_size;
+	_cap_arena_block *_block;
+	// Largest block released by a rewind, reused by the next growth
+	_cap_arena_block *_spare;
+	bool _growable;
+	// A mapped arena's single block is reserved address space, which is
+	// made accessible up to _committed, in multiples of _granule
+	bool _mapped;
+	size_t _committed;
+	size_t _granule;
+	// Accounting of CAP_ARENA_STATS, the bytes asked for, the alignment
+	// padding and the number of the allocations since the last reset, and
+	// the largest size the arena reached
+	size_t _requested_size;
+	size_t _padding_size;
+	size_t _allocation_count;
+	size_t _peak_size;
+	// Container which handed the arena out, a cap_arena_pool's slot
+	void *_owner;
 } cap_arena_allocator;
 
+/**
+ * Save point of an arena allocator, the position of it's next allocation
+ */
+typedef struct {
+	_cap_arena_block *_block;
+	size_t _offset;
+	size_t _size;
+	size_t _requested_size;
+	size_t _padding_size;
+	size_t _allocation_count;
+} cap_arena_savepoint;
+
+/**
+ * Usage of an arena allocator at one point, from cap_arena_stats_snapshot().
+ * The requested and padding sizes, the allocation count and the peak are only
+ * counted when CAP_ARENA_STATS is defined before including this header, they
+ * are 0 otherwise
+ */
+typedef struct {
+	// Bytes asked for by the allocations since the last reset
+	size_t requested_size;
+	// Bytes the allocations took, the requested size and the padding
+	size_t used_size;
+	// Bytes skipped to align the allocations
+	size_t padding_size;
+	// Sum of the block sizes, and the part of it which is committed
+	size_t capacity;
+	size_t committed_size;
+	// Largest used size since the arena was created
+	size_t peak_size;
+	size_t allocation_count;
+	size_t block_count;
+} cap_arena_stats;
+
+/**
+ * Defining CAP_ARENA_DEBUG before including this header turns on the debug
+ * mode of the arena allocators. The blocks are mapped between two PROT_NONE
+ * guard pages, with their memory ending against the second one, so writing or
+ * reading past the end of a block faults instead of reaching the heap. The
+ * memory which isn't allocated, fresh blocks, the space given back by a reset,
+ * a rewind, a shrinking or moving reallocation and a free through
+ * cap_arena_allocator_interface(), is filled with CAP_ARENA_POISON_BYTE so a
+ * stale pointer reads garbage rather than the old contents. Under
+ * AddressSanitizer that memory is also poisoned, so any access to it is
+ * reported where it happens. A mapped arena has no guard pages, the end of it's
+ * reservation isn't accessible anyway
+ */
+
 /**
  * Create a new Arena allocator of the given size.
  *
@@ -38,22 +164,104 @@ typedef struct {
  * @return New arena allocator object
  */
 static cap_arena_allocator *cap_arena_allocator_init(size_t init_size);
+/**
+ * Create a new growable Arena allocator, starting with a block of the given
+ * size. When an allocation doesn't fit within the current block, a new block
+ * of twice it's size, or larger if the allocation needs it, is chained after
+ * it, so the number of blocks stays logarithmic in the arena's size
+ *
+ * @param init_size Size of the first block
+ * @return New arena allocator object
+ */
+static cap_arena_allocator *cap_arena_allocator_init_growable(size_t init_size);
+/**
+ * Create a new Arena allocator backed by a reservation of virtual address
+ * space, made with mmap(PROT_NONE). No memory is committed up front, the
+ * allocations commit the pages they reach as they go, so a large arena which
+ * is mostly unused costs neither the time to fault it in nor the memory. The
+ * arena doesn't grow beyond the reservation
+ *
+ * @param reserve_size Size of the address space to reserve, rounded up to the
+ * page size, or the huge page size if huge pages are asked for
+ * @param flags Bitwise OR of cap_arena_map_flags
+ * @return New arena allocator object
+ */
+static cap_arena_allocator *cap_arena_allocator_init_mapped(size_t reserve_size,
+							    int flags);
 /**
  * Return a new pointer which can hold the given size capacity within the arena
- * allocator
+ * allocator, aligned to CAP_ARENA_DEFAULT_ALIGNMENT
  *
  * If the given size is larger the one given on the space available on the
- * allocator, it returns NULL
+ * allocator, it returns NULL. A growable allocator chains a new block instead,
+ * and only returns NULL if that block can't be allocated
  *
  * @param arena Arena allocator object
  * @param size Size of the memory to be allocated from the arena allocator
  * @return Pointer to the start of the buffer
  */
 static void *cap_arena_alloc(cap_arena_allocator *arena, size_t size);
+/**
+ * Return a new pointer which can hold the given size capacity within the arena
+ * allocator, aligned to the given alignment, e.g a cache line for a hot struct
+ * or 32 for an AVX buffer. The bytes skipped to align the pointer are counted
+ * as used
+ *
+ * If the given size and the alignment padding are larger than the space
+ * available on the allocator, it returns NULL, or chains a new block for a
+ * growable allocator
+ *
+ * @param arena Arena allocator object
+ * @param size Size of the memory to be allocated from the arena allocator
+ * @param align Alignment of the pointer, a power of two
+ * @return Pointer to the start of the buffer
+ */
+static void *cap_arena_alloc_aligned(cap_arena_allocator *arena, size_t size,
+				     size_t align);
+/**
+ * Resize the given allocation. If it's the most recent allocation of the arena
+ * and the new size fits within the current block, it grows or shrinks in
+ * place and the same pointer is returned, so a buffer built at the arena's tip
+ * never copies. Otherwise a new allocation at the default alignment is made
+ * and the contents are copied into it, the old allocation's space is only
+ * reclaimed by a rewind or a reset
+ *
+ * @param arena Arena allocator object
+ * @param ptr Allocation to resize, NULL to make a new one
+ * @param old_size Size the allocation was made with
+ * @param new_size New size of the allocation
+ * @return Pointer to the resized allocation, NULL if there's no space for it
+ */
+static void *cap_arena_realloc_last(cap_arena_allocator *arena, void *ptr,
+				    size_t old_size, size_t new_size);
+/**
+ * Get a save point of the arena allocator, which cap_arena_rewind() returns
+ * to. The save points may be nested
+ *
+ * @param arena Arena allocator object
+ * @return Save point at the arena's next allocation
+ */
+static cap_arena_savepoint cap_arena_mark(cap_arena_allocator *arena);
+/**
+ * Discard all the allocations made since the given save point. The blocks
+ * chained since the save point are released, but for the largest one, which
+ * is kept for the next block the arena needs. The save points taken after the
+ * given one are invalidated, and every save point is invalidated by
+ * cap_arena_reset()
+ *
+ * @param arena Arena allocator object
+ * @param mark Save point of the arena
+ */
+static void cap_arena_rewind(cap_arena_allocator *arena,
+			     cap_arena_savepoint mark);
 /**
  * Reset the arena allocater to point the the starting memory region. One can
  * just overwrite the existing or previous memory/contents
  *
+ * A growable allocator keeps it's largest block only and releases the others,
+ * so an arena which is reset after each request stops allocating once it's
+ * largest block holds a whole request
+ *
  * @param arena Arena allocator object
  */
 static void cap_arena_reset(cap_arena_allocator *arena);
@@ -71,54 +279,561 @@ static void cap_arena_free(cap_arena_allocator *arena);
  */
 static size_t cap_arena_size(cap_arena_allocator *arena);
 /**
- * Get the remaining space available on the allocator
+ * Get the remaining space available on the allocator, within the current block
+ * for a growable allocator
  *
  * @param arena Arena allocator object
- * @return Remaining space left before the allocator runs out of memory
+ * @return Remaining space left before the allocator runs out of memory, or
+ * chains a new block
  */
 static size_t cap_arena_remaining_size(cap_arena_allocator *arena);
 /**
  * Get the capacity of the underlying arena allocator
  *
  * @param arena Arena allocator object
- * @return Capacity of the arena allocator object
+ * @return Capacity of the arena allocator object, the sum of it's block sizes
+ * including the one kept by a rewind
  */
 static size_t cap_arena_capacity(cap_arena_allocator *arena);
+/**
+ * Get the number of bytes of the arena allocator which are committed, the
+ * capacity unless the allocator is mapped
+ *
+ * @param arena Arena allocator object
+ * @return Committed size of the arena allocator
+ */
+static size_t cap_arena_committed_size(cap_arena_allocator *arena);
+/**
+ * Give the memory of a mapped arena allocator beyond it's current size, or
+ * the given size if it's larger, back to the system with
+ * madvise(MADV_DONTNEED). The memory stays committed, the pages are zero
+ * filled again on their next use. Calling it after cap_arena_reset() drops the
+ * arena's resident memory down to the given size. It does nothing unless the
+ * allocator is mapped
+ *
+ * @param arena Arena allocator object
+ * @param keep_size Size of the memory to keep resident
+ */
+static void cap_arena_trim(cap_arena_allocator *arena, size_t keep_size);
+/**
+ * Get the number of blocks of the arena allocator
+ *
+ * @param arena Arena allocator object
+ * @return Number of blocks, always one unless the allocator is growable
+ */
+static size_t cap_arena_block_count(cap_arena_allocator *arena);
+/**
+ * Get a cap_allocator which takes it's memory from the arena allocator, for
+ * the containers' *_init_with_allocator() functions. Freeing is a no-op, the
+ * memory comes back with cap_arena_reset() or cap_arena_rewind(), so a
+ * container built within a request is dropped with the request's arena. A
+ * reallocation of the arena's last allocation grows in place
+ *
+ * @param arena Arena allocator object, it must outlive the containers
+ * @return Allocator to pass to the containers
+ */
+static cap_allocator cap_arena_allocator_interface(cap_arena_allocator *arena);
+/**
+ * Get the number of bytes asked for by the allocations since the last reset,
+ * without the alignment padding. Counted when CAP_ARENA_STATS is defined
+ *
+ * @param arena Arena allocator object
+ * @return Requested size, 0 without CAP_ARENA_STATS
+ */
+static size_t cap_arena_requested_size(cap_arena_allocator *arena);
+/**
+ * Get the number of bytes skipped to align the allocations since the last
+ * reset, the difference of the arena's size and the requested size. Counted
+ * when CAP_ARENA_STATS is defined
+ *
+ * @param arena Arena allocator object
+ * @return Alignment padding, 0 without CAP_ARENA_STATS
+ */
+static size_t cap_arena_padding_size(cap_arena_allocator *arena);
+/**
+ * Get the largest size the arena allocator reached since it was created,
+ * which a reset or a rewind doesn't lower. Counted when CAP_ARENA_STATS is
+ * defined
+ *
+ * @param arena Arena allocator object
+ * @return Peak size, 0 without CAP_ARENA_STATS
+ */
+static size_t cap_arena_peak_size(cap_arena_allocator *arena);
+/**
+ * Get the number of allocations made since the last reset, a reallocation in
+ * place isn't counted. Counted when CAP_ARENA_STATS is defined
+ *
+ * @param arena Arena allocator object
+ * @return Allocation count, 0 without CAP_ARENA_STATS
+ */
+static size_t cap_arena_allocation_count(cap_arena_allocator *arena);
+/**
+ * Get all the usage figures of the arena allocator at once
+ *
+ * @param arena Arena allocator object
+ * @return Snapshot of the arena's usage
+ */
+static cap_arena_stats cap_arena_stats_snapshot(cap_arena_allocator *arena);
+
+static cap_arena_allocator *_cap_arena_allocator_init(size_t init_size,
+						      bool growable);
+static _cap_arena_block *_cap_arena_block_init(size_t size);
+static void _cap_arena_block_free(cap_arena_allocator *arena,
+				  _cap_arena_block *block);
+static void *_cap_arena_reserve(size_t *size, int flags, size_t *granule);
+static bool _cap_arena_commit(cap_arena_allocator *arena, size_t end);
+static void *_cap_arena_bump(cap_arena_allocator *arena, size_t size,
+			     size_t align);
+static bool _cap_arena_grow(cap_arena_allocator *arena, size_t size,
+			    size_t align);
+static void _cap_arena_release_block(cap_arena_allocator *arena,
+				     _cap_arena_block *block);
+static void _cap_arena_account(cap_arena_allocator *arena, size_t size,
+			       size_t padding);
+static void _cap_arena_account_resize(cap_arena_allocator *arena,
+				      size_t old_size, size_t new_size);
+static void _cap_arena_poison(void *ptr, size_t size);
+static void _cap_arena_unpoison(void *ptr, size_t size);
+static void *_cap_arena_interface_alloc(void *arena, size_t size);
+static void *_cap_arena_interface_realloc(void *arena, void *ptr,
+					  size_t old_size, size_t new_size);
+static void _cap_arena_interface_free(void *arena, void *ptr, size_t size);
 
 static cap_arena_allocator *cap_arena_allocator_init(size_t init_size) {
+	return _cap_arena_allocator_init(init_size, false);
+}
+
+static cap_arena_allocator *
+cap_arena_allocator_init_growable(size_t init_size) {
+	assert(init_size > 0);
+	return _cap_arena_allocator_init(init_size, true);
+}
+
+static cap_arena_allocator *_cap_arena_allocator_init(size_t init_size,
+						      bool growable) {
 	cap_arena_allocator *arena =
 	    (cap_arena_allocator *)malloc(sizeof(cap_arena_allocator));
 	if (!arena) {
 		fprintf(stderr, "memory allocation failur\n");
 		return NULL;
 	}
-	arena->_mem_ptr = (unsigned char *)malloc(init_size);
-	if (!arena->_mem_ptr) {
+	arena->_block = _cap_arena_block_init(init_size);
+	if (!arena->_block) {
 		fprintf(stderr, "memory allocation failur\n");
 		free(arena);
 		return NULL;
 	}
+	arena->_mem_ptr = arena->_block->_mem;
+	arena->_offset = 0;
 	arena->_total_arena_size = init_size;
 	arena->_current_arena_size = 0;
+	arena->_spare = NULL;
+	arena->_growable = growable;
+	arena->_mapped = false;
+	arena->_committed = 0;
+	arena->_granule = 1;
+	arena->_requested_size = 0;
+	arena->_padding_size = 0;
+	arena->_allocation_count = 0;
+	arena->_peak_size = 0;
+	arena->_owner = NULL;
 	return arena;
 }
 
+static cap_arena_allocator *cap_arena_allocator_init_mapped(size_t reserve_size,
+							    int flags) {
+	assert(reserve_size > 0);
+	cap_arena_allocator *arena =
+	    (cap_arena_allocator *)malloc(sizeof(cap_arena_allocator));
+	_cap_arena_block *block =
+	    (_cap_arena_block *)malloc(sizeof(_cap_arena_block));
+	size_t granule;
+	void *mem = arena && block
+			? _cap_arena_reserve(&reserve_size, flags, &granule)
+			: NULL;
+	if (!mem) {
+		fprintf(stderr, "memory allocation failur\n");
+		free(block);
+		free(arena);
+		return NULL;
+	}
+	block->_prev = NULL;
+	block->_mem = (unsigned char *)mem;
+	block->_size = reserve_size;
+	arena->_block = block;
+	arena->_mem_ptr = block->_mem;
+	arena->_offset = 0;
+	arena->_total_arena_size = reserve_size;
+	arena->_current_arena_size = 0;
+	arena->_spare = NULL;
+	arena->_growable = false;
+	arena->_mapped = true;
+	arena->_committed = 0;
+	arena->_granule = granule;
+	arena->_requested_size = 0;
+	arena->_padding_size = 0;
+	arena->_allocation_count = 0;
+	arena->_peak_size = 0;
+	arena->_owner = NULL;
+	return arena;
+}
+
+// Reserves the address space of a mapped arena, the size is rounded up to
+// the granule the memory is committed in
+static void *_cap_arena_reserve(size_t *size, int flags, size_t *granule) {
+	bool huge = flags & (CAP_ARENA_MAP_HUGETLB | CAP_ARENA_MAP_HUGEPAGE);
+	*granule =
+	    huge ? CAP_ARENA_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+	if (*size > SIZE_MAX - *granule * 2) return NULL;
+	*size = (*size + *granule - 1) & ~(*granule - 1);
+	// The reservation doesn't count against the commit limit, the pages do
+	// once they're made accessible
+	const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_HUGETLB
+	// Explicit huge pages are reserved from the pool up front, without the
+	// reservation a short pool would only show as a SIGBUS on first use
+	if (flags & CAP_ARENA_MAP_HUGETLB) {
+		void *mem = mmap(NULL, *size, PROT_NONE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1,
+				 0);
+		if (mem != MAP_FAILED) return mem;
+	}
+#endif
+	if (!huge) {
+		void *mem = mmap(NULL, *size, PROT_NONE, map_flags, -1, 0);
+		return mem == MAP_FAILED ? NULL : mem;
+	}
+	// Transparent huge pages only back aligned huge pages, so one more huge
+	// page is reserved and the unaligned ends are unmapped
+	unsigned char *mem = (unsigned char *)mmap(
+	    NULL, *size + *granule, PROT_NONE, map_flags, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+	size_t head = (size_t)(-(uintptr_t)mem & (*granule - 1));
+	if (head) munmap(mem, head);
+	if (*granule - head) munmap(mem + head + *size, *granule - head);
+#ifdef MADV_HUGEPAGE
+	madvise(mem + head, *size, MADV_HUGEPAGE);
+#endif
+	return mem + head;
+}
+
+// Makes the memory of a mapped arena accessible up to the given offset
+static bool _cap_arena_commit(cap_arena_allocator *arena, size_t end) {
+	if (!arena->_mapped || end <= arena->_committed) return true;
+	// Committing a little ahead saves a system call per page
+	size_t target = end;
+	if (target - arena->_committed < CAP_ARENA_COMMIT_SIZE)
+		target = arena->_committed + CAP_ARENA_COMMIT_SIZE;
+	target = (target + arena->_granule - 1) & ~(arena->_granule - 1);
+	if (target > arena->_block->_size) target = arena->_block->_size;
+	if (mprotect(arena->_mem_ptr + arena->_committed,
+		     target - arena->_committed,
+		     PROT_READ | PROT_WRITE) != 0)
+		return false;
+	_cap_arena_poison(arena->_mem_ptr + arena->_committed,
+			  target - arena->_committed);
+	arena->_committed = target;
+	return true;
+}
+
+// The block's header and it's memory are a single allocation, the memory
+// starts at the default alignment. In the debug mode the memory is mapped on
+// it's own, it ends against the trailing guard page as close as the default
+// alignment allows
+static _cap_arena_block *_cap_arena_block_init(size_t size) {
+#ifdef CAP_ARENA_DEBUG
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	if (size > SIZE_MAX - page * 3) return NULL;
+	size_t span = (size + page - 1) & ~(page - 1);
+	unsigned char *map =
+	    (unsigned char *)mmap(NULL, span + page * 2, PROT_NONE,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) return NULL;
+	_cap_arena_block *guarded =
+	    (_cap_arena_block *)malloc(sizeof(_cap_arena_block));
+	if (!guarded ||
+	    (span && mprotect(map + page, span, PROT_READ | PROT_WRITE) != 0)) {
+		free(guarded);
+		munmap(map, span + page * 2);
+		return NULL;
+	}
+	guarded->_prev = NULL;
+	guarded->_mem = map + page +
+			((span - size) & ~(CAP_ARENA_DEFAULT_ALIGNMENT - 1));
+	guarded->_size = size;
+	guarded->_map = map;
+	guarded->_map_size = span + page * 2;
+	_cap_arena_poison(guarded->_mem, size);
+	return guarded;
+#else
+	const size_t header =
+	    (sizeof(_cap_arena_block) + CAP_ARENA_DEFAULT_ALIGNMENT - 1) &
+	    ~(CAP_ARENA_DEFAULT_ALIGNMENT - 1);
+	if (size > SIZE_MAX - header) return NULL;
+	_cap_arena_block *block = (_cap_arena_block *)malloc(header + size);
+	if (!block) return NULL;
+	block->_prev = NULL;
+	block->_mem = (unsigned char *)block + header;
+	block->_size = size;
+	return block;
+#endif
+}
+
+static void _cap_arena_block_free(cap_arena_allocator *arena,
+				  _cap_arena_block *block) {
+#ifdef CAP_ARENA_DEBUG
+	// The address range may be mapped again, without the poison
+	_cap_arena_unpoison(block->_mem,
+			    arena->_mapped ? arena->_committed : block->_size);
+	if (!arena->_mapped) {
+		munmap(block->_map, block->_map_size);
+		free(block);
+		return;
+	}
+#endif
+	if (arena->_mapped) munmap(block->_mem, block->_size);
+	free(block);
+}
+
+// Fills the memory which isn't allocated and hides it from AddressSanitizer,
+// in the debug mode only
+static void _cap_arena_poison(void *ptr, size_t size) {
+#ifdef CAP_ARENA_DEBUG
+	// The memory may be poisoned already
+	_cap_arena_unpoison(ptr, size);
+	memset(ptr, CAP_ARENA_POISON_BYTE, size);
+#ifdef CAP_ARENA_ASAN
+	ASAN_POISON_MEMORY_REGION(ptr, size);
+#endif
+#else
+	(void)ptr;
+	(void)size;
+#endif
+}
+
+static void _cap_arena_unpoison(void *ptr, size_t size) {
+#ifdef CAP_ARENA_ASAN
+	ASAN_UNPOISON_MEMORY_REGION(ptr, size);
+#else
+	(void)ptr;
+	(void)size;
+#endif
+}
+
 static void *cap_arena_alloc(cap_arena_allocator *arena, size_t size) {
 	assert(arena != NULL);
-	if ((arena->_current_arena_size + size) > arena->_total_arena_size)
+	return cap_arena_alloc_aligned(arena, size,
+				       CAP_ARENA_DEFAULT_ALIGNMENT);
+}
+
+static void *cap_arena_alloc_aligned(cap_arena_allocator *arena, size_t size,
+				     size_t align) {
+	assert(arena != NULL && align > 0 && (align & (align - 1)) == 0);
+	void *ptr = _cap_arena_bump(arena, size, align);
+	if (ptr || !arena->_growable) return ptr;
+	if (!_cap_arena_grow(arena, size, align)) {
+		fprintf(stderr, "memory allocation failur\n");
 		return NULL;
-	arena->_current_arena_size += size;
-	return (arena->_mem_ptr + arena->_current_arena_size);
+	}
+	return _cap_arena_bump(arena, size, align);
+}
+
+// Allocates from the current block, NULL if it doesn't fit
+static void *_cap_arena_bump(cap_arena_allocator *arena, size_t size,
+			     size_t align) {
+	// The padding aligns the address itself, so alignments stricter than
+	// the one of malloc() hold as well
+	uintptr_t address = (uintptr_t)(arena->_mem_ptr + arena->_offset);
+	size_t padding = (size_t)(-address & (align - 1));
+	size_t remaining = arena->_block->_size - arena->_offset;
+	if (padding > remaining || size > remaining - padding) return NULL;
+	if (!_cap_arena_commit(arena, arena->_offset + padding + size))
+		return NULL;
+	unsigned char *ptr = arena->_mem_ptr + arena->_offset + padding;
+	_cap_arena_unpoison(ptr, size);
+	arena->_offset += padding + size;
+	arena->_current_arena_size += padding + size;
+	_cap_arena_account(arena, size, padding);
+	return ptr;
+}
+
+static void _cap_arena_account(cap_arena_allocator *arena, size_t size,
+			       size_t padding) {
+#ifdef CAP_ARENA_STATS
+	arena->_requested_size += size;
+	arena->_padding_size += padding;
+	arena->_allocation_count++;
+	if (arena->_current_arena_size > arena->_peak_size)
+		arena->_peak_size = arena->_current_arena_size;
+#else
+	(void)arena;
+	(void)size;
+	(void)padding;
+#endif
+}
+
+static void _cap_arena_account_resize(cap_arena_allocator *arena,
+				      size_t old_size, size_t new_size) {
+#ifdef CAP_ARENA_STATS
+	arena->_requested_size = arena->_requested_size - old_size + new_size;
+	if (arena->_current_arena_size > arena->_peak_size)
+		arena->_peak_size = arena->_current_arena_size;
+#else
+	(void)arena;
+	(void)old_size;
+	(void)new_size;
+#endif
+}
+
+// Chains a block which holds the allocation whatever it's padding, at least
+// twice the size of the current block
+static bool _cap_arena_grow(cap_arena_allocator *arena, size_t size,
+			    size_t align) {
+	if (size > SIZE_MAX - align) return false;
+	size_t needed = size + align - 1;
+	size_t block_size = arena->_block->_size;
+	do {
+		if (block_size > SIZE_MAX / 2) {
+			block_size = needed;
+			break;
+		}
+		block_size *= 2;
+	} while (block_size < needed);
+	_cap_arena_block *block;
+	if (arena->_spare && arena->_spare->_size >= needed) {
+		block = arena->_spare;
+		arena->_spare = NULL;
+	} else {
+		block = _cap_arena_block_init(block_size);
+		if (!block) return false;
+		arena->_total_arena_size += block_size;
+	}
+	block->_prev = arena->_block;
+	arena->_block = block;
+	arena->_mem_ptr = block->_mem;
+	arena->_offset = 0;
+	return true;
+}
+
+// Keeps the largest of the released blocks as the spare
+static void _cap_arena_release_block(cap_arena_allocator *arena,
+				     _cap_arena_block *block) {
+	if (arena->_spare && arena->_spare->_size >= block->_size) {
+		arena->_total_arena_size -= block->_size;
+		_cap_arena_block_free(arena, block);
+		return;
+	}
+	if (arena->_spare) {
+		arena->_total_arena_size -= arena->_spare->_size;
+		_cap_arena_block_free(arena, arena->_spare);
+	}
+	block->_prev = NULL;
+	_cap_arena_poison(block->_mem, block->_size);
+	arena->_spare = block;
+}
+
+static void *cap_arena_realloc_last(cap_arena_allocator *arena, void *ptr,
+				    size_t old_size, size_t new_size) {
+	assert(arena != NULL);
+	if (!ptr) return cap_arena_alloc(arena, new_size);
+	unsigned char *start = (unsigned char *)ptr;
+	unsigned char *tip = arena->_mem_ptr + arena->_offset;
+	if (start + old_size == tip && start >= arena->_mem_ptr) {
+		size_t offset = (size_t)(start - arena->_mem_ptr);
+		if (new_size <= arena->_block->_size - offset &&
+		    _cap_arena_commit(arena, offset + new_size)) {
+			if (new_size > old_size)
+				_cap_arena_unpoison(start + old_size,
+						    new_size - old_size);
+			else
+				_cap_arena_poison(start + new_size,
+						  old_size - new_size);
+			arena->_offset = offset + new_size;
+			arena->_current_arena_size =
+			    arena->_current_arena_size - old_size + new_size;
+			_cap_arena_account_resize(arena, old_size, new_size);
+			return ptr;
+		}
+	}
+	void *moved = cap_arena_alloc(arena, new_size);
+	if (moved) {
+		memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+		_cap_arena_poison(ptr, old_size);
+	}
+	return moved;
+}
+
+static cap_arena_savepoint cap_arena_mark(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	cap_arena_savepoint mark = {arena->_block,
+				    arena->_offset,
+				    arena->_current_arena_size,
+				    arena->_requested_size,
+				    arena->_padding_size,
+				    arena->_allocation_count};
+	return mark;
+}
+
+static void cap_arena_rewind(cap_arena_allocator *arena,
+			     cap_arena_savepoint mark) {
+	assert(arena != NULL && mark._block != NULL);
+	while (arena->_block != mark._block) {
+		// The save point's block must still be within the chain
+		assert(arena->_block->_prev != NULL);
+		_cap_arena_block *block = arena->_block;
+		arena->_block = block->_prev;
+		_cap_arena_release_block(arena, block);
+	}
+	assert(mark._offset <= arena->_block->_size);
+	_cap_arena_poison(arena->_block->_mem + mark._offset,
+			  (arena->_mapped ? arena->_committed
+					  : arena->_block->_size) -
+			      mark._offset);
+	arena->_mem_ptr = arena->_block->_mem;
+	arena->_offset = mark._offset;
+	arena->_current_arena_size = mark._size;
+	arena->_requested_size = mark._requested_size;
+	arena->_padding_size = mark._padding_size;
+	arena->_allocation_count = mark._allocation_count;
 }
 
 static void cap_arena_reset(cap_arena_allocator *arena) {
 	assert(arena != NULL);
+	if (arena->_spare) {
+		arena->_spare->_prev = arena->_block;
+		arena->_block = arena->_spare;
+		arena->_spare = NULL;
+	}
+	_cap_arena_block *largest = arena->_block;
+	for (_cap_arena_block *block = arena->_block; block;
+	     block = block->_prev)
+		if (block->_size > largest->_size) largest = block;
+	while (arena->_block) {
+		_cap_arena_block *block = arena->_block;
+		arena->_block = block->_prev;
+		if (block != largest) _cap_arena_block_free(arena, block);
+	}
+	largest->_prev = NULL;
+	_cap_arena_poison(largest->_mem,
+			  arena->_mapped ? arena->_committed : largest->_size);
+	arena->_block = largest;
+	arena->_mem_ptr = largest->_mem;
+	arena->_offset = 0;
+	arena->_total_arena_size = largest->_size;
 	arena->_current_arena_size = 0;
+	arena->_requested_size = 0;
+	arena->_padding_size = 0;
+	arena->_allocation_count = 0;
 }
 
 static void cap_arena_free(cap_arena_allocator *arena) {
 	assert(arena != NULL);
-	if (arena->_mem_ptr) free(arena->_mem_ptr);
+	if (arena->_spare) _cap_arena_block_free(arena, arena->_spare);
+	while (arena->_block) {
+		_cap_arena_block *block = arena->_block;
+		arena->_block = block->_prev;
+		_cap_arena_block_free(arena, block);
+	}
 	free(arena);
 }
 
@@ -129,7 +844,7 @@ static size_t cap_arena_size(cap_arena_allocator *arena) {
 
 static size_t cap_arena_remaining_size(cap_arena_allocator *arena) {
 	assert(arena != NULL);
-	return (arena->_total_arena_size - arena->_current_arena_size);
+	return arena->_block->_size - arena->_offset;
 }
 
 static size_t cap_arena_capacity(cap_arena_allocator *arena) {
@@ -137,4 +852,86 @@ static size_t cap_arena_capacity(cap_arena_allocator *arena) {
 	return arena->_total_arena_size;
 }
 
+static size_t cap_arena_committed_size(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	return arena->_mapped ? arena->_committed : arena->_total_arena_size;
+}
+
+static void cap_arena_trim(cap_arena_allocator *arena, size_t keep_size) {
+	assert(arena != NULL);
+	if (!arena->_mapped) return;
+	size_t keep = keep_size > arena->_offset ? keep_size : arena->_offset;
+	if (keep >= arena->_committed) return;
+	keep = (keep + arena->_granule - 1) & ~(arena->_granule - 1);
+	if (keep < arena->_committed)
+		madvise(arena->_mem_ptr + keep, arena->_committed - keep,
+			MADV_DONTNEED);
+}
+
+static size_t cap_arena_block_count(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	size_t count = 0;
+	for (_cap_arena_block *block = arena->_block; block;
+	     block = block->_prev)
+		count++;
+	return count;
+}
+
+static cap_allocator cap_arena_allocator_interface(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	cap_allocator allocator = {_cap_arena_interface_alloc,
+				   _cap_arena_interface_realloc,
+				   _cap_arena_interface_free, arena};
+	return allocator;
+}
+
+static void *_cap_arena_interface_alloc(void *arena, size_t size) {
+	return cap_arena_alloc((cap_arena_allocator *)arena, size);
+}
+
+static void *_cap_arena_interface_realloc(void *arena, void *ptr,
+					  size_t old_size, size_t new_size) {
+	return cap_arena_realloc_last((cap_arena_allocator *)arena, ptr,
+				      old_size, new_size);
+}
+
+static void _cap_arena_interface_free(void *arena, void *ptr, size_t size) {
+	(void)arena;
+	_cap_arena_poison(ptr, size);
+}
+
+static size_t cap_arena_requested_size(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	return arena->_requested_size;
+}
+
+static size_t cap_arena_padding_size(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	return arena->_padding_size;
+}
+
+static size_t cap_arena_peak_size(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	return arena->_peak_size;
+}
+
+static size_t cap_arena_allocation_count(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	return arena->_allocation_count;
+}
+
+static cap_arena_stats cap_arena_stats_snapshot(cap_arena_allocator *arena) {
+	assert(arena != NULL);
+	cap_arena_stats stats;
+	stats.requested_size = arena->_requested_size;
+	stats.used_size = arena->_current_arena_size;
+	stats.padding_size = arena->_padding_size;
+	stats.capacity = arena->_total_arena_size;
+	stats.committed_size = cap_arena_committed_size(arena);
+	stats.peak_size = arena->_peak_size;
+	stats.allocation_count = arena->_allocation_count;
+	stats.block_count = cap_arena_block_count(arena);
+	return stats;
+}
+
 #endif // !CAP_ARENA_ALLOCATOR
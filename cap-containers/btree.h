@@ -0,0 +1,1051 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_BTREE_H
+#define CAP_BTREE_H
+#include "allocator.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(CAP_BTREE_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(CAP_BTREE_SIMD) && defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_GENERIC_TYPE unsigned char
+#define CAP_GENERIC_TYPE_PTR CAP_GENERIC_TYPE *
+#define CAP_BTREE_CACHE_LINE_SIZE 64
+// An internal node is 4 cache lines and a leaf is 16 cache lines, the keys and
+// the links are 8 bytes each and the node's bookkeeping takes the last 16 bytes
+#define CAP_BTREE_INTERNAL_KEYS ((4 * CAP_BTREE_CACHE_LINE_SIZE - 16) / 16)
+#define CAP_BTREE_LEAF_KEYS ((16 * CAP_BTREE_CACHE_LINE_SIZE - 16) / 16)
+#define CAP_BTREE_INTERNAL_MIN_KEYS (CAP_BTREE_INTERNAL_KEYS / 2)
+#define CAP_BTREE_LEAF_MIN_KEYS (CAP_BTREE_LEAF_KEYS / 2)
+#define CAP_BTREE_MAX_HEIGHT 32
+
+// Integer keyed trees store the key by value, so that a node's keys are one
+// contiguous int64_t array which can be scanned with SIMD compares
+typedef union {
+	int64_t _int_key;
+	CAP_GENERIC_TYPE_PTR _key;
+} _cap_btree_key;
+
+typedef struct {
+	_cap_btree_key _keys[CAP_BTREE_INTERNAL_KEYS];
+	void *_children[CAP_BTREE_INTERNAL_KEYS + 1];
+	int _num_keys;
+} _cap_btree_internal;
+
+typedef struct _cap_btree_leaf {
+	_cap_btree_key _keys[CAP_BTREE_LEAF_KEYS];
+	void *_values[CAP_BTREE_LEAF_KEYS];
+	struct _cap_btree_leaf *_next;
+	int _num_keys;
+} _cap_btree_leaf;
+
+// Nodes an insert may need for splitting, allocated before the tree is touched
+typedef struct {
+	_cap_btree_leaf *_leaf;
+	_cap_btree_internal *_internals[CAP_BTREE_MAX_HEIGHT];
+	int _internal_count;
+} _cap_btree_spares;
+
+typedef struct {
+	// The root is a leaf when the height is 1, every leaf is at same depth
+	void *_root;
+	int _height;
+	size_t _size;
+	size_t _key_size;
+	bool _int_keys;
+	int (*_compare_fn)(void *key_one, void *key_two);
+	_cap_btree_leaf *_first_leaf;
+	cap_allocator _allocator;
+} cap_btree;
+
+typedef struct {
+	CAP_GENERIC_TYPE_PTR key;
+	void *value;
+	size_t _current_index;
+	int _leaf_index;
+	_cap_btree_leaf *_current_leaf;
+	cap_btree *_original_reference;
+} cap_btree_iterator;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_btree is an ordered key-value container with the same interface as
+ * cap_map, implemented as a B+tree. Elements are kept sorted within wide leaf
+ * nodes which are chained together, so that ordered scans read contiguous
+ * memory instead of chasing a pointer per element. Nodes are allocated aligned
+ * to, and sized in multiples of, a cache line.
+ *
+ * Trees created with cap_btree_init_int64() copy the int64_t keys into the
+ * nodes. Define CAP_BTREE_SIMD before including this header to search those
+ * keys with AVX2 or SSE4.2 compares when the compiler targets them, otherwise a
+ * branchless scalar search is used.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_btree container object
+ *
+ * @param key_size Size of the key
+ * @param compare_fn Function to compare two keys, it returns negative, zero or
+ * positive value if the first key is less, equal or greater than the second one
+ * @return Newly allocated cap_btree container
+ */
+static cap_btree *cap_btree_init(size_t key_size,
+				 int (*compare_fn)(void *, void *));
+/**
+ * Initilize a cap_btree container object whose keys are int64_t. The keys are
+ * still passed as pointers, but they are copied into the container, so the
+ * key's memory doesn't need to outlive the element.
+ *
+ * @return Newly allocated cap_btree container
+ */
+static cap_btree *cap_btree_init_int64(void);
+/**
+ * Initilize a cap_btree container object which takes the container and it's
+ * nodes from the given allocator. The nodes are cache line aligned only when
+ * the allocator returns such memory, the default allocator always does.
+ *
+ * @param key_size Size of the key
+ * @param compare_fn Function to compare two keys
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated cap_btree container
+ */
+static cap_btree *
+cap_btree_init_with_allocator(size_t key_size,
+			      int (*compare_fn)(void *, void *),
+			      const cap_allocator *allocator);
+/**
+ * Initilize a cap_btree container object whose keys are int64_t, taking the
+ * container and it's nodes from the given allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated cap_btree container
+ */
+static cap_btree *
+cap_btree_init_int64_with_allocator(const cap_allocator *allocator);
+/**
+ * Insert a key-value pair onto the cap_btree container. If the key already
+ * exists, it's value is replaced with the given value.
+ *
+ * The container doesn't manage the life time of the given pointers, except for
+ * the keys of an int64_t keyed tree which are copied.
+ *
+ * @param tree cap_btree container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return Returns 0 if the operation is success, or else returns -1 is there
+ * was a memory allocation error
+ */
+static int cap_btree_insert(cap_btree *tree, void *key, void *value);
+/**
+ * Find an element on the cap_btree container
+ *
+ * @param tree cap_btree container
+ * @param key Key for which we need to find the value.
+ * @return Returns the pointer to the element, if the element with key is not
+ * found, it returns NULL
+ */
+static void *cap_btree_find(cap_btree *tree, void *key);
+/**
+ * Check if an item with the given key exists within the cap_btree container.
+ *
+ * @param tree cap_btree container
+ * @param key Key for which we need to see if the elements exists.
+ * @return True if the item does exists, or else returns false if not
+ */
+static bool cap_btree_contains(cap_btree *tree, void *key);
+/**
+ * Remove an element which is mapped to the given key from the container
+ *
+ * @param tree cap_btree container
+ * @param key Key of the element to be removed
+ * @return 0 if the key is found and the element is removed successfully.
+ * Returns -1 if the element is not found.
+ */
+static int cap_btree_remove(cap_btree *tree, void *key);
+/**
+ * Pass every element whose key is within [low_key, high_key] into fn_ptr, in
+ * ascending order of the keys
+ *
+ * @param tree cap_btree container
+ * @param low_key Lower bound of the range, inclusive
+ * @param high_key Upper bound of the range, inclusive
+ * @param fn_ptr Function to which we pass the key and the value
+ * @return Number of elements passed into fn_ptr
+ */
+static size_t cap_btree_range(cap_btree *tree, void *low_key, void *high_key,
+			      void (*fn_ptr)(void *key, void *value));
+/**
+ * Get the function pointer to the handle which the cap_btree container uses to
+ * compare two keys
+ *
+ * @param tree cap_btree container
+ * @return Function pointer given during the initilization, NULL for an int64_t
+ * keyed tree
+ */
+static int (*cap_btree_compare_fn(cap_btree *tree))(void *, void *);
+/**
+ * Get the current size of the container i.e number of elements
+ *
+ * @param tree cap_btree container
+ * @return size of the container.
+ */
+static size_t cap_btree_size(cap_btree *tree);
+/**
+ * Check if the cap_btree is empty or not
+ *
+ * @param tree cap_btree container
+ * @return True if the container is empty, False if not.
+ */
+static bool cap_btree_empty(cap_btree *tree);
+/**
+ * Get the height of the cap_btree, a tree whose root is a leaf has height 1
+ *
+ * @param tree cap_btree container
+ * @return Height of the tree
+ */
+static int cap_btree_height(cap_btree *tree);
+/**
+ * Free the cap_btree container. It doesn't touch the key or value's underlying
+ * memory. Only frees the memory which the container owns.
+ *
+ * @param tree cap_btree container
+ */
+static void cap_btree_free(cap_btree *tree);
+/**
+ * Free the cap_btree container and also call free() on the keys and values
+ * (assuming that they are dynamically allocated). Keys of an int64_t keyed tree
+ * are owned by the container and aren't passed to free().
+ *
+ * @param tree cap_btree container
+ */
+static void cap_btree_deep_free(cap_btree *tree);
+/**
+ * Initialize an Iterator object for iterating over a cap_btree container
+ *
+ * @param tree cap_btree container for which we need to create a iterator
+ * @return Allocated cap_btree_iterator object which points to the first
+ * element, key and value are NULL if the container is empty
+ */
+static cap_btree_iterator *cap_btree_iterator_init(cap_btree *tree);
+/**
+ * Initialize an Iterator object which points to the first element whose key is
+ * not less than the given key
+ *
+ * @param tree cap_btree container
+ * @param key Key to seek to
+ * @return Allocated cap_btree_iterator object, key and value are NULL if every
+ * element's key is less than the given key
+ */
+static cap_btree_iterator *cap_btree_lower_bound(cap_btree *tree, void *key);
+/**
+ * Check if an element which is pointed by the iterator matches the given
+ * predicate function
+ *
+ * @param iterator cap_btree_iterator iterator object
+ * @param predicate_fn Predicate function, we pass the key into it
+ * @return Returns True, if predicate_fn says so, if not returns False.
+ */
+static bool cap_btree_iterator_equals_predicate(cap_btree_iterator *iterator,
+						bool (*predicate_fn)(void *));
+/**
+ * Increment the Iterator to the next element on the container, key and value
+ * are set to NULL once the iterator moves past the last element
+ *
+ * @param iterator cap_btree_iterator iterator object
+ */
+static void cap_btree_iterator_increment(cap_btree_iterator *iterator);
+/**
+ * Peek into the next element's key without incrementing the iterator
+ *
+ * @param iterator cap_btree_iterator iterator object
+ * @return Next element's key, if the iterator is at the last element, it
+ * returns NULL
+ */
+static void *cap_btree_iterator_next(cap_btree_iterator *iterator);
+/**
+ * Get an iterator to the start of a cap_btree container
+ *
+ * @param tree cap_btree container
+ * @return Allocated cap_btree_iterator iterator which points to the first
+ * element of the container
+ */
+static cap_btree_iterator *cap_btree_begin(cap_btree *tree);
+/**
+ * Access the value of the element with the smallest key
+ *
+ * @param tree cap_btree container
+ * @return First element's value, NULL if the container is empty
+ */
+static void *cap_btree_front(cap_btree *tree);
+/**
+ * Free the cap_btree_iterator iterator object. This operation doesn't free the
+ * underlying element which this iterator points to but only the
+ * cap_btree_iterator object
+ *
+ * @param iterator cap_btree_iterator iterator object to be freed
+ */
+static void cap_btree_iterator_free(cap_btree_iterator *iterator);
+
+// Prototypes (Internal helpers)
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static cap_btree *_cap_btree_alloc(const cap_allocator *allocator);
+static void *_cap_btree_node_alloc(cap_btree *tree, size_t size);
+static void _cap_btree_node_free(cap_btree *tree, void *node, size_t size);
+static _cap_btree_key _cap_btree_make_key(cap_btree *tree, void *key);
+static int _cap_btree_int_rank(const _cap_btree_key *keys, int num_keys,
+			       int64_t target, bool inclusive);
+static int _cap_btree_rank(cap_btree *tree, const _cap_btree_key *keys,
+			   int num_keys, void *key, bool inclusive);
+static bool _cap_btree_key_equals(cap_btree *tree, _cap_btree_key node_key,
+				  void *key);
+static _cap_btree_leaf *_cap_btree_find_leaf(cap_btree *tree, void *key);
+static int _cap_btree_split_count(cap_btree *tree, void *key);
+static void _cap_btree_insert_node(cap_btree *tree, void *node, int level,
+				   void *key, void *value,
+				   _cap_btree_spares *spares,
+				   _cap_btree_key *split_key,
+				   void **split_node);
+static bool _cap_btree_remove_node(cap_btree *tree, void *node, int level,
+				   void *key);
+static void _cap_btree_rebalance(cap_btree *tree, _cap_btree_internal *parent,
+				 int index, int child_level);
+static void _cap_btree_replace_separators(cap_btree *tree, void *key);
+static _cap_btree_key _cap_btree_min_key(void *node, int level);
+static void _cap_btree_free_node(cap_btree *tree, void *node, int level);
+static cap_btree_iterator *_cap_btree_iterator_at(cap_btree *tree,
+						  _cap_btree_leaf *leaf,
+						  int leaf_index,
+						  size_t current_index);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_btree *cap_btree_init(size_t key_size,
+				 int (*compare_fn)(void *, void *)) {
+	return cap_btree_init_with_allocator(key_size, compare_fn, NULL);
+}
+
+static cap_btree *cap_btree_init_int64(void) {
+	return cap_btree_init_int64_with_allocator(NULL);
+}
+
+static cap_btree *
+cap_btree_init_with_allocator(size_t key_size,
+			      int (*compare_fn)(void *, void *),
+			      const cap_allocator *allocator) {
+	assert(compare_fn != NULL);
+	cap_btree *tree = _cap_btree_alloc(allocator);
+	if (!tree) return NULL;
+	tree->_key_size = key_size;
+	tree->_int_keys = false;
+	tree->_compare_fn = compare_fn;
+	return tree;
+}
+
+static cap_btree *
+cap_btree_init_int64_with_allocator(const cap_allocator *allocator) {
+	cap_btree *tree = _cap_btree_alloc(allocator);
+	if (!tree) return NULL;
+	tree->_key_size = sizeof(int64_t);
+	tree->_int_keys = true;
+	tree->_compare_fn = NULL;
+	return tree;
+}
+
+static int cap_btree_insert(cap_btree *tree, void *key, void *value) {
+	assert(tree != NULL && key != NULL && value != NULL);
+	_cap_btree_leaf *leaf = _cap_btree_find_leaf(tree, key);
+	int index =
+	    _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys, key, false);
+	if (index < leaf->_num_keys &&
+	    _cap_btree_key_equals(tree, leaf->_keys[index], key)) {
+		leaf->_values[index] = value;
+		return 0;
+	}
+	// Allocate every node the splits need up front, so that a memory
+	// allocation failure leaves the tree untouched
+	_cap_btree_spares spares = {NULL, {NULL}, 0};
+	int splits = _cap_btree_split_count(tree, key);
+	int internals_needed = splits == tree->_height ? splits : splits - 1;
+	if (splits > 0) {
+		spares._leaf = (_cap_btree_leaf *)_cap_btree_node_alloc(
+		    tree, sizeof(_cap_btree_leaf));
+		if (!spares._leaf) goto allocation_failure;
+	}
+	for (; spares._internal_count < internals_needed;
+	     ++spares._internal_count) {
+		spares._internals[spares._internal_count] =
+		    (_cap_btree_internal *)_cap_btree_node_alloc(
+			tree, sizeof(_cap_btree_internal));
+		if (!spares._internals[spares._internal_count])
+			goto allocation_failure;
+	}
+	_cap_btree_key split_key;
+	void *split_node = NULL;
+	_cap_btree_insert_node(tree, tree->_root, tree->_height, key, value,
+			       &spares, &split_key, &split_node);
+	if (split_node) {
+		_cap_btree_internal *new_root =
+		    spares._internals[--spares._internal_count];
+		new_root->_keys[0] = split_key;
+		new_root->_children[0] = tree->_root;
+		new_root->_children[1] = split_node;
+		new_root->_num_keys = 1;
+		tree->_root = new_root;
+		tree->_height++;
+	}
+	return 0;
+allocation_failure:
+	fprintf(stderr, "memory allocation failure\n");
+	if (spares._leaf)
+		_cap_btree_node_free(tree, spares._leaf,
+				     sizeof(_cap_btree_leaf));
+	for (int i = 0; i < spares._internal_count; ++i)
+		_cap_btree_node_free(tree, spares._internals[i],
+				     sizeof(_cap_btree_internal));
+	return -1;
+}
+
+static void *cap_btree_find(cap_btree *tree, void *key) {
+	assert(tree != NULL && key != NULL);
+	_cap_btree_leaf *leaf = _cap_btree_find_leaf(tree, key);
+	int index =
+	    _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys, key, false);
+	if (index < leaf->_num_keys &&
+	    _cap_btree_key_equals(tree, leaf->_keys[index], key))
+		return leaf->_values[index];
+	return NULL;
+}
+
+static bool cap_btree_contains(cap_btree *tree, void *key) {
+	assert(tree != NULL && key != NULL);
+	return cap_btree_find(tree, key) != NULL;
+}
+
+static int cap_btree_remove(cap_btree *tree, void *key) {
+	assert(tree != NULL && key != NULL);
+	if (!tree->_size) return -1;
+	if (!_cap_btree_remove_node(tree, tree->_root, tree->_height, key))
+		return -1;
+	if (tree->_height > 1 &&
+	    ((_cap_btree_internal *)tree->_root)->_num_keys == 0) {
+		_cap_btree_internal *old_root =
+		    (_cap_btree_internal *)tree->_root;
+		tree->_root = old_root->_children[0];
+		tree->_height--;
+		_cap_btree_node_free(tree, old_root,
+				     sizeof(_cap_btree_internal));
+	}
+	// The removed key may be released by the user now, no separator may
+	// point to it
+	if (!tree->_int_keys) _cap_btree_replace_separators(tree, key);
+	return 0;
+}
+
+static size_t cap_btree_range(cap_btree *tree, void *low_key, void *high_key,
+			      void (*fn_ptr)(void *key, void *value)) {
+	assert(tree != NULL && low_key != NULL && high_key != NULL &&
+	       fn_ptr != NULL);
+	_cap_btree_leaf *leaf = _cap_btree_find_leaf(tree, low_key);
+	int index =
+	    _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys, low_key, false);
+	size_t count = 0;
+	while (leaf) {
+		// Everything before end within this leaf is within the range
+		int end = _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys,
+					  high_key, true);
+		for (; index < end; ++index, ++count)
+			fn_ptr(tree->_int_keys
+				   ? (void *)&leaf->_keys[index]._int_key
+				   : (void *)leaf->_keys[index]._key,
+			       leaf->_values[index]);
+		if (end < leaf->_num_keys) break;
+		leaf = leaf->_next;
+		index = 0;
+	}
+	return count;
+}
+
+static int (*cap_btree_compare_fn(cap_btree *tree))(void *, void *) {
+	assert(tree != NULL);
+	return tree->_compare_fn;
+}
+
+static size_t cap_btree_size(cap_btree *tree) {
+	assert(tree != NULL);
+	return tree->_size;
+}
+
+static bool cap_btree_empty(cap_btree *tree) {
+	assert(tree != NULL);
+	return tree->_size == 0;
+}
+
+static int cap_btree_height(cap_btree *tree) {
+	assert(tree != NULL);
+	return tree->_height;
+}
+
+static void cap_btree_free(cap_btree *tree) {
+	assert(tree != NULL);
+	_cap_btree_free_node(tree, tree->_root, tree->_height);
+	cap_allocator allocator = tree->_allocator;
+	_cap_allocator_free(&allocator, tree, sizeof(cap_btree));
+}
+
+static void cap_btree_deep_free(cap_btree *tree) {
+	assert(tree != NULL);
+	for (_cap_btree_leaf *leaf = tree->_first_leaf; leaf;
+	     leaf = leaf->_next) {
+		for (int i = 0; i < leaf->_num_keys; ++i) {
+			if (!tree->_int_keys) free(leaf->_keys[i]._key);
+			free(leaf->_values[i]);
+		}
+	}
+	cap_btree_free(tree);
+}
+
+static cap_btree_iterator *cap_btree_iterator_init(cap_btree *tree) {
+	assert(tree != NULL);
+	return _cap_btree_iterator_at(tree, tree->_first_leaf, 0, 0);
+}
+
+static cap_btree_iterator *cap_btree_lower_bound(cap_btree *tree, void *key) {
+	assert(tree != NULL && key != NULL);
+	_cap_btree_leaf *leaf = _cap_btree_find_leaf(tree, key);
+	int index =
+	    _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys, key, false);
+	// The global index isn't known without counting, it's only used to
+	// detect the end which lower_bound iterators detect through the leaves
+	return _cap_btree_iterator_at(tree, leaf, index, 0);
+}
+
+static bool cap_btree_iterator_equals_predicate(cap_btree_iterator *iterator,
+						bool (*predicate_fn)(void *)) {
+	assert(iterator != NULL && predicate_fn != NULL);
+	return predicate_fn(iterator->key);
+}
+
+static void cap_btree_iterator_increment(cap_btree_iterator *iterator) {
+	assert(iterator != NULL);
+	if (!iterator->_current_leaf) return;
+	iterator->_leaf_index++;
+	iterator->_current_index++;
+	if (iterator->_leaf_index >= iterator->_current_leaf->_num_keys) {
+		iterator->_current_leaf = iterator->_current_leaf->_next;
+		iterator->_leaf_index = 0;
+	}
+	if (!iterator->_current_leaf) {
+		iterator->key = NULL;
+		iterator->value = NULL;
+		return;
+	}
+	_cap_btree_leaf *leaf = iterator->_current_leaf;
+	iterator->key =
+	    iterator->_original_reference->_int_keys
+		? (CAP_GENERIC_TYPE_PTR)&leaf->_keys[iterator->_leaf_index]
+		      ._int_key
+		: leaf->_keys[iterator->_leaf_index]._key;
+	iterator->value = leaf->_values[iterator->_leaf_index];
+}
+
+static void *cap_btree_iterator_next(cap_btree_iterator *iterator) {
+	assert(iterator != NULL);
+	_cap_btree_leaf *leaf = iterator->_current_leaf;
+	if (!leaf) return NULL;
+	int index = iterator->_leaf_index + 1;
+	if (index >= leaf->_num_keys) {
+		leaf = leaf->_next;
+		index = 0;
+	}
+	if (!leaf) return NULL;
+	return iterator->_original_reference->_int_keys
+		   ? (void *)&leaf->_keys[index]._int_key
+		   : (void *)leaf->_keys[index]._key;
+}
+
+static cap_btree_iterator *cap_btree_begin(cap_btree *tree) {
+	assert(tree != NULL);
+	return cap_btree_iterator_init(tree);
+}
+
+static void *cap_btree_front(cap_btree *tree) {
+	assert(tree != NULL);
+	if (!tree->_size) return NULL;
+	return tree->_first_leaf->_values[0];
+}
+
+static void cap_btree_iterator_free(cap_btree_iterator *iterator) {
+	assert(iterator != NULL);
+	free(iterator);
+}
+
+static cap_btree *_cap_btree_alloc(const cap_allocator *allocator) {
+	cap_btree *tree =
+	    (cap_btree *)_cap_allocator_calloc(allocator, 1, sizeof(cap_btree));
+	if (!tree) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	if (allocator) tree->_allocator = *allocator;
+	tree->_root = _cap_btree_node_alloc(tree, sizeof(_cap_btree_leaf));
+	if (!tree->_root) {
+		fprintf(stderr, "memory allocation failure\n");
+		_cap_allocator_free(allocator, tree, sizeof(cap_btree));
+		return NULL;
+	}
+	tree->_first_leaf = (_cap_btree_leaf *)tree->_root;
+	tree->_height = 1;
+	tree->_size = 0;
+	return tree;
+}
+
+static void *_cap_btree_node_alloc(cap_btree *tree, size_t size) {
+	size_t rounded_size = (size + CAP_BTREE_CACHE_LINE_SIZE - 1) /
+			      CAP_BTREE_CACHE_LINE_SIZE *
+			      CAP_BTREE_CACHE_LINE_SIZE;
+	void *node;
+	if (tree->_allocator.alloc)
+		node = tree->_allocator.alloc(tree->_allocator.ctx,
+					      rounded_size);
+	else
+		node = aligned_alloc(CAP_BTREE_CACHE_LINE_SIZE, rounded_size);
+	if (node) memset(node, 0, rounded_size);
+	return node;
+}
+
+static void _cap_btree_node_free(cap_btree *tree, void *node, size_t size) {
+	size_t rounded_size = (size + CAP_BTREE_CACHE_LINE_SIZE - 1) /
+			      CAP_BTREE_CACHE_LINE_SIZE *
+			      CAP_BTREE_CACHE_LINE_SIZE;
+	_cap_allocator_free(&tree->_allocator, node, rounded_size);
+}
+
+static _cap_btree_key _cap_btree_make_key(cap_btree *tree, void *key) {
+	_cap_btree_key node_key;
+	if (tree->_int_keys)
+		memcpy(&node_key._int_key, key, sizeof(int64_t));
+	else
+		node_key._key = (CAP_GENERIC_TYPE_PTR)key;
+	return node_key;
+}
+
+static int _cap_btree_int_rank(const _cap_btree_key *keys, int num_keys,
+			       int64_t target, bool inclusive) {
+	// Counts the keys which are less than (or not greater than, if
+	// inclusive) the target. Nodes are small enough that counting over the
+	// whole node beats the mispredicted branches of a binary search
+	int count = 0;
+	int index = 0;
+#if defined(CAP_BTREE_SIMD) && defined(__AVX2__)
+	__m256i pivot = _mm256_set1_epi64x(target);
+	for (; index + 4 <= num_keys; index += 4) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)&keys[index]);
+		__m256i mask = inclusive ? _mm256_cmpgt_epi64(block, pivot)
+					 : _mm256_cmpgt_epi64(pivot, block);
+		int bits = __builtin_popcount(
+		    _mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+		count += inclusive ? 4 - bits : bits;
+	}
+#elif defined(CAP_BTREE_SIMD) && defined(__SSE4_2__)
+	__m128i pivot = _mm_set1_epi64x(target);
+	for (; index + 2 <= num_keys; index += 2) {
+		__m128i block = _mm_loadu_si128((const __m128i *)&keys[index]);
+		__m128i mask = inclusive ? _mm_cmpgt_epi64(block, pivot)
+					 : _mm_cmpgt_epi64(pivot, block);
+		int bits = __builtin_popcount(
+		    _mm_movemask_pd(_mm_castsi128_pd(mask)));
+		count += inclusive ? 2 - bits : bits;
+	}
+#endif
+	if (inclusive)
+		for (; index < num_keys; ++index)
+			count += keys[index]._int_key <= target;
+	else
+		for (; index < num_keys; ++index)
+			count += keys[index]._int_key < target;
+	return count;
+}
+
+static int _cap_btree_rank(cap_btree *tree, const _cap_btree_key *keys,
+			   int num_keys, void *key, bool inclusive) {
+	if (tree->_int_keys) {
+		int64_t target;
+		memcpy(&target, key, sizeof(int64_t));
+		return _cap_btree_int_rank(keys, num_keys, target, inclusive);
+	}
+	int low = 0, high = num_keys;
+	while (low < high) {
+		int middle = low + (high - low) / 2;
+		int cmp = tree->_compare_fn(keys[middle]._key, key);
+		if (cmp < 0 || (inclusive && cmp == 0))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static bool _cap_btree_key_equals(cap_btree *tree, _cap_btree_key node_key,
+				  void *key) {
+	if (tree->_int_keys) {
+		int64_t target;
+		memcpy(&target, key, sizeof(int64_t));
+		return node_key._int_key == target;
+	}
+	return tree->_compare_fn(node_key._key, key) == 0;
+}
+
+static _cap_btree_leaf *_cap_btree_find_leaf(cap_btree *tree, void *key) {
+	// A separator is the smallest key of the subtree to it's right, so
+	// keys equal to it go right
+	void *node = tree->_root;
+	for (int level = tree->_height; level > 1; --level) {
+		_cap_btree_internal *internal = (_cap_btree_internal *)node;
+		int index = _cap_btree_rank(tree, internal->_keys,
+					    internal->_num_keys, key, true);
+		node = internal->_children[index];
+	}
+	return (_cap_btree_leaf *)node;
+}
+
+static int _cap_btree_split_count(cap_btree *tree, void *key) {
+	// Splits propagate upwards only through full nodes, so the number of
+	// splits is the length of the run of full nodes ending at the leaf
+	int splits = 0;
+	void *node = tree->_root;
+	for (int level = tree->_height; level > 1; --level) {
+		_cap_btree_internal *internal = (_cap_btree_internal *)node;
+		if (internal->_num_keys == CAP_BTREE_INTERNAL_KEYS)
+			splits++;
+		else
+			splits = 0;
+		int index = _cap_btree_rank(tree, internal->_keys,
+					    internal->_num_keys, key, true);
+		node = internal->_children[index];
+	}
+	if (((_cap_btree_leaf *)node)->_num_keys < CAP_BTREE_LEAF_KEYS)
+		return 0;
+	return splits + 1;
+}
+
+static void _cap_btree_insert_node(cap_btree *tree, void *node, int level,
+				   void *key, void *value,
+				   _cap_btree_spares *spares,
+				   _cap_btree_key *split_key,
+				   void **split_node) {
+	*split_node = NULL;
+	if (level == 1) {
+		_cap_btree_leaf *leaf = (_cap_btree_leaf *)node;
+		int index = _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys,
+					    key, false);
+		_cap_btree_leaf *target = leaf;
+		if (leaf->_num_keys == CAP_BTREE_LEAF_KEYS) {
+			_cap_btree_leaf *right = spares->_leaf;
+			spares->_leaf = NULL;
+			int left_keys = (CAP_BTREE_LEAF_KEYS + 1) / 2;
+			right->_num_keys = CAP_BTREE_LEAF_KEYS - left_keys;
+			memcpy(right->_keys, &leaf->_keys[left_keys],
+			       sizeof(_cap_btree_key) * right->_num_keys);
+			memcpy(right->_values, &leaf->_values[left_keys],
+			       sizeof(void *) * right->_num_keys);
+			leaf->_num_keys = left_keys;
+			right->_next = leaf->_next;
+			leaf->_next = right;
+			if (index > left_keys) {
+				target = right;
+				index -= left_keys;
+			}
+			*split_node = right;
+		}
+		memmove(&target->_keys[index + 1], &target->_keys[index],
+			sizeof(_cap_btree_key) * (target->_num_keys - index));
+		memmove(&target->_values[index + 1], &target->_values[index],
+			sizeof(void *) * (target->_num_keys - index));
+		target->_keys[index] = _cap_btree_make_key(tree, key);
+		target->_values[index] = value;
+		target->_num_keys++;
+		tree->_size++;
+		if (*split_node)
+			*split_key = ((_cap_btree_leaf *)*split_node)->_keys[0];
+		return;
+	}
+	_cap_btree_internal *internal = (_cap_btree_internal *)node;
+	int index = _cap_btree_rank(tree, internal->_keys, internal->_num_keys,
+				    key, true);
+	_cap_btree_key child_split_key;
+	void *child_split_node = NULL;
+	_cap_btree_insert_node(tree, internal->_children[index], level - 1, key,
+			       value, spares, &child_split_key,
+			       &child_split_node);
+	if (!child_split_node) return;
+	if (internal->_num_keys < CAP_BTREE_INTERNAL_KEYS) {
+		memmove(&internal->_keys[index + 1], &internal->_keys[index],
+			sizeof(_cap_btree_key) * (internal->_num_keys - index));
+		memmove(&internal->_children[index + 2],
+			&internal->_children[index + 1],
+			sizeof(void *) * (internal->_num_keys - index));
+		internal->_keys[index] = child_split_key;
+		internal->_children[index + 1] = child_split_node;
+		internal->_num_keys++;
+		return;
+	}
+	_cap_btree_internal *right =
+	    spares->_internals[--spares->_internal_count];
+	// Lay the keys and children out with the new separator in place, then
+	// keep the lower half, push the middle key up and move the upper half
+	_cap_btree_key keys[CAP_BTREE_INTERNAL_KEYS + 1];
+	void *children[CAP_BTREE_INTERNAL_KEYS + 2];
+	memcpy(keys, internal->_keys, sizeof(_cap_btree_key) * index);
+	keys[index] = child_split_key;
+	memcpy(&keys[index + 1], &internal->_keys[index],
+	       sizeof(_cap_btree_key) * (CAP_BTREE_INTERNAL_KEYS - index));
+	memcpy(children, internal->_children, sizeof(void *) * (index + 1));
+	children[index + 1] = child_split_node;
+	memcpy(&children[index + 2], &internal->_children[index + 1],
+	       sizeof(void *) * (CAP_BTREE_INTERNAL_KEYS - index));
+	int left_keys = (CAP_BTREE_INTERNAL_KEYS + 1) / 2;
+	internal->_num_keys = left_keys;
+	memcpy(internal->_keys, keys, sizeof(_cap_btree_key) * left_keys);
+	memcpy(internal->_children, children, sizeof(void *) * (left_keys + 1));
+	right->_num_keys = CAP_BTREE_INTERNAL_KEYS - left_keys;
+	memcpy(right->_keys, &keys[left_keys + 1],
+	       sizeof(_cap_btree_key) * right->_num_keys);
+	memcpy(right->_children, &children[left_keys + 1],
+	       sizeof(void *) * (right->_num_keys + 1));
+	*split_key = keys[left_keys];
+	*split_node = right;
+}
+
+static bool _cap_btree_remove_node(cap_btree *tree, void *node, int level,
+				   void *key) {
+	if (level == 1) {
+		_cap_btree_leaf *leaf = (_cap_btree_leaf *)node;
+		int index = _cap_btree_rank(tree, leaf->_keys, leaf->_num_keys,
+					    key, false);
+		if (index >= leaf->_num_keys ||
+		    !_cap_btree_key_equals(tree, leaf->_keys[index], key))
+			return false;
+		memmove(&leaf->_keys[index], &leaf->_keys[index + 1],
+			sizeof(_cap_btree_key) * (leaf->_num_keys - index - 1));
+		memmove(&leaf->_values[index], &leaf->_values[index + 1],
+			sizeof(void *) * (leaf->_num_keys - index - 1));
+		leaf->_num_keys--;
+		tree->_size--;
+		return true;
+	}
+	_cap_btree_internal *internal = (_cap_btree_internal *)node;
+	int index = _cap_btree_rank(tree, internal->_keys, internal->_num_keys,
+				    key, true);
+	if (!_cap_btree_remove_node(tree, internal->_children[index], level - 1,
+				    key))
+		return false;
+	int child_keys =
+	    level - 1 == 1
+		? ((_cap_btree_leaf *)internal->_children[index])->_num_keys
+		: ((_cap_btree_internal *)internal->_children[index])
+		      ->_num_keys;
+	int child_min_keys = level - 1 == 1 ? CAP_BTREE_LEAF_MIN_KEYS
+					    : CAP_BTREE_INTERNAL_MIN_KEYS;
+	if (child_keys < child_min_keys)
+		_cap_btree_rebalance(tree, internal, index, level - 1);
+	return true;
+}
+
+static void _cap_btree_replace_separators(cap_btree *tree, void *key) {
+	// A borrow or a merge between internal nodes moves separators down,
+	// so once the tree is rebalanced a separator equal to the removed key
+	// may sit in any internal node on the key's path. Each is replaced
+	// with the smallest key of the subtree to it's right
+	void *node = tree->_root;
+	for (int level = tree->_height; level > 1; --level) {
+		_cap_btree_internal *internal = (_cap_btree_internal *)node;
+		int index = _cap_btree_rank(tree, internal->_keys,
+					    internal->_num_keys, key, true);
+		if (index > 0 &&
+		    _cap_btree_key_equals(tree, internal->_keys[index - 1],
+					  key))
+			internal->_keys[index - 1] = _cap_btree_min_key(
+			    internal->_children[index], level - 1);
+		node = internal->_children[index];
+	}
+}
+
+static void _cap_btree_rebalance(cap_btree *tree, _cap_btree_internal *parent,
+				 int index, int child_level) {
+	if (child_level == 1) {
+		_cap_btree_leaf *child = (_cap_btree_leaf *)parent->_children[index];
+		_cap_btree_leaf *left =
+		    index > 0 ? (_cap_btree_leaf *)parent->_children[index - 1]
+			      : NULL;
+		_cap_btree_leaf *right =
+		    index < parent->_num_keys
+			? (_cap_btree_leaf *)parent->_children[index + 1]
+			: NULL;
+		if (left && left->_num_keys > CAP_BTREE_LEAF_MIN_KEYS) {
+			memmove(&child->_keys[1], child->_keys,
+				sizeof(_cap_btree_key) * child->_num_keys);
+			memmove(&child->_values[1], child->_values,
+				sizeof(void *) * child->_num_keys);
+			child->_keys[0] = left->_keys[left->_num_keys - 1];
+			child->_values[0] = left->_values[left->_num_keys - 1];
+			child->_num_keys++;
+			left->_num_keys--;
+			parent->_keys[index - 1] = child->_keys[0];
+			return;
+		}
+		if (right && right->_num_keys > CAP_BTREE_LEAF_MIN_KEYS) {
+			child->_keys[child->_num_keys] = right->_keys[0];
+			child->_values[child->_num_keys] = right->_values[0];
+			child->_num_keys++;
+			memmove(right->_keys, &right->_keys[1],
+				sizeof(_cap_btree_key) * (right->_num_keys - 1));
+			memmove(right->_values, &right->_values[1],
+				sizeof(void *) * (right->_num_keys - 1));
+			right->_num_keys--;
+			parent->_keys[index] = right->_keys[0];
+			return;
+		}
+		// Merge into the left one of the pair, so that the first leaf
+		// of the tree is never the one which gets freed
+		if (left) {
+			right = child;
+			child = left;
+			index--;
+		}
+		memcpy(&child->_keys[child->_num_keys], right->_keys,
+		       sizeof(_cap_btree_key) * right->_num_keys);
+		memcpy(&child->_values[child->_num_keys], right->_values,
+		       sizeof(void *) * right->_num_keys);
+		child->_num_keys += right->_num_keys;
+		child->_next = right->_next;
+		_cap_btree_node_free(tree, right, sizeof(_cap_btree_leaf));
+	} else {
+		_cap_btree_internal *child =
+		    (_cap_btree_internal *)parent->_children[index];
+		_cap_btree_internal *left =
+		    index > 0 ? (_cap_btree_internal *)parent->_children[index - 1]
+			      : NULL;
+		_cap_btree_internal *right =
+		    index < parent->_num_keys
+			? (_cap_btree_internal *)parent->_children[index + 1]
+			: NULL;
+		if (left && left->_num_keys > CAP_BTREE_INTERNAL_MIN_KEYS) {
+			memmove(&child->_keys[1], child->_keys,
+				sizeof(_cap_btree_key) * child->_num_keys);
+			memmove(&child->_children[1], child->_children,
+				sizeof(void *) * (child->_num_keys + 1));
+			child->_keys[0] = parent->_keys[index - 1];
+			child->_children[0] = left->_children[left->_num_keys];
+			child->_num_keys++;
+			parent->_keys[index - 1] = left->_keys[left->_num_keys - 1];
+			left->_num_keys--;
+			return;
+		}
+		if (right && right->_num_keys > CAP_BTREE_INTERNAL_MIN_KEYS) {
+			child->_keys[child->_num_keys] = parent->_keys[index];
+			child->_children[child->_num_keys + 1] =
+			    right->_children[0];
+			child->_num_keys++;
+			parent->_keys[index] = right->_keys[0];
+			memmove(right->_keys, &right->_keys[1],
+				sizeof(_cap_btree_key) * (right->_num_keys - 1));
+			memmove(right->_children, &right->_children[1],
+				sizeof(void *) * right->_num_keys);
+			right->_num_keys--;
+			return;
+		}
+		if (left) {
+			right = child;
+			child = left;
+			index--;
+		}
+		child->_keys[child->_num_keys] = parent->_keys[index];
+		memcpy(&child->_keys[child->_num_keys + 1], right->_keys,
+		       sizeof(_cap_btree_key) * right->_num_keys);
+		memcpy(&child->_children[child->_num_keys + 1], right->_children,
+		       sizeof(void *) * (right->_num_keys + 1));
+		child->_num_keys += right->_num_keys + 1;
+		_cap_btree_node_free(tree, right, sizeof(_cap_btree_internal));
+	}
+	// The right node of the pair is gone, drop it's separator and link
+	memmove(&parent->_keys[index], &parent->_keys[index + 1],
+		sizeof(_cap_btree_key) * (parent->_num_keys - index - 1));
+	memmove(&parent->_children[index + 1], &parent->_children[index + 2],
+		sizeof(void *) * (parent->_num_keys - index - 1));
+	parent->_num_keys--;
+}
+
+static _cap_btree_key _cap_btree_min_key(void *node, int level) {
+	for (; level > 1; --level)
+		node = ((_cap_btree_internal *)node)->_children[0];
+	return ((_cap_btree_leaf *)node)->_keys[0];
+}
+
+static void _cap_btree_free_node(cap_btree *tree, void *node, int level) {
+	if (level > 1) {
+		_cap_btree_internal *internal = (_cap_btree_internal *)node;
+		for (int i = 0; i <= internal->_num_keys; ++i)
+			_cap_btree_free_node(tree, internal->_children[i],
+					     level - 1);
+		_cap_btree_node_free(tree, node, sizeof(_cap_btree_internal));
+	} else {
+		_cap_btree_node_free(tree, node, sizeof(_cap_btree_leaf));
+	}
+}
+
+static cap_btree_iterator *_cap_btree_iterator_at(cap_btree *tree,
+						  _cap_btree_leaf *leaf,
+						  int leaf_index,
+						  size_t current_index) {
+	cap_btree_iterator *iterator =
+	    (cap_btree_iterator *)calloc(1, sizeof(cap_btree_iterator));
+	if (!iterator) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	if (leaf_index >= leaf->_num_keys) {
+		leaf = leaf->_next;
+		leaf_index = 0;
+	}
+	iterator->_original_reference = tree;
+	iterator->_current_leaf = leaf;
+	iterator->_leaf_index = leaf_index;
+	iterator->_current_index = current_index;
+	if (leaf) {
+		iterator->key = tree->_int_keys
+				    ? (CAP_GENERIC_TYPE_PTR)&leaf
+					  ->_keys[leaf_index]
+					  ._int_key
+				    : leaf->_keys[leaf_index]._key;
+		iterator->value = leaf->_values[leaf_index];
+	}
+	return iterator;
+}
+
+#endif // !CAP_BTREE_H
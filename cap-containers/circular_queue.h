@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_CIRCULAR_QUEUE_H
 #define CAP_CIRCULAR_QUEUE_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +40,7 @@ typedef struct {
 	int _size;
 	size_t _tail_index;
 	CAP_GENERIC_TYPE_PTR *_internal_buffer;
+	cap_allocator _allocator;
 } cap_circular_queue;
 #endif
 
@@ -49,6 +52,17 @@ typedef struct {
  * @return Allocated cap_circular_queue container
  */
 static cap_circular_queue *cap_circular_queue_init(size_t capacity_of_queue);
+/**
+ * Initilize the cap_circular_queue container with initial capacity, taking the
+ * container and it's buffer from the given allocator
+ *
+ * @param capacity_of_queue Initial capacity of the circular queue
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_circular_queue container
+ */
+static cap_circular_queue *
+cap_circular_queue_init_with_allocator(size_t capacity_of_queue,
+				       const cap_allocator *allocator);
 /**
  * Query the capacity of the given cap_circular_queue
  *
@@ -94,19 +108,28 @@ static void cap_circular_queue_free(cap_circular_queue *cqueue);
 static void cap_circular_queue_deep_free(cap_circular_queue *cqueue);
 
 static cap_circular_queue *cap_circular_queue_init(size_t capacity_of_queue) {
+	return cap_circular_queue_init_with_allocator(capacity_of_queue, NULL);
+}
+
+static cap_circular_queue *
+cap_circular_queue_init_with_allocator(size_t capacity_of_queue,
+				       const cap_allocator *allocator) {
 	assert(capacity_of_queue);
 	cap_circular_queue *cqueue =
-	    (cap_circular_queue *)CAP_ALLOCATOR(cap_circular_queue, 1);
+	    (cap_circular_queue *)_cap_allocator_calloc(
+		allocator, 1, sizeof(cap_circular_queue));
 	if (!cqueue) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) cqueue->_allocator = *allocator;
 	cqueue->_capacity = capacity_of_queue;
-	cqueue->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(
-	    CAP_GENERIC_TYPE_PTR, capacity_of_queue);
+	cqueue->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)_cap_allocator_alloc(
+	    allocator, sizeof(CAP_GENERIC_TYPE_PTR) * capacity_of_queue);
 	if (!cqueue->_internal_buffer) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(cqueue);
+		_cap_allocator_free(allocator, cqueue,
+				    sizeof(cap_circular_queue));
 		return NULL;
 	}
 	cqueue->_head_index = 0;
@@ -139,8 +162,10 @@ static int cap_circular_queue_size(cap_circular_queue *cqueue) {
 
 static void cap_circular_queue_free(cap_circular_queue *cqueue) {
 	assert(cqueue != NULL);
-	if (cqueue->_internal_buffer) free(cqueue->_internal_buffer);
-	free(cqueue);
+	cap_allocator allocator = cqueue->_allocator;
+	_cap_allocator_free(&allocator, cqueue->_internal_buffer,
+			    sizeof(CAP_GENERIC_TYPE_PTR) * cqueue->_capacity);
+	_cap_allocator_free(&allocator, cqueue, sizeof(cap_circular_queue));
 }
 
 static void cap_circular_queue_deep_free(cap_circular_queue *cqueue) {
@@ -148,8 +173,7 @@ static void cap_circular_queue_deep_free(cap_circular_queue *cqueue) {
 	for (int index = cqueue->_head_index - 1; index >= cqueue->_tail_index;
 	     index++)
 		free(cqueue->_internal_buffer[index]);
-	free(cqueue->_internal_buffer);
-	free(cqueue);
+	cap_circular_queue_free(cqueue);
 }
 
 static size_t cap_circular_queue_capacity(const cap_circular_queue *cqueue) {
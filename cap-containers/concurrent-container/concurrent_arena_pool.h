@@ -0,0 +1,272 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_CONCURRENT_ARENA_POOL_H
+#define CAP_CONCURRENT_ARENA_POOL_H
+#include "../arena_allocator.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_ARENA_POOL_CACHE_LINE_SIZE 64
+// Number of returns over which a slot's high-water mark is taken, and how many
+// times larger than the mark the kept block may grow before it's replaced
+#define CAP_ARENA_POOL_WINDOW 64
+#define CAP_ARENA_POOL_SHRINK_RATIO 4
+
+// Each slot sits on it's own cache lines, so that threads checking out
+// different slots don't contend
+typedef struct {
+	_Alignas(CAP_ARENA_POOL_CACHE_LINE_SIZE) atomic_bool _in_use;
+	_Atomic(cap_arena_allocator *) _arena;
+	// Largest size the slot's arena reached over the last full window, and
+	// over the current one
+	atomic_size_t _high_water;
+	size_t _window_peak;
+	size_t _returns;
+} _cap_arena_pool_slot;
+
+typedef struct {
+	_cap_arena_pool_slot *_slots;
+	size_t _slot_count;
+	size_t _block_size;
+	atomic_size_t _overflows;
+} cap_arena_pool;
+
+// Slot the calling thread last checked out, tried first by it's next checkout
+static _Thread_local size_t _cap_arena_pool_slot_hint = 0;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_arena_pool hands out growable cap_arena_allocator objects to threads or
+ * requests, and takes them back reset, so that a request's arena costs no
+ * system allocation once the pool is warm. An arena is used by one thread at a
+ * time, the pool itself is thread-safe and lock-free: checkout claims a free
+ * slot with a compare and swap, trying the slot the thread used last first, so
+ * a thread keeps getting the same warm arena back. When every slot is checked
+ * out, a standalone arena is made, which is freed when it's returned. Each
+ * arena is marked with the slot it belongs to, a standalone arena with none.
+ *
+ * Each slot keeps the high-water mark of it's arena over the last
+ * CAP_ARENA_POOL_WINDOW returns. An arena which had to chain blocks, or whose
+ * kept block is CAP_ARENA_POOL_SHRINK_RATIO times larger than the mark, is
+ * replaced on return by one with a single block sized to the mark, so each
+ * slot converges on a block which holds it's requests.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_arena_pool. The arenas are made on the first checkout of
+ * each slot
+ *
+ * @param slot_count Number of arenas the pool keeps
+ * @param block_size Size of the first block of a new arena
+ * @return Allocated cap_arena_pool, NULL if there was a memory error
+ */
+static cap_arena_pool *cap_arena_pool_init(size_t slot_count,
+					   size_t block_size);
+/**
+ * Check out an arena from the pool, it's the caller's until it's returned
+ *
+ * @param pool cap_arena_pool object
+ * @return An empty arena, NULL if there was a memory error
+ */
+static cap_arena_allocator *cap_arena_pool_checkout(cap_arena_pool *pool);
+/**
+ * Return an arena to the pool, from any thread. The arena is reset, every
+ * pointer allocated from it is invalidated
+ *
+ * @param pool cap_arena_pool object
+ * @param arena Arena checked out from the pool
+ */
+static void cap_arena_pool_return(cap_arena_pool *pool,
+				  cap_arena_allocator *arena);
+/**
+ * Get the largest high-water mark of the pool's slots, the most memory a
+ * request used over the last window
+ *
+ * @param pool cap_arena_pool object
+ * @return High-water mark in bytes
+ */
+static size_t cap_arena_pool_high_water(cap_arena_pool *pool);
+/**
+ * Get the number of checkouts which found every slot in use, and got a
+ * standalone arena
+ *
+ * @param pool cap_arena_pool object
+ * @return Number of standalone arenas made
+ */
+static size_t cap_arena_pool_overflows(cap_arena_pool *pool);
+/**
+ * Free the cap_arena_pool along with it's arenas, every arena must have been
+ * returned
+ *
+ * @param pool cap_arena_pool object
+ */
+static void cap_arena_pool_free(cap_arena_pool *pool);
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static void _cap_arena_pool_record(cap_arena_pool *pool,
+				   _cap_arena_pool_slot *slot,
+				   cap_arena_allocator *arena);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_arena_pool *cap_arena_pool_init(size_t slot_count,
+					   size_t block_size) {
+	assert(slot_count > 0 && block_size > 0);
+	cap_arena_pool *pool = (cap_arena_pool *)malloc(sizeof(cap_arena_pool));
+	if (!pool) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	pool->_slots = (_cap_arena_pool_slot *)aligned_alloc(
+	    CAP_ARENA_POOL_CACHE_LINE_SIZE,
+	    sizeof(_cap_arena_pool_slot) * slot_count);
+	if (!pool->_slots) {
+		fprintf(stderr, "memory allocation failure\n");
+		free(pool);
+		return NULL;
+	}
+	memset(pool->_slots, 0, sizeof(_cap_arena_pool_slot) * slot_count);
+	for (size_t i = 0; i < slot_count; ++i) {
+		atomic_init(&pool->_slots[i]._in_use, false);
+		atomic_init(&pool->_slots[i]._arena, NULL);
+		atomic_init(&pool->_slots[i]._high_water, 0);
+	}
+	pool->_slot_count = slot_count;
+	pool->_block_size = block_size;
+	atomic_init(&pool->_overflows, 0);
+	return pool;
+}
+
+static cap_arena_allocator *cap_arena_pool_checkout(cap_arena_pool *pool) {
+	assert(pool != NULL);
+	size_t start = _cap_arena_pool_slot_hint % pool->_slot_count;
+	for (size_t i = 0; i < pool->_slot_count; ++i) {
+		size_t index = (start + i) % pool->_slot_count;
+		_cap_arena_pool_slot *slot = &pool->_slots[index];
+		bool expected = false;
+		// Reading first keeps the busy slots' lines shared
+		if (atomic_load_explicit(&slot->_in_use,
+					 memory_order_relaxed) ||
+		    !atomic_compare_exchange_strong_explicit(
+			&slot->_in_use, &expected, true,
+			memory_order_acquire, memory_order_relaxed))
+			continue;
+		_cap_arena_pool_slot_hint = index;
+		cap_arena_allocator *arena =
+		    atomic_load_explicit(&slot->_arena, memory_order_relaxed);
+		if (arena) return arena;
+		arena = cap_arena_allocator_init_growable(pool->_block_size);
+		if (!arena) {
+			atomic_store_explicit(&slot->_in_use, false,
+					      memory_order_release);
+			return NULL;
+		}
+		arena->_owner = slot;
+		atomic_store_explicit(&slot->_arena, arena,
+				      memory_order_relaxed);
+		return arena;
+	}
+	atomic_fetch_add_explicit(&pool->_overflows, 1, memory_order_relaxed);
+	return cap_arena_allocator_init_growable(pool->_block_size);
+}
+
+static void cap_arena_pool_return(cap_arena_pool *pool,
+				  cap_arena_allocator *arena) {
+	assert(pool != NULL && arena != NULL);
+	_cap_arena_pool_slot *slot = (_cap_arena_pool_slot *)arena->_owner;
+	if (!slot) {
+		cap_arena_free(arena);
+		return;
+	}
+	assert(slot >= pool->_slots && slot < pool->_slots + pool->_slot_count);
+	_cap_arena_pool_record(pool, slot, arena);
+	atomic_store_explicit(&slot->_in_use, false, memory_order_release);
+}
+
+static size_t cap_arena_pool_high_water(cap_arena_pool *pool) {
+	assert(pool != NULL);
+	size_t high_water = 0;
+	for (size_t i = 0; i < pool->_slot_count; ++i) {
+		size_t mark = atomic_load_explicit(&pool->_slots[i]._high_water,
+						   memory_order_relaxed);
+		if (mark > high_water) high_water = mark;
+	}
+	return high_water;
+}
+
+static size_t cap_arena_pool_overflows(cap_arena_pool *pool) {
+	assert(pool != NULL);
+	return atomic_load_explicit(&pool->_overflows, memory_order_relaxed);
+}
+
+static void cap_arena_pool_free(cap_arena_pool *pool) {
+	assert(pool != NULL);
+	for (size_t i = 0; i < pool->_slot_count; ++i) {
+		assert(!atomic_load(&pool->_slots[i]._in_use));
+		cap_arena_allocator *arena =
+		    atomic_load(&pool->_slots[i]._arena);
+		if (arena) cap_arena_free(arena);
+	}
+	free(pool->_slots);
+	free(pool);
+}
+
+// Updates the slot's high-water mark with the arena's size, then resets the
+// arena, replacing it if it's block doesn't fit the mark
+static void _cap_arena_pool_record(cap_arena_pool *pool,
+				   _cap_arena_pool_slot *slot,
+				   cap_arena_allocator *arena) {
+	size_t used = cap_arena_size(arena);
+	size_t high_water =
+	    atomic_load_explicit(&slot->_high_water, memory_order_relaxed);
+	if (used > slot->_window_peak) slot->_window_peak = used;
+	if (used > high_water) high_water = used;
+	if (++slot->_returns == CAP_ARENA_POOL_WINDOW) {
+		high_water = slot->_window_peak;
+		slot->_window_peak = 0;
+		slot->_returns = 0;
+	}
+	atomic_store_explicit(&slot->_high_water, high_water,
+			      memory_order_relaxed);
+
+	bool chained = cap_arena_block_count(arena) > 1;
+	cap_arena_reset(arena);
+	size_t target = pool->_block_size;
+	while (target < high_water && target <= SIZE_MAX / 2) target <<= 1;
+	if (!chained &&
+	    cap_arena_capacity(arena) / CAP_ARENA_POOL_SHRINK_RATIO <= target)
+		return;
+	// Best effort, the old arena is kept if the new one can't be made
+	cap_arena_allocator *resized =
+	    cap_arena_allocator_init_growable(target);
+	if (!resized) return;
+	resized->_owner = slot;
+	atomic_store_explicit(&slot->_arena, resized, memory_order_relaxed);
+	cap_arena_free(arena);
+}
+
+#endif // !CAP_CONCURRENT_ARENA_POOL_H
@@ -0,0 +1,718 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_CONCURRENT_LRU_CACHE_H
+#define CAP_CONCURRENT_LRU_CACHE_H
+#include "../lru_cache.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_CONCURRENT_LRU_CACHE_LINE_SIZE 64
+#define CAP_PTHREAD_RWLOCK_LOCK_STATUS(return_value)                           \
+	do {                                                                   \
+		if (return_value != 0) {                                       \
+			perror("pthread_rwlock_lock");                         \
+			exit(EXIT_FAILURE);                                    \
+		}                                                              \
+	} while (0)
+#define CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(return_value)                         \
+	do {                                                                   \
+		if (return_value != 0) {                                       \
+			perror("pthread_rwlock_unlock");                       \
+			exit(EXIT_FAILURE);                                    \
+		}                                                              \
+	} while (0)
+
+// Each shard sits on it's own cache lines, so that threads working on
+// different shards don't contend on the lock's cache line
+typedef struct {
+	_Alignas(CAP_CONCURRENT_LRU_CACHE_LINE_SIZE) pthread_rwlock_t _lock;
+	cap_lru_cache *_cache;
+	// Lookups served under the read lock, which can't update the shard
+	// cache's counters, counted atomically
+	uint64_t _read_hits;
+	uint64_t _read_misses;
+} _cap_concurrent_lru_cache_shard;
+
+typedef struct {
+	_cap_concurrent_lru_cache_shard *_shards;
+	size_t _shard_mask;
+	size_t _promotion_window;
+	_hash_fn_type _hash_fn;
+	size_t _key_size;
+} cap_concurrent_lru_cache;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_concurrent_lru_cache is a thread-safe LRU cache, which partitions the
+ * keys across independently locked shards. Each shard is a cap_lru_cache with
+ * it's own list and hash table, the key's hash picks the shard, so threads
+ * working on keys of different shards never wait on each other. The eviction
+ * order is least recently used within each shard.
+ *
+ * Every hit moves the entry to the head of it's shard's list, which needs the
+ * shard's write lock. With a promotion window set, hits on entries which were
+ * promoted recently skip the move and only take the read lock.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_concurrent_lru_cache container
+ *
+ * @param capacity Cache's capacity, number of entries. It's split evenly
+ * across the shards
+ * @param shard_count Number of shards, rounded up to a power of two
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, returns true if
+ * the two keys are same. Pass NULL to compare the key_size bytes with memcmp()
+ * @param hash_fn Function pointer for hashing a key. Pass NULL to use the
+ * default hash function
+ * @return Allocated cap_concurrent_lru_cache container, NULL if there was a
+ * memory error
+ */
+static cap_concurrent_lru_cache *
+cap_concurrent_lru_cache_init(size_t capacity, size_t shard_count,
+			      size_t key_size, _compare_fn_type compare_fn,
+			      _hash_fn_type hash_fn);
+/**
+ * Initilize a cap_concurrent_lru_cache container with an evict function, which
+ * is called with each entry a shard evicts or expires. It's called while the
+ * shard's write lock is held, so it must not call back into the cache
+ *
+ * @param capacity Cache's capacity, number of entries
+ * @param shard_count Number of shards, rounded up to a power of two
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, NULL for memcmp()
+ * @param hash_fn Function pointer for hashing a key, NULL for the default one
+ * @param evict_fn Function called with the key and value of a dropped entry,
+ * the reason and evict_arg
+ * @param evict_arg Pointer passed to evict_fn
+ * @return Allocated cap_concurrent_lru_cache container, NULL if there was a
+ * memory error
+ */
+static cap_concurrent_lru_cache *cap_concurrent_lru_cache_init_with_evict_fn(
+    size_t capacity, size_t shard_count, size_t key_size,
+    _compare_fn_type compare_fn, _hash_fn_type hash_fn,
+    _evict_fn_type evict_fn, void *evict_arg);
+/**
+ * Set the promotion window. A hit only moves the entry to the head of it's
+ * shard if fewer than window other entries of the shard were used since the
+ * entry was last moved, i.e hot entries near the head stay where they are and
+ * their hits only take the read lock. Zero, the default, promotes on every
+ * hit. Must be called before the cache is shared between threads
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param window Promotion window, in number of promotions
+ */
+static void
+cap_concurrent_lru_cache_set_promotion_window(cap_concurrent_lru_cache *cache,
+					      size_t window);
+/**
+ * Lookup the cache with key, and mark the entry as recently used
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param key key to lookup
+ * @return Pointer to value if found. NULL otherwise.
+ */
+static void *cap_concurrent_lru_cache_get(cap_concurrent_lru_cache *cache,
+					  void *key);
+/**
+ * Insert a key-value pair. If the key is already cached, it's value is
+ * replaced. The least recently used entry of the shard is evicted if the shard
+ * is full
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool cap_concurrent_lru_cache_put(cap_concurrent_lru_cache *cache,
+					 void *key, void *value);
+/**
+ * Insert a key-value pair which expires after the given TTL, in milliseconds
+ * of CLOCK_MONOTONIC. If the key is already cached, it's value and expiry are
+ * replaced
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @param ttl Time to live in milliseconds, zero never expires
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool
+cap_concurrent_lru_cache_put_with_ttl(cap_concurrent_lru_cache *cache,
+				      void *key, void *value, uint64_t ttl);
+/**
+ * Lookup a batch of keys. The keys are hashed up front and grouped by shard,
+ * so each shard's lock is taken once per batch of up to 64 keys rather than
+ * once per key
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param keys Array of count keys
+ * @param values Array of count values, filled with each key's value or NULL
+ * @param count Number of keys
+ * @return Number of keys found
+ */
+static size_t cap_concurrent_lru_cache_get_many(cap_concurrent_lru_cache *cache,
+						void **keys, void **values,
+						size_t count);
+/**
+ * Insert a batch of key-value pairs, grouped by shard the same way as
+ * cap_concurrent_lru_cache_get_many(). Pairs of the same shard are inserted
+ * in their order within the batch
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param keys Array of count keys
+ * @param values Array of count values
+ * @param count Number of pairs
+ * @return Number of pairs inserted, less than count if there was a memory
+ * error
+ */
+static size_t cap_concurrent_lru_cache_put_many(cap_concurrent_lru_cache *cache,
+						void **keys, void **values,
+						size_t count);
+/**
+ * Remove every entry which expired at or before now. The shards are swept one
+ * after the other, each under it's write lock
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param now Current time, in milliseconds of CLOCK_MONOTONIC
+ * @return Number of entries removed
+ */
+static size_t
+cap_concurrent_lru_cache_expire_now(cap_concurrent_lru_cache *cache,
+				    uint64_t now);
+/**
+ * Check if a key is cached, without marking it as used
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param key key to lookup
+ * @return True if the key is cached, False if not
+ */
+static bool cap_concurrent_lru_cache_contains(cap_concurrent_lru_cache *cache,
+					      void *key);
+/**
+ * Remove an entry from the cache
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param key key of the entry to remove
+ * @return True if the entry was found and removed, False if not
+ */
+static bool cap_concurrent_lru_cache_remove(cap_concurrent_lru_cache *cache,
+					    void *key);
+/**
+ * Get the number of entries within the cache. The shards are counted one after
+ * the other, so the result is only exact when no other thread modifies the
+ * cache
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @return Number of entries
+ */
+static size_t cap_concurrent_lru_cache_size(cap_concurrent_lru_cache *cache);
+/**
+ * Get the number of shards
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @return Number of shards
+ */
+static size_t
+cap_concurrent_lru_cache_shard_count(cap_concurrent_lru_cache *cache);
+/**
+ * Get the counters of the whole cache, the sum of the shards' counters. The
+ * shards are read one after the other
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @return Sum of the counters
+ */
+static cap_cache_stats
+cap_concurrent_lru_cache_stats(cap_concurrent_lru_cache *cache);
+/**
+ * Get the counters of one shard, to spot a shard which is hotter than the
+ * others
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param shard_index Index of the shard, less than the shard count
+ * @return Counters of the shard
+ */
+static cap_cache_stats
+cap_concurrent_lru_cache_shard_stats(cap_concurrent_lru_cache *cache,
+				     size_t shard_index);
+/**
+ * Start tracking the most looked up keys, each shard tracks k keys of it's
+ * own. See cap_lru_cache_track_hot_keys()
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param k Number of keys tracked per shard
+ * @param sample_rate One in this many lookups is sampled, at least one
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool
+cap_concurrent_lru_cache_track_hot_keys(cap_concurrent_lru_cache *cache,
+					size_t k, size_t sample_rate);
+/**
+ * Get the hottest tracked keys across the shards, the hottest first
+ *
+ * @param cache cap_concurrent_lru_cache container
+ * @param keys Buffer of max keys, each key_size bytes, the keys are copied to
+ * @param counts Array of max counts, filled with each key's estimated lookups
+ * @param max Maximum number of keys to return
+ * @return Number of keys returned
+ */
+static size_t cap_concurrent_lru_cache_hot_keys(cap_concurrent_lru_cache *cache,
+						void *keys, uint64_t *counts,
+						size_t max);
+/**
+ * Deallocate the cap_concurrent_lru_cache container. The keys and values
+ * aren't touched
+ *
+ * @param cache cap_concurrent_lru_cache container
+ */
+static void cap_concurrent_lru_cache_free(cap_concurrent_lru_cache *cache);
+
+// Prototypes (Internal helpers)
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static _cap_concurrent_lru_cache_shard *
+_cap_concurrent_lru_cache_shard_of(cap_concurrent_lru_cache *cache,
+				   size_t hash);
+static bool _cap_concurrent_lru_cache_put(cap_concurrent_lru_cache *cache,
+					  void *key, void *value,
+					  uint64_t ttl);
+static size_t _cap_concurrent_lru_cache_batch(cap_concurrent_lru_cache *cache,
+					      void **keys, void **values,
+					      size_t count, bool put);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_concurrent_lru_cache *
+cap_concurrent_lru_cache_init(size_t capacity, size_t shard_count,
+			      size_t key_size, _compare_fn_type compare_fn,
+			      _hash_fn_type hash_fn) {
+	return cap_concurrent_lru_cache_init_with_evict_fn(
+	    capacity, shard_count, key_size, compare_fn, hash_fn, NULL, NULL);
+}
+
+static cap_concurrent_lru_cache *cap_concurrent_lru_cache_init_with_evict_fn(
+    size_t capacity, size_t shard_count, size_t key_size,
+    _compare_fn_type compare_fn, _hash_fn_type hash_fn,
+    _evict_fn_type evict_fn, void *evict_arg) {
+	assert(capacity > 0 && shard_count > 0 && key_size > 0);
+	size_t shards = 1;
+	while (shards < shard_count) shards <<= 1;
+	cap_concurrent_lru_cache *cache = (cap_concurrent_lru_cache *)calloc(
+	    1, sizeof(cap_concurrent_lru_cache));
+	if (!cache) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	cache->_shards = (_cap_concurrent_lru_cache_shard *)aligned_alloc(
+	    CAP_CONCURRENT_LRU_CACHE_LINE_SIZE,
+	    sizeof(_cap_concurrent_lru_cache_shard) * shards);
+	if (!cache->_shards) {
+		fprintf(stderr, "memory allocation failure\n");
+		free(cache);
+		return NULL;
+	}
+	cache->_shard_mask = shards - 1;
+	cache->_promotion_window = 0;
+	cache->_hash_fn = hash_fn ? hash_fn : _cap_lru_cache_default_hash;
+	cache->_key_size = key_size;
+	memset(cache->_shards, 0,
+	       sizeof(_cap_concurrent_lru_cache_shard) * shards);
+	size_t shard_capacity = (capacity + shards - 1) / shards;
+	for (size_t i = 0; i < shards; ++i) {
+		_cap_concurrent_lru_cache_shard *shard = &cache->_shards[i];
+		shard->_cache = cap_lru_cache_init_with_evict_fn(
+		    shard_capacity, key_size, compare_fn, cache->_hash_fn,
+		    CAP_CACHE_POLICY_LRU, evict_fn, evict_arg);
+		if (!shard->_cache ||
+		    pthread_rwlock_init(&shard->_lock, NULL) != 0) {
+			fprintf(stderr, "cap_concurrent_lru_cache_init: shard "
+					"initialization failure\n");
+			if (shard->_cache) cap_lru_cache_free(shard->_cache);
+			for (size_t j = 0; j < i; ++j) {
+				shard = &cache->_shards[j];
+				pthread_rwlock_destroy(&shard->_lock);
+				cap_lru_cache_free(shard->_cache);
+			}
+			free(cache->_shards);
+			free(cache);
+			return NULL;
+		}
+	}
+	return cache;
+}
+
+static void
+cap_concurrent_lru_cache_set_promotion_window(cap_concurrent_lru_cache *cache,
+					      size_t window) {
+	assert(cache != NULL);
+	cache->_promotion_window = window;
+}
+
+static void *cap_concurrent_lru_cache_get(cap_concurrent_lru_cache *cache,
+					  void *key) {
+	assert(cache != NULL && key != NULL);
+	size_t hash = cache->_hash_fn((uint8_t *)key, cache->_key_size);
+	_cap_concurrent_lru_cache_shard *shard =
+	    _cap_concurrent_lru_cache_shard_of(cache, hash);
+	void *value = NULL;
+	bool sample = false;
+	int ret;
+	if (cache->_promotion_window) {
+		// The stamps and the clock only change under the write lock,
+		// so a recently promoted entry can be served under the read
+		// lock. An expired entry is removed, and a sampled lookup is
+		// tracked, under the write lock
+		ret = pthread_rwlock_rdlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+		cap_lru_cache *shard_cache = shard->_cache;
+		_cap_lru_cache_node *node = _cap_lru_cache_find_node(
+		    shard_cache, key, hash);
+		bool recent = node &&
+			      shard_cache->clock - node->stamp <
+				  cache->_promotion_window &&
+			      !_cap_lru_cache_expired(shard_cache, node);
+		sample = shard_cache->hot &&
+			 _cap_lru_cache_hot_keys_due(shard_cache->hot);
+		if (node) value = node->value;
+		ret = pthread_rwlock_unlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+		if (!sample && !node) {
+			__atomic_add_fetch(&shard->_read_misses, 1,
+					   __ATOMIC_RELAXED);
+			return NULL;
+		}
+		if (!sample && recent) {
+			__atomic_add_fetch(&shard->_read_hits, 1,
+					   __ATOMIC_RELAXED);
+			return value;
+		}
+	}
+	ret = pthread_rwlock_wrlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+	// The read path already counted the lookup down, without a window it's
+	// counted here
+	if (!cache->_promotion_window)
+		sample = shard->_cache->hot &&
+			 _cap_lru_cache_hot_keys_due(shard->_cache->hot);
+	if (sample && shard->_cache->hot)
+		_cap_lru_cache_hot_keys_sample(shard->_cache, key, hash);
+	value = _cap_lru_cache_lookup_hashed(shard->_cache, key, hash);
+	ret = pthread_rwlock_unlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	return value;
+}
+
+static bool cap_concurrent_lru_cache_put(cap_concurrent_lru_cache *cache,
+					 void *key, void *value) {
+	assert(cache != NULL && key != NULL);
+	return _cap_concurrent_lru_cache_put(cache, key, value, 0);
+}
+
+static bool
+cap_concurrent_lru_cache_put_with_ttl(cap_concurrent_lru_cache *cache,
+				      void *key, void *value, uint64_t ttl) {
+	assert(cache != NULL && key != NULL);
+	return _cap_concurrent_lru_cache_put(cache, key, value, ttl);
+}
+
+static size_t cap_concurrent_lru_cache_get_many(cap_concurrent_lru_cache *cache,
+						void **keys, void **values,
+						size_t count) {
+	assert(cache != NULL && keys != NULL && values != NULL);
+	return _cap_concurrent_lru_cache_batch(cache, keys, values, count,
+					       false);
+}
+
+static size_t cap_concurrent_lru_cache_put_many(cap_concurrent_lru_cache *cache,
+						void **keys, void **values,
+						size_t count) {
+	assert(cache != NULL && keys != NULL && values != NULL);
+	return _cap_concurrent_lru_cache_batch(cache, keys, values, count,
+					       true);
+}
+
+static size_t
+cap_concurrent_lru_cache_expire_now(cap_concurrent_lru_cache *cache,
+				    uint64_t now) {
+	assert(cache != NULL);
+	size_t expired_count = 0;
+	for (size_t i = 0; i <= cache->_shard_mask; ++i) {
+		_cap_concurrent_lru_cache_shard *shard = &cache->_shards[i];
+		int ret = pthread_rwlock_wrlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+		expired_count += cap_lru_cache_expire_now(shard->_cache, now);
+		ret = pthread_rwlock_unlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	}
+	return expired_count;
+}
+
+static bool cap_concurrent_lru_cache_contains(cap_concurrent_lru_cache *cache,
+					      void *key) {
+	assert(cache != NULL && key != NULL);
+	size_t hash = cache->_hash_fn((uint8_t *)key, cache->_key_size);
+	_cap_concurrent_lru_cache_shard *shard =
+	    _cap_concurrent_lru_cache_shard_of(cache, hash);
+	int ret = pthread_rwlock_rdlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+	_cap_lru_cache_node *node = _cap_lru_cache_find_node(shard->_cache, key,
+							     hash);
+	bool return_value =
+	    node && !_cap_lru_cache_expired(shard->_cache, node);
+	ret = pthread_rwlock_unlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	return return_value;
+}
+
+static bool cap_concurrent_lru_cache_remove(cap_concurrent_lru_cache *cache,
+					    void *key) {
+	assert(cache != NULL && key != NULL);
+	size_t hash = cache->_hash_fn((uint8_t *)key, cache->_key_size);
+	_cap_concurrent_lru_cache_shard *shard =
+	    _cap_concurrent_lru_cache_shard_of(cache, hash);
+	int ret = pthread_rwlock_wrlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+	bool return_value =
+	    _cap_lru_cache_remove_hashed(shard->_cache, key, hash);
+	ret = pthread_rwlock_unlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	return return_value;
+}
+
+static size_t cap_concurrent_lru_cache_size(cap_concurrent_lru_cache *cache) {
+	assert(cache != NULL);
+	size_t size = 0;
+	for (size_t i = 0; i <= cache->_shard_mask; ++i) {
+		_cap_concurrent_lru_cache_shard *shard = &cache->_shards[i];
+		int ret = pthread_rwlock_rdlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+		size += shard->_cache->size;
+		ret = pthread_rwlock_unlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	}
+	return size;
+}
+
+static size_t
+cap_concurrent_lru_cache_shard_count(cap_concurrent_lru_cache *cache) {
+	assert(cache != NULL);
+	return cache->_shard_mask + 1;
+}
+
+static cap_cache_stats
+cap_concurrent_lru_cache_stats(cap_concurrent_lru_cache *cache) {
+	assert(cache != NULL);
+	cap_cache_stats total;
+	memset(&total, 0, sizeof(cap_cache_stats));
+	for (size_t i = 0; i <= cache->_shard_mask; ++i) {
+		cap_cache_stats stats =
+		    cap_concurrent_lru_cache_shard_stats(cache, i);
+		total.hits += stats.hits;
+		total.misses += stats.misses;
+		total.inserts += stats.inserts;
+		total.updates += stats.updates;
+		total.evictions += stats.evictions;
+		total.expirations += stats.expirations;
+	}
+	return total;
+}
+
+static cap_cache_stats
+cap_concurrent_lru_cache_shard_stats(cap_concurrent_lru_cache *cache,
+				     size_t shard_index) {
+	assert(cache != NULL && shard_index <= cache->_shard_mask);
+	_cap_concurrent_lru_cache_shard *shard = &cache->_shards[shard_index];
+	int ret = pthread_rwlock_rdlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+	cap_cache_stats stats = cap_lru_cache_stats(shard->_cache);
+	ret = pthread_rwlock_unlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	stats.hits += __atomic_load_n(&shard->_read_hits, __ATOMIC_RELAXED);
+	stats.misses +=
+	    __atomic_load_n(&shard->_read_misses, __ATOMIC_RELAXED);
+	return stats;
+}
+
+static bool
+cap_concurrent_lru_cache_track_hot_keys(cap_concurrent_lru_cache *cache,
+					size_t k, size_t sample_rate) {
+	assert(cache != NULL && sample_rate > 0);
+	bool return_value = true;
+	for (size_t i = 0; i <= cache->_shard_mask; ++i) {
+		_cap_concurrent_lru_cache_shard *shard = &cache->_shards[i];
+		int ret = pthread_rwlock_wrlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+		if (!cap_lru_cache_track_hot_keys(shard->_cache, k,
+						  sample_rate))
+			return_value = false;
+		ret = pthread_rwlock_unlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	}
+	return return_value;
+}
+
+static size_t cap_concurrent_lru_cache_hot_keys(cap_concurrent_lru_cache *cache,
+						void *keys, uint64_t *counts,
+						size_t max) {
+	assert(cache != NULL && keys != NULL && counts != NULL);
+	// Each shard's hottest max keys are gathered, then the hottest max
+	// of them are picked. A key belongs to a single shard, so no key is
+	// gathered twice
+	size_t shards = cache->_shard_mask + 1;
+	size_t key_size = cache->_key_size;
+	CAP_GENERIC_TYPE_PTR gathered_keys =
+	    (CAP_GENERIC_TYPE_PTR)malloc(key_size * max * shards);
+	uint64_t(*order)[2] =
+	    (uint64_t(*)[2])malloc(sizeof(uint64_t[2]) * max * shards);
+	uint64_t *gathered_counts =
+	    (uint64_t *)malloc(sizeof(uint64_t) * max * shards);
+	if (!gathered_keys || !order || !gathered_counts) {
+		fprintf(stderr, "memory allocation failure\n");
+		free(gathered_keys);
+		free(order);
+		free(gathered_counts);
+		return 0;
+	}
+	size_t gathered = 0;
+	for (size_t i = 0; i < shards; ++i) {
+		_cap_concurrent_lru_cache_shard *shard = &cache->_shards[i];
+		int ret = pthread_rwlock_rdlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+		gathered += cap_lru_cache_hot_keys(
+		    shard->_cache, gathered_keys + gathered * key_size,
+		    gathered_counts + gathered, max);
+		ret = pthread_rwlock_unlock(&shard->_lock);
+		CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	}
+	for (size_t i = 0; i < gathered; ++i) {
+		order[i][0] = gathered_counts[i];
+		order[i][1] = i;
+	}
+	qsort(order, gathered, sizeof(uint64_t[2]),
+	      _cap_lru_cache_hot_keys_compare);
+	size_t returned = max < gathered ? max : gathered;
+	for (size_t i = 0; i < returned; ++i) {
+		size_t index = (size_t)order[i][1];
+		memcpy((CAP_GENERIC_TYPE_PTR)keys + i * key_size,
+		       gathered_keys + index * key_size, key_size);
+		counts[i] = order[i][0];
+	}
+	free(gathered_keys);
+	free(order);
+	free(gathered_counts);
+	return returned;
+}
+
+static void cap_concurrent_lru_cache_free(cap_concurrent_lru_cache *cache) {
+	assert(cache != NULL);
+	for (size_t i = 0; i <= cache->_shard_mask; ++i) {
+		pthread_rwlock_destroy(&cache->_shards[i]._lock);
+		cap_lru_cache_free(cache->_shards[i]._cache);
+	}
+	free(cache->_shards);
+	free(cache);
+}
+
+static _cap_concurrent_lru_cache_shard *
+_cap_concurrent_lru_cache_shard_of(cap_concurrent_lru_cache *cache,
+				   size_t hash) {
+	// The low bits of the hash pick the bucket within the shard, so the
+	// shard is picked from the high bits of a multiplicative remix
+	uint64_t mixed = (uint64_t)hash * 0x9E3779B97F4A7C15ULL;
+	return &cache->_shards[(size_t)(mixed >> 40) & cache->_shard_mask];
+}
+
+static bool _cap_concurrent_lru_cache_put(cap_concurrent_lru_cache *cache,
+					  void *key, void *value,
+					  uint64_t ttl) {
+	size_t hash = cache->_hash_fn((uint8_t *)key, cache->_key_size);
+	_cap_concurrent_lru_cache_shard *shard =
+	    _cap_concurrent_lru_cache_shard_of(cache, hash);
+	int ret = pthread_rwlock_wrlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+	bool return_value =
+	    _cap_lru_cache_put_hashed(shard->_cache, key, value, 1, ttl, hash);
+	ret = pthread_rwlock_unlock(&shard->_lock);
+	CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+	return return_value;
+}
+
+// Hashes a batch of keys, sorts their indices by shard, then takes each
+// shard's write lock once for all of it's keys
+static size_t _cap_concurrent_lru_cache_batch(cap_concurrent_lru_cache *cache,
+					      void **keys, void **values,
+					      size_t count, bool put) {
+	size_t hashes[CAP_LRU_CACHE_BATCH_SIZE];
+	_cap_concurrent_lru_cache_shard *shards[CAP_LRU_CACHE_BATCH_SIZE];
+	size_t order[CAP_LRU_CACHE_BATCH_SIZE];
+	const size_t batch_size = CAP_LRU_CACHE_BATCH_SIZE;
+	size_t done = 0;
+	for (size_t start = 0; start < count; start += batch_size) {
+		size_t batch =
+		    count - start < batch_size ? count - start : batch_size;
+		// Insertion sort is stable, so the keys of a shard keep their
+		// order within the batch
+		for (size_t i = 0; i < batch; ++i) {
+			uint8_t *key = (uint8_t *)keys[start + i];
+			size_t hash = cache->_hash_fn(key, cache->_key_size);
+			hashes[i] = hash;
+			shards[i] =
+			    _cap_concurrent_lru_cache_shard_of(cache, hash);
+			size_t j = i;
+			for (; j > 0 && shards[order[j - 1]] > shards[i]; --j)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+		for (size_t run = 0; run < batch;) {
+			_cap_concurrent_lru_cache_shard *shard =
+			    shards[order[run]];
+			int ret = pthread_rwlock_wrlock(&shard->_lock);
+			CAP_PTHREAD_RWLOCK_LOCK_STATUS(ret);
+			for (; run < batch && shards[order[run]] == shard;
+			     ++run) {
+				size_t i = order[run];
+				void *key = keys[start + i];
+				if (put) {
+					if (_cap_lru_cache_put_hashed(
+						shard->_cache, key,
+						values[start + i], 1, 0,
+						hashes[i]))
+						done++;
+				} else {
+					values[start + i] =
+					    _cap_lru_cache_get_hashed(
+						shard->_cache, key, hashes[i]);
+					if (values[start + i]) done++;
+				}
+			}
+			ret = pthread_rwlock_unlock(&shard->_lock);
+			CAP_PTHREAD_RWLOCK_UNLOCK_STATUS(ret);
+		}
+	}
+	return done;
+}
+
+#endif // !CAP_CONCURRENT_LRU_CACHE_H
@@ -0,0 +1,630 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_CONCURRENT_MAP_H
+#define CAP_CONCURRENT_MAP_H
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_GENERIC_TYPE unsigned char
+#define CAP_GENERIC_TYPE_PTR CAP_GENERIC_TYPE *
+#define CAP_ALLOCATOR(type, number_of_elements)                                \
+	calloc(number_of_elements, sizeof(type))
+#define CAP_MAP_MAX_SKIPLIST_SIZE 16
+#define CAP_MAP_MAX_THREADS 128
+#define CAP_MAP_CACHE_LINE_SIZE 64
+#define CAP_MAP_RETIRE_LISTS 4
+#define CAP_MAP_MARK_BIT ((uintptr_t)1)
+#define CAP_MAP_IS_MARKED(link) (((link)&CAP_MAP_MARK_BIT) != 0)
+#define CAP_MAP_UNMARK(link) ((_cap_map_node *)((link) & ~CAP_MAP_MARK_BIT))
+
+typedef struct _cap_map_node {
+	CAP_GENERIC_TYPE_PTR _key;
+	_Atomic(void *) _value;
+	int _height;
+	// Set by whichever of the inserting or the removing thread finishes
+	// last with the node, that thread hands it to the reclaimer
+	atomic_bool _unlink_done;
+	struct _cap_map_node *_retired_next;
+	// Low bit of a link set means the node owning the link is deleted
+	_Atomic(uintptr_t) _forward[];
+} _cap_map_node;
+
+typedef struct {
+	// (epoch << 1) | 1 while a thread is inside an operation, 0 otherwise
+	_Atomic(uint64_t) _epoch;
+	unsigned char
+	    _padding[CAP_MAP_CACHE_LINE_SIZE - sizeof(_Atomic(uint64_t))];
+} _cap_map_epoch_slot;
+
+typedef struct {
+	_cap_map_node *_head;
+	size_t _key_size;
+	int _height;
+	int (*_compare_fn)(void *key_one, void *key_two);
+	atomic_size_t _size;
+	_Atomic(uint64_t) _global_epoch;
+	_Atomic(_cap_map_node *) _retired[CAP_MAP_RETIRE_LISTS];
+	_cap_map_epoch_slot _epoch_slots[CAP_MAP_MAX_THREADS];
+} cap_map;
+
+static _Thread_local size_t _cap_map_slot_hint = 0;
+static _Thread_local uint64_t _cap_map_rand_state = 0;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * This is the concurrent or thread-safe version of cap_map. Unlike the other
+ * concurrent containers, it doesn't use a mutex. Insert and remove are the
+ * lock-free skip list algorithm of Fraser and Herlihy: a node is deleted by
+ * marking the low bit of its forward links, and any thread which walks over a
+ * marked node helps unlinking it. Find and range scans never write to the
+ * shared links, so they never block or retry.
+ *
+ * Removed nodes are reclaimed using epoch based reclamation. Every operation
+ * publishes the global epoch into one of CAP_MAP_MAX_THREADS slots while it is
+ * running, and a removed node is only freed once every running operation has
+ * moved two epochs past the point where the node was unlinked. More than
+ * CAP_MAP_MAX_THREADS operations running at the very same time will spin until
+ * a slot is released.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_map container object
+ *
+ * @param key_size Size of the key
+ * @param compare_fn Function to compare two keys, it returns negative, zero or
+ * positive value if the first key is less, equal or greater than the second one
+ * @return Newly allocated cap_map container
+ */
+static cap_map *cap_map_init(size_t key_size,
+			     int (*compare_fn)(void *, void *));
+/**
+ * Insert a key-value pair onto the cap_map container. If the key already
+ * exists, it's value is replaced with the given value.
+ *
+ * The container doesn't manage the life time of the given pointers, neither the
+ * Key's pointer nor the Value's one. The key must not be freed while it's still
+ * present on the container.
+ *
+ * @param map cap_map container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return Returns 0 if the operation is success, or else returns -1 is there
+ * was a memory allocation error
+ */
+static int cap_map_insert(cap_map *map, void *key, void *value);
+/**
+ * Find an element on the cap_map container. Never blocks.
+ *
+ * @param map cap_map container
+ * @param key Key for which we need to find the value.
+ * @return Returns the pointer to the element, if the element with key is not
+ * found, it returns NULL
+ */
+static void *cap_map_find(cap_map *map, void *key);
+/**
+ * Check if an item with the given key exists within the cap_map container.
+ *
+ * @param map cap_map container
+ * @param key Key for which we need to see if the elements exists.
+ * @return True if the item does exists, or else returns false if not
+ */
+static bool cap_map_contains(cap_map *map, void *key);
+/**
+ * Remove an element which is mapped to the given key from the container
+ *
+ * @param map cap_map container
+ * @param key Key of the element to be removed
+ * @return 0 if the key is found and the element is removed successfully.
+ * Returns -1 if the element is not found, or if another thread removed it
+ * first.
+ */
+static int cap_map_remove(cap_map *map, void *key);
+/**
+ * Pass every element whose key is within [low_key, high_key] into fn_ptr, in
+ * ascending order of the keys. Never blocks.
+ *
+ * The scan is not a snapshot: elements inserted or removed by other threads
+ * while the scan is running may or may not be visited.
+ *
+ * @param map cap_map container
+ * @param low_key Lower bound of the range, inclusive
+ * @param high_key Upper bound of the range, inclusive
+ * @param fn_ptr Function to which we pass the key and the value
+ * @return Number of elements passed into fn_ptr
+ */
+static size_t cap_map_range(cap_map *map, void *low_key, void *high_key,
+			    void (*fn_ptr)(void *key, void *value));
+/**
+ * Pass every element of the container into fn_ptr, in ascending order of the
+ * keys. Never blocks.
+ *
+ * @param map cap_map container
+ * @param fn_ptr Function to which we pass the key and the value
+ * @return Number of elements passed into fn_ptr
+ */
+static size_t cap_map_for_each(cap_map *map,
+			       void (*fn_ptr)(void *key, void *value));
+/**
+ * Get the function pointer to the handle which the cap_map container uses to
+ * compare two keys
+ *
+ * @param map cap_map container
+ * @return Function pointer to the handle which compares two keys. The one given
+ * during the initilization of the cap_map
+ */
+static int (*cap_map_compare_fn(cap_map *map))(void *, void *);
+/**
+ * Get the current size of the container i.e number of elements
+ *
+ * @param map cap_map container
+ * @return size of the container.
+ */
+static size_t cap_map_size(cap_map *map);
+/**
+ * Check if the cap_map is empty or not
+ *
+ * @param map cap_map container
+ * @return True if the container is empty, False if not.
+ */
+static bool cap_map_empty(cap_map *map);
+/**
+ * Get the max height of the cap_map
+ *
+ * @param map cap_map container
+ * @return Max height of the container's skip list
+ */
+static int cap_map_height(cap_map *map);
+/**
+ * Free the cap_map container. It doesn't touch the key or value's underlying
+ * memory. Only frees the memory which the container owns. No other thread may
+ * be using the container when it's freed.
+ *
+ * @param map cap_map container
+ */
+static void cap_map_free(cap_map *map);
+/**
+ * Free the cap_map container and also call free() on the keys and values which
+ * are still present on the container. No other thread may be using the
+ * container when it's freed.
+ *
+ * @param map cap_map container
+ */
+static void cap_map_deep_free(cap_map *map);
+
+// Prototypes (Internal helpers)
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static _cap_map_node *_cap_map_node_init(void *key, void *value, int height);
+static int _cap_map_get_rand_level(int max_number);
+static bool _cap_map_search(cap_map *map, void *key, _cap_map_node **preds,
+			    _cap_map_node **succs);
+static _cap_map_node *_cap_map_lower_bound(cap_map *map, void *key);
+static size_t _cap_map_epoch_enter(cap_map *map);
+static void _cap_map_epoch_exit(cap_map *map, size_t slot);
+static void _cap_map_retire(cap_map *map, size_t slot, _cap_map_node *node);
+static void _cap_map_try_advance_epoch(cap_map *map);
+static void _cap_map_free_nodes(_cap_map_node *node);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_map *cap_map_init(size_t key_size,
+			     int (*compare_fn)(void *, void *)) {
+	assert(compare_fn != NULL);
+	cap_map *map = (cap_map *)CAP_ALLOCATOR(cap_map, 1);
+	if (!map) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	map->_head =
+	    _cap_map_node_init(NULL, NULL, CAP_MAP_MAX_SKIPLIST_SIZE);
+	if (!map->_head) {
+		fprintf(stderr, "memory allocation failure\n");
+		free(map);
+		return NULL;
+	}
+	map->_key_size = key_size;
+	map->_height = CAP_MAP_MAX_SKIPLIST_SIZE;
+	map->_compare_fn = compare_fn;
+	atomic_init(&map->_size, 0);
+	atomic_init(&map->_global_epoch, 0);
+	for (size_t i = 0; i < CAP_MAP_RETIRE_LISTS; ++i)
+		atomic_init(&map->_retired[i], NULL);
+	for (size_t i = 0; i < CAP_MAP_MAX_THREADS; ++i)
+		atomic_init(&map->_epoch_slots[i]._epoch, 0);
+	return map;
+}
+
+static int cap_map_insert(cap_map *map, void *key, void *value) {
+	assert(map != NULL && key != NULL && value != NULL);
+	_cap_map_node *preds[CAP_MAP_MAX_SKIPLIST_SIZE];
+	_cap_map_node *succs[CAP_MAP_MAX_SKIPLIST_SIZE];
+	_cap_map_node *new_node = NULL;
+	int height = _cap_map_get_rand_level(map->_height);
+	size_t slot = _cap_map_epoch_enter(map);
+	for (;;) {
+		if (_cap_map_search(map, key, preds, succs)) {
+			atomic_store(&succs[0]->_value, value);
+			// Raced with a remove of the same key, the update
+			// might be lost so insert a fresh node instead
+			if (CAP_MAP_IS_MARKED(
+				atomic_load(&succs[0]->_forward[0])))
+				continue;
+			_cap_map_epoch_exit(map, slot);
+			free(new_node);
+			return 0;
+		}
+		if (!new_node) {
+			new_node = _cap_map_node_init(key, value, height);
+			if (!new_node) {
+				fprintf(stderr, "memory allocation failure\n");
+				_cap_map_epoch_exit(map, slot);
+				return -1;
+			}
+		}
+		for (int i = 0; i < height; ++i)
+			atomic_store_explicit(&new_node->_forward[i],
+					      (uintptr_t)succs[i],
+					      memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)succs[0];
+		if (atomic_compare_exchange_strong(&preds[0]->_forward[0],
+						   &expected,
+						   (uintptr_t)new_node))
+			break;
+	}
+	atomic_fetch_add(&map->_size, 1);
+	for (int level = 1; level < height; ++level) {
+		for (;;) {
+			uintptr_t current =
+			    atomic_load(&new_node->_forward[level]);
+			if (CAP_MAP_IS_MARKED(current)) goto linked;
+			// Only a remover changes the node's own links, so a
+			// failed CAS here means the node is being deleted
+			if ((_cap_map_node *)current != succs[level] &&
+			    !atomic_compare_exchange_strong(
+				&new_node->_forward[level], &current,
+				(uintptr_t)succs[level]))
+				goto linked;
+			uintptr_t expected = (uintptr_t)succs[level];
+			if (atomic_compare_exchange_strong(
+				&preds[level]->_forward[level], &expected,
+				(uintptr_t)new_node))
+				break;
+			_cap_map_search(map, key, preds, succs);
+			if (succs[0] != new_node) goto linked;
+		}
+	}
+linked:
+	// A remover may have unlinked the node before we linked one of the
+	// upper levels, walk over it once more so that the late link is gone
+	if (CAP_MAP_IS_MARKED(atomic_load(&new_node->_forward[0])))
+		_cap_map_search(map, key, preds, succs);
+	if (atomic_exchange(&new_node->_unlink_done, true))
+		_cap_map_retire(map, slot, new_node);
+	_cap_map_epoch_exit(map, slot);
+	return 0;
+}
+
+static void *cap_map_find(cap_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	size_t slot = _cap_map_epoch_enter(map);
+	void *value = NULL;
+	_cap_map_node *node = _cap_map_lower_bound(map, key);
+	if (node && map->_compare_fn(node->_key, key) == 0)
+		value = atomic_load(&node->_value);
+	_cap_map_epoch_exit(map, slot);
+	return value;
+}
+
+static bool cap_map_contains(cap_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	return cap_map_find(map, key) != NULL;
+}
+
+static int cap_map_remove(cap_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	_cap_map_node *preds[CAP_MAP_MAX_SKIPLIST_SIZE];
+	_cap_map_node *succs[CAP_MAP_MAX_SKIPLIST_SIZE];
+	size_t slot = _cap_map_epoch_enter(map);
+	if (!_cap_map_search(map, key, preds, succs)) {
+		_cap_map_epoch_exit(map, slot);
+		return -1;
+	}
+	_cap_map_node *victim = succs[0];
+	for (int level = victim->_height - 1; level >= 1; --level) {
+		uintptr_t successor = atomic_load(&victim->_forward[level]);
+		while (!CAP_MAP_IS_MARKED(successor))
+			atomic_compare_exchange_weak(
+			    &victim->_forward[level], &successor,
+			    successor | CAP_MAP_MARK_BIT);
+	}
+	// Marking the bottom level is the linearization point, only one
+	// thread can win it
+	uintptr_t successor = atomic_load(&victim->_forward[0]);
+	for (;;) {
+		if (CAP_MAP_IS_MARKED(successor)) {
+			_cap_map_epoch_exit(map, slot);
+			return -1;
+		}
+		if (atomic_compare_exchange_weak(&victim->_forward[0],
+						 &successor,
+						 successor | CAP_MAP_MARK_BIT))
+			break;
+	}
+	atomic_fetch_sub(&map->_size, 1);
+	_cap_map_search(map, key, preds, succs);
+	if (atomic_exchange(&victim->_unlink_done, true))
+		_cap_map_retire(map, slot, victim);
+	_cap_map_epoch_exit(map, slot);
+	return 0;
+}
+
+static size_t cap_map_range(cap_map *map, void *low_key, void *high_key,
+			    void (*fn_ptr)(void *key, void *value)) {
+	assert(map != NULL && low_key != NULL && high_key != NULL &&
+	       fn_ptr != NULL);
+	size_t count = 0;
+	size_t slot = _cap_map_epoch_enter(map);
+	_cap_map_node *node = _cap_map_lower_bound(map, low_key);
+	while (node && map->_compare_fn(node->_key, high_key) <= 0) {
+		uintptr_t successor = atomic_load(&node->_forward[0]);
+		if (!CAP_MAP_IS_MARKED(successor)) {
+			fn_ptr(node->_key, atomic_load(&node->_value));
+			++count;
+		}
+		node = CAP_MAP_UNMARK(successor);
+	}
+	_cap_map_epoch_exit(map, slot);
+	return count;
+}
+
+static size_t cap_map_for_each(cap_map *map,
+			       void (*fn_ptr)(void *key, void *value)) {
+	assert(map != NULL && fn_ptr != NULL);
+	size_t count = 0;
+	size_t slot = _cap_map_epoch_enter(map);
+	_cap_map_node *node =
+	    CAP_MAP_UNMARK(atomic_load(&map->_head->_forward[0]));
+	while (node) {
+		uintptr_t successor = atomic_load(&node->_forward[0]);
+		if (!CAP_MAP_IS_MARKED(successor)) {
+			fn_ptr(node->_key, atomic_load(&node->_value));
+			++count;
+		}
+		node = CAP_MAP_UNMARK(successor);
+	}
+	_cap_map_epoch_exit(map, slot);
+	return count;
+}
+
+static int (*cap_map_compare_fn(cap_map *map))(void *, void *) {
+	assert(map != NULL);
+	return map->_compare_fn;
+}
+
+static size_t cap_map_size(cap_map *map) {
+	assert(map != NULL);
+	return atomic_load(&map->_size);
+}
+
+static bool cap_map_empty(cap_map *map) {
+	assert(map != NULL);
+	return atomic_load(&map->_size) == 0;
+}
+
+static int cap_map_height(cap_map *map) {
+	assert(map != NULL);
+	return map->_height;
+}
+
+static void cap_map_free(cap_map *map) {
+	assert(map != NULL);
+	_cap_map_free_nodes(map->_head);
+	for (size_t i = 0; i < CAP_MAP_RETIRE_LISTS; ++i) {
+		_cap_map_node *node = atomic_load(&map->_retired[i]);
+		while (node) {
+			_cap_map_node *free_me = node;
+			node = node->_retired_next;
+			free(free_me);
+		}
+	}
+	free(map);
+}
+
+static void cap_map_deep_free(cap_map *map) {
+	assert(map != NULL);
+	_cap_map_node *node =
+	    CAP_MAP_UNMARK(atomic_load(&map->_head->_forward[0]));
+	while (node) {
+		uintptr_t successor = atomic_load(&node->_forward[0]);
+		if (!CAP_MAP_IS_MARKED(successor)) {
+			free(node->_key);
+			free(atomic_load(&node->_value));
+		}
+		node = CAP_MAP_UNMARK(successor);
+	}
+	cap_map_free(map);
+}
+
+static _cap_map_node *_cap_map_node_init(void *key, void *value, int height) {
+	_cap_map_node *node = (_cap_map_node *)calloc(
+	    1, sizeof(_cap_map_node) + sizeof(_Atomic(uintptr_t)) * height);
+	if (!node) return NULL;
+	node->_key = (CAP_GENERIC_TYPE_PTR)key;
+	node->_height = height;
+	node->_retired_next = NULL;
+	atomic_init(&node->_value, value);
+	atomic_init(&node->_unlink_done, false);
+	for (int i = 0; i < height; ++i) atomic_init(&node->_forward[i], 0);
+	return node;
+}
+
+static int _cap_map_get_rand_level(int max_number) {
+	// rand() isn't thread-safe, every thread keeps it's own xorshift state
+	// which is seeded from the address of the thread-local itself
+	if (!_cap_map_rand_state)
+		_cap_map_rand_state = ((uint64_t)(uintptr_t)&_cap_map_rand_state ^
+				       (uint64_t)time(NULL)) |
+				      1;
+	uint64_t bits = _cap_map_rand_state;
+	bits ^= bits << 13;
+	bits ^= bits >> 7;
+	bits ^= bits << 17;
+	_cap_map_rand_state = bits;
+	int returner = 1;
+	while (returner < max_number && (bits & 1)) {
+		returner += 1;
+		bits >>= 1;
+	}
+	return returner;
+}
+
+static bool _cap_map_search(cap_map *map, void *key, _cap_map_node **preds,
+			    _cap_map_node **succs) {
+retry:;
+	_cap_map_node *pred = map->_head;
+	for (int level = map->_height - 1; level >= 0; --level) {
+		_cap_map_node *current =
+		    CAP_MAP_UNMARK(atomic_load(&pred->_forward[level]));
+		while (current) {
+			uintptr_t successor =
+			    atomic_load(&current->_forward[level]);
+			// Help unlinking the deleted nodes on our way, if pred
+			// was itself deleted meanwhile the CAS fails
+			while (CAP_MAP_IS_MARKED(successor)) {
+				uintptr_t expected = (uintptr_t)current;
+				if (!atomic_compare_exchange_strong(
+					&pred->_forward[level], &expected,
+					successor & ~CAP_MAP_MARK_BIT))
+					goto retry;
+				current = CAP_MAP_UNMARK(successor);
+				if (!current) break;
+				successor =
+				    atomic_load(&current->_forward[level]);
+			}
+			if (!current) break;
+			if (map->_compare_fn(current->_key, key) >= 0) break;
+			pred = current;
+			current = CAP_MAP_UNMARK(successor);
+		}
+		preds[level] = pred;
+		succs[level] = current;
+	}
+	return succs[0] && map->_compare_fn(succs[0]->_key, key) == 0;
+}
+
+static _cap_map_node *_cap_map_lower_bound(cap_map *map, void *key) {
+	_cap_map_node *pred = map->_head;
+	_cap_map_node *current = NULL;
+	for (int level = map->_height - 1; level >= 0; --level) {
+		current = CAP_MAP_UNMARK(atomic_load(&pred->_forward[level]));
+		while (current) {
+			uintptr_t successor =
+			    atomic_load(&current->_forward[level]);
+			// Links of a deleted node never change again, so it's
+			// safe to step over it without unlinking
+			if (CAP_MAP_IS_MARKED(successor)) {
+				current = CAP_MAP_UNMARK(successor);
+				continue;
+			}
+			if (map->_compare_fn(current->_key, key) >= 0) break;
+			pred = current;
+			current = CAP_MAP_UNMARK(successor);
+		}
+	}
+	return current;
+}
+
+static size_t _cap_map_epoch_enter(cap_map *map) {
+	size_t slot = _cap_map_slot_hint % CAP_MAP_MAX_THREADS;
+	for (;;) {
+		uint64_t expected = 0;
+		uint64_t epoch = atomic_load(&map->_global_epoch);
+		if (atomic_compare_exchange_strong(
+			&map->_epoch_slots[slot]._epoch, &expected,
+			(epoch << 1) | 1))
+			break;
+		slot = (slot + 1) % CAP_MAP_MAX_THREADS;
+	}
+	_cap_map_slot_hint = slot;
+	// The global epoch may have moved on between reading it and publishing
+	// it, re-publish until the published one is the current one
+	for (;;) {
+		uint64_t published =
+		    atomic_load(&map->_epoch_slots[slot]._epoch) >> 1;
+		uint64_t epoch = atomic_load(&map->_global_epoch);
+		if (published == epoch) break;
+		atomic_store(&map->_epoch_slots[slot]._epoch, (epoch << 1) | 1);
+	}
+	return slot;
+}
+
+static void _cap_map_epoch_exit(cap_map *map, size_t slot) {
+	atomic_store(&map->_epoch_slots[slot]._epoch, 0);
+}
+
+static void _cap_map_retire(cap_map *map, size_t slot, _cap_map_node *node) {
+	uint64_t epoch = atomic_load(&map->_epoch_slots[slot]._epoch) >> 1;
+	_Atomic(_cap_map_node *) *retired =
+	    &map->_retired[epoch % CAP_MAP_RETIRE_LISTS];
+	_cap_map_node *head = atomic_load(retired);
+	do {
+		node->_retired_next = head;
+	} while (!atomic_compare_exchange_weak(retired, &head, node));
+	_cap_map_try_advance_epoch(map);
+}
+
+static void _cap_map_try_advance_epoch(cap_map *map) {
+	// Must be called from within an operation. While the caller is running
+	// the global epoch can't move more than one step past the caller's
+	uint64_t epoch = atomic_load(&map->_global_epoch);
+	for (size_t i = 0; i < CAP_MAP_MAX_THREADS; ++i) {
+		uint64_t slot_epoch = atomic_load(&map->_epoch_slots[i]._epoch);
+		if ((slot_epoch & 1) && (slot_epoch >> 1) != epoch) return;
+	}
+	if (!atomic_compare_exchange_strong(&map->_global_epoch, &epoch,
+					    epoch + 1))
+		return;
+	// Every running operation is now at epoch or epoch + 1, so the nodes
+	// retired at epoch - 2 can't be reached by anyone anymore
+	_cap_map_node *node = atomic_exchange(
+	    &map->_retired[(epoch + 2) % CAP_MAP_RETIRE_LISTS], NULL);
+	while (node) {
+		_cap_map_node *free_me = node;
+		node = node->_retired_next;
+		free(free_me);
+	}
+}
+
+static void _cap_map_free_nodes(_cap_map_node *node) {
+	while (node) {
+		_cap_map_node *free_me = node;
+		node = CAP_MAP_UNMARK(atomic_load(&node->_forward[0]));
+		free(free_me);
+	}
+}
+
+#endif // !CAP_CONCURRENT_MAP_H
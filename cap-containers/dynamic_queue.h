@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_DYNAMIC_QUEUE_H
 #define CAP_DYNAMIC_QUEUE_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,12 +47,16 @@ typedef struct _cap_list_node {
 typedef struct {
 	_cap_list_node *_head_node;
 	_cap_list_node *_tail_node;
+	// Allocator of the nodes, kept with the list rather than taken from the
+	// queue since swap exchanges the lists of queues
+	cap_allocator _allocator;
 } _cap_list;
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
 
 typedef struct {
 	size_t _current_size;
 	_cap_list *_internal_list;
+	cap_allocator _allocator;
 } cap_dynamic_queue;
 
 /**
@@ -59,6 +65,15 @@ typedef struct {
  * @return A dynamic queue container.
  */
 static cap_dynamic_queue *cap_dynamic_queue_init();
+/**
+ * Initilize a cap_dynamic_queue object which takes the container and it's
+ * nodes from the given allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return A dynamic queue container.
+ */
+static cap_dynamic_queue *
+cap_dynamic_queue_init_with_allocator(const cap_allocator *allocator);
 
 /**
  * Query size of the dynamic queue
@@ -123,7 +138,7 @@ static void cap_dynamic_queue_deep_free(cap_dynamic_queue *d_queue);
 
 // Prototypes (Internal helpers)
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
-static _cap_list *_cap_list_init();
+static _cap_list *_cap_list_init(const cap_allocator *);
 static bool _cap_list_push_front(_cap_list *, void *);
 static void *_cap_list_pop_back(_cap_list *);
 static void *_cap_list_front(const _cap_list *);
@@ -133,16 +148,24 @@ static void _cap_list_free(_cap_list *);
 #endif
 
 static cap_dynamic_queue *cap_dynamic_queue_init() {
+	return cap_dynamic_queue_init_with_allocator(NULL);
+}
+
+static cap_dynamic_queue *
+cap_dynamic_queue_init_with_allocator(const cap_allocator *allocator) {
 	cap_dynamic_queue *dynamic_queue =
-	    (cap_dynamic_queue *)CAP_ALLOCATOR(cap_dynamic_queue, 1);
+	    (cap_dynamic_queue *)_cap_allocator_calloc(
+		allocator, 1, sizeof(cap_dynamic_queue));
 	if (!dynamic_queue) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
-	dynamic_queue->_internal_list = _cap_list_init();
+	if (allocator) dynamic_queue->_allocator = *allocator;
+	dynamic_queue->_internal_list = _cap_list_init(allocator);
 	if (!dynamic_queue->_internal_list) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(dynamic_queue);
+		_cap_allocator_free(allocator, dynamic_queue,
+				    sizeof(cap_dynamic_queue));
 		return NULL;
 	}
 	dynamic_queue->_current_size = 0;
@@ -152,13 +175,15 @@ static cap_dynamic_queue *cap_dynamic_queue_init() {
 static void cap_dynamic_queue_free(cap_dynamic_queue *dynamic_queue) {
 	assert(dynamic_queue != NULL);
 	_cap_list_free(dynamic_queue->_internal_list);
-	free(dynamic_queue);
+	_cap_allocator_free(&dynamic_queue->_allocator, dynamic_queue,
+			    sizeof(cap_dynamic_queue));
 }
 
 static void cap_dynamic_queue_deep_free(cap_dynamic_queue *dynamic_queue) {
 	assert(dynamic_queue != NULL);
 	_cap_list_deep_free(dynamic_queue->_internal_list);
-	free(dynamic_queue);
+	_cap_allocator_free(&dynamic_queue->_allocator, dynamic_queue,
+			    sizeof(cap_dynamic_queue));
 }
 
 static size_t cap_dynamic_queue_size(const cap_dynamic_queue *dynamic_queue) {
@@ -205,19 +230,23 @@ static void cap_dynamic_queue_swap(cap_dynamic_queue *dynamic_queue_one,
 	dynamic_queue_two->_internal_list = one_tmp_internal_list;
 }
 
-static _cap_list *_cap_list_init() {
+static _cap_list *_cap_list_init(const cap_allocator *allocator) {
 	_cap_list_node *head_and_tail_nodes =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 2);
+	    (_cap_list_node *)_cap_allocator_alloc(allocator,
+						   sizeof(_cap_list_node) * 2);
 	if (!head_and_tail_nodes) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
-	_cap_list *d_list = (_cap_list *)CAP_ALLOCATOR(_cap_list, 1);
+	_cap_list *d_list =
+	    (_cap_list *)_cap_allocator_calloc(allocator, 1, sizeof(_cap_list));
 	if (!d_list) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(head_and_tail_nodes);
+		_cap_allocator_free(allocator, head_and_tail_nodes,
+				    sizeof(_cap_list_node) * 2);
 		return NULL;
 	}
+	if (allocator) d_list->_allocator = *allocator;
 	d_list->_head_node = head_and_tail_nodes;
 	d_list->_tail_node = (head_and_tail_nodes + 1);
 	d_list->_head_node->data = NULL;
@@ -231,8 +260,8 @@ static _cap_list *_cap_list_init() {
 
 static bool _cap_list_push_front(_cap_list *d_list, void *data) {
 	assert((d_list != NULL) && (data != NULL));
-	_cap_list_node *new_node =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 1);
+	_cap_list_node *new_node = (_cap_list_node *)_cap_allocator_alloc(
+	    &d_list->_allocator, sizeof(_cap_list_node));
 	if (!new_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -251,7 +280,10 @@ static void *_cap_list_pop_back(_cap_list *d_list) {
 	_cap_list_node *pop_node = d_list->_tail_node->previous;
 	d_list->_tail_node->previous = pop_node->previous;
 	pop_node->previous->next = d_list->_tail_node;
-	return pop_node->data;
+	void *data = pop_node->data;
+	_cap_allocator_free(&d_list->_allocator, pop_node,
+			    sizeof(_cap_list_node));
+	return data;
 }
 
 static void *_cap_list_front(const _cap_list *d_list) {
@@ -266,30 +298,27 @@ static void *_cap_list_back(const _cap_list *d_list) {
 
 static void _cap_list_free(_cap_list *d_list) {
 	assert(d_list != NULL);
+	cap_allocator allocator = d_list->_allocator;
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
-		current_node->data = NULL;
-		if (current_node != NULL) free(current_node);
+	while (current_node != d_list->_tail_node) {
+		_cap_list_node *next_node = current_node->next;
+		_cap_allocator_free(&allocator, current_node,
+				    sizeof(_cap_list_node));
 		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+	}
+	_cap_allocator_free(&allocator, d_list->_head_node,
+			    sizeof(_cap_list_node) * 2);
+	_cap_allocator_free(&allocator, d_list, sizeof(_cap_list));
 }
 
 static void _cap_list_deep_free(_cap_list *d_list) {
 	assert(d_list != NULL);
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
+	while (current_node != d_list->_tail_node) {
 		if (current_node->data != NULL) free(current_node->data);
-		if (current_node != NULL) free(current_node);
-		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+		current_node = current_node->next;
+	}
+	_cap_list_free(d_list);
 }
 
 #endif // !CAP_DYNAMIC_QUEUE_H
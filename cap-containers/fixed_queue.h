@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_FIXED_QUEUE_H
 #define CAP_FIXED_QUEUE_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,12 +45,16 @@ typedef struct _cap_list_node {
 typedef struct {
 	_cap_list_node *_head_node;
 	_cap_list_node *_tail_node;
+	// Allocator of the nodes, kept with the list rather than taken from the
+	// queue since swap exchanges the lists of queues
+	cap_allocator _allocator;
 } _cap_list;
 
 typedef struct {
 	size_t _capacity;
 	size_t _current_size;
 	_cap_list *_internal_list;
+	cap_allocator _allocator;
 } cap_fixed_queue;
 #endif
 
@@ -61,6 +67,17 @@ typedef struct {
  * @return Dynamically allocated cap_fixed_queue container object
  */
 static cap_fixed_queue *cap_fixed_queue_init(size_t init_size);
+/**
+ * Initilize a cap_fixed_queue object which takes the container and it's nodes
+ * from the given allocator
+ *
+ * @param init_size Size of the fixed queue
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Dynamically allocated cap_fixed_queue container object
+ */
+static cap_fixed_queue *
+cap_fixed_queue_init_with_allocator(size_t init_size,
+				    const cap_allocator *allocator);
 
 // Lookup & Update:
 /**
@@ -144,7 +161,7 @@ static void cap_fixed_queue_deep_free(cap_fixed_queue *queue);
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 // Prototypes (Internal helpers)
-static _cap_list *_cap_list_init();
+static _cap_list *_cap_list_init(const cap_allocator *);
 static bool _cap_list_push_front(_cap_list *, void *);
 static void *_cap_list_pop_back(_cap_list *);
 static void *_cap_list_front(const _cap_list *);
@@ -154,17 +171,25 @@ static void _cap_list_free(_cap_list *);
 #endif
 
 static cap_fixed_queue *cap_fixed_queue_init(size_t initial_size) {
+	return cap_fixed_queue_init_with_allocator(initial_size, NULL);
+}
+
+static cap_fixed_queue *
+cap_fixed_queue_init_with_allocator(size_t initial_size,
+				    const cap_allocator *allocator) {
 	assert(initial_size > 0);
-	cap_fixed_queue *fixed_queue =
-	    (cap_fixed_queue *)CAP_ALLOCATOR(cap_fixed_queue, 1);
+	cap_fixed_queue *fixed_queue = (cap_fixed_queue *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_fixed_queue));
 	if (!fixed_queue) {
 		fprintf(stderr, "memory allocation failed\n");
 		return NULL;
 	}
-	fixed_queue->_internal_list = _cap_list_init();
+	if (allocator) fixed_queue->_allocator = *allocator;
+	fixed_queue->_internal_list = _cap_list_init(allocator);
 	if (!fixed_queue->_internal_list) {
 		fprintf(stderr, "memory allocation failed\n");
-		free(fixed_queue);
+		_cap_allocator_free(allocator, fixed_queue,
+				    sizeof(cap_fixed_queue));
 		return NULL;
 	}
 	fixed_queue->_current_size = 0;
@@ -175,13 +200,15 @@ static cap_fixed_queue *cap_fixed_queue_init(size_t initial_size) {
 static void cap_fixed_queue_free(cap_fixed_queue *fixed_queue) {
 	assert(fixed_queue != NULL);
 	_cap_list_free(fixed_queue->_internal_list);
-	free(fixed_queue);
+	_cap_allocator_free(&fixed_queue->_allocator, fixed_queue,
+			    sizeof(cap_fixed_queue));
 }
 
 static void cap_fixed_queue_deep_free(cap_fixed_queue *fixed_queue) {
 	assert(fixed_queue != NULL);
 	_cap_list_deep_free(fixed_queue->_internal_list);
-	free(fixed_queue);
+	_cap_allocator_free(&fixed_queue->_allocator, fixed_queue,
+			    sizeof(cap_fixed_queue));
 }
 
 static size_t cap_fixed_queue_capacity(const cap_fixed_queue *fixed_queue) {
@@ -244,10 +271,19 @@ static void cap_fixed_queue_swap(cap_fixed_queue *fixed_queue_one,
 	fixed_queue_two->_internal_list = one_tmp_internal_list;
 }
 
-static _cap_list *_cap_list_init() {
+static _cap_list *_cap_list_init(const cap_allocator *allocator) {
 	_cap_list_node *head_and_tail_nodes =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 2);
-	_cap_list *d_list = (_cap_list *)CAP_ALLOCATOR(_cap_list, 1);
+	    (_cap_list_node *)_cap_allocator_alloc(allocator,
+						   sizeof(_cap_list_node) * 2);
+	if (!head_and_tail_nodes) return NULL;
+	_cap_list *d_list =
+	    (_cap_list *)_cap_allocator_calloc(allocator, 1, sizeof(_cap_list));
+	if (!d_list) {
+		_cap_allocator_free(allocator, head_and_tail_nodes,
+				    sizeof(_cap_list_node) * 2);
+		return NULL;
+	}
+	if (allocator) d_list->_allocator = *allocator;
 	d_list->_head_node = head_and_tail_nodes;
 	d_list->_tail_node = (head_and_tail_nodes + 1);
 	d_list->_head_node->data = NULL;
@@ -261,8 +297,8 @@ static _cap_list *_cap_list_init() {
 
 static bool _cap_list_push_front(_cap_list *d_list, void *data) {
 	assert((d_list != NULL) && (data != NULL));
-	_cap_list_node *new_node =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 1);
+	_cap_list_node *new_node = (_cap_list_node *)_cap_allocator_alloc(
+	    &d_list->_allocator, sizeof(_cap_list_node));
 	if (new_node == NULL) return false;
 	new_node->data = (CAP_GENERIC_TYPE_PTR)data;
 	new_node->previous = d_list->_head_node;
@@ -278,7 +314,10 @@ static void *_cap_list_pop_back(_cap_list *d_list) {
 	_cap_list_node *pop_node = d_list->_tail_node->previous;
 	d_list->_tail_node->previous = pop_node->previous;
 	pop_node->previous->next = d_list->_tail_node;
-	return pop_node->data;
+	void *data = pop_node->data;
+	_cap_allocator_free(&d_list->_allocator, pop_node,
+			    sizeof(_cap_list_node));
+	return data;
 }
 
 static void *_cap_list_front(const _cap_list *d_list) {
@@ -293,30 +332,27 @@ static void *_cap_list_back(const _cap_list *d_list) {
 
 static void _cap_list_free(_cap_list *d_list) {
 	assert(d_list != NULL);
+	cap_allocator allocator = d_list->_allocator;
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
-		current_node->data = NULL;
-		if (current_node != NULL) free(current_node);
+	while (current_node != d_list->_tail_node) {
+		_cap_list_node *next_node = current_node->next;
+		_cap_allocator_free(&allocator, current_node,
+				    sizeof(_cap_list_node));
 		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+	}
+	_cap_allocator_free(&allocator, d_list->_head_node,
+			    sizeof(_cap_list_node) * 2);
+	_cap_allocator_free(&allocator, d_list, sizeof(_cap_list));
 }
 
 static void _cap_list_deep_free(_cap_list *d_list) {
 	assert(d_list != NULL);
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
+	while (current_node != d_list->_tail_node) {
 		if (current_node->data != NULL) free(current_node->data);
-		if (current_node != NULL) free(current_node);
-		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+		current_node = current_node->next;
+	}
+	_cap_list_free(d_list);
 }
 
 #endif // !CAP_FIXED_QUEUE_H
@@ -0,0 +1,768 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_FLAT_MAP_H
+#define CAP_FLAT_MAP_H
+#include "vector.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_FLAT_MAP_INITIAL_SIZE 8
+
+typedef struct {
+	// Keys and values are kept sorted in two parallel arrays. An int64_t
+	// keyed map stores the keys by value in _int_keys instead of _keys
+	cap_vector *_keys;
+	cap_vector *_values;
+	int64_t *_int_keys;
+	size_t _int_keys_capacity;
+	size_t _key_size;
+	bool _sorted;
+	int (*_compare_fn)(void *key_one, void *key_two);
+	cap_allocator _allocator;
+} cap_flat_map;
+
+typedef struct {
+	CAP_GENERIC_TYPE_PTR key;
+	void *value;
+	size_t _current_index;
+	cap_flat_map *_original_reference;
+} cap_flat_map_iterator;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_flat_map is an ordered key-value container which keeps it's elements
+ * sorted within contiguous cap_vector storage and looks them up with a binary
+ * search. It's meant for small or read-mostly maps, where it beats the node
+ * based containers by a wide margin. Inserting or removing a single element is
+ * O(n), so bulk construction should use cap_flat_map_push() followed by one
+ * cap_flat_map_sort().
+ *
+ * Maps created with cap_flat_map_init_int64() copy the int64_t keys into one
+ * contiguous array and search it with a branchless binary search.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_flat_map container object
+ *
+ * @param key_size Size of the key
+ * @param compare_fn Function to compare two keys, it returns negative, zero or
+ * positive value if the first key is less, equal or greater than the second one
+ * @return Newly allocated cap_flat_map container
+ */
+static cap_flat_map *cap_flat_map_init(size_t key_size,
+				       int (*compare_fn)(void *, void *));
+/**
+ * Initilize a cap_flat_map container object whose keys are int64_t. The keys
+ * are still passed as pointers, but they are copied into the container.
+ *
+ * @return Newly allocated cap_flat_map container
+ */
+static cap_flat_map *cap_flat_map_init_int64(void);
+/**
+ * Initilize a cap_flat_map container object which takes the container and it's
+ * arrays from the given allocator
+ *
+ * @param key_size Size of the key
+ * @param compare_fn Function to compare two keys
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated cap_flat_map container
+ */
+static cap_flat_map *
+cap_flat_map_init_with_allocator(size_t key_size,
+				 int (*compare_fn)(void *, void *),
+				 const cap_allocator *allocator);
+/**
+ * Initilize a cap_flat_map container object whose keys are int64_t, taking the
+ * container and it's arrays from the given allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated cap_flat_map container
+ */
+static cap_flat_map *
+cap_flat_map_init_int64_with_allocator(const cap_allocator *allocator);
+/**
+ * Reserve space for the given number of elements, so that bulk construction
+ * doesn't reallocate
+ *
+ * @param map cap_flat_map container
+ * @param capacity Number of elements to reserve space for
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool cap_flat_map_reserve(cap_flat_map *map, size_t capacity);
+/**
+ * Append a key-value pair without keeping the container sorted, amortized O(1).
+ * The container is sorted by cap_flat_map_sort() or, lazily, by the next
+ * operation which needs the order. If the same key is pushed more than once,
+ * the last pushed value is kept.
+ *
+ * @param map cap_flat_map container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool cap_flat_map_push(cap_flat_map *map, void *key, void *value);
+/**
+ * Sort the elements appended with cap_flat_map_push() and drop the duplicate
+ * keys. O(n log n) operation
+ *
+ * @param map cap_flat_map container
+ * @return True if the operation is success, False if there was a memory error,
+ * in which case the container is left unchanged
+ */
+static bool cap_flat_map_sort(cap_flat_map *map);
+/**
+ * Insert a key-value pair at it's sorted position. If the key already exists,
+ * it's value is replaced with the given value. O(n) operation
+ *
+ * @param map cap_flat_map container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return Returns 0 if the operation is success, or else returns -1 is there
+ * was a memory allocation error
+ */
+static int cap_flat_map_insert(cap_flat_map *map, void *key, void *value);
+/**
+ * Find an element on the cap_flat_map container. O(log n) operation
+ *
+ * @param map cap_flat_map container
+ * @param key Key for which we need to find the value.
+ * @return Returns the pointer to the element, if the element with key is not
+ * found, it returns NULL
+ */
+static void *cap_flat_map_find(cap_flat_map *map, void *key);
+/**
+ * Check if an item with the given key exists within the cap_flat_map
+ * container.
+ *
+ * @param map cap_flat_map container
+ * @param key Key for which we need to see if the elements exists.
+ * @return True if the item does exists, or else returns false if not
+ */
+static bool cap_flat_map_contains(cap_flat_map *map, void *key);
+/**
+ * Get the index of the first element whose key is not less than the given key
+ *
+ * @param map cap_flat_map container
+ * @param key Key to search for
+ * @return Index of the element, it's the size of the container if every key is
+ * less than the given key
+ */
+static size_t cap_flat_map_lower_bound(cap_flat_map *map, void *key);
+/**
+ * Remove an element which is mapped to the given key from the container. O(n)
+ * operation
+ *
+ * @param map cap_flat_map container
+ * @param key Key of the element to be removed
+ * @return 0 if the key is found and the element is removed successfully.
+ * Returns -1 if the element is not found.
+ */
+static int cap_flat_map_remove(cap_flat_map *map, void *key);
+/**
+ * Get the key of the element at the given index, in the sorted order
+ *
+ * @param map cap_flat_map container
+ * @param index Zero based index of the element
+ * @return Pointer to the key, NULL if the index is out of range
+ */
+static void *cap_flat_map_key_at(cap_flat_map *map, size_t index);
+/**
+ * Get the value of the element at the given index, in the sorted order
+ *
+ * @param map cap_flat_map container
+ * @param index Zero based index of the element
+ * @return Value at the index, NULL if the index is out of range
+ */
+static void *cap_flat_map_value_at(cap_flat_map *map, size_t index);
+/**
+ * Merge two cap_flat_map containers into a new one in linear time. When both
+ * contain the same key, the value from map_two is kept. Neither of the given
+ * containers is modified, except for being sorted if they weren't.
+ *
+ * @param map_one First cap_flat_map container
+ * @param map_two Second cap_flat_map container, it must have the same kind of
+ * keys as map_one
+ * @return Newly allocated cap_flat_map container, NULL if there was a memory
+ * error
+ */
+static cap_flat_map *cap_flat_map_merge(cap_flat_map *map_one,
+					cap_flat_map *map_two);
+/**
+ * Get the current size of the container i.e number of elements
+ *
+ * @param map cap_flat_map container
+ * @return size of the container.
+ */
+static size_t cap_flat_map_size(cap_flat_map *map);
+/**
+ * Check if the cap_flat_map is empty or not
+ *
+ * @param map cap_flat_map container
+ * @return True if the container is empty, False if not.
+ */
+static bool cap_flat_map_empty(cap_flat_map *map);
+/**
+ * Free the cap_flat_map container. It doesn't touch the key or value's
+ * underlying memory. Only frees the memory which the container owns.
+ *
+ * @param map cap_flat_map container
+ */
+static void cap_flat_map_free(cap_flat_map *map);
+/**
+ * Free the cap_flat_map container and also call free() on the keys and values
+ * (assuming that they are dynamically allocated). Keys of an int64_t keyed map
+ * are owned by the container and aren't passed to free().
+ *
+ * @param map cap_flat_map container
+ */
+static void cap_flat_map_deep_free(cap_flat_map *map);
+/**
+ * Initialize an Iterator object for iterating over a cap_flat_map container in
+ * the sorted order
+ *
+ * @param map cap_flat_map container for which we need to create a iterator
+ * @return Allocated cap_flat_map_iterator object which points to the first
+ * element, key and value are NULL if the container is empty
+ */
+static cap_flat_map_iterator *cap_flat_map_iterator_init(cap_flat_map *map);
+/**
+ * Check if an element which is pointed by the iterator matches the given
+ * predicate function
+ *
+ * @param iterator cap_flat_map_iterator iterator object
+ * @param predicate_fn Predicate function, we pass the key into it
+ * @return Returns True, if predicate_fn says so, if not returns False.
+ */
+static bool
+cap_flat_map_iterator_equals_predicate(cap_flat_map_iterator *iterator,
+				       bool (*predicate_fn)(void *));
+/**
+ * Increment the Iterator to the next element on the container, key and value
+ * are set to NULL once the iterator moves past the last element
+ *
+ * @param iterator cap_flat_map_iterator iterator object
+ */
+static void cap_flat_map_iterator_increment(cap_flat_map_iterator *iterator);
+/**
+ * Peek into the next element's key without incrementing the iterator
+ *
+ * @param iterator cap_flat_map_iterator iterator object
+ * @return Next element's key, if the iterator is at the last element, it
+ * returns NULL
+ */
+static void *cap_flat_map_iterator_next(cap_flat_map_iterator *iterator);
+/**
+ * Get an iterator to the start of a cap_flat_map container
+ *
+ * @param map cap_flat_map container
+ * @return Allocated cap_flat_map_iterator iterator which points to the first
+ * element of the container
+ */
+static cap_flat_map_iterator *cap_flat_map_begin(cap_flat_map *map);
+/**
+ * Free the cap_flat_map_iterator iterator object. This operation doesn't free
+ * the underlying element which this iterator points to but only the
+ * cap_flat_map_iterator object
+ *
+ * @param iterator cap_flat_map_iterator iterator object to be freed
+ */
+static void cap_flat_map_iterator_free(cap_flat_map_iterator *iterator);
+
+// Prototypes (Internal helpers)
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static cap_flat_map *_cap_flat_map_alloc(size_t key_size,
+					 int (*compare_fn)(void *, void *),
+					 bool int_keys, size_t init_size,
+					 const cap_allocator *allocator);
+static int _cap_flat_map_compare_at(cap_flat_map *map, size_t index_one,
+				    size_t index_two);
+static size_t _cap_flat_map_search(cap_flat_map *map, void *key);
+static bool _cap_flat_map_key_equals(cap_flat_map *map, size_t index,
+				     void *key);
+static void _cap_flat_map_merge_sort(cap_flat_map *map, size_t *order,
+				     size_t *buffer, size_t size);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_flat_map *cap_flat_map_init(size_t key_size,
+				       int (*compare_fn)(void *, void *)) {
+	return cap_flat_map_init_with_allocator(key_size, compare_fn, NULL);
+}
+
+static cap_flat_map *cap_flat_map_init_int64(void) {
+	return cap_flat_map_init_int64_with_allocator(NULL);
+}
+
+static cap_flat_map *
+cap_flat_map_init_with_allocator(size_t key_size,
+				 int (*compare_fn)(void *, void *),
+				 const cap_allocator *allocator) {
+	assert(compare_fn != NULL);
+	return _cap_flat_map_alloc(key_size, compare_fn, false,
+				   CAP_FLAT_MAP_INITIAL_SIZE, allocator);
+}
+
+static cap_flat_map *
+cap_flat_map_init_int64_with_allocator(const cap_allocator *allocator) {
+	return _cap_flat_map_alloc(sizeof(int64_t), NULL, true,
+				   CAP_FLAT_MAP_INITIAL_SIZE, allocator);
+}
+
+static bool cap_flat_map_reserve(cap_flat_map *map, size_t capacity) {
+	assert(map != NULL);
+	if (capacity <= map->_values->_capacity) return true;
+	if (map->_int_keys) {
+		int64_t *tmp_ptr = (int64_t *)_cap_allocator_realloc(
+		    &map->_allocator, map->_int_keys,
+		    sizeof(int64_t) * map->_int_keys_capacity,
+		    sizeof(int64_t) * capacity);
+		if (!tmp_ptr) return false;
+		map->_int_keys = tmp_ptr;
+		map->_int_keys_capacity = capacity;
+	} else if (!_cap_vector_reserve(map->_keys, capacity)) {
+		return false;
+	}
+	return _cap_vector_reserve(map->_values, capacity);
+}
+
+static bool cap_flat_map_push(cap_flat_map *map, void *key, void *value) {
+	assert(map != NULL && key != NULL && value != NULL);
+	size_t size = map->_values->_size;
+	if (size == map->_values->_capacity &&
+	    !cap_flat_map_reserve(map, size * 2)) {
+		fprintf(stderr, "memory allocation failure\n");
+		return false;
+	}
+	if (map->_int_keys)
+		memcpy(&map->_int_keys[size], key, sizeof(int64_t));
+	else
+		cap_vector_push_back(map->_keys, key);
+	cap_vector_push_back(map->_values, value);
+	// Appending a larger key than the last one keeps the order
+	if (map->_sorted && size &&
+	    _cap_flat_map_compare_at(map, size - 1, size) >= 0)
+		map->_sorted = false;
+	return true;
+}
+
+static bool cap_flat_map_sort(cap_flat_map *map) {
+	assert(map != NULL);
+	if (map->_sorted) return true;
+	size_t size = map->_values->_size;
+	size_t capacity = map->_values->_capacity;
+	const cap_allocator *allocator = &map->_allocator;
+	size_t *order = (size_t *)_cap_allocator_alloc(
+	    allocator, sizeof(size_t) * size * 2);
+	CAP_GENERIC_TYPE_PTR *values =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_alloc(
+		allocator, sizeof(CAP_GENERIC_TYPE_PTR) * capacity);
+	CAP_GENERIC_TYPE_PTR *keys = NULL;
+	int64_t *int_keys = NULL;
+	if (map->_int_keys)
+		int_keys = (int64_t *)_cap_allocator_alloc(
+		    allocator, sizeof(int64_t) * capacity);
+	else
+		keys = (CAP_GENERIC_TYPE_PTR *)_cap_allocator_alloc(
+		    allocator, sizeof(CAP_GENERIC_TYPE_PTR) * capacity);
+	if (!order || !values || (!keys && !int_keys)) {
+		fprintf(stderr, "memory allocation failure\n");
+		_cap_allocator_free(allocator, order,
+				    sizeof(size_t) * size * 2);
+		_cap_allocator_free(allocator, values,
+				    sizeof(CAP_GENERIC_TYPE_PTR) * capacity);
+		_cap_allocator_free(allocator, keys,
+				    sizeof(CAP_GENERIC_TYPE_PTR) * capacity);
+		_cap_allocator_free(allocator, int_keys,
+				    sizeof(int64_t) * capacity);
+		return false;
+	}
+	for (size_t i = 0; i < size; ++i) order[i] = i;
+	// The sort is stable, so of the equal keys the last pushed one is last
+	_cap_flat_map_merge_sort(map, order, order + size, size);
+	size_t new_size = 0;
+	for (size_t i = 0; i < size; ++i) {
+		if (i + 1 < size &&
+		    _cap_flat_map_compare_at(map, order[i], order[i + 1]) == 0)
+			continue;
+		values[new_size] = map->_values->_internal_buffer[order[i]];
+		if (int_keys)
+			int_keys[new_size] = map->_int_keys[order[i]];
+		else
+			keys[new_size] = map->_keys->_internal_buffer[order[i]];
+		new_size++;
+	}
+	_cap_allocator_free(allocator, order, sizeof(size_t) * size * 2);
+	_cap_allocator_free(allocator, map->_values->_internal_buffer,
+			    sizeof(CAP_GENERIC_TYPE_PTR) * capacity);
+	map->_values->_internal_buffer = values;
+	map->_values->_size = new_size;
+	if (int_keys) {
+		_cap_allocator_free(allocator, map->_int_keys,
+				    sizeof(int64_t) * map->_int_keys_capacity);
+		map->_int_keys = int_keys;
+		map->_int_keys_capacity = capacity;
+	} else {
+		_cap_allocator_free(allocator, map->_keys->_internal_buffer,
+				    sizeof(CAP_GENERIC_TYPE_PTR) *
+					map->_keys->_capacity);
+		map->_keys->_capacity = capacity;
+		map->_keys->_internal_buffer = keys;
+		map->_keys->_size = new_size;
+	}
+	map->_sorted = true;
+	return true;
+}
+
+static int cap_flat_map_insert(cap_flat_map *map, void *key, void *value) {
+	assert(map != NULL && key != NULL && value != NULL);
+	if (!cap_flat_map_sort(map)) return -1;
+	size_t size = map->_values->_size;
+	size_t index = _cap_flat_map_search(map, key);
+	if (index < size && _cap_flat_map_key_equals(map, index, key)) {
+		map->_values->_internal_buffer[index] =
+		    (CAP_GENERIC_TYPE_PTR)value;
+		return 0;
+	}
+	if (size == map->_values->_capacity &&
+	    !cap_flat_map_reserve(map, size * 2)) {
+		fprintf(stderr, "memory allocation failure\n");
+		return -1;
+	}
+	CAP_GENERIC_TYPE_PTR *values = map->_values->_internal_buffer;
+	memmove(&values[index + 1], &values[index],
+		sizeof(CAP_GENERIC_TYPE_PTR) * (size - index));
+	values[index] = (CAP_GENERIC_TYPE_PTR)value;
+	map->_values->_size++;
+	if (map->_int_keys) {
+		memmove(&map->_int_keys[index + 1], &map->_int_keys[index],
+			sizeof(int64_t) * (size - index));
+		memcpy(&map->_int_keys[index], key, sizeof(int64_t));
+	} else {
+		CAP_GENERIC_TYPE_PTR *keys = map->_keys->_internal_buffer;
+		memmove(&keys[index + 1], &keys[index],
+			sizeof(CAP_GENERIC_TYPE_PTR) * (size - index));
+		keys[index] = (CAP_GENERIC_TYPE_PTR)key;
+		map->_keys->_size++;
+	}
+	return 0;
+}
+
+static void *cap_flat_map_find(cap_flat_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	if (!cap_flat_map_sort(map)) return NULL;
+	size_t index = _cap_flat_map_search(map, key);
+	if (index < map->_values->_size &&
+	    _cap_flat_map_key_equals(map, index, key))
+		return map->_values->_internal_buffer[index];
+	return NULL;
+}
+
+static bool cap_flat_map_contains(cap_flat_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	return cap_flat_map_find(map, key) != NULL;
+}
+
+static size_t cap_flat_map_lower_bound(cap_flat_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	cap_flat_map_sort(map);
+	return _cap_flat_map_search(map, key);
+}
+
+static int cap_flat_map_remove(cap_flat_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	if (!cap_flat_map_sort(map)) return -1;
+	size_t size = map->_values->_size;
+	size_t index = _cap_flat_map_search(map, key);
+	if (index >= size || !_cap_flat_map_key_equals(map, index, key))
+		return -1;
+	CAP_GENERIC_TYPE_PTR *values = map->_values->_internal_buffer;
+	memmove(&values[index], &values[index + 1],
+		sizeof(CAP_GENERIC_TYPE_PTR) * (size - index - 1));
+	map->_values->_size--;
+	if (map->_int_keys) {
+		memmove(&map->_int_keys[index], &map->_int_keys[index + 1],
+			sizeof(int64_t) * (size - index - 1));
+	} else {
+		CAP_GENERIC_TYPE_PTR *keys = map->_keys->_internal_buffer;
+		memmove(&keys[index], &keys[index + 1],
+			sizeof(CAP_GENERIC_TYPE_PTR) * (size - index - 1));
+		map->_keys->_size--;
+	}
+	return 0;
+}
+
+static void *cap_flat_map_key_at(cap_flat_map *map, size_t index) {
+	assert(map != NULL);
+	cap_flat_map_sort(map);
+	if (index >= map->_values->_size) return NULL;
+	if (map->_int_keys) return &map->_int_keys[index];
+	return map->_keys->_internal_buffer[index];
+}
+
+static void *cap_flat_map_value_at(cap_flat_map *map, size_t index) {
+	assert(map != NULL);
+	cap_flat_map_sort(map);
+	if (index >= map->_values->_size) return NULL;
+	return map->_values->_internal_buffer[index];
+}
+
+static cap_flat_map *cap_flat_map_merge(cap_flat_map *map_one,
+					cap_flat_map *map_two) {
+	assert(map_one != NULL && map_two != NULL);
+	assert((map_one->_int_keys == NULL) == (map_two->_int_keys == NULL));
+	if (!cap_flat_map_sort(map_one) || !cap_flat_map_sort(map_two))
+		return NULL;
+	size_t size_one = map_one->_values->_size;
+	size_t size_two = map_two->_values->_size;
+	bool int_keys = map_one->_int_keys != NULL;
+	cap_flat_map *merged =
+	    _cap_flat_map_alloc(map_one->_key_size, map_one->_compare_fn,
+				int_keys, size_one + size_two + 1,
+				&map_one->_allocator);
+	if (!merged) return NULL;
+	size_t i = 0, j = 0, k = 0;
+	while (i < size_one || j < size_two) {
+		int cmp;
+		if (i == size_one)
+			cmp = 1;
+		else if (j == size_two)
+			cmp = -1;
+		else if (merged->_int_keys)
+			cmp = (map_one->_int_keys[i] > map_two->_int_keys[j]) -
+			      (map_one->_int_keys[i] < map_two->_int_keys[j]);
+		else
+			cmp = merged->_compare_fn(
+			    map_one->_keys->_internal_buffer[i],
+			    map_two->_keys->_internal_buffer[j]);
+		// On equal keys take the element of map_two and skip map_one's
+		cap_flat_map *source = cmp < 0 ? map_one : map_two;
+		size_t index = cmp < 0 ? i : j;
+		merged->_values->_internal_buffer[k] =
+		    source->_values->_internal_buffer[index];
+		if (merged->_int_keys)
+			merged->_int_keys[k] = source->_int_keys[index];
+		else
+			merged->_keys->_internal_buffer[k] =
+			    source->_keys->_internal_buffer[index];
+		if (cmp <= 0) i++;
+		if (cmp >= 0) j++;
+		k++;
+	}
+	merged->_values->_size = k;
+	if (!merged->_int_keys) merged->_keys->_size = k;
+	return merged;
+}
+
+static size_t cap_flat_map_size(cap_flat_map *map) {
+	assert(map != NULL);
+	if (!map->_sorted) cap_flat_map_sort(map);
+	return map->_values->_size;
+}
+
+static bool cap_flat_map_empty(cap_flat_map *map) {
+	assert(map != NULL);
+	return map->_values->_size == 0;
+}
+
+static void cap_flat_map_free(cap_flat_map *map) {
+	assert(map != NULL);
+	cap_allocator allocator = map->_allocator;
+	if (map->_keys) cap_vector_free(map->_keys);
+	cap_vector_free(map->_values);
+	_cap_allocator_free(&allocator, map->_int_keys,
+			    sizeof(int64_t) * map->_int_keys_capacity);
+	_cap_allocator_free(&allocator, map, sizeof(cap_flat_map));
+}
+
+static void cap_flat_map_deep_free(cap_flat_map *map) {
+	assert(map != NULL);
+	// Duplicates which weren't sorted out yet share the value pointers
+	cap_flat_map_sort(map);
+	cap_allocator allocator = map->_allocator;
+	if (map->_keys) cap_vector_deep_free(map->_keys);
+	cap_vector_deep_free(map->_values);
+	_cap_allocator_free(&allocator, map->_int_keys,
+			    sizeof(int64_t) * map->_int_keys_capacity);
+	_cap_allocator_free(&allocator, map, sizeof(cap_flat_map));
+}
+
+static cap_flat_map_iterator *cap_flat_map_iterator_init(cap_flat_map *map) {
+	assert(map != NULL);
+	cap_flat_map_iterator *iterator =
+	    (cap_flat_map_iterator *)calloc(1, sizeof(cap_flat_map_iterator));
+	if (!iterator) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	iterator->_original_reference = map;
+	iterator->_current_index = 0;
+	iterator->key = (CAP_GENERIC_TYPE_PTR)cap_flat_map_key_at(map, 0);
+	iterator->value = cap_flat_map_value_at(map, 0);
+	return iterator;
+}
+
+static bool
+cap_flat_map_iterator_equals_predicate(cap_flat_map_iterator *iterator,
+				       bool (*predicate_fn)(void *)) {
+	assert(iterator != NULL && predicate_fn != NULL);
+	return predicate_fn(iterator->key);
+}
+
+static void cap_flat_map_iterator_increment(cap_flat_map_iterator *iterator) {
+	assert(iterator != NULL);
+	cap_flat_map *map = iterator->_original_reference;
+	if (iterator->_current_index < map->_values->_size)
+		iterator->_current_index++;
+	iterator->key = (CAP_GENERIC_TYPE_PTR)cap_flat_map_key_at(
+	    map, iterator->_current_index);
+	iterator->value = cap_flat_map_value_at(map, iterator->_current_index);
+}
+
+static void *cap_flat_map_iterator_next(cap_flat_map_iterator *iterator) {
+	assert(iterator != NULL);
+	return cap_flat_map_key_at(iterator->_original_reference,
+				   iterator->_current_index + 1);
+}
+
+static cap_flat_map_iterator *cap_flat_map_begin(cap_flat_map *map) {
+	assert(map != NULL);
+	return cap_flat_map_iterator_init(map);
+}
+
+static void cap_flat_map_iterator_free(cap_flat_map_iterator *iterator) {
+	assert(iterator != NULL);
+	free(iterator);
+}
+
+static cap_flat_map *_cap_flat_map_alloc(size_t key_size,
+					 int (*compare_fn)(void *, void *),
+					 bool int_keys, size_t init_size,
+					 const cap_allocator *allocator) {
+	cap_flat_map *map = (cap_flat_map *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_flat_map));
+	if (!map) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	if (allocator) map->_allocator = *allocator;
+	map->_values = cap_vector_init_with_allocator(init_size, allocator);
+	if (int_keys) {
+		map->_int_keys = (int64_t *)_cap_allocator_alloc(
+		    allocator, sizeof(int64_t) * init_size);
+		map->_int_keys_capacity = init_size;
+	} else {
+		map->_keys =
+		    cap_vector_init_with_allocator(init_size, allocator);
+	}
+	if (!map->_values || (!map->_keys && !map->_int_keys)) {
+		fprintf(stderr, "memory allocation failure\n");
+		if (map->_values) cap_vector_free(map->_values);
+		if (map->_keys) cap_vector_free(map->_keys);
+		_cap_allocator_free(allocator, map->_int_keys,
+				    sizeof(int64_t) * init_size);
+		_cap_allocator_free(allocator, map, sizeof(cap_flat_map));
+		return NULL;
+	}
+	map->_key_size = key_size;
+	map->_compare_fn = compare_fn;
+	map->_sorted = true;
+	return map;
+}
+
+static int _cap_flat_map_compare_at(cap_flat_map *map, size_t index_one,
+				    size_t index_two) {
+	if (map->_int_keys)
+		return (map->_int_keys[index_one] > map->_int_keys[index_two]) -
+		       (map->_int_keys[index_one] < map->_int_keys[index_two]);
+	return map->_compare_fn(map->_keys->_internal_buffer[index_one],
+				map->_keys->_internal_buffer[index_two]);
+}
+
+static size_t _cap_flat_map_search(cap_flat_map *map, void *key) {
+	size_t size = map->_values->_size;
+	if (!size) return 0;
+	if (map->_int_keys) {
+		// Branchless lower bound, the loop runs exactly log2(size)
+		// times and the ternary compiles down to a conditional move
+		int64_t target;
+		memcpy(&target, key, sizeof(int64_t));
+		const int64_t *base = map->_int_keys;
+		size_t length = size;
+		while (length > 1) {
+			size_t half = length / 2;
+			base = base[half] < target ? base + half : base;
+			length -= half;
+		}
+		return (size_t)(base - map->_int_keys) + (*base < target);
+	}
+	size_t low = 0, high = size;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (map->_compare_fn(map->_keys->_internal_buffer[middle], key) <
+		    0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static bool _cap_flat_map_key_equals(cap_flat_map *map, size_t index,
+				     void *key) {
+	if (map->_int_keys) {
+		int64_t target;
+		memcpy(&target, key, sizeof(int64_t));
+		return map->_int_keys[index] == target;
+	}
+	return map->_compare_fn(map->_keys->_internal_buffer[index], key) == 0;
+}
+
+static void _cap_flat_map_merge_sort(cap_flat_map *map, size_t *order,
+				     size_t *buffer, size_t size) {
+	size_t *source = order, *destination = buffer;
+	for (size_t width = 1; width < size; width *= 2) {
+		for (size_t low = 0; low < size; low += 2 * width) {
+			size_t middle = low + width < size ? low + width : size;
+			size_t high =
+			    low + 2 * width < size ? low + 2 * width : size;
+			size_t i = low, j = middle, k = low;
+			while (i < middle && j < high)
+				destination[k++] =
+				    _cap_flat_map_compare_at(map, source[j],
+							     source[i]) < 0
+					? source[j++]
+					: source[i++];
+			while (i < middle) destination[k++] = source[i++];
+			while (j < high) destination[k++] = source[j++];
+		}
+		size_t *tmp = source;
+		source = destination;
+		destination = tmp;
+	}
+	if (source != order) memcpy(order, source, sizeof(size_t) * size);
+}
+
+#endif // !CAP_FLAT_MAP_H
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_FORWARD_LIST_H
 #define CAP_FORWARD_LIST_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +42,7 @@ typedef struct _cap_flist_node {
 typedef struct {
 	size_t size;
 	_cap_flist_node *head;
+	cap_allocator _allocator;
 } cap_forward_list;
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
 
@@ -51,6 +54,15 @@ typedef struct {
  * @return Allocated cap_forward_list object
  */
 static cap_forward_list *cap_forward_list_init();
+/**
+ * Initilize a cap_forward_list container object which takes the container and
+ * it's nodes from the given allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_forward_list object
+ */
+static cap_forward_list *
+cap_forward_list_init_with_allocator(const cap_allocator *allocator);
 
 // Lookup & Update:
 /**
@@ -138,12 +150,18 @@ static void cap_forward_list_free(cap_forward_list *list);
 static void cap_forward_list_deep_free(cap_forward_list *list);
 
 static cap_forward_list *cap_forward_list_init() {
-	cap_forward_list *f_list =
-	    (cap_forward_list *)CAP_ALLOCATOR(cap_forward_list, 1);
+	return cap_forward_list_init_with_allocator(NULL);
+}
+
+static cap_forward_list *
+cap_forward_list_init_with_allocator(const cap_allocator *allocator) {
+	cap_forward_list *f_list = (cap_forward_list *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_forward_list));
 	if (!f_list) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) f_list->_allocator = *allocator;
 	f_list->head = NULL;
 	f_list->size = 0;
 	return f_list;
@@ -152,9 +170,11 @@ static cap_forward_list *cap_forward_list_init() {
 static bool cap_forward_list_push_front(cap_forward_list *f_list, void *data) {
 	assert(f_list != NULL && data != NULL);
 	_cap_flist_node *current_node = f_list->head;
-	f_list->head = (_cap_flist_node *)CAP_ALLOCATOR(_cap_flist_node, 1);
+	f_list->head = (_cap_flist_node *)_cap_allocator_alloc(
+	    &f_list->_allocator, sizeof(_cap_flist_node));
 	if (!f_list->head) {
 		fprintf(stderr, "memory allocation failure\n");
+		f_list->head = current_node;
 		return false;
 	}
 	f_list->head->data = (CAP_GENERIC_TYPE_PTR)data;
@@ -166,9 +186,12 @@ static bool cap_forward_list_push_front(cap_forward_list *f_list, void *data) {
 static void *cap_forward_list_pop_front(cap_forward_list *f_list) {
 	assert(f_list != NULL);
 	if (!f_list->head) return NULL;
-	void *returner = f_list->head->data;
-	f_list->head = f_list->head->next;
+	_cap_flist_node *pop_node = f_list->head;
+	void *returner = pop_node->data;
+	f_list->head = pop_node->next;
 	f_list->size--;
+	_cap_allocator_free(&f_list->_allocator, pop_node,
+			    sizeof(_cap_flist_node));
 	return returner;
 }
 
@@ -191,12 +214,15 @@ static void cap_forward_list_swap(cap_forward_list *f_list_one,
 
 static void cap_forward_list_free(cap_forward_list *f_list) {
 	assert(f_list != NULL);
+	cap_allocator allocator = f_list->_allocator;
 	_cap_flist_node *current_node = f_list->head;
 	while (current_node != NULL) {
 		_cap_flist_node *next_node = current_node->next;
-		free(current_node);
+		_cap_allocator_free(&allocator, current_node,
+				    sizeof(_cap_flist_node));
 		current_node = next_node;
 	}
+	_cap_allocator_free(&allocator, f_list, sizeof(cap_forward_list));
 }
 
 static size_t cap_forward_list_size(cap_forward_list *f_list) {
@@ -206,13 +232,10 @@ static size_t cap_forward_list_size(cap_forward_list *f_list) {
 
 static void cap_forward_list_deep_free(cap_forward_list *f_list) {
 	assert(f_list != NULL);
-	_cap_flist_node *current_node = f_list->head;
-	while (current_node != NULL) {
-		_cap_flist_node *next_node = current_node->next;
-		free(current_node);
+	for (_cap_flist_node *current_node = f_list->head; current_node != NULL;
+	     current_node = current_node->next)
 		free(current_node->data);
-		current_node = next_node;
-	}
+	cap_forward_list_free(f_list);
 }
 
 static bool cap_forward_list_empty(cap_forward_list *f_list) {
@@ -239,13 +262,17 @@ static bool cap_forward_list_remove_if(cap_forward_list *f_list,
 	if (!f_list->size) return false;
 	bool return_now = false;
 CHECK_AGAIN:
-	if (f_list->head->data != NULL && predicate_fn(f_list->head->data)) {
-		f_list->head = f_list->head->next;
+	if (f_list->head != NULL && f_list->head->data != NULL &&
+	    predicate_fn(f_list->head->data)) {
+		_cap_flist_node *free_me = f_list->head;
+		f_list->head = free_me->next;
 		f_list->size--;
+		_cap_allocator_free(&f_list->_allocator, free_me,
+				    sizeof(_cap_flist_node));
 		return_now = true;
 		goto CHECK_AGAIN;
 	}
-	if (return_now) return true;
+	if (return_now || f_list->head == NULL) return return_now;
 	_cap_flist_node *iter_node = f_list->head;
 	bool removed_some = false;
 	while (iter_node->next != NULL) {
@@ -255,7 +282,8 @@ CHECK_AGAIN:
 			iter_node->next = iter_node->next->next;
 			f_list->size--;
 			removed_some = true;
-			free(free_me);
+			_cap_allocator_free(&f_list->_allocator, free_me,
+					    sizeof(_cap_flist_node));
 			continue;
 		}
 		iter_node = iter_node->next;
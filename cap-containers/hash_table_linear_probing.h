@@ -21,6 +21,7 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_HASHTABLE_LP_H
 #define CAP_HASHTABLE_LP_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -46,6 +47,7 @@ typedef struct {
 	_compare_fn_type compare_fn;
 	_hash_fn_type hash_fn;
 	_cap_hash_node *_hash_buckets;
+	cap_allocator _allocator;
 } cap_lp_hash_table;
 
 /**
@@ -63,6 +65,21 @@ typedef struct {
 static cap_lp_hash_table *cap_lp_hash_table_init(size_t key_size,
 						 _compare_fn_type compare_fn,
 						 _hash_fn_type hash_fn);
+/**
+ * Initilize a cap_lp_hash_table container which takes the container and it's
+ * buckets from the given allocator
+ *
+ * @param key_size Key-size that'd be used for the container
+ * @param compare_fn Compare function pointer for comparing two keys
+ * @param hash_fn Hash function to be used, NULL for the default
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated cap_lp_hash_table container.
+ */
+static cap_lp_hash_table *
+cap_lp_hash_table_init_with_allocator(size_t key_size,
+				      _compare_fn_type compare_fn,
+				      _hash_fn_type hash_fn,
+				      const cap_allocator *allocator);
 /**
  * Check if a key contains within the cap_lp_hash_table container
  *
@@ -139,13 +156,23 @@ static void _cap_lp_hash_table_rehash(cap_lp_hash_table *table);
 static cap_lp_hash_table *cap_lp_hash_table_init(size_t key_size,
 						 _compare_fn_type compare_fn,
 						 _hash_fn_type hash_fn) {
+	return cap_lp_hash_table_init_with_allocator(key_size, compare_fn,
+						     hash_fn, NULL);
+}
+
+static cap_lp_hash_table *
+cap_lp_hash_table_init_with_allocator(size_t key_size,
+				      _compare_fn_type compare_fn,
+				      _hash_fn_type hash_fn,
+				      const cap_allocator *allocator) {
 	assert(compare_fn != NULL);
-	cap_lp_hash_table *table =
-	    (cap_lp_hash_table *)CAP_ALLOCATOR(cap_lp_hash_table, 1);
+	cap_lp_hash_table *table = (cap_lp_hash_table *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_lp_hash_table));
 	if (!table) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) table->_allocator = *allocator;
 	table->size = 0;
 	table->capacity = CAP_HASHTABLE_LP_INIT_SIZE;
 	table->key_size = key_size;
@@ -154,11 +181,12 @@ static cap_lp_hash_table *cap_lp_hash_table_init(size_t key_size,
 		table->hash_fn = hash_fn;
 	else
 		table->hash_fn = _hash_fn_defaut_hash_lp;
-	table->_hash_buckets =
-	    (_cap_hash_node *)CAP_ALLOCATOR(_cap_hash_node, table->capacity);
+	table->_hash_buckets = (_cap_hash_node *)_cap_allocator_calloc(
+	    allocator, table->capacity, sizeof(_cap_hash_node));
 	if (!table->_hash_buckets) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(table);
+		_cap_allocator_free(allocator, table,
+				    sizeof(cap_lp_hash_table));
 		return NULL;
 	}
 	return table;
@@ -246,8 +274,8 @@ static void cap_lp_hash_table_insert(cap_lp_hash_table *table, void *key,
 static void _cap_lp_hash_table_rehash(cap_lp_hash_table *table) {
 	_cap_hash_node *old_hash_node = table->_hash_buckets;
 	size_t old_capacity = table->capacity;
-	table->_hash_buckets = (_cap_hash_node *)CAP_ALLOCATOR(
-	    _cap_hash_node, table->capacity * 2);
+	table->_hash_buckets = (_cap_hash_node *)_cap_allocator_calloc(
+	    &table->_allocator, table->capacity * 2, sizeof(_cap_hash_node));
 	if (!table->_hash_buckets) {
 		fprintf(stderr, "memory allocation falure on rehash\n");
 		assert(false);
@@ -259,6 +287,8 @@ static void _cap_lp_hash_table_rehash(cap_lp_hash_table *table) {
 		cap_lp_hash_table_insert(table, old_hash_node[i].key,
 					 old_hash_node[i].value);
 	}
+	_cap_allocator_free(&table->_allocator, old_hash_node,
+			    sizeof(_cap_hash_node) * old_capacity);
 }
 
 static bool cap_lp_hash_table_contains(cap_lp_hash_table *table, void *key) {
@@ -292,8 +322,11 @@ static size_t cap_lp_hash_table_size(cap_lp_hash_table *table) {
 
 static void cap_lp_hash_table_free(cap_lp_hash_table *table) {
 	if (table) {
-		free(table->_hash_buckets);
-		free(table);
+		cap_allocator allocator = table->_allocator;
+		_cap_allocator_free(&allocator, table->_hash_buckets,
+				    sizeof(_cap_hash_node) * table->capacity);
+		_cap_allocator_free(&allocator, table,
+				    sizeof(cap_lp_hash_table));
 	}
 }
 
@@ -306,6 +339,7 @@ static void cap_lp_hash_table_deep_free(cap_lp_hash_table *table) {
 				free(table->_hash_buckets[i].value);
 			}
 		}
+		cap_lp_hash_table_free(table);
 	}
 }
 
@@ -21,6 +21,7 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_HASHTABLE_SP_H
 #define CAP_HASHTABLE_SP_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -57,6 +58,7 @@ typedef struct {
 	_compare_fn_type compare_fn;
 	_hash_fn_type hash_fn;
 	_cap_ll_chain *_hash_buckets;
+	cap_allocator _allocator;
 } cap_hash_table;
 #endif
 
@@ -79,6 +81,20 @@ static cap_hash_table *cap_hash_table_init(size_t key_size,
 					   size_t init_capacity,
 					   _compare_fn_type compare_fn,
 					   _hash_fn_type hash_fn);
+/**
+ * Initilize a cap_hash_table container which takes the container, it's buckets
+ * and it's nodes from the given allocator
+ *
+ * @param key_size Key-size for the cap_hash_table container
+ * @param init_capacity Initial capacity of the hash-table's buckets.
+ * @param compare_fn Function pointer for comparing two keys
+ * @param hash_fn Function pointer for hash-function, NULL for the default
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_hash_table container
+ */
+static cap_hash_table *cap_hash_table_init_with_allocator(
+    size_t key_size, size_t init_capacity, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, const cap_allocator *allocator);
 
 // Lookup & Update:
 /**
@@ -187,29 +203,32 @@ static size_t _hash_fn_default_hash(uint8_t *key, size_t key_size);
 
 // Linked list chain:
 // Init:
-static _cap_ll_chain *_cap_ll_chain_init();
+static _cap_ll_chain *_cap_ll_chain_init(const cap_allocator *);
 
 // Lookups:
 static _cap_hash_node *_cap_ll_chain_find_if(_cap_ll_chain *, void *key,
 					     size_t key_size);
 static bool _cap_ll_chain_push_front(_cap_ll_chain *, void *key,
-				     size_t key_size, void *data);
+				     size_t key_size, void *data,
+				     const cap_allocator *);
 static bool _cap_ll_chain_remove_if(_cap_ll_chain *, void *key, size_t key_size,
-				    bool is_deep_free);
+				    bool is_deep_free, const cap_allocator *);
 static size_t _cap_ll_chain_size(_cap_ll_chain *);
 
 // Memory:
-static void _cap_ll_chain_free(_cap_ll_chain *);
-static void _cap_ll_chain_deep_free(_cap_ll_chain *);
+static void _cap_ll_chain_free(_cap_ll_chain *, const cap_allocator *);
+static void _cap_ll_chain_deep_free(_cap_ll_chain *, const cap_allocator *);
 #endif
 
 static cap_hash_table *
 _cap_hash_table_rehash(cap_hash_table *hash_table_original) {
 	assert(hash_table_original != NULL);
-	cap_hash_table *new_hash_table = cap_hash_table_init(
+	cap_hash_table *new_hash_table = cap_hash_table_init_with_allocator(
 	    hash_table_original->key_size, hash_table_original->capacity * 2,
-	    hash_table_original->compare_fn, hash_table_original->hash_fn);
-	for (size_t i = 0; i < hash_table_original->size; i++) {
+	    hash_table_original->compare_fn, hash_table_original->hash_fn,
+	    &hash_table_original->_allocator);
+	if (!new_hash_table) return NULL;
+	for (size_t i = 0; i < hash_table_original->capacity; i++) {
 		_cap_hash_node *current_node =
 		    hash_table_original->_hash_buckets[i]._head_node;
 		_cap_hash_node *prev_node = NULL;
@@ -218,8 +237,10 @@ _cap_hash_table_rehash(cap_hash_table *hash_table_original) {
 					      current_node->data);
 			prev_node = current_node;
 			current_node = current_node->next;
-			free(prev_node);
+			_cap_allocator_free(&hash_table_original->_allocator,
+					    prev_node, sizeof(_cap_hash_node));
 		}
+		hash_table_original->_hash_buckets[i]._head_node = NULL;
 	}
 	return new_hash_table;
 }
@@ -232,6 +253,11 @@ static size_t cap_hash_table_bucket_size(cap_hash_table *hash_table) {
 static void cap_hash_table_swap(cap_hash_table *hash_table_one,
 				cap_hash_table *hash_table_two) {
 	assert(hash_table_one != NULL && hash_table_two != NULL);
+	// The buckets change owners, so both have to come from one allocator
+	assert(hash_table_one->_allocator.alloc ==
+		   hash_table_two->_allocator.alloc &&
+	       hash_table_one->_allocator.ctx ==
+		   hash_table_two->_allocator.ctx);
 	_cap_ll_chain *temp_one_hash_bucket = hash_table_one->_hash_buckets;
 	size_t temp_one_size = hash_table_one->size;
 	size_t temp_one_key_size = hash_table_one->key_size;
@@ -269,7 +295,8 @@ static bool cap_hash_table_deep_erase(cap_hash_table *hash_table, void *key) {
 	    hash_table->capacity;
 	bool remove_if_return =
 	    _cap_ll_chain_remove_if(&hash_table->_hash_buckets[key_index], key,
-				    hash_table->key_size, true);
+				    hash_table->key_size, true,
+				    &hash_table->_allocator);
 	if (remove_if_return) hash_table->size--;
 	return remove_if_return;
 }
@@ -281,7 +308,8 @@ static bool cap_hash_table_erase(cap_hash_table *hash_table, void *key) {
 	    hash_table->capacity;
 	bool remove_if_return =
 	    _cap_ll_chain_remove_if(&hash_table->_hash_buckets[key_index], key,
-				    hash_table->key_size, false);
+				    hash_table->key_size, false,
+				    &hash_table->_allocator);
 	if (remove_if_return) hash_table->size--;
 	return remove_if_return;
 }
@@ -303,8 +331,10 @@ static void cap_hash_table_insert(cap_hash_table *hash_table, void *key,
 	if (CAP_HASHTABLE_LOAD_FACTOR(hash_table)) {
 		cap_hash_table *rehashed_table =
 		    _cap_hash_table_rehash(hash_table);
-		cap_hash_table_swap(hash_table, rehashed_table);
-		free(rehashed_table);
+		if (rehashed_table) {
+			cap_hash_table_swap(hash_table, rehashed_table);
+			cap_hash_table_free(rehashed_table);
+		}
 	}
 	size_t key_index =
 	    hash_table->hash_fn((uint8_t *)key, hash_table->key_size) %
@@ -315,7 +345,8 @@ static void cap_hash_table_insert(cap_hash_table *hash_table, void *key,
 		find_if_key->data = (CAP_GENERIC_TYPE_PTR)value;
 	}
 	_cap_ll_chain_push_front(&hash_table->_hash_buckets[key_index], key,
-				 hash_table->key_size, value);
+				 hash_table->key_size, value,
+				 &hash_table->_allocator);
 	if (find_if_key == NULL) hash_table->size++;
 }
 
@@ -331,40 +362,51 @@ static bool cap_hash_table_contains(cap_hash_table *hash_table, void *key) {
 }
 
 static void cap_hash_table_free(cap_hash_table *hash_table) {
-	for (size_t i = 1; i < hash_table->size; i++) {
-		_cap_ll_chain_free(&hash_table->_hash_buckets[i]);
+	cap_allocator allocator = hash_table->_allocator;
+	for (size_t i = 0; i < hash_table->capacity; i++) {
+		_cap_ll_chain_free(&hash_table->_hash_buckets[i], &allocator);
 	}
-	free(hash_table->_hash_buckets);
-	free(hash_table);
+	_cap_allocator_free(&allocator, hash_table->_hash_buckets,
+			    sizeof(_cap_ll_chain) * hash_table->capacity);
+	_cap_allocator_free(&allocator, hash_table, sizeof(cap_hash_table));
 }
 
 static void cap_hash_table_deep_free(cap_hash_table *hash_table) {
-	for (size_t i = 1; i < hash_table->size; i++) {
-		_cap_ll_chain_deep_free(&hash_table->_hash_buckets[i]);
+	for (size_t i = 0; i < hash_table->capacity; i++) {
+		_cap_ll_chain_deep_free(&hash_table->_hash_buckets[i],
+					&hash_table->_allocator);
 	}
-	free(hash_table->_hash_buckets);
-	free(hash_table);
+	cap_hash_table_free(hash_table);
 }
 
 static cap_hash_table *cap_hash_table_init(size_t key_size,
 					   size_t init_capacity,
 					   _compare_fn_type compare_fn,
 					   _hash_fn_type hash_fn) {
-	cap_hash_table *hash_table =
-	    (cap_hash_table *)CAP_ALLOCATOR(cap_hash_table, 1);
+	return cap_hash_table_init_with_allocator(key_size, init_capacity,
+						  compare_fn, hash_fn, NULL);
+}
+
+static cap_hash_table *cap_hash_table_init_with_allocator(
+    size_t key_size, size_t init_capacity, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, const cap_allocator *allocator) {
+	cap_hash_table *hash_table = (cap_hash_table *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_hash_table));
 	if (!hash_table) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) hash_table->_allocator = *allocator;
 	hash_table->capacity = init_capacity;
 	hash_table->key_size = key_size;
 	hash_table->size = 0;
 	hash_table->compare_fn = compare_fn;
-	hash_table->_hash_buckets =
-	    (_cap_ll_chain *)CAP_ALLOCATOR(_cap_ll_chain, init_capacity);
+	hash_table->_hash_buckets = (_cap_ll_chain *)_cap_allocator_calloc(
+	    allocator, init_capacity, sizeof(_cap_ll_chain));
 	if (!hash_table->_hash_buckets) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(hash_table);
+		_cap_allocator_free(allocator, hash_table,
+				    sizeof(cap_hash_table));
 		return NULL;
 	}
 	if (!hash_fn)
@@ -378,9 +420,9 @@ static cap_hash_table *cap_hash_table_init(size_t key_size,
 	return hash_table;
 }
 
-static _cap_ll_chain *_cap_ll_chain_init() {
-	_cap_ll_chain *f_list =
-	    (_cap_ll_chain *)CAP_ALLOCATOR(_cap_ll_chain, 1);
+static _cap_ll_chain *_cap_ll_chain_init(const cap_allocator *allocator) {
+	_cap_ll_chain *f_list = (_cap_ll_chain *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(_cap_ll_chain));
 	if (!f_list) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
@@ -391,11 +433,12 @@ static _cap_ll_chain *_cap_ll_chain_init() {
 }
 
 static bool _cap_ll_chain_push_front(_cap_ll_chain *f_list, void *key,
-				     size_t key_size, void *data) {
+				     size_t key_size, void *data,
+				     const cap_allocator *allocator) {
 	assert(f_list != NULL && key != NULL && data != NULL);
 	_cap_hash_node *current_head = f_list->_head_node;
-	_cap_hash_node *hash_node =
-	    (_cap_hash_node *)CAP_ALLOCATOR(_cap_hash_node, 1);
+	_cap_hash_node *hash_node = (_cap_hash_node *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(_cap_hash_node));
 	if (!hash_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -421,7 +464,8 @@ static _cap_hash_node *_cap_ll_chain_find_if(_cap_ll_chain *f_list, void *key,
 }
 
 static bool _cap_ll_chain_remove_if(_cap_ll_chain *f_list, void *key,
-				    size_t key_size, bool deep_free) {
+				    size_t key_size, bool deep_free,
+				    const cap_allocator *allocator) {
 	assert(f_list != NULL && key != NULL);
 	_cap_hash_node *current_node = f_list->_head_node;
 	_cap_hash_node *prev_node = NULL;
@@ -435,7 +479,8 @@ static bool _cap_ll_chain_remove_if(_cap_ll_chain *f_list, void *key,
 					free(current_node->data);
 					free(current_node->key);
 				}
-				free(current_node);
+				_cap_allocator_free(allocator, current_node,
+						    sizeof(_cap_hash_node));
 				return true;
 			} else if (prev_node == NULL &&
 				   current_node->next != NULL) {
@@ -445,7 +490,8 @@ static bool _cap_ll_chain_remove_if(_cap_ll_chain *f_list, void *key,
 					free(current_node->data);
 					free(current_node->key);
 				}
-				free(current_node);
+				_cap_allocator_free(allocator, current_node,
+						    sizeof(_cap_hash_node));
 				return true;
 			} else {
 				prev_node->next = current_node->next;
@@ -454,7 +500,8 @@ static bool _cap_ll_chain_remove_if(_cap_ll_chain *f_list, void *key,
 					free(current_node->data);
 					free(current_node->key);
 				}
-				free(current_node);
+				_cap_allocator_free(allocator, current_node,
+						    sizeof(_cap_hash_node));
 				return true;
 			}
 		} else {
@@ -470,26 +517,29 @@ static size_t _cap_ll_chain_size(_cap_ll_chain *f_list) {
 	return f_list->_num_items;
 }
 
-static void _cap_ll_chain_free(_cap_ll_chain *f_list) {
+static void _cap_ll_chain_free(_cap_ll_chain *f_list,
+			       const cap_allocator *allocator) {
 	assert(f_list != NULL);
 	_cap_hash_node *current_node = f_list->_head_node;
 	while (current_node != NULL) {
 		_cap_hash_node *next_node = current_node->next;
-		free(current_node);
+		_cap_allocator_free(allocator, current_node,
+				    sizeof(_cap_hash_node));
 		current_node = next_node;
 	}
+	f_list->_head_node = NULL;
+	f_list->_num_items = 0;
 }
 
-static void _cap_ll_chain_deep_free(_cap_ll_chain *f_list) {
+static void _cap_ll_chain_deep_free(_cap_ll_chain *f_list,
+				    const cap_allocator *allocator) {
 	assert(f_list != NULL);
-	_cap_hash_node *current_node = f_list->_head_node;
-	while (current_node != NULL) {
-		_cap_hash_node *next_node = current_node->next;
+	for (_cap_hash_node *current_node = f_list->_head_node;
+	     current_node != NULL; current_node = current_node->next) {
 		free(current_node->key);
 		free(current_node->data);
-		free(current_node);
-		current_node = next_node;
 	}
+	_cap_ll_chain_free(f_list, allocator);
 }
 
 
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_LIST_H
 #define CAP_LIST_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,6 +44,7 @@ typedef struct _cap_list_node {
 typedef struct {
 	_cap_list_node *_head_node;
 	_cap_list_node *_tail_node;
+	cap_allocator _allocator;
 } cap_list;
 
 typedef struct {
@@ -57,6 +60,14 @@ typedef struct {
  * @return  Allocated cap_list container
  */
 static cap_list *cap_list_init();
+/**
+ * Initilize a cap_list container which takes the container and it's nodes
+ * from the given allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return  Allocated cap_list container
+ */
+static cap_list *cap_list_init_with_allocator(const cap_allocator *allocator);
 
 // Lookup & Update:
 /**
@@ -161,19 +172,25 @@ static void cap_list_deep_free(cap_list *list);
  */
 static void cap_list_free(cap_list *list);
 
-static cap_list *cap_list_init() {
+static cap_list *cap_list_init() { return cap_list_init_with_allocator(NULL); }
+
+static cap_list *cap_list_init_with_allocator(const cap_allocator *allocator) {
 	_cap_list_node *head_and_tail_nodes =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 2);
+	    (_cap_list_node *)_cap_allocator_alloc(allocator,
+						   sizeof(_cap_list_node) * 2);
 	if (!head_and_tail_nodes) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
-	cap_list *d_list = (cap_list *)CAP_ALLOCATOR(cap_list, 1);
+	cap_list *d_list =
+	    (cap_list *)_cap_allocator_calloc(allocator, 1, sizeof(cap_list));
 	if (!d_list) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(head_and_tail_nodes);
+		_cap_allocator_free(allocator, head_and_tail_nodes,
+				    sizeof(_cap_list_node) * 2);
 		return NULL;
 	}
+	if (allocator) d_list->_allocator = *allocator;
 	d_list->_head_node = head_and_tail_nodes;
 	d_list->_tail_node = (head_and_tail_nodes + 1);
 	d_list->_head_node->data = NULL;
@@ -187,8 +204,8 @@ static cap_list *cap_list_init() {
 
 static bool cap_list_push_front(cap_list *d_list, void *data) {
 	assert((d_list != NULL) && (data != NULL));
-	_cap_list_node *new_node =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 1);
+	_cap_list_node *new_node = (_cap_list_node *)_cap_allocator_alloc(
+	    &d_list->_allocator, sizeof(_cap_list_node));
 	if (!new_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -204,8 +221,8 @@ static bool cap_list_push_front(cap_list *d_list, void *data) {
 
 static bool cap_list_push_back(cap_list *d_list, void *data) {
 	assert((d_list != NULL) && (data != NULL));
-	_cap_list_node *new_node =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 1);
+	_cap_list_node *new_node = (_cap_list_node *)_cap_allocator_alloc(
+	    &d_list->_allocator, sizeof(_cap_list_node));
 	if (!new_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -223,17 +240,25 @@ static bool cap_list_push_back(cap_list *d_list, void *data) {
 static void *cap_list_pop_front(cap_list *d_list) {
 	assert(d_list != NULL);
 	_cap_list_node *pop_node = d_list->_head_node->next;
+	if (pop_node == d_list->_tail_node) return NULL;
 	d_list->_head_node->next = pop_node->next;
 	pop_node->next->previous = d_list->_head_node;
-	return pop_node->data;
+	void *data = pop_node->data;
+	_cap_allocator_free(&d_list->_allocator, pop_node,
+			    sizeof(_cap_list_node));
+	return data;
 }
 
 static void *cap_list_pop_back(cap_list *d_list) {
 	assert(d_list != NULL);
 	_cap_list_node *pop_node = d_list->_tail_node->previous;
+	if (pop_node == d_list->_head_node) return NULL;
 	d_list->_tail_node->previous = pop_node->previous;
 	pop_node->previous->next = d_list->_tail_node;
-	return pop_node->data;
+	void *data = pop_node->data;
+	_cap_allocator_free(&d_list->_allocator, pop_node,
+			    sizeof(_cap_list_node));
+	return data;
 }
 
 static void *cap_list_front(const cap_list *d_list) {
@@ -277,7 +302,9 @@ static bool cap_list_remove_if(cap_list *d_list, bool (*predicate_fn)(void *)) {
 			if (predicate_fn(iter_node->data)) {
 				iter_node->previous->next = iter_node->next;
 				iter_node->next->previous = iter_node->previous;
-				if (iter_node != NULL) free(iter_node);
+				_cap_allocator_free(&d_list->_allocator,
+						    iter_node,
+						    sizeof(_cap_list_node));
 				num_removed++;
 			}
 		}
@@ -299,7 +326,9 @@ static bool cap_list_remove_if_deep(cap_list *d_list,
 				iter_node->previous->next = iter_node->next;
 				iter_node->next->previous = iter_node->previous;
 				if (iter_node->data) free(iter_node->data);
-				if (iter_node) free(iter_node);
+				_cap_allocator_free(&d_list->_allocator,
+						    iter_node,
+						    sizeof(_cap_list_node));
 				num_removed++;
 			}
 		}
@@ -312,8 +341,8 @@ static bool cap_list_insert_after(cap_list *d_list,
 				  void *insert_after_this_node, void *data) {
 	assert((d_list != NULL) && (insert_after_this_node != NULL) &&
 	       (data != NULL));
-	_cap_list_node *new_node =
-	    (_cap_list_node *)CAP_ALLOCATOR(_cap_list_node, 1);
+	_cap_list_node *new_node = (_cap_list_node *)_cap_allocator_alloc(
+	    &d_list->_allocator, sizeof(_cap_list_node));
 	if (!new_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -328,30 +357,27 @@ static bool cap_list_insert_after(cap_list *d_list,
 
 static void cap_list_free(cap_list *d_list) {
 	assert(d_list != NULL);
+	cap_allocator allocator = d_list->_allocator;
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
-		current_node->data = NULL;
-		if (current_node != NULL) free(current_node);
+	while (current_node != d_list->_tail_node) {
+		_cap_list_node *next_node = current_node->next;
+		_cap_allocator_free(&allocator, current_node,
+				    sizeof(_cap_list_node));
 		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+	}
+	_cap_allocator_free(&allocator, d_list->_head_node,
+			    sizeof(_cap_list_node) * 2);
+	_cap_allocator_free(&allocator, d_list, sizeof(cap_list));
 }
 
 static void cap_list_deep_free(cap_list *d_list) {
 	assert(d_list != NULL);
 	_cap_list_node *current_node = d_list->_head_node->next;
-	_cap_list_node *next_node;
-	do {
-		next_node = current_node->next;
+	while (current_node != d_list->_tail_node) {
 		if (current_node->data != NULL) free(current_node->data);
-		if (current_node != NULL) free(current_node);
-		current_node = next_node;
-	} while ((current_node != NULL) &&
-		 (current_node != d_list->_tail_node));
-	free(d_list->_head_node);
+		current_node = current_node->next;
+	}
+	cap_list_free(d_list);
 }
 
 #endif // !CAP_LIST_H
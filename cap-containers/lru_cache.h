@@ -22,160 +22,2029 @@
 #ifndef CAP_LRU_CACHE_H
 #define CAP_LRU_CACHE_H
 
+#include "allocator.h"
+#include "timer_wheel.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
-#define CAP_GENERIC_TYPE int
-#define CAP_HASH_SIZE 10000
+#define CAP_GENERIC_TYPE unsigned char
 #define CAP_GENERIC_TYPE_PTR CAP_GENERIC_TYPE *
-#define CAP_ALLOCATOR(type, number_of_elements) malloc(sizeof(type) * number_of_elements)
+#define CAP_ALLOCATOR(type, number_of_elements)                                \
+	calloc(number_of_elements, sizeof(type))
+#define CAP_LRU_CACHE_LISTS 4
+// Share of the capacity given to the S3-FIFO small queue, in percent
+#define CAP_LRU_CACHE_S3FIFO_SMALL_RATIO 10
+#define CAP_LRU_CACHE_S3FIFO_MAX_FREQ 3
+// Share of the capacity given to the W-TinyLFU window, and share of the main
+// space given to the protected segment, in percent
+#define CAP_LRU_CACHE_TINYLFU_WINDOW_RATIO 1
+#define CAP_LRU_CACHE_TINYLFU_PROTECTED_RATIO 80
+#define CAP_LRU_CACHE_SKETCH_DEPTH 4
+#define CAP_LRU_CACHE_SKETCH_MAX_COUNT 15
+// The sketch counters are halved after this many times it's width accesses
+#define CAP_LRU_CACHE_SKETCH_SAMPLE_FACTOR 10
+// Upper bound of the initial number of buckets, the table grows with the
+// number of entries past it
+#define CAP_LRU_CACHE_MAX_INITIAL_BUCKETS (1 << 20)
+#define CAP_LRU_CACHE_GHOST_NONE SIZE_MAX
+// Number of nodes of the first slab, every next slab doubles the number of
+// nodes up to the maximum
+#define CAP_LRU_CACHE_MIN_SLAB_NODES 64
+#define CAP_LRU_CACHE_MAX_SLAB_NODES (1 << 16)
+// Number of keys the batched functions hash ahead of the lookups
+#define CAP_LRU_CACHE_BATCH_SIZE 64
+#define CAP_LRU_CACHE_HOT_NONE SIZE_MAX
+// Snapshot file header, the record flags byte marking the end of the records
+// and the bit offset of the list index within a record's flags
+#define CAP_LRU_CACHE_SNAPSHOT_MAGIC "CAPLRU01"
+#define CAP_LRU_CACHE_SNAPSHOT_MAGIC_SIZE 8
+#define CAP_LRU_CACHE_SNAPSHOT_END 0xFF
+#define CAP_LRU_CACHE_SNAPSHOT_LIST_SHIFT 4
+
+typedef bool (*_compare_fn_type)(void *key_one, void *key_two);
+typedef size_t (*_hash_fn_type)(uint8_t *key, size_t key_size);
+typedef uint64_t (*_clock_fn_type)(void);
 
 typedef struct _cap_lru_cache_node {
     CAP_GENERIC_TYPE_PTR key;
-    CAP_GENERIC_TYPE_PTR value;
+    void *value;
+    size_t hash;
+    // Share of the capacity the entry takes, e.g it's size in bytes
+    size_t cost;
+    // Value of the cache's clock when the node was last moved to the head
+    size_t stamp;
+    // Index of the list the node is on, and it's reference bit (CLOCK) or
+    // access count (S3-FIFO)
+    unsigned char list;
+    unsigned char freq;
     struct _cap_lru_cache_node *prev;
     struct _cap_lru_cache_node *next;
+    // Next node within the same hash bucket, or on the free list
+    struct _cap_lru_cache_node *hnext;
+    // Expiry of the entry, only scheduled on the wheel if it has a TTL
+    cap_timer_wheel_timer timer;
 } _cap_lru_cache_node;
 
+// Block of nodes, the nodes are never freed one by one but recycled through
+// the cache's free list
+typedef struct _cap_lru_cache_slab {
+    struct _cap_lru_cache_slab *next;
+    size_t node_count;
+    _cap_lru_cache_node nodes[];
+} _cap_lru_cache_slab;
+
 typedef struct {
-    int capacity;
-    int size;
-    _cap_lru_cache_node **table;
     _cap_lru_cache_node *head;
     _cap_lru_cache_node *tail;
+    size_t size;
+    // Sum of the costs of the nodes on the list
+    size_t weight;
+} _cap_lru_cache_list;
+
+// FIFO of the hashes of the keys recently evicted from the S3-FIFO small
+// queue, the ring slots are chained within hash buckets by index
+typedef struct {
+    size_t *hashes;
+    size_t *next;
+    size_t *buckets;
+    size_t capacity;
+    size_t bucket_count;
+    size_t position;
+    size_t size;
+} _cap_lru_cache_ghost;
+
+// Count-min sketch estimating the access frequency of the keys for W-TinyLFU
+typedef struct {
+    uint8_t *counters;
+    size_t width;
+    size_t additions;
+    size_t sample_size;
+} _cap_lru_cache_sketch;
+
+// Space-saving summary of the sampled lookups. The slots hold copies of the
+// keys and their counts, a min-heap of the slots finds the one to replace and
+// an open addressing index of the slots finds a key
+typedef struct {
+    CAP_GENERIC_TYPE_PTR keys;
+    size_t *hashes;
+    uint64_t *counts;
+    size_t *heap;
+    size_t *positions;
+    size_t *index;
+    size_t index_mask;
+    size_t capacity;
+    size_t size;
+    size_t sample_rate;
+    size_t countdown;
+} _cap_lru_cache_hot_keys;
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * Eviction policies of cap_lru_cache
+ *
+ * CAP_CACHE_POLICY_LRU evicts the least recently used entry.
+ *
+ * CAP_CACHE_POLICY_CLOCK keeps the entries in insertion order and only sets a
+ * reference bit on a hit, an entry with the bit set gets a second chance when
+ * it comes up for eviction. Hits never relink the list.
+ *
+ * CAP_CACHE_POLICY_S3FIFO inserts new keys into a small FIFO queue, holding
+ * 10% of the capacity, and only moves the ones which were hit again into the
+ * main queue, so a scan of one-time keys can't flush the main queue. The keys
+ * evicted from the small queue are remembered in a ghost queue, and go
+ * straight into the main queue when they come back.
+ *
+ * CAP_CACHE_POLICY_TINYLFU keeps a 1% LRU window in front of a segmented LRU
+ * main space, and only admits an entry from the window into the main space if
+ * a count-min sketch estimates it to be more frequently accessed than the main
+ * space's victim.
+ *
+ * CAP_CACHE_POLICY_ARC splits the entries between a list of the ones used once
+ * recently and a list of the ones used more than once, and remembers the hashes
+ * of the keys evicted from each list in a ghost list. A miss on a key in the
+ * first ghost list grows the first list's share of the capacity, a miss on a
+ * key in the second ghost list shrinks it, so the cache tunes itself between
+ * recency and frequency as the workload shifts.
+ */
+typedef enum {
+    CAP_CACHE_POLICY_LRU,
+    CAP_CACHE_POLICY_CLOCK,
+    CAP_CACHE_POLICY_S3FIFO,
+    CAP_CACHE_POLICY_TINYLFU,
+    CAP_CACHE_POLICY_ARC
+} cap_cache_policy;
+
+/**
+ * Reasons for which cap_lru_cache gives an entry to the evict function.
+ * CAP_CACHE_EVICTED is an entry evicted by the policy to make room,
+ * CAP_CACHE_EXPIRED is an entry whose TTL passed
+ */
+typedef enum { CAP_CACHE_EVICTED, CAP_CACHE_EXPIRED } cap_cache_evict_reason;
+
+typedef void (*_evict_fn_type)(void *key, void *value,
+                               cap_cache_evict_reason reason, void *arg);
+typedef size_t (*_value_size_fn_type)(void *value);
+typedef bool (*_restore_fn_type)(void *key, void *value, size_t value_size,
+                                 void **key_out, void **value_out, void *arg);
+typedef void (*_release_fn_type)(void *key, void *value, void *arg);
+
+/**
+ * Counters of a cap_lru_cache, since the initilization or the last reset. A
+ * lookup of an expired entry counts as a miss and an expiration
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t updates;
+    uint64_t evictions;
+    uint64_t expirations;
+} cap_cache_stats;
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+typedef struct {
+    // Budget for the sum of the entry costs, and the sum in use
+    size_t capacity;
+    size_t used;
+    size_t size;
+    size_t key_size;
+    _compare_fn_type compare_fn;
+    _hash_fn_type hash_fn;
+    // Number of buckets is a power of two, at least the number of entries
+    size_t bucket_count;
+    _cap_lru_cache_node **table;
+    cap_cache_policy policy;
+    // Called for each entry the cache drops on it's own
+    _evict_fn_type evict_fn;
+    void *evict_arg;
+    cap_cache_stats stats;
+    // Tracker of the most looked up keys, NULL unless it's enabled
+    _cap_lru_cache_hot_keys *hot;
+    // LRU and CLOCK use the first list only, S3-FIFO uses the small and the
+    // main queue, W-TinyLFU uses the window, probation and protected segments,
+    // ARC uses T1, T2 and their ghost lists B1 and B2
+    _cap_lru_cache_list lists[CAP_LRU_CACHE_LISTS];
+    // Target weight of the S3-FIFO small queue or the W-TinyLFU window, and
+    // of the W-TinyLFU protected segment
+    size_t small_capacity;
+    size_t protected_capacity;
+    // Target weight of the ARC T1 list, adapted on every ghost hit
+    size_t arc_target;
+    _cap_lru_cache_ghost ghost;
+    _cap_lru_cache_sketch sketch;
+    // Counts the moves to the head, so the distance between the clock and a
+    // node's stamp tells how recently the node was used
+    size_t clock;
+    // Nodes come from the slabs, the evicted and removed ones are kept on the
+    // free list and reused, so a cache at it's capacity doesn't allocate
+    _cap_lru_cache_slab *slabs;
+    _cap_lru_cache_node *free_nodes;
+    size_t slab_nodes;
+    // Expiry times of the entries with a TTL, allocated on the first one
+    cap_timer_wheel *wheel;
+    _clock_fn_type clock_fn;
+    uint64_t default_ttl;
+    // Where the cache, it's table, slabs, ghosts and sketch come from
+    cap_allocator allocator;
 } cap_lru_cache;
 #endif // DOXYGEN_SHOULD_SKIP_THIS
 
 /**
- * Initilize a cap_lru_cache
+ * Initilize a cap_lru_cache with the LRU eviction policy. Keys are arbitrary
+ * byte strings of key_size bytes, the hash table is sized from the capacity and
+ * grows with the number of entries so that it's load factor never goes over
+ * one, colliding keys are chained within their bucket.
+ *
+ * The capacity is a budget for the sum of the entry costs. cap_lru_cache_put()
+ * gives every entry a cost of one, so the capacity is a number of entries,
+ * while cap_lru_cache_put_with_cost() lets the capacity be e.g a number of
+ * bytes.
+ *
+ * Entries may expire after a TTL, measured in the ticks of the cache's clock,
+ * milliseconds of CLOCK_MONOTONIC by default. An expired entry is removed when
+ * it's looked up, or in bulk by cap_lru_cache_expire_now(). The expiry times
+ * are kept on a hierarchical timer wheel, so neither of them scans the cache.
+ *
+ * The cache doesn't manage the life time of the given keys and values, the
+ * key must stay valid for as long as it's within the cache
  * 
- * @param capacity Cache's capacity
- * @return Allocated cap_lru_cache container
+ * @param capacity Cache's capacity, in the unit of the entry costs
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, returns true if
+ * the two keys are same. Pass NULL to compare the key_size bytes with memcmp()
+ * @param hash_fn Function pointer for hashing a key. Pass NULL to use the
+ * default hash function (FNV-1a)
+ * @return Allocated cap_lru_cache container, NULL if there was a memory error
+ */
+static cap_lru_cache *cap_lru_cache_init_with_keys(size_t capacity,
+                                                   size_t key_size,
+                                                   _compare_fn_type compare_fn,
+                                                   _hash_fn_type hash_fn);
+/**
+ * Initilize a cap_lru_cache of int keys with the LRU eviction policy, the keys
+ * are compared and hashed by value. Same as cap_lru_cache_init_with_keys() with
+ * sizeof(int) and the default compare and hash functions
+ *
+ * @param capacity Cache's capacity, in the unit of the entry costs
+ * @return Allocated cap_lru_cache container, NULL if there was a memory error
  */
 static cap_lru_cache *cap_lru_cache_init(int capacity);
 /**
- * Deallocate cap_lru_cache container
+ * Initilize a cap_lru_cache with the given eviction policy. Every other
+ * function behaves the same regardless of the policy
+ *
+ * @param capacity Cache's capacity, in the unit of the entry costs
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, NULL for memcmp()
+ * @param hash_fn Function pointer for hashing a key, NULL for the default one
+ * @param policy Eviction policy
+ * @return Allocated cap_lru_cache container, NULL if there was a memory error
+ */
+static cap_lru_cache *
+cap_lru_cache_init_with_policy(size_t capacity, size_t key_size,
+                               _compare_fn_type compare_fn,
+                               _hash_fn_type hash_fn, cap_cache_policy policy);
+/**
+ * Initilize a cap_lru_cache with the given eviction policy and an evict
+ * function. The evict function is called with each entry the cache drops on
+ * it's own, i.e evicted by the policy or expired, after the entry left the
+ * cache, so it can free the value or write it back. It isn't called for
+ * cap_lru_cache_remove(), for a value replaced by a put, or by
+ * cap_lru_cache_free(), and it must not call back into the cache
+ *
+ * @param capacity Cache's capacity, in the unit of the entry costs
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, NULL for memcmp()
+ * @param hash_fn Function pointer for hashing a key, NULL for the default one
+ * @param policy Eviction policy
+ * @param evict_fn Function called with the key and value of a dropped entry,
+ * the reason and evict_arg
+ * @param evict_arg Pointer passed to evict_fn
+ * @return Allocated cap_lru_cache container, NULL if there was a memory error
+ */
+static cap_lru_cache *cap_lru_cache_init_with_evict_fn(
+    size_t capacity, size_t key_size, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, cap_cache_policy policy, _evict_fn_type evict_fn,
+    void *evict_arg);
+/**
+ * Initilize a cap_lru_cache like cap_lru_cache_init_with_evict_fn(), taking
+ * the cache, it's table and it's nodes from the given allocator. The optional
+ * TTL wheel and hot keys tracker still come from malloc()
+ *
+ * @param capacity Cache's capacity, in the unit of the entry costs
+ * @param key_size Size of the keys in bytes
+ * @param compare_fn Function pointer for comparing two keys, NULL for memcmp()
+ * @param hash_fn Function pointer for hashing a key, NULL for the default one
+ * @param policy Eviction policy
+ * @param evict_fn Function called with each dropped entry, may be NULL
+ * @param evict_arg Pointer passed to evict_fn
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_lru_cache container, NULL if there was a memory error
+ */
+static cap_lru_cache *cap_lru_cache_init_with_allocator(
+    size_t capacity, size_t key_size, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, cap_cache_policy policy, _evict_fn_type evict_fn,
+    void *evict_arg, const cap_allocator *allocator);
+/**
+ * Deallocate cap_lru_cache container. The keys and values aren't touched
  * 
  * @param cache cap_lru_cache pointer
  */
 static void cap_lru_cache_free(cap_lru_cache *cache);
 /**
- * Lookup a cache with key. Moves the lookuped value to front of cache.
+ * Lookup a cache with key. Marks the entry as used, for the LRU policy it
+ * moves the entry to front of cache. An expired entry is removed instead
  *
  * @param cache cap_lru_cache container
  * @param key key to lookup
- * @return Pointer to value if found. NULL otherwise.
+ * @return Pointer to value if found and not expired. NULL otherwise.
  *
  */
-static CAP_GENERIC_TYPE_PTR cap_lru_cache_get(cap_lru_cache *cache, CAP_GENERIC_TYPE_PTR key);
+static void *cap_lru_cache_get(cap_lru_cache *cache, void *key);
 /**
- * Insert it into cache at front.
+ * Insert a key-value pair into the cache. If the key is already cached, it's
+ * value is replaced. An entry chosen by the eviction policy is evicted if the
+ * cache is full. The entry gets the cache's default TTL
  *
  * @param cache cap_lru_cache container
- * @param key
- * @param value
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @return True if the operation is success, False if there was a memory error
  */
-static void cap_lru_cache_put(cap_lru_cache *cache, CAP_GENERIC_TYPE_PTR key, CAP_GENERIC_TYPE_PTR value);
+static bool cap_lru_cache_put(cap_lru_cache *cache, void *key, void *value);
+/**
+ * Lookup a batch of keys, the same as calling cap_lru_cache_get() on each key
+ * in order. The keys are hashed ahead of the lookups, so fetching their
+ * buckets overlaps
+ *
+ * @param cache cap_lru_cache container
+ * @param keys Array of count keys
+ * @param values Array of count values, filled with each key's value or NULL
+ * @param count Number of keys
+ * @return Number of keys found
+ */
+static size_t cap_lru_cache_get_many(cap_lru_cache *cache, void **keys,
+                                     void **values, size_t count);
+/**
+ * Insert a batch of key-value pairs, the same as calling cap_lru_cache_put()
+ * on each pair in order
+ *
+ * @param cache cap_lru_cache container
+ * @param keys Array of count keys
+ * @param values Array of count values
+ * @param count Number of pairs
+ * @return Number of pairs inserted, less than count if there was a memory
+ * error
+ */
+static size_t cap_lru_cache_put_many(cap_lru_cache *cache, void **keys,
+                                     void **values, size_t count);
+/**
+ * Insert a key-value pair with the given cost into the cache. If the key is
+ * already cached, it's value and cost are replaced. Entries chosen by the
+ * eviction policy are evicted until the costs fit within the capacity. The
+ * entry gets the cache's default TTL
+ *
+ * @param cache cap_lru_cache container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @param cost Cost of the entry, e.g the size of the value in bytes
+ * @return True if the operation is success, False if there was a memory error
+ * or the cost is greater than the capacity
+ */
+static bool cap_lru_cache_put_with_cost(cap_lru_cache *cache, void *key,
+                                        void *value, size_t cost);
+/**
+ * Insert a key-value pair which expires after the given TTL. If the key is
+ * already cached, it's value and expiry are replaced
+ *
+ * @param cache cap_lru_cache container
+ * @param key Pointer to the key
+ * @param value Pointer to the value
+ * @param ttl Time to live in ticks of the cache's clock, zero never expires
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool cap_lru_cache_put_with_ttl(cap_lru_cache *cache, void *key,
+                                       void *value, uint64_t ttl);
+/**
+ * Remove every entry which expired at or before now. Runs in time proportional
+ * to the number of expired entries, not to the size of the cache
+ *
+ * @param cache cap_lru_cache container
+ * @param now Current time, from the cache's clock
+ * @return Number of entries removed
+ */
+static size_t cap_lru_cache_expire_now(cap_lru_cache *cache, uint64_t now);
+/**
+ * Set the TTL which cap_lru_cache_put() and cap_lru_cache_put_with_cost() give
+ * the entries they insert. Zero, the default, never expires
+ *
+ * @param cache cap_lru_cache container
+ * @param ttl Time to live in ticks of the cache's clock
+ */
+static void cap_lru_cache_set_default_ttl(cap_lru_cache *cache, uint64_t ttl);
+/**
+ * Set the clock the TTLs are measured with. Must be called before any entry
+ * with a TTL is inserted
+ *
+ * @param cache cap_lru_cache container
+ * @param clock_fn Function returning the current time in ticks, which never
+ * goes backwards. NULL for the milliseconds of CLOCK_MONOTONIC
+ */
+static void cap_lru_cache_set_clock(cap_lru_cache *cache,
+                                    _clock_fn_type clock_fn);
+/**
+ * Check if a key is cached, without marking the entry as used
+ *
+ * @param cache cap_lru_cache container
+ * @param key key to lookup
+ * @return True if the key is cached and not expired, False if not
+ */
+static bool cap_lru_cache_contains(cap_lru_cache *cache, void *key);
+/**
+ * Remove an entry from the cache
+ *
+ * @param cache cap_lru_cache container
+ * @param key key of the entry to remove
+ * @return True if the entry was found and removed, False if not
+ */
+static bool cap_lru_cache_remove(cap_lru_cache *cache, void *key);
+/**
+ * Change the capacity of the cache. Entries are evicted until the costs fit
+ * within the new capacity. If the S3-FIFO ghost queue has to be resized, the
+ * history it holds is dropped
+ *
+ * @param cache cap_lru_cache container
+ * @param capacity New capacity of the cache
+ * @return True if the operation is success, False if there was a memory error,
+ * in which case the cache is left unchanged
+ */
+static bool cap_lru_cache_set_capacity(cap_lru_cache *cache, size_t capacity);
+/**
+ * Get the number of entries within the cache
+ *
+ * @param cache cap_lru_cache container
+ * @return Number of entries
+ */
+static size_t cap_lru_cache_size(cap_lru_cache *cache);
+/**
+ * Get the capacity of the cache
+ *
+ * @param cache cap_lru_cache container
+ * @return Capacity of the cache
+ */
+static size_t cap_lru_cache_capacity(cap_lru_cache *cache);
+/**
+ * Get the sum of the costs of the cached entries, i.e the bytes in use if the
+ * costs are sizes in bytes
+ *
+ * @param cache cap_lru_cache container
+ * @return Used capacity
+ */
+static size_t cap_lru_cache_used(cap_lru_cache *cache);
+/**
+ * Get the eviction policy of the cache
+ *
+ * @param cache cap_lru_cache container
+ * @return Eviction policy given during the initilization
+ */
+static cap_cache_policy cap_lru_cache_policy(cap_lru_cache *cache);
+/**
+ * Write the entries to a binary snapshot, so a restarted process can load them
+ * back with cap_lru_cache_load() and start warm. Each list of the policy is
+ * written from it's least to it's most recently used entry, one record at a
+ * time, so no memory is allocated whatever the size of the cache. A record
+ * holds the key bytes, the value bytes, the cost and the remaining TTL as
+ * variable length integers. Expired entries are skipped
+ *
+ * @param cache cap_lru_cache container
+ * @param file File opened for writing in binary mode
+ * @param value_size_fn Function returning the number of bytes to save from a
+ * value pointer
+ * @return True if the operation is success, False if writing failed
+ */
+static bool cap_lru_cache_save(cap_lru_cache *cache, FILE *file,
+                               _value_size_fn_type value_size_fn);
+/**
+ * Load a snapshot written by cap_lru_cache_save() into an empty cache. The
+ * entries go back on their lists in the saved order, so the recency order is
+ * the saved one. If the snapshot doesn't fit within the capacity, the least
+ * recently used entries are evicted as the more recent ones are loaded. A
+ * snapshot saved with another policy is loaded onto the main list of the
+ * cache's policy, in the saved order
+ *
+ * The cache doesn't own the keys and values, so restore_fn is called with the
+ * bytes of each record, which are only valid during the call, and gives back
+ * the key and value pointers the cache stores. Once given back they belong to
+ * the entry, like the ones of cap_lru_cache_put(), and the evict function is
+ * called for the entries evicted while loading. If the cache can't store them
+ * because of a memory error, release_fn is called with them before the
+ * loading stops, so they're handed back to the caller rather than dropped
+ *
+ * @param cache cap_lru_cache container, without entries
+ * @param file File opened for reading in binary mode
+ * @param restore_fn Function called with the key bytes, the value bytes, the
+ * value size and arg, which sets the key and value to store and returns false
+ * to stop the loading
+ * @param release_fn Function called with a key and value restore_fn gave back
+ * which the cache couldn't store, and arg. NULL if the caller keeps track of
+ * them otherwise
+ * @param arg Pointer passed to restore_fn and release_fn
+ * @return True if every record was loaded, False if the cache wasn't empty,
+ * the file isn't a snapshot of a cache with the same key size, reading failed,
+ * restore_fn stopped the loading or there was a memory error
+ */
+static bool cap_lru_cache_load(cap_lru_cache *cache, FILE *file,
+                               _restore_fn_type restore_fn,
+                               _release_fn_type release_fn, void *arg);
+/**
+ * Get the counters of the cache. Counting is always on, and costs an
+ * increment per operation
+ *
+ * @param cache cap_lru_cache container
+ * @return Copy of the counters
+ */
+static cap_cache_stats cap_lru_cache_stats(cap_lru_cache *cache);
+/**
+ * Reset the counters of the cache to zero
+ *
+ * @param cache cap_lru_cache container
+ */
+static void cap_lru_cache_reset_stats(cap_lru_cache *cache);
+/**
+ * Start tracking the most looked up keys. One in sample_rate lookups is fed to
+ * a space-saving summary of k keys, which holds every key looked up more than
+ * 1/k of the sampled lookups. Calling it again restarts the tracking, k zero
+ * stops it
+ *
+ * @param cache cap_lru_cache container
+ * @param k Number of keys tracked
+ * @param sample_rate One in this many lookups is sampled, at least one
+ * @return True if the operation is success, False if there was a memory error
+ */
+static bool cap_lru_cache_track_hot_keys(cap_lru_cache *cache, size_t k,
+                                         size_t sample_rate);
+/**
+ * Get the hottest tracked keys, the hottest first. The counts are estimated
+ * lookups, the sampled count times the sample rate, which may overestimate the
+ * keys that entered the summary late
+ *
+ * @param cache cap_lru_cache container
+ * @param keys Buffer of max keys, each key_size bytes, the keys are copied to
+ * @param counts Array of max counts, filled with each key's estimated lookups
+ * @param max Maximum number of keys to return
+ * @return Number of keys returned
+ */
+static size_t cap_lru_cache_hot_keys(cap_lru_cache *cache, void *keys,
+                                     uint64_t *counts, size_t max);
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static bool _cap_lru_cache_keys_equal(cap_lru_cache *cache, void *key_one,
+                                      void *key_two);
+static size_t _cap_lru_cache_default_hash(uint8_t *key, size_t key_size);
+static size_t _cap_lru_cache_hash_key(cap_lru_cache *cache, void *key);
+static uint64_t _cap_lru_cache_default_clock(void);
+static bool _cap_lru_cache_expired(cap_lru_cache *cache,
+                                   _cap_lru_cache_node *node);
+static bool _cap_lru_cache_set_expiry(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node, uint64_t ttl);
+static size_t _cap_lru_cache_bucket_count_for(size_t capacity);
+static _cap_lru_cache_node *_cap_lru_cache_find_node(cap_lru_cache *cache,
+                                                     void *key, size_t hash);
+static bool _cap_lru_cache_grow_slabs(cap_lru_cache *cache);
+static _cap_lru_cache_node *_cap_lru_cache_create_node(cap_lru_cache *cache,
+                                                       void *key, void *value,
+                                                       size_t hash);
+static void _cap_lru_cache_release_node(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node);
+static void _cap_lru_cache_list_push_head(cap_lru_cache *cache,
+                                          _cap_lru_cache_node *node,
+                                          unsigned char list);
+static void _cap_lru_cache_list_unlink(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node);
+static void _cap_lru_cache_move_to_head(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node);
+static void _cap_lru_cache_move_to_list(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node,
+                                        unsigned char list);
+static void _cap_lru_cache_unlink_bucket(cap_lru_cache *cache,
+                                         _cap_lru_cache_node *node);
+static void _cap_lru_cache_unlink_node(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node);
+static void _cap_lru_cache_evict_node(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node,
+                                      cap_cache_evict_reason reason);
+static void _cap_lru_cache_hash_batch(cap_lru_cache *cache, void **keys,
+                                      size_t *hashes, size_t count);
+static void _cap_lru_cache_remove_tail(cap_lru_cache *cache);
+static void _cap_lru_cache_set_segments(cap_lru_cache *cache);
+static bool _cap_lru_cache_resize_table(cap_lru_cache *cache,
+                                        size_t bucket_count);
+static size_t _cap_lru_cache_ghost_capacity_for(cap_lru_cache *cache);
+static bool _cap_lru_cache_resize_history(cap_lru_cache *cache);
+static void _cap_lru_cache_touch_node(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node);
+static void _cap_lru_cache_insert_node(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node);
+static void _cap_lru_cache_link_node(cap_lru_cache *cache,
+                                     _cap_lru_cache_node *node);
+static bool _cap_lru_cache_write_varint(FILE *file, uint64_t number);
+static bool _cap_lru_cache_read_varint(FILE *file, uint64_t *number);
+static bool _cap_lru_cache_save_node(cap_lru_cache *cache, FILE *file,
+                                     _cap_lru_cache_node *node,
+                                     _value_size_fn_type value_size_fn,
+                                     uint64_t now);
+static void _cap_lru_cache_evict_clock(cap_lru_cache *cache);
+static void _cap_lru_cache_evict_s3fifo(cap_lru_cache *cache);
+static void _cap_lru_cache_evict_tinylfu(cap_lru_cache *cache);
+static void _cap_lru_cache_admit_tinylfu(cap_lru_cache *cache);
+static void _cap_lru_cache_rebalance_tinylfu(cap_lru_cache *cache);
+static _cap_lru_cache_node *_cap_lru_cache_find_ghost(cap_lru_cache *cache,
+                                                      size_t hash);
+static void _cap_lru_cache_drop_ghost(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node);
+static void _cap_lru_cache_insert_arc(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node);
+static void _cap_lru_cache_evict_arc(cap_lru_cache *cache,
+                                     bool ghost_hit_in_b2);
+static void _cap_lru_cache_trim_arc(cap_lru_cache *cache);
+static bool _cap_lru_cache_ghost_init(const cap_allocator *allocator,
+                                      _cap_lru_cache_ghost *ghost,
+                                      size_t capacity);
+static void _cap_lru_cache_ghost_free(const cap_allocator *allocator,
+                                      _cap_lru_cache_ghost *ghost);
+static void _cap_lru_cache_ghost_insert(_cap_lru_cache_ghost *ghost,
+                                        size_t hash);
+static bool _cap_lru_cache_ghost_contains(_cap_lru_cache_ghost *ghost,
+                                          size_t hash);
+static bool _cap_lru_cache_sketch_init(const cap_allocator *allocator,
+                                       _cap_lru_cache_sketch *sketch,
+                                       size_t width);
+static void _cap_lru_cache_sketch_free(const cap_allocator *allocator,
+                                       _cap_lru_cache_sketch *sketch);
+static size_t _cap_lru_cache_sketch_index(_cap_lru_cache_sketch *sketch,
+                                          size_t hash, size_t row);
+static void _cap_lru_cache_sketch_increment(_cap_lru_cache_sketch *sketch,
+                                            size_t hash);
+static size_t _cap_lru_cache_sketch_estimate(_cap_lru_cache_sketch *sketch,
+                                             size_t hash);
+static _cap_lru_cache_hot_keys *_cap_lru_cache_hot_keys_init(
+    size_t key_size, size_t k, size_t sample_rate);
+static void _cap_lru_cache_hot_keys_free(_cap_lru_cache_hot_keys *hot);
+static bool _cap_lru_cache_hot_keys_due(_cap_lru_cache_hot_keys *hot);
+static size_t _cap_lru_cache_hot_keys_find(cap_lru_cache *cache, void *key,
+                                           size_t hash);
+static void _cap_lru_cache_hot_keys_index_insert(_cap_lru_cache_hot_keys *hot,
+                                                 size_t slot);
+static void _cap_lru_cache_hot_keys_index_remove(_cap_lru_cache_hot_keys *hot,
+                                                 size_t slot);
+static void _cap_lru_cache_hot_keys_sift_down(_cap_lru_cache_hot_keys *hot,
+                                              size_t position);
+static void _cap_lru_cache_hot_keys_swap(_cap_lru_cache_hot_keys *hot,
+                                         size_t one, size_t two);
+static void _cap_lru_cache_hot_keys_sample(cap_lru_cache *cache, void *key,
+                                           size_t hash);
+static int _cap_lru_cache_hot_keys_compare(const void *one, const void *two);
+static void *_cap_lru_cache_get_hashed(cap_lru_cache *cache, void *key,
+                                      size_t hash);
+static void *_cap_lru_cache_lookup_hashed(cap_lru_cache *cache, void *key,
+                                         size_t hash);
+static bool _cap_lru_cache_put_hashed(cap_lru_cache *cache, void *key,
+                                      void *value, size_t cost, uint64_t ttl,
+                                      size_t hash);
+static bool _cap_lru_cache_remove_hashed(cap_lru_cache *cache, void *key,
+                                         size_t hash);
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+static size_t _cap_lru_cache_default_hash(uint8_t *key, size_t key_size) {
+    // Hash type: FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key_size; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+static bool _cap_lru_cache_keys_equal(cap_lru_cache *cache, void *key_one,
+                                      void *key_two) {
+    if (cache->compare_fn) return cache->compare_fn(key_one, key_two);
+    return memcmp(key_one, key_two, cache->key_size) == 0;
+}
+
+static size_t _cap_lru_cache_hash_key(cap_lru_cache *cache, void *key) {
+    return cache->hash_fn((uint8_t *)key, cache->key_size);
+}
 
-static int hash(CAP_GENERIC_TYPE_PTR key) {
-    return (*key) % CAP_HASH_SIZE;
+static uint64_t _cap_lru_cache_default_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
 }
 
-static _cap_lru_cache_node *create_node(CAP_GENERIC_TYPE_PTR key, CAP_GENERIC_TYPE_PTR value) {
-    _cap_lru_cache_node *node = (_cap_lru_cache_node *)CAP_ALLOCATOR(_cap_lru_cache_node, 1);
-    node->key = key;
+// Only entries with a TTL read the clock
+static bool _cap_lru_cache_expired(cap_lru_cache *cache,
+                                   _cap_lru_cache_node *node) {
+    return node->timer._pprev && node->timer._expires <= cache->clock_fn();
+}
+
+static bool _cap_lru_cache_set_expiry(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node, uint64_t ttl) {
+    if (!ttl) {
+        if (cache->wheel) _cap_timer_wheel_unlink(cache->wheel, &node->timer);
+        return true;
+    }
+    if (!cache->wheel) {
+        cache->wheel = _cap_timer_wheel_init(cache->clock_fn(), false);
+        if (!cache->wheel) return false;
+    }
+    node->timer._data = node;
+    _cap_timer_wheel_schedule(cache->wheel, &node->timer,
+                              cache->clock_fn() + ttl);
+    return true;
+}
+
+static size_t _cap_lru_cache_bucket_count_for(size_t capacity) {
+    size_t bucket_count = 16;
+    while (bucket_count < capacity) bucket_count <<= 1;
+    return bucket_count;
+}
+
+static _cap_lru_cache_node *_cap_lru_cache_find_node(cap_lru_cache *cache,
+                                                     void *key, size_t hash) {
+    _cap_lru_cache_node *node = cache->table[hash & (cache->bucket_count - 1)];
+    while (node) {
+        // ARC's ghosts share the table, they have no key
+        if (node->hash == hash && node->key &&
+            _cap_lru_cache_keys_equal(cache, node->key, key))
+            return node;
+        node = node->hnext;
+    }
+    return NULL;
+}
+
+static bool _cap_lru_cache_grow_slabs(cap_lru_cache *cache) {
+    _cap_lru_cache_slab *slab = (_cap_lru_cache_slab *)_cap_allocator_alloc(
+        &cache->allocator, sizeof(_cap_lru_cache_slab) +
+                               sizeof(_cap_lru_cache_node) * cache->slab_nodes);
+    if (!slab) return false;
+    slab->node_count = cache->slab_nodes;
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+    for (size_t i = 0; i < slab->node_count; ++i) {
+        slab->nodes[i].hnext = cache->free_nodes;
+        cache->free_nodes = &slab->nodes[i];
+    }
+    if (cache->slab_nodes < CAP_LRU_CACHE_MAX_SLAB_NODES)
+        cache->slab_nodes <<= 1;
+    return true;
+}
+
+static _cap_lru_cache_node *_cap_lru_cache_create_node(cap_lru_cache *cache,
+                                                       void *key, void *value,
+                                                       size_t hash) {
+    if (!cache->free_nodes && !_cap_lru_cache_grow_slabs(cache)) return NULL;
+    _cap_lru_cache_node *node = cache->free_nodes;
+    cache->free_nodes = node->hnext;
+    memset(node, 0, sizeof(_cap_lru_cache_node));
+    node->key = (CAP_GENERIC_TYPE_PTR)key;
     node->value = value;
-    node->prev = node->next = NULL;
+    node->hash = hash;
     return node;
 }
 
-static void move_to_head(cap_lru_cache *cache, _cap_lru_cache_node *node) {
-    if (node == cache->head) return;
-    
+static void _cap_lru_cache_release_node(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node) {
+    node->hnext = cache->free_nodes;
+    cache->free_nodes = node;
+}
+
+static void _cap_lru_cache_list_push_head(cap_lru_cache *cache,
+                                          _cap_lru_cache_node *node,
+                                          unsigned char list) {
+    _cap_lru_cache_list *target = &cache->lists[list];
+    node->list = list;
+    node->prev = NULL;
+    node->next = target->head;
+    if (target->head) target->head->prev = node;
+    target->head = node;
+    if (!target->tail) target->tail = node;
+    target->size++;
+    target->weight += node->cost;
+}
+
+static void _cap_lru_cache_list_unlink(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node) {
+    _cap_lru_cache_list *source = &cache->lists[node->list];
     if (node->prev) node->prev->next = node->next;
+    else source->head = node->next;
     if (node->next) node->next->prev = node->prev;
-    if (node == cache->tail) cache->tail = node->prev;
+    else source->tail = node->prev;
+    source->size--;
+    source->weight -= node->cost;
+}
 
-    node->next = cache->head;
-    node->prev = NULL;
+static void _cap_lru_cache_move_to_head(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node) {
+    node->stamp = ++cache->clock;
+    if (node == cache->lists[node->list].head) return;
+    _cap_lru_cache_move_to_list(cache, node, node->list);
+}
+
+static void _cap_lru_cache_move_to_list(cap_lru_cache *cache,
+                                        _cap_lru_cache_node *node,
+                                        unsigned char list) {
+    _cap_lru_cache_list_unlink(cache, node);
+    _cap_lru_cache_list_push_head(cache, node, list);
+}
+
+static void _cap_lru_cache_unlink_bucket(cap_lru_cache *cache,
+                                         _cap_lru_cache_node *node) {
+    _cap_lru_cache_node **link =
+        &cache->table[node->hash & (cache->bucket_count - 1)];
+    while (*link != node) link = &(*link)->hnext;
+    *link = node->hnext;
+}
+
+static void _cap_lru_cache_unlink_node(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node) {
+    _cap_lru_cache_list_unlink(cache, node);
+    _cap_lru_cache_unlink_bucket(cache, node);
+    if (cache->wheel) _cap_timer_wheel_unlink(cache->wheel, &node->timer);
+    cache->used -= node->cost;
+    _cap_lru_cache_release_node(cache, node);
+    cache->size--;
+}
+
+static void _cap_lru_cache_evict_node(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node,
+                                      cap_cache_evict_reason reason) {
+    if (reason == CAP_CACHE_EXPIRED) cache->stats.expirations++;
+    else cache->stats.evictions++;
+    void *key = node->key;
+    void *value = node->value;
+    _cap_lru_cache_unlink_node(cache, node);
+    if (cache->evict_fn) cache->evict_fn(key, value, reason, cache->evict_arg);
+}
+
+// Hashes the keys and prefetches their buckets, so that the lookups which
+// follow don't wait on the buckets one after the other
+static void _cap_lru_cache_hash_batch(cap_lru_cache *cache, void **keys,
+                                      size_t *hashes, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        hashes[i] = _cap_lru_cache_hash_key(cache, keys[i]);
+        __builtin_prefetch(
+            &cache->table[hashes[i] & (cache->bucket_count - 1)]);
+    }
+}
 
-    if (cache->head) cache->head->prev = node;
-    cache->head = node;
+// Evicts one entry, the way the cache's policy picks it
+static void _cap_lru_cache_remove_tail(cap_lru_cache *cache) {
+    if (!cache->size) return;
+    switch (cache->policy) {
+    case CAP_CACHE_POLICY_CLOCK:
+        _cap_lru_cache_evict_clock(cache);
+        break;
+    case CAP_CACHE_POLICY_S3FIFO:
+        _cap_lru_cache_evict_s3fifo(cache);
+        break;
+    case CAP_CACHE_POLICY_TINYLFU:
+        _cap_lru_cache_evict_tinylfu(cache);
+        break;
+    case CAP_CACHE_POLICY_ARC:
+        _cap_lru_cache_evict_arc(cache, false);
+        break;
+    default:
+        _cap_lru_cache_evict_node(cache, cache->lists[0].tail,
+                                  CAP_CACHE_EVICTED);
+        break;
+    }
+}
 
-    if (!cache->tail) cache->tail = node;
+static void _cap_lru_cache_set_segments(cap_lru_cache *cache) {
+    size_t ratio = cache->policy == CAP_CACHE_POLICY_S3FIFO
+                       ? CAP_LRU_CACHE_S3FIFO_SMALL_RATIO
+                       : CAP_LRU_CACHE_TINYLFU_WINDOW_RATIO;
+    cache->small_capacity = cache->capacity * ratio / 100;
+    if (!cache->small_capacity) cache->small_capacity = 1;
+    cache->protected_capacity =
+        (cache->capacity - cache->small_capacity) *
+        CAP_LRU_CACHE_TINYLFU_PROTECTED_RATIO / 100;
 }
 
-static void remove_tail(cap_lru_cache *cache) {
-    if (!cache->tail) return;
+static bool _cap_lru_cache_resize_table(cap_lru_cache *cache,
+                                        size_t bucket_count) {
+    _cap_lru_cache_node **table = (_cap_lru_cache_node **)_cap_allocator_calloc(
+        &cache->allocator, bucket_count, sizeof(_cap_lru_cache_node *));
+    if (!table) return false;
+    // The hashes are stored within the nodes, so rehashing doesn't call the
+    // hash function again
+    for (int list = 0; list < CAP_LRU_CACHE_LISTS; ++list) {
+        _cap_lru_cache_node *node = cache->lists[list].head;
+        for (; node; node = node->next) {
+            size_t index = node->hash & (bucket_count - 1);
+            node->hnext = table[index];
+            table[index] = node;
+        }
+    }
+    _cap_allocator_free(&cache->allocator, cache->table,
+                        sizeof(_cap_lru_cache_node *) * cache->bucket_count);
+    cache->table = table;
+    cache->bucket_count = bucket_count;
+    return true;
+}
 
-    _cap_lru_cache_node *node = cache->tail;
-    if (node->prev) node->prev->next = NULL;
-    cache->tail = node->prev;
+// The ghost queue remembers as many keys as the main queue holds, which is
+// the main queue's capacity when every cost is one, and is bounded by the
+// number of entries otherwise
+static size_t _cap_lru_cache_ghost_capacity_for(cap_lru_cache *cache) {
+    size_t capacity = cache->capacity - cache->small_capacity;
+    if (capacity > cache->bucket_count) capacity = cache->bucket_count;
+    return capacity ? capacity : 1;
+}
 
-    if (!cache->tail) cache->head = NULL;
+// Resizes the S3-FIFO ghost queue and the W-TinyLFU sketch, which are sized
+// from the number of entries, after the capacity or the table changed
+static bool _cap_lru_cache_resize_history(cap_lru_cache *cache) {
+    if (cache->policy == CAP_CACHE_POLICY_S3FIFO &&
+        cache->ghost.capacity != _cap_lru_cache_ghost_capacity_for(cache)) {
+        _cap_lru_cache_ghost ghost;
+        if (!_cap_lru_cache_ghost_init(
+                &cache->allocator, &ghost,
+                _cap_lru_cache_ghost_capacity_for(cache)))
+            return false;
+        _cap_lru_cache_ghost_free(&cache->allocator, &cache->ghost);
+        cache->ghost = ghost;
+    }
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU &&
+        cache->sketch.width < cache->bucket_count) {
+        _cap_lru_cache_sketch sketch;
+        if (!_cap_lru_cache_sketch_init(&cache->allocator, &sketch,
+                                        cache->bucket_count))
+            return false;
+        _cap_lru_cache_sketch_free(&cache->allocator, &cache->sketch);
+        cache->sketch = sketch;
+    }
+    return true;
+}
 
-    cache->table[hash(node->key)] = NULL;
-    free(node);
+// Records a hit on the node
+static void _cap_lru_cache_touch_node(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node) {
+    switch (cache->policy) {
+    case CAP_CACHE_POLICY_CLOCK:
+        node->freq = 1;
+        break;
+    case CAP_CACHE_POLICY_S3FIFO:
+        if (node->freq < CAP_LRU_CACHE_S3FIFO_MAX_FREQ) node->freq++;
+        break;
+    case CAP_CACHE_POLICY_TINYLFU:
+        // A hit on probation promotes the entry to the protected segment
+        if (node->list == 1) {
+            node->stamp = ++cache->clock;
+            _cap_lru_cache_move_to_list(cache, node, 2);
+            _cap_lru_cache_rebalance_tinylfu(cache);
+        } else {
+            _cap_lru_cache_move_to_head(cache, node);
+        }
+        break;
+    case CAP_CACHE_POLICY_ARC:
+        // A hit on T1 promotes the entry to T2, the entries used more than
+        // once
+        if (node->list == 0) {
+            node->stamp = ++cache->clock;
+            _cap_lru_cache_move_to_list(cache, node, 1);
+        } else {
+            _cap_lru_cache_move_to_head(cache, node);
+        }
+        break;
+    default:
+        _cap_lru_cache_move_to_head(cache, node);
+        break;
+    }
+}
+
+// Links a new node into the table and the policy's lists, evicting as needed
+static void _cap_lru_cache_insert_node(cap_lru_cache *cache,
+                                       _cap_lru_cache_node *node) {
+    if (cache->policy == CAP_CACHE_POLICY_ARC) {
+        _cap_lru_cache_insert_arc(cache, node);
+        return;
+    }
+    if (cache->policy != CAP_CACHE_POLICY_TINYLFU)
+        while (cache->size && cache->used + node->cost > cache->capacity)
+            _cap_lru_cache_remove_tail(cache);
+
+    _cap_lru_cache_link_node(cache, node);
+    node->freq = 0;
+    if (cache->policy == CAP_CACHE_POLICY_S3FIFO &&
+        _cap_lru_cache_ghost_contains(&cache->ghost, node->hash)) {
+        _cap_lru_cache_list_push_head(cache, node, 1);
+        return;
+    }
+    _cap_lru_cache_list_push_head(cache, node, 0);
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU)
+        _cap_lru_cache_admit_tinylfu(cache);
+}
+
+// Links a node into the table and counts it, the caller pushes it on a list
+static void _cap_lru_cache_link_node(cap_lru_cache *cache,
+                                     _cap_lru_cache_node *node) {
+    // Growing is best effort, a failure only leaves longer chains
+    size_t linked = cache->size;
+    if (cache->policy == CAP_CACHE_POLICY_ARC)
+        linked += cache->lists[2].size + cache->lists[3].size;
+    if (linked >= cache->bucket_count &&
+        _cap_lru_cache_resize_table(cache, cache->bucket_count * 2))
+        _cap_lru_cache_resize_history(cache);
+    size_t index = node->hash & (cache->bucket_count - 1);
+    node->hnext = cache->table[index];
+    cache->table[index] = node;
+    node->stamp = ++cache->clock;
+    cache->used += node->cost;
+    cache->size++;
+}
+
+static void _cap_lru_cache_evict_clock(cap_lru_cache *cache) {
+    // The tail is the clock hand, entries which were referenced since the
+    // hand last passed get their bit cleared and go around once more
+    _cap_lru_cache_node *node = cache->lists[0].tail;
+    while (node->freq) {
+        node->freq = 0;
+        _cap_lru_cache_move_to_list(cache, node, 0);
+        node = cache->lists[0].tail;
+    }
+    _cap_lru_cache_evict_node(cache, node, CAP_CACHE_EVICTED);
+}
+
+static void _cap_lru_cache_evict_s3fifo(cap_lru_cache *cache) {
+    _cap_lru_cache_list *small = &cache->lists[0];
+    _cap_lru_cache_list *main = &cache->lists[1];
+    for (;;) {
+        if (small->size && (small->weight >= cache->small_capacity ||
+                            !main->size)) {
+            _cap_lru_cache_node *node = small->tail;
+            if (node->freq > 1) {
+                node->freq = 0;
+                _cap_lru_cache_move_to_list(cache, node, 1);
+                continue;
+            }
+            _cap_lru_cache_ghost_insert(&cache->ghost, node->hash);
+            _cap_lru_cache_evict_node(cache, node, CAP_CACHE_EVICTED);
+            return;
+        }
+        _cap_lru_cache_node *node = main->tail;
+        if (node->freq) {
+            node->freq--;
+            _cap_lru_cache_move_to_list(cache, node, 1);
+            continue;
+        }
+        _cap_lru_cache_evict_node(cache, node, CAP_CACHE_EVICTED);
+        return;
+    }
+}
+
+static void _cap_lru_cache_evict_tinylfu(cap_lru_cache *cache) {
+    // Probation first, then the window, then the protected segment
+    static const unsigned char order[3] = {1, 0, 2};
+    for (int i = 0; i < 3; ++i) {
+        if (cache->lists[order[i]].tail) {
+            _cap_lru_cache_evict_node(cache, cache->lists[order[i]].tail,
+                                      CAP_CACHE_EVICTED);
+            return;
+        }
+    }
+}
+
+static void _cap_lru_cache_admit_tinylfu(cap_lru_cache *cache) {
+    _cap_lru_cache_list *window = &cache->lists[0];
+    while (window->size && window->weight > cache->small_capacity) {
+        _cap_lru_cache_node *candidate = window->tail;
+        if (cache->used <= cache->capacity) {
+            _cap_lru_cache_move_to_list(cache, candidate, 1);
+            continue;
+        }
+        // The main space is full, the window's candidate only gets in if
+        // it's used more frequently than each victim it displaces
+        _cap_lru_cache_node *victim = cache->lists[1].tail;
+        if (!victim) victim = cache->lists[2].tail;
+        if (victim &&
+            _cap_lru_cache_sketch_estimate(&cache->sketch, candidate->hash) >
+                _cap_lru_cache_sketch_estimate(&cache->sketch, victim->hash))
+            _cap_lru_cache_evict_node(cache, victim, CAP_CACHE_EVICTED);
+        else
+            _cap_lru_cache_evict_node(cache, candidate, CAP_CACHE_EVICTED);
+    }
+    while (cache->used > cache->capacity) _cap_lru_cache_evict_tinylfu(cache);
+}
+
+static void _cap_lru_cache_rebalance_tinylfu(cap_lru_cache *cache) {
+    while (cache->lists[2].size &&
+           cache->lists[2].weight > cache->protected_capacity)
+        _cap_lru_cache_move_to_list(cache, cache->lists[2].tail, 1);
+}
+
+// ARC's ghost lists hold nodes without a key or a value, which stay in the
+// table under the hash of the evicted key
+static _cap_lru_cache_node *_cap_lru_cache_find_ghost(cap_lru_cache *cache,
+                                                      size_t hash) {
+    _cap_lru_cache_node *node = cache->table[hash & (cache->bucket_count - 1)];
+    for (; node; node = node->hnext)
+        if (!node->key && node->hash == hash) return node;
+    return NULL;
+}
+
+static void _cap_lru_cache_drop_ghost(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node) {
+    _cap_lru_cache_list_unlink(cache, node);
+    _cap_lru_cache_unlink_bucket(cache, node);
+    _cap_lru_cache_release_node(cache, node);
+}
+
+static void _cap_lru_cache_insert_arc(cap_lru_cache *cache,
+                                      _cap_lru_cache_node *node) {
+    _cap_lru_cache_list *lists = cache->lists;
+    _cap_lru_cache_node *ghost = _cap_lru_cache_find_ghost(cache, node->hash);
+    bool ghost_hit = ghost != NULL;
+    bool ghost_hit_in_b2 = ghost_hit && ghost->list == 3;
+    if (ghost_hit) {
+        // The target moves towards the list whose ghost was hit, by more
+        // when that ghost list is the smaller one
+        size_t delta = ghost->cost;
+        size_t b1 = lists[2].weight, b2 = lists[3].weight;
+        if (ghost_hit_in_b2) {
+            if (b1 > b2) delta *= b1 / b2;
+            cache->arc_target =
+                cache->arc_target > delta ? cache->arc_target - delta : 0;
+        } else {
+            if (b2 > b1) delta *= b2 / b1;
+            cache->arc_target = cache->capacity - cache->arc_target > delta
+                                    ? cache->arc_target + delta
+                                    : cache->capacity;
+        }
+        _cap_lru_cache_drop_ghost(cache, ghost);
+    }
+    while (cache->size && cache->used + node->cost > cache->capacity)
+        _cap_lru_cache_evict_arc(cache, ghost_hit_in_b2);
+    _cap_lru_cache_link_node(cache, node);
+    node->freq = 0;
+    // A key seen on a ghost list was used before, it goes straight to T2
+    _cap_lru_cache_list_push_head(cache, node, ghost_hit ? 1 : 0);
+    _cap_lru_cache_trim_arc(cache);
+}
+
+// ARC's REPLACE: the victim is T1's tail while T1 is over it's target, T2's
+// tail otherwise, and the victim's node becomes a ghost
+static void _cap_lru_cache_evict_arc(cap_lru_cache *cache,
+                                     bool ghost_hit_in_b2) {
+    _cap_lru_cache_list *t1 = &cache->lists[0];
+    bool from_t1 = t1->size && (t1->weight > cache->arc_target ||
+                                (ghost_hit_in_b2 &&
+                                 t1->weight == cache->arc_target) ||
+                                !cache->lists[1].size);
+    unsigned char list = from_t1 ? 0 : 1;
+    _cap_lru_cache_node *node = cache->lists[list].tail;
+    cache->stats.evictions++;
+    void *key = node->key;
+    void *value = node->value;
+    _cap_lru_cache_list_unlink(cache, node);
+    if (cache->wheel) _cap_timer_wheel_unlink(cache->wheel, &node->timer);
+    cache->used -= node->cost;
     cache->size--;
+    node->key = NULL;
+    node->value = NULL;
+    // Ghosts weigh at least one, so that the bounds below limit their number
+    if (!node->cost) node->cost = 1;
+    _cap_lru_cache_list_push_head(cache, node, list + 2);
+    _cap_lru_cache_trim_arc(cache);
+    if (cache->evict_fn)
+        cache->evict_fn(key, value, CAP_CACHE_EVICTED, cache->evict_arg);
+}
+
+// T1 and B1 together weigh at most the capacity, and the four lists together
+// at most twice the capacity
+static void _cap_lru_cache_trim_arc(cap_lru_cache *cache) {
+    _cap_lru_cache_list *lists = cache->lists;
+    while (lists[2].size &&
+           lists[0].weight + lists[2].weight > cache->capacity)
+        _cap_lru_cache_drop_ghost(cache, lists[2].tail);
+    while (lists[3].size && lists[0].weight + lists[1].weight +
+                                    lists[2].weight + lists[3].weight >
+                                2 * cache->capacity)
+        _cap_lru_cache_drop_ghost(cache, lists[3].tail);
+}
+
+static bool _cap_lru_cache_ghost_init(const cap_allocator *allocator,
+                                      _cap_lru_cache_ghost *ghost,
+                                      size_t capacity) {
+    memset(ghost, 0, sizeof(_cap_lru_cache_ghost));
+    ghost->capacity = capacity ? capacity : 1;
+    ghost->bucket_count = _cap_lru_cache_bucket_count_for(ghost->capacity);
+    ghost->hashes = (size_t *)_cap_allocator_alloc(
+        allocator, sizeof(size_t) * ghost->capacity);
+    ghost->next = (size_t *)_cap_allocator_alloc(
+        allocator, sizeof(size_t) * ghost->capacity);
+    ghost->buckets = (size_t *)_cap_allocator_alloc(
+        allocator, sizeof(size_t) * ghost->bucket_count);
+    if (!ghost->hashes || !ghost->next || !ghost->buckets) {
+        _cap_lru_cache_ghost_free(allocator, ghost);
+        return false;
+    }
+    for (size_t i = 0; i < ghost->bucket_count; ++i)
+        ghost->buckets[i] = CAP_LRU_CACHE_GHOST_NONE;
+    return true;
+}
+
+static void _cap_lru_cache_ghost_free(const cap_allocator *allocator,
+                                      _cap_lru_cache_ghost *ghost) {
+    _cap_allocator_free(allocator, ghost->hashes,
+                        sizeof(size_t) * ghost->capacity);
+    _cap_allocator_free(allocator, ghost->next,
+                        sizeof(size_t) * ghost->capacity);
+    _cap_allocator_free(allocator, ghost->buckets,
+                        sizeof(size_t) * ghost->bucket_count);
+    memset(ghost, 0, sizeof(_cap_lru_cache_ghost));
+}
+
+static void _cap_lru_cache_ghost_insert(_cap_lru_cache_ghost *ghost,
+                                        size_t hash) {
+    size_t slot = ghost->position;
+    if (ghost->size == ghost->capacity) {
+        // Drop the oldest hash, which sits in the slot being reused
+        size_t *link = &ghost->buckets[ghost->hashes[slot] &
+                                       (ghost->bucket_count - 1)];
+        while (*link != slot) link = &ghost->next[*link];
+        *link = ghost->next[slot];
+    } else {
+        ghost->size++;
+    }
+    size_t *bucket = &ghost->buckets[hash & (ghost->bucket_count - 1)];
+    ghost->hashes[slot] = hash;
+    ghost->next[slot] = *bucket;
+    *bucket = slot;
+    ghost->position = (slot + 1) % ghost->capacity;
+}
+
+static bool _cap_lru_cache_ghost_contains(_cap_lru_cache_ghost *ghost,
+                                          size_t hash) {
+    size_t slot = ghost->buckets[hash & (ghost->bucket_count - 1)];
+    while (slot != CAP_LRU_CACHE_GHOST_NONE) {
+        if (ghost->hashes[slot] == hash) return true;
+        slot = ghost->next[slot];
+    }
+    return false;
+}
+
+static bool _cap_lru_cache_sketch_init(const cap_allocator *allocator,
+                                       _cap_lru_cache_sketch *sketch,
+                                       size_t width) {
+    sketch->width = width;
+    sketch->additions = 0;
+    sketch->sample_size = width * CAP_LRU_CACHE_SKETCH_SAMPLE_FACTOR;
+    sketch->counters = (uint8_t *)_cap_allocator_calloc(
+        allocator, sketch->width * CAP_LRU_CACHE_SKETCH_DEPTH, sizeof(uint8_t));
+    return sketch->counters != NULL;
+}
+
+static void _cap_lru_cache_sketch_free(const cap_allocator *allocator,
+                                       _cap_lru_cache_sketch *sketch) {
+    _cap_allocator_free(allocator, sketch->counters,
+                        sketch->width * CAP_LRU_CACHE_SKETCH_DEPTH);
+    sketch->counters = NULL;
+}
+
+static size_t _cap_lru_cache_sketch_index(_cap_lru_cache_sketch *sketch,
+                                          size_t hash, size_t row) {
+    // Each row indexes with a different combination of two halves of a
+    // remixed hash, the odd step keeps the rows independent
+    uint64_t mixed = (uint64_t)hash * 0x9E3779B97F4A7C15ULL;
+    mixed ^= mixed >> 32;
+    uint64_t step = (mixed >> 17) | 1;
+    return row * sketch->width + (size_t)((mixed + row * step) &
+                                          (sketch->width - 1));
+}
+
+static void _cap_lru_cache_sketch_increment(_cap_lru_cache_sketch *sketch,
+                                            size_t hash) {
+    for (size_t row = 0; row < CAP_LRU_CACHE_SKETCH_DEPTH; ++row) {
+        uint8_t *counter =
+            &sketch->counters[_cap_lru_cache_sketch_index(sketch, hash, row)];
+        if (*counter < CAP_LRU_CACHE_SKETCH_MAX_COUNT) (*counter)++;
+    }
+    // Halving every counter once in a while lets old popularity fade away
+    if (++sketch->additions >= sketch->sample_size) {
+        for (size_t i = 0; i < sketch->width * CAP_LRU_CACHE_SKETCH_DEPTH; ++i)
+            sketch->counters[i] >>= 1;
+        sketch->additions /= 2;
+    }
+}
+
+static size_t _cap_lru_cache_sketch_estimate(_cap_lru_cache_sketch *sketch,
+                                             size_t hash) {
+    size_t estimate = CAP_LRU_CACHE_SKETCH_MAX_COUNT;
+    for (size_t row = 0; row < CAP_LRU_CACHE_SKETCH_DEPTH; ++row) {
+        size_t count =
+            sketch->counters[_cap_lru_cache_sketch_index(sketch, hash, row)];
+        if (count < estimate) estimate = count;
+    }
+    return estimate;
+}
+
+cap_lru_cache *cap_lru_cache_init_with_keys(size_t capacity, size_t key_size,
+                                            _compare_fn_type compare_fn,
+                                            _hash_fn_type hash_fn) {
+    return cap_lru_cache_init_with_policy(capacity, key_size, compare_fn,
+                                          hash_fn, CAP_CACHE_POLICY_LRU);
 }
 
 cap_lru_cache *cap_lru_cache_init(int capacity) {
-    cap_lru_cache *cache = (cap_lru_cache *)CAP_ALLOCATOR(cap_lru_cache, 1);
+    assert(capacity > 0);
+    return cap_lru_cache_init_with_keys((size_t)capacity, sizeof(int), NULL,
+                                        NULL);
+}
+
+cap_lru_cache *cap_lru_cache_init_with_policy(size_t capacity, size_t key_size,
+                                              _compare_fn_type compare_fn,
+                                              _hash_fn_type hash_fn,
+                                              cap_cache_policy policy) {
+    return cap_lru_cache_init_with_evict_fn(capacity, key_size, compare_fn,
+                                            hash_fn, policy, NULL, NULL);
+}
+
+cap_lru_cache *cap_lru_cache_init_with_evict_fn(
+    size_t capacity, size_t key_size, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, cap_cache_policy policy, _evict_fn_type evict_fn,
+    void *evict_arg) {
+    return cap_lru_cache_init_with_allocator(capacity, key_size, compare_fn,
+                                             hash_fn, policy, evict_fn,
+                                             evict_arg, NULL);
+}
+
+cap_lru_cache *cap_lru_cache_init_with_allocator(
+    size_t capacity, size_t key_size, _compare_fn_type compare_fn,
+    _hash_fn_type hash_fn, cap_cache_policy policy, _evict_fn_type evict_fn,
+    void *evict_arg, const cap_allocator *allocator) {
+    assert(capacity > 0 && key_size > 0);
+    cap_lru_cache *cache = (cap_lru_cache *)_cap_allocator_calloc(
+        allocator, 1, sizeof(cap_lru_cache));
+    if (!cache) {
+        fprintf(stderr, "memory allocation failure\n");
+        return NULL;
+    }
+    if (allocator) cache->allocator = *allocator;
     cache->capacity = capacity;
+    cache->used = 0;
     cache->size = 0;
-    cache->table = (_cap_lru_cache_node **)calloc(CAP_HASH_SIZE, sizeof(_cap_lru_cache_node *));
-    cache->head = cache->tail = NULL;
+    cache->key_size = key_size;
+    cache->compare_fn = compare_fn;
+    cache->hash_fn = hash_fn ? hash_fn : _cap_lru_cache_default_hash;
+    cache->clock_fn = _cap_lru_cache_default_clock;
+    cache->slab_nodes = CAP_LRU_CACHE_MIN_SLAB_NODES;
+    cache->policy = policy;
+    cache->evict_fn = evict_fn;
+    cache->evict_arg = evict_arg;
+    _cap_lru_cache_set_segments(cache);
+    cache->bucket_count = _cap_lru_cache_bucket_count_for(
+        capacity < CAP_LRU_CACHE_MAX_INITIAL_BUCKETS
+            ? capacity
+            : CAP_LRU_CACHE_MAX_INITIAL_BUCKETS);
+    cache->table = (_cap_lru_cache_node **)_cap_allocator_calloc(
+        allocator, cache->bucket_count, sizeof(_cap_lru_cache_node *));
+    bool allocated = cache->table != NULL;
+    if (policy == CAP_CACHE_POLICY_S3FIFO)
+        allocated = _cap_lru_cache_ghost_init(
+                        allocator, &cache->ghost,
+                        _cap_lru_cache_ghost_capacity_for(cache)) &&
+                    allocated;
+    if (policy == CAP_CACHE_POLICY_TINYLFU)
+        allocated =
+            _cap_lru_cache_sketch_init(allocator, &cache->sketch,
+                                       cache->bucket_count) &&
+            allocated;
+    if (!allocated) {
+        fprintf(stderr, "memory allocation failure\n");
+        _cap_lru_cache_ghost_free(allocator, &cache->ghost);
+        _cap_lru_cache_sketch_free(allocator, &cache->sketch);
+        _cap_allocator_free(allocator, cache->table,
+                            sizeof(_cap_lru_cache_node *) *
+                                cache->bucket_count);
+        _cap_allocator_free(allocator, cache, sizeof(cap_lru_cache));
+        return NULL;
+    }
     return cache;
 }
 
 void cap_lru_cache_free(cap_lru_cache *cache) {
-    _cap_lru_cache_node *current = cache->head;
-    while (current) {
-        _cap_lru_cache_node *temp = current;
-        current = current->next;
-        free(temp);
+    assert(cache != NULL);
+    cap_allocator allocator = cache->allocator;
+    while (cache->slabs) {
+        _cap_lru_cache_slab *temp = cache->slabs;
+        cache->slabs = temp->next;
+        _cap_allocator_free(&allocator, temp,
+                            sizeof(_cap_lru_cache_slab) +
+                                sizeof(_cap_lru_cache_node) * temp->node_count);
     }
-    free(cache->table);
-    free(cache);
+    _cap_lru_cache_ghost_free(&allocator, &cache->ghost);
+    _cap_lru_cache_sketch_free(&allocator, &cache->sketch);
+    if (cache->wheel) cap_timer_wheel_free(cache->wheel);
+    if (cache->hot) _cap_lru_cache_hot_keys_free(cache->hot);
+    _cap_allocator_free(&allocator, cache->table,
+                        sizeof(_cap_lru_cache_node *) * cache->bucket_count);
+    _cap_allocator_free(&allocator, cache, sizeof(cap_lru_cache));
+}
+
+void *cap_lru_cache_get(cap_lru_cache *cache, void *key) {
+    assert(cache != NULL && key != NULL);
+    return _cap_lru_cache_get_hashed(cache, key,
+                                     _cap_lru_cache_hash_key(cache, key));
+}
+
+static void *_cap_lru_cache_get_hashed(cap_lru_cache *cache, void *key,
+                                      size_t hash) {
+    if (cache->hot && _cap_lru_cache_hot_keys_due(cache->hot))
+        _cap_lru_cache_hot_keys_sample(cache, key, hash);
+    return _cap_lru_cache_lookup_hashed(cache, key, hash);
 }
 
-CAP_GENERIC_TYPE_PTR cap_lru_cache_get(cap_lru_cache *cache, CAP_GENERIC_TYPE_PTR key) {
-    int index = hash(key);
-    _cap_lru_cache_node *node = cache->table[index];
+// A lookup without the hot keys sampling, for callers which already counted it
+static void *_cap_lru_cache_lookup_hashed(cap_lru_cache *cache, void *key,
+                                         size_t hash) {
+    // W-TinyLFU counts misses as well, they are what the admission compares
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU)
+        _cap_lru_cache_sketch_increment(&cache->sketch, hash);
+    _cap_lru_cache_node *node = _cap_lru_cache_find_node(cache, key, hash);
     
-    if (node && *node->key == *key) {
-        move_to_head(cache, node);
+    if (node && _cap_lru_cache_expired(cache, node)) {
+        _cap_lru_cache_evict_node(cache, node, CAP_CACHE_EXPIRED);
+        cache->stats.misses++;
+        return NULL;
+    }
+    if (node) {
+        _cap_lru_cache_touch_node(cache, node);
+        cache->stats.hits++;
         return node->value;
     }
     
+    cache->stats.misses++;
     return NULL;
 }
 
-void cap_lru_cache_put(cap_lru_cache *cache, CAP_GENERIC_TYPE_PTR key, CAP_GENERIC_TYPE_PTR value) {
-    int index = hash(key);
-    _cap_lru_cache_node *node = cache->table[index];
+size_t cap_lru_cache_get_many(cap_lru_cache *cache, void **keys,
+                              void **values, size_t count) {
+    assert(cache != NULL && keys != NULL && values != NULL);
+    size_t hashes[CAP_LRU_CACHE_BATCH_SIZE];
+    size_t hits = 0;
+    for (size_t start = 0; start < count; start += CAP_LRU_CACHE_BATCH_SIZE) {
+        size_t batch = count - start < CAP_LRU_CACHE_BATCH_SIZE
+                           ? count - start
+                           : CAP_LRU_CACHE_BATCH_SIZE;
+        _cap_lru_cache_hash_batch(cache, keys + start, hashes, batch);
+        for (size_t i = 0; i < batch; ++i) {
+            values[start + i] =
+                _cap_lru_cache_get_hashed(cache, keys[start + i], hashes[i]);
+            if (values[start + i]) hits++;
+        }
+    }
+    return hits;
+}
+
+size_t cap_lru_cache_put_many(cap_lru_cache *cache, void **keys,
+                              void **values, size_t count) {
+    assert(cache != NULL && keys != NULL && values != NULL);
+    size_t hashes[CAP_LRU_CACHE_BATCH_SIZE];
+    size_t inserted = 0;
+    for (size_t start = 0; start < count; start += CAP_LRU_CACHE_BATCH_SIZE) {
+        size_t batch = count - start < CAP_LRU_CACHE_BATCH_SIZE
+                           ? count - start
+                           : CAP_LRU_CACHE_BATCH_SIZE;
+        _cap_lru_cache_hash_batch(cache, keys + start, hashes, batch);
+        for (size_t i = 0; i < batch; ++i)
+            if (_cap_lru_cache_put_hashed(cache, keys[start + i],
+                                          values[start + i], 1,
+                                          cache->default_ttl, hashes[i]))
+                inserted++;
+    }
+    return inserted;
+}
+
+bool cap_lru_cache_put(cap_lru_cache *cache, void *key, void *value) {
+    assert(cache != NULL && key != NULL);
+    return _cap_lru_cache_put_hashed(cache, key, value, 1, cache->default_ttl,
+                                     _cap_lru_cache_hash_key(cache, key));
+}
+
+bool cap_lru_cache_put_with_cost(cap_lru_cache *cache, void *key, void *value,
+                                 size_t cost) {
+    assert(cache != NULL && key != NULL);
+    return _cap_lru_cache_put_hashed(cache, key, value, cost,
+                                     cache->default_ttl,
+                                     _cap_lru_cache_hash_key(cache, key));
+}
+
+bool cap_lru_cache_put_with_ttl(cap_lru_cache *cache, void *key, void *value,
+                                uint64_t ttl) {
+    assert(cache != NULL && key != NULL);
+    return _cap_lru_cache_put_hashed(cache, key, value, 1, ttl,
+                                     _cap_lru_cache_hash_key(cache, key));
+}
 
-    if (node && *node->key == *key) {
+static bool _cap_lru_cache_put_hashed(cap_lru_cache *cache, void *key,
+                                      void *value, size_t cost, uint64_t ttl,
+                                      size_t hash) {
+    if (cost > cache->capacity) return false;
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU)
+        _cap_lru_cache_sketch_increment(&cache->sketch, hash);
+    _cap_lru_cache_node *node = _cap_lru_cache_find_node(cache, key, hash);
+
+    if (node) {
+        if (!_cap_lru_cache_set_expiry(cache, node, ttl)) {
+            fprintf(stderr, "memory allocation failure\n");
+            return false;
+        }
         node->value = value;
-        move_to_head(cache, node);
+        cache->stats.updates++;
+        cache->used = cache->used - node->cost + cost;
+        cache->lists[node->list].weight =
+            cache->lists[node->list].weight - node->cost + cost;
+        node->cost = cost;
+        _cap_lru_cache_touch_node(cache, node);
+        // An entry which grew may push the cache over it's capacity
+        while (cache->used > cache->capacity) _cap_lru_cache_remove_tail(cache);
+        return true;
+    }
+
+    _cap_lru_cache_node *new_node = _cap_lru_cache_create_node(cache, key,
+                                                               value, hash);
+    if (!new_node) {
+        fprintf(stderr, "memory allocation failure\n");
+        return false;
+    }
+    new_node->cost = cost;
+    if (!_cap_lru_cache_set_expiry(cache, new_node, ttl)) {
+        fprintf(stderr, "memory allocation failure\n");
+        _cap_lru_cache_release_node(cache, new_node);
+        return false;
+    }
+    cache->stats.inserts++;
+    _cap_lru_cache_insert_node(cache, new_node);
+    return true;
+}
+
+size_t cap_lru_cache_expire_now(cap_lru_cache *cache, uint64_t now) {
+    assert(cache != NULL);
+    if (!cache->wheel) return 0;
+    size_t expired_count = 0;
+    cap_timer_wheel_timer *timer;
+    while ((timer = _cap_timer_wheel_pop(cache->wheel, now))) {
+        _cap_lru_cache_evict_node(cache, (_cap_lru_cache_node *)timer->_data,
+                                  CAP_CACHE_EXPIRED);
+        expired_count++;
+    }
+    return expired_count;
+}
+
+void cap_lru_cache_set_default_ttl(cap_lru_cache *cache, uint64_t ttl) {
+    assert(cache != NULL);
+    cache->default_ttl = ttl;
+}
+
+void cap_lru_cache_set_clock(cap_lru_cache *cache, _clock_fn_type clock_fn) {
+    assert(cache != NULL);
+    cache->clock_fn = clock_fn ? clock_fn : _cap_lru_cache_default_clock;
+}
+
+bool cap_lru_cache_contains(cap_lru_cache *cache, void *key) {
+    assert(cache != NULL && key != NULL);
+    _cap_lru_cache_node *node = _cap_lru_cache_find_node(
+        cache, key, _cap_lru_cache_hash_key(cache, key));
+    return node && !_cap_lru_cache_expired(cache, node);
+}
+
+bool cap_lru_cache_remove(cap_lru_cache *cache, void *key) {
+    assert(cache != NULL && key != NULL);
+    return _cap_lru_cache_remove_hashed(cache, key,
+                                        _cap_lru_cache_hash_key(cache, key));
+}
+
+static bool _cap_lru_cache_remove_hashed(cap_lru_cache *cache, void *key,
+                                         size_t hash) {
+    _cap_lru_cache_node *node = _cap_lru_cache_find_node(cache, key, hash);
+    if (!node) return false;
+    _cap_lru_cache_unlink_node(cache, node);
+    return true;
+}
+
+bool cap_lru_cache_set_capacity(cap_lru_cache *cache, size_t capacity) {
+    assert(cache != NULL && capacity > 0);
+    size_t old_capacity = cache->capacity;
+    cache->capacity = capacity;
+    _cap_lru_cache_set_segments(cache);
+    if (!_cap_lru_cache_resize_history(cache)) {
+        fprintf(stderr, "memory allocation failure\n");
+        cache->capacity = old_capacity;
+        _cap_lru_cache_set_segments(cache);
+        return false;
+    }
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU)
+        _cap_lru_cache_rebalance_tinylfu(cache);
+    if (cache->arc_target > cache->capacity)
+        cache->arc_target = cache->capacity;
+    while (cache->used > cache->capacity) _cap_lru_cache_remove_tail(cache);
+    if (cache->policy == CAP_CACHE_POLICY_ARC) _cap_lru_cache_trim_arc(cache);
+    return true;
+}
+
+size_t cap_lru_cache_size(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    return cache->size;
+}
+
+size_t cap_lru_cache_capacity(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    return cache->capacity;
+}
+
+size_t cap_lru_cache_used(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    return cache->used;
+}
+
+cap_cache_policy cap_lru_cache_policy(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    return cache->policy;
+}
+
+cap_cache_stats cap_lru_cache_stats(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    return cache->stats;
+}
+
+void cap_lru_cache_reset_stats(cap_lru_cache *cache) {
+    assert(cache != NULL);
+    memset(&cache->stats, 0, sizeof(cap_cache_stats));
+}
+
+bool cap_lru_cache_track_hot_keys(cap_lru_cache *cache, size_t k,
+                                  size_t sample_rate) {
+    assert(cache != NULL && sample_rate > 0);
+    _cap_lru_cache_hot_keys *hot = NULL;
+    if (k) {
+        hot = _cap_lru_cache_hot_keys_init(cache->key_size, k, sample_rate);
+        if (!hot) {
+            fprintf(stderr, "memory allocation failure\n");
+            return false;
+        }
+    }
+    if (cache->hot) _cap_lru_cache_hot_keys_free(cache->hot);
+    cache->hot = hot;
+    return true;
+}
+
+size_t cap_lru_cache_hot_keys(cap_lru_cache *cache, void *keys,
+                              uint64_t *counts, size_t max) {
+    assert(cache != NULL && keys != NULL && counts != NULL);
+    _cap_lru_cache_hot_keys *hot = cache->hot;
+    if (!hot || !hot->size || !max) return 0;
+    // Pairs of a count and a slot, sorted by the count
+    uint64_t(*order)[2] =
+        (uint64_t(*)[2])malloc(sizeof(uint64_t[2]) * hot->size);
+    if (!order) {
+        fprintf(stderr, "memory allocation failure\n");
+        return 0;
+    }
+    for (size_t slot = 0; slot < hot->size; ++slot) {
+        order[slot][0] = hot->counts[slot];
+        order[slot][1] = slot;
+    }
+    qsort(order, hot->size, sizeof(uint64_t[2]),
+          _cap_lru_cache_hot_keys_compare);
+    size_t returned = max < hot->size ? max : hot->size;
+    for (size_t i = 0; i < returned; ++i) {
+        size_t slot = (size_t)order[i][1];
+        memcpy((CAP_GENERIC_TYPE_PTR)keys + i * cache->key_size,
+               hot->keys + slot * cache->key_size, cache->key_size);
+        counts[i] = order[i][0] * hot->sample_rate;
+    }
+    free(order);
+    return returned;
+}
+
+static _cap_lru_cache_hot_keys *_cap_lru_cache_hot_keys_init(
+    size_t key_size, size_t k, size_t sample_rate) {
+    _cap_lru_cache_hot_keys *hot =
+        (_cap_lru_cache_hot_keys *)CAP_ALLOCATOR(_cap_lru_cache_hot_keys, 1);
+    if (!hot) return NULL;
+    // The index is kept at most half full
+    size_t index_size = _cap_lru_cache_bucket_count_for(k * 2);
+    hot->keys = (CAP_GENERIC_TYPE_PTR)malloc(key_size * k);
+    hot->hashes = (size_t *)malloc(sizeof(size_t) * k);
+    hot->counts = (uint64_t *)malloc(sizeof(uint64_t) * k);
+    hot->heap = (size_t *)malloc(sizeof(size_t) * k);
+    hot->positions = (size_t *)malloc(sizeof(size_t) * k);
+    hot->index = (size_t *)malloc(sizeof(size_t) * index_size);
+    hot->index_mask = index_size - 1;
+    hot->capacity = k;
+    hot->sample_rate = sample_rate;
+    hot->countdown = sample_rate;
+    if (!hot->keys || !hot->hashes || !hot->counts || !hot->heap ||
+        !hot->positions || !hot->index) {
+        _cap_lru_cache_hot_keys_free(hot);
+        return NULL;
+    }
+    for (size_t i = 0; i < index_size; ++i)
+        hot->index[i] = CAP_LRU_CACHE_HOT_NONE;
+    return hot;
+}
+
+static void _cap_lru_cache_hot_keys_free(_cap_lru_cache_hot_keys *hot) {
+    free(hot->keys);
+    free(hot->hashes);
+    free(hot->counts);
+    free(hot->heap);
+    free(hot->positions);
+    free(hot->index);
+    free(hot);
+}
+
+// Counts down the lookups to the next sample. The concurrent cache counts down
+// under it's read lock as well, so the count down is atomic
+static bool _cap_lru_cache_hot_keys_due(_cap_lru_cache_hot_keys *hot) {
+    if (__atomic_sub_fetch(&hot->countdown, 1, __ATOMIC_RELAXED) != 0)
+        return false;
+    __atomic_store_n(&hot->countdown, hot->sample_rate, __ATOMIC_RELAXED);
+    return true;
+}
+
+static size_t _cap_lru_cache_hot_keys_find(cap_lru_cache *cache, void *key,
+                                           size_t hash) {
+    _cap_lru_cache_hot_keys *hot = cache->hot;
+    size_t i = hash & hot->index_mask;
+    for (; hot->index[i] != CAP_LRU_CACHE_HOT_NONE;
+         i = (i + 1) & hot->index_mask) {
+        size_t slot = hot->index[i];
+        if (hot->hashes[slot] == hash &&
+            _cap_lru_cache_keys_equal(cache, hot->keys + slot * cache->key_size,
+                                      key))
+            return slot;
+    }
+    return CAP_LRU_CACHE_HOT_NONE;
+}
+
+static void _cap_lru_cache_hot_keys_index_insert(_cap_lru_cache_hot_keys *hot,
+                                                 size_t slot) {
+    size_t i = hot->hashes[slot] & hot->index_mask;
+    while (hot->index[i] != CAP_LRU_CACHE_HOT_NONE)
+        i = (i + 1) & hot->index_mask;
+    hot->index[i] = slot;
+}
+
+// Linear probing deletion, the entries after the hole which may not sit
+// before their home position are shifted back into it
+static void _cap_lru_cache_hot_keys_index_remove(_cap_lru_cache_hot_keys *hot,
+                                                 size_t slot) {
+    size_t hole = hot->hashes[slot] & hot->index_mask;
+    while (hot->index[hole] != slot) hole = (hole + 1) & hot->index_mask;
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & hot->index_mask;
+        if (hot->index[i] == CAP_LRU_CACHE_HOT_NONE) break;
+        size_t home = hot->hashes[hot->index[i]] & hot->index_mask;
+        bool between = hole <= i ? hole < home && home <= i
+                                 : hole < home || home <= i;
+        if (between) continue;
+        hot->index[hole] = hot->index[i];
+        hole = i;
+    }
+    hot->index[hole] = CAP_LRU_CACHE_HOT_NONE;
+}
+
+static void _cap_lru_cache_hot_keys_sift_down(_cap_lru_cache_hot_keys *hot,
+                                              size_t position) {
+    for (;;) {
+        size_t smallest = position;
+        size_t left = position * 2 + 1, right = left + 1;
+        if (left < hot->size && hot->counts[hot->heap[left]] <
+                                    hot->counts[hot->heap[smallest]])
+            smallest = left;
+        if (right < hot->size && hot->counts[hot->heap[right]] <
+                                     hot->counts[hot->heap[smallest]])
+            smallest = right;
+        if (smallest == position) return;
+        _cap_lru_cache_hot_keys_swap(hot, position, smallest);
+        position = smallest;
+    }
+}
+
+static void _cap_lru_cache_hot_keys_swap(_cap_lru_cache_hot_keys *hot,
+                                         size_t one, size_t two) {
+    size_t slot = hot->heap[one];
+    hot->heap[one] = hot->heap[two];
+    hot->heap[two] = slot;
+    hot->positions[hot->heap[one]] = one;
+    hot->positions[slot] = two;
+}
+
+// Space-saving: a tracked key's count goes up by one, an untracked key takes
+// a free slot, or replaces the key with the smallest count and inherits it's
+// count plus one
+static void _cap_lru_cache_hot_keys_sample(cap_lru_cache *cache, void *key,
+                                           size_t hash) {
+    _cap_lru_cache_hot_keys *hot = cache->hot;
+    size_t slot = _cap_lru_cache_hot_keys_find(cache, key, hash);
+    if (slot != CAP_LRU_CACHE_HOT_NONE) {
+        hot->counts[slot]++;
+        _cap_lru_cache_hot_keys_sift_down(hot, hot->positions[slot]);
+        return;
+    }
+    if (hot->size < hot->capacity) {
+        // A new slot has a count of one, the smallest, so it goes all the
+        // way up to the root
+        slot = hot->size++;
+        hot->counts[slot] = 1;
+        hot->heap[slot] = slot;
+        hot->positions[slot] = slot;
+        for (size_t position = slot; position > 0;) {
+            size_t parent = (position - 1) / 2;
+            if (hot->counts[hot->heap[parent]] <= 1) break;
+            _cap_lru_cache_hot_keys_swap(hot, position, parent);
+            position = parent;
+        }
     } else {
-        if (cache->size == cache->capacity) {
-            remove_tail(cache);
+        slot = hot->heap[0];
+        _cap_lru_cache_hot_keys_index_remove(hot, slot);
+        hot->counts[slot]++;
+    }
+    memcpy(hot->keys + slot * cache->key_size, key, cache->key_size);
+    hot->hashes[slot] = hash;
+    _cap_lru_cache_hot_keys_index_insert(hot, slot);
+    _cap_lru_cache_hot_keys_sift_down(hot, hot->positions[slot]);
+}
+
+// Orders the pairs of a count and a slot by the count, highest first
+static int _cap_lru_cache_hot_keys_compare(const void *one, const void *two) {
+    const uint64_t *pair_one = (const uint64_t *)one;
+    const uint64_t *pair_two = (const uint64_t *)two;
+    if (pair_one[0] != pair_two[0]) return pair_one[0] < pair_two[0] ? 1 : -1;
+    return pair_one[1] < pair_two[1] ? -1 : 1;
+}
+
+bool cap_lru_cache_save(cap_lru_cache *cache, FILE *file,
+                        _value_size_fn_type value_size_fn) {
+    assert(cache != NULL && file != NULL && value_size_fn != NULL);
+    if (fwrite(CAP_LRU_CACHE_SNAPSHOT_MAGIC, 1,
+               CAP_LRU_CACHE_SNAPSHOT_MAGIC_SIZE,
+               file) != CAP_LRU_CACHE_SNAPSHOT_MAGIC_SIZE ||
+        !_cap_lru_cache_write_varint(file, cache->key_size) ||
+        !_cap_lru_cache_write_varint(file, cache->policy))
+        return false;
+    uint64_t now = cache->wheel ? cache->clock_fn() : 0;
+    for (int list = 0; list < CAP_LRU_CACHE_LISTS; ++list) {
+        _cap_lru_cache_node *node = cache->lists[list].tail;
+        for (; node; node = node->prev)
+            if (!_cap_lru_cache_save_node(cache, file, node, value_size_fn,
+                                          now))
+                return false;
+    }
+    return fputc(CAP_LRU_CACHE_SNAPSHOT_END, file) != EOF &&
+           fflush(file) == 0;
+}
+
+bool cap_lru_cache_load(cap_lru_cache *cache, FILE *file,
+                        _restore_fn_type restore_fn,
+                        _release_fn_type release_fn, void *arg) {
+    assert(cache != NULL && file != NULL && restore_fn != NULL);
+    if (cache->size) return false;
+    char magic[CAP_LRU_CACHE_SNAPSHOT_MAGIC_SIZE];
+    uint64_t key_size, policy;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, CAP_LRU_CACHE_SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+        !_cap_lru_cache_read_varint(file, &key_size) ||
+        key_size != cache->key_size ||
+        !_cap_lru_cache_read_varint(file, &policy))
+        return false;
+    // The key buffer is fixed, the value buffer grows to the largest value
+    CAP_GENERIC_TYPE_PTR key = (CAP_GENERIC_TYPE_PTR)malloc(key_size);
+    CAP_GENERIC_TYPE_PTR value = NULL;
+    size_t value_capacity = 0;
+    bool loaded = key != NULL;
+    while (loaded) {
+        int flags = fgetc(file);
+        if (flags == CAP_LRU_CACHE_SNAPSHOT_END) break;
+        uint64_t cost, ttl, value_size;
+        if (flags == EOF || fread(key, 1, key_size, file) != key_size ||
+            !_cap_lru_cache_read_varint(file, &cost) ||
+            !_cap_lru_cache_read_varint(file, &ttl) ||
+            !_cap_lru_cache_read_varint(file, &value_size) ||
+            cost > cache->capacity) {
+            loaded = false;
+            break;
         }
+        if (value_size > value_capacity) {
+            CAP_GENERIC_TYPE_PTR grown =
+                (CAP_GENERIC_TYPE_PTR)realloc(value, value_size);
+            if (!grown) {
+                fprintf(stderr, "memory allocation failure\n");
+                loaded = false;
+                break;
+            }
+            value = grown;
+            value_capacity = value_size;
+        }
+        void *stored_key = NULL, *stored_value = NULL;
+        if ((value_size && fread(value, 1, value_size, file) != value_size) ||
+            !restore_fn(key, value, value_size, &stored_key, &stored_value,
+                        arg)) {
+            loaded = false;
+            break;
+        }
+        const int shift = CAP_LRU_CACHE_SNAPSHOT_LIST_SHIFT;
+        unsigned char list = (unsigned char)(flags >> shift);
+        unsigned char freq = (unsigned char)(flags & ((1 << shift) - 1));
+        // ARC's ghost lists are never saved
+        if (policy != cache->policy || list >= CAP_LRU_CACHE_LISTS ||
+            (cache->policy == CAP_CACHE_POLICY_ARC && list > 1)) {
+            // The main list, the probation segment for W-TinyLFU
+            list = cache->policy == CAP_CACHE_POLICY_S3FIFO ||
+                   cache->policy == CAP_CACHE_POLICY_TINYLFU;
+            freq = 0;
+        }
+        size_t hash = _cap_lru_cache_hash_key(cache, stored_key);
+        _cap_lru_cache_node *node =
+            _cap_lru_cache_create_node(cache, stored_key, stored_value, hash);
+        if (node) node->cost = (size_t)cost;
+        if (node && !_cap_lru_cache_set_expiry(cache, node, ttl)) {
+            _cap_lru_cache_release_node(cache, node);
+            node = NULL;
+        }
+        if (!node) {
+            fprintf(stderr, "memory allocation failure\n");
+            if (release_fn) release_fn(stored_key, stored_value, arg);
+            loaded = false;
+            break;
+        }
+        _cap_lru_cache_link_node(cache, node);
+        node->freq = freq;
+        _cap_lru_cache_list_push_head(cache, node, list);
+        while (cache->used > cache->capacity) _cap_lru_cache_remove_tail(cache);
+    }
+    if (cache->policy == CAP_CACHE_POLICY_TINYLFU)
+        _cap_lru_cache_rebalance_tinylfu(cache);
+    free(key);
+    free(value);
+    return loaded;
+}
+
+static bool _cap_lru_cache_write_varint(FILE *file, uint64_t number) {
+    // 7 bits per byte, the high bit is set on every byte but the last
+    unsigned char bytes[10];
+    size_t length = 0;
+    do {
+        bytes[length] = (unsigned char)(number & 0x7F);
+        number >>= 7;
+        if (number) bytes[length] |= 0x80;
+        length++;
+    } while (number);
+    return fwrite(bytes, 1, length, file) == length;
+}
 
-        _cap_lru_cache_node *new_node = create_node(key, value);
-        new_node->next = cache->head;
-        if (cache->head) cache->head->prev = new_node;
-        cache->head = new_node;
-        if (!cache->tail) cache->tail = new_node;
+static bool _cap_lru_cache_read_varint(FILE *file, uint64_t *number) {
+    *number = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) return false;
+        *number |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
 
-        cache->table[index] = new_node;
-        cache->size++;
+static bool _cap_lru_cache_save_node(cap_lru_cache *cache, FILE *file,
+                                     _cap_lru_cache_node *node,
+                                     _value_size_fn_type value_size_fn,
+                                     uint64_t now) {
+    // ARC's ghosts are not entries
+    if (!node->key) return true;
+    // The TTL is saved as the time left, the clock of the process which
+    // loads the snapshot starts elsewhere
+    uint64_t ttl = 0;
+    if (node->timer._pprev) {
+        if (node->timer._expires <= now) return true;
+        ttl = node->timer._expires - now;
     }
+    size_t value_size = value_size_fn(node->value);
+    int flags = node->list << CAP_LRU_CACHE_SNAPSHOT_LIST_SHIFT | node->freq;
+    return fputc(flags, file) != EOF &&
+           fwrite(node->key, 1, cache->key_size, file) == cache->key_size &&
+           _cap_lru_cache_write_varint(file, node->cost) &&
+           _cap_lru_cache_write_varint(file, ttl) &&
+           _cap_lru_cache_write_varint(file, value_size) &&
+           (!value_size ||
+            fwrite(node->value, 1, value_size, file) == value_size);
 }
 
 #endif
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_MAP_H
 #define CAP_MAP_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,14 +36,32 @@
 	calloc(number_of_elements, sizeof(type))
 #define CAP_MAP_MAX_SKIPLIST_SIZE 10
 
-typedef struct cap_map {
+struct _cap_map_node;
+
+typedef struct {
+	struct _cap_map_node *_forward;
+	// Number of level 0 steps covered by the link, the link to the end of
+	// the list spans up to the position after the last element
+	size_t _width;
+} _cap_map_link;
+
+// A node has as many links as it's height, the head has
+// CAP_MAP_MAX_SKIPLIST_SIZE of them
+typedef struct _cap_map_node {
 	CAP_GENERIC_TYPE_PTR _key;
-	size_t _key_size;
 	void *_value;
 	int _height;
+	_cap_map_link _links[];
+} _cap_map_node;
+
+typedef struct cap_map {
+	_cap_map_node *_head;
+	size_t _key_size;
+	int _height;
 	size_t _size;
 	int (*_compare_fn)(void *key_one, void *key_two);
-	struct cap_map *_forward[CAP_MAP_MAX_SKIPLIST_SIZE];
+	// The nodes come from the allocator, which is only kept on the map
+	cap_allocator _allocator;
 } cap_map;
 
 typedef struct {
@@ -49,10 +69,10 @@ typedef struct {
 	void *value;
 	size_t _current_index;
 	cap_map *_original_reference;
-	cap_map *_current_element;
+	_cap_map_node *_current_element;
 } cap_map_iterator;
 
-bool _cap_map_is_seeded = false;
+static bool _cap_map_is_seeded = false;
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
 
 /**
@@ -62,6 +82,18 @@ bool _cap_map_is_seeded = false;
  */
 static cap_map *cap_map_init(size_t key_size,
 			     int (*compare_fn)(void *, void *));
+/**
+ * Initilize a cap_map container object which takes it's nodes from the given
+ * allocator
+ *
+ * @param key_size Size of the keys
+ * @param compare_fn Function which compares two keys
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Newly allocated pointer to the head
+ */
+static cap_map *cap_map_init_with_allocator(size_t key_size,
+					    int (*compare_fn)(void *, void *),
+					    const cap_allocator *allocator);
 /**
  * Insert a key-value pair onto the cap_map container.
  *
@@ -129,6 +161,37 @@ static int cap_map_remove(cap_map *map, void *key);
  * @return Max height of the container's implementation
  */
 static int cap_map_height(cap_map *map);
+/**
+ * Get the number of elements whose key is less than the given key, i.e the
+ * index the key has (or would have) in the sorted order of the container.
+ * O(log n) operation
+ *
+ * @param map cap_map container
+ * @param key Key to rank
+ * @return Number of elements with a key less than the given key
+ */
+static size_t cap_map_rank(cap_map *map, void *key);
+/**
+ * Get the value of the element at the given index, in the sorted order of the
+ * keys. O(log n) operation
+ *
+ * @param map cap_map container
+ * @param index Zero based index of the element
+ * @return Value at the index, if the index is not less than the size of the
+ * container, it returns NULL
+ */
+static void *cap_map_select(cap_map *map, size_t index);
+/**
+ * Count the elements whose key is within [low_key, high_key]. O(log n)
+ * operation
+ *
+ * @param map cap_map container
+ * @param low_key Lower bound of the range, inclusive
+ * @param high_key Upper bound of the range, inclusive
+ * @return Number of elements within the range
+ */
+static size_t cap_map_count_range(cap_map *map, void *low_key,
+				  void *high_key);
 /**
  * Free the cap_map container. It doesn't touch the key or value's underlying
  * memory. Only frees the memory which the container owns.
@@ -159,6 +222,17 @@ static bool cap_map_empty(cap_map *map);
  * which is given in the parameter
  */
 static cap_map_iterator *cap_map_iterator_init(cap_map *map);
+/**
+ * Initialize an Iterator object which points to the element at the given index,
+ * in the sorted order of the keys. Seeking to the index is O(log n), which is
+ * handy for paging through the container
+ *
+ * @param map cap_map container for which we need to create a iterator
+ * @param index Zero based index of the element
+ * @return Allocated cap_map_iterator object, if the index is not less than the
+ * size of the container, it returns NULL
+ */
+static cap_map_iterator *cap_map_iterator_at(cap_map *map, size_t index);
 /**
  * Check if an element which is pointed by the iterator matches the given
  * predicate function
@@ -210,88 +284,116 @@ static void *cap_map_front(cap_map *map);
 static void cap_map_iterator_free(cap_map_iterator *iterator);
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
+static void _cap_map_seed(void);
 static int _cap_map_get_rand_level(int max_number);
-static void _cap_map_free_node(cap_map *map);
-static void _cap_map_deep_free_node(cap_map *map);
+static size_t _cap_map_node_size(int height);
+static void _cap_map_free_node(const cap_allocator *, _cap_map_node *);
+static size_t _cap_map_rank(cap_map *map, void *key, bool inclusive);
+static _cap_map_node *_cap_map_select_node(cap_map *map, size_t index);
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
 
 static cap_map *cap_map_init(size_t key_size,
 			     int (*compare_fn)(void *, void *)) {
+	return cap_map_init_with_allocator(key_size, compare_fn, NULL);
+}
+
+static cap_map *cap_map_init_with_allocator(size_t key_size,
+					    int (*compare_fn)(void *, void *),
+					    const cap_allocator *allocator) {
 	assert(compare_fn != NULL);
-	if (!_cap_map_is_seeded) srand(time(NULL));
-	cap_map *map = (cap_map *)CAP_ALLOCATOR(cap_map, 1);
+	_cap_map_seed();
+	cap_map *map =
+	    (cap_map *)_cap_allocator_calloc(allocator, 1, sizeof(cap_map));
 	if (!map) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) map->_allocator = *allocator;
+	map->_head = (_cap_map_node *)_cap_allocator_calloc(
+	    allocator, 1, _cap_map_node_size(CAP_MAP_MAX_SKIPLIST_SIZE));
+	if (!map->_head) {
+		fprintf(stderr, "memory allocation failure\n");
+		_cap_allocator_free(allocator, map, sizeof(cap_map));
+		return NULL;
+	}
+	map->_head->_height = CAP_MAP_MAX_SKIPLIST_SIZE;
 	map->_compare_fn = compare_fn;
 	map->_height = CAP_MAP_MAX_SKIPLIST_SIZE;
 	map->_size = 0;
 	map->_key_size = key_size;
+	for (int i = 0; i < CAP_MAP_MAX_SKIPLIST_SIZE; ++i)
+		map->_head->_links[i]._width = 1;
 	return map;
 }
 
 static int cap_map_insert(cap_map *map, void *key, void *value) {
 	assert(map != NULL && key != NULL && value != NULL);
-	cap_map *current_node = map;
+	_cap_map_node *current_node = map->_head;
 	int current_level = map->_height - 1;
-	cap_map *previous[CAP_MAP_MAX_SKIPLIST_SIZE];
+	_cap_map_node *previous[CAP_MAP_MAX_SKIPLIST_SIZE];
+	size_t rank[CAP_MAP_MAX_SKIPLIST_SIZE];
+	size_t position = 0;
 	while (current_level >= 0) {
 		previous[current_level] = current_node;
-		if (current_node->_forward[current_level] == NULL) {
+		rank[current_level] = position;
+		_cap_map_link *link = &current_node->_links[current_level];
+		if (link->_forward == NULL) {
 			current_level--;
 		} else {
-			int cmp = map->_compare_fn(
-			    current_node->_forward[current_level]->_key, key);
+			int cmp = map->_compare_fn(link->_forward->_key, key);
 			if (cmp == 0) {
-				current_node->_forward[current_level]->_value =
-				    value;
+				link->_forward->_value = value;
 				return 0;
 			} else if (cmp > 0) {
 				current_level--;
 			} else {
-				current_node =
-				    current_node->_forward[current_level];
+				position += link->_width;
+				current_node = link->_forward;
 			}
 		}
 	}
-	cap_map *new_node = (cap_map *)CAP_ALLOCATOR(cap_map, 1);
+	int height = _cap_map_get_rand_level(map->_height);
+	_cap_map_node *new_node = (_cap_map_node *)_cap_allocator_alloc(
+	    &map->_allocator, _cap_map_node_size(height));
 	if (!new_node) {
 		fprintf(stderr, "memory allocation failure\n");
 		return -1;
 	}
 	new_node->_value = value;
 	new_node->_key = (CAP_GENERIC_TYPE_PTR)key;
-	new_node->_height = _cap_map_get_rand_level(map->_height);
-	new_node->_key_size = map->_key_size;
+	new_node->_height = height;
 	++map->_size;
-	for (int i = CAP_MAP_MAX_SKIPLIST_SIZE - 1; i > new_node->_height; --i)
-		new_node->_forward[i] = NULL;
-	for (int i = new_node->_height - 1; i >= 0; --i) {
-		new_node->_forward[i] = previous[i]->_forward[i];
-		previous[i]->_forward[i] = new_node;
+	size_t new_position = rank[0] + 1;
+	for (int i = height - 1; i >= 0; --i) {
+		_cap_map_link *link = &previous[i]->_links[i];
+		new_node->_links[i]._forward = link->_forward;
+		new_node->_links[i]._width =
+		    rank[i] + link->_width + 1 - new_position;
+		link->_forward = new_node;
+		link->_width = new_position - rank[i];
 	}
+	for (int i = height; i < CAP_MAP_MAX_SKIPLIST_SIZE; ++i)
+		previous[i]->_links[i]._width++;
 	return 0;
 }
 
 static void *cap_map_find(cap_map *map, void *key) {
 	assert(map != NULL && key != NULL);
-	cap_map *current_node = map;
+	_cap_map_node *current_node = map->_head;
 	int current_level = map->_height - 1;
 	while (current_level >= 0) {
-		if (current_node->_forward[current_level] == NULL) {
+		_cap_map_node *next =
+		    current_node->_links[current_level]._forward;
+		if (next == NULL) {
 			current_level--;
 		} else {
-			int cmp = map->_compare_fn(
-			    current_node->_forward[current_level]->_key, key);
+			int cmp = map->_compare_fn(next->_key, key);
 			if (cmp == 0) {
-				return current_node->_forward[current_level]
-				    ->_value;
+				return next->_value;
 			} else if (cmp > 0) {
 				current_level--;
 			} else {
-				current_node =
-				    current_node->_forward[current_level];
+				current_node = next;
 			}
 		}
 	}
@@ -326,64 +428,85 @@ static bool cap_map_empty(cap_map *map) {
 static int cap_map_remove(cap_map *map, void *key) {
 	assert(map != NULL && key != NULL);
 	if (!map->_size) return -1;
-	cap_map *current_node = map;
+	_cap_map_node *current_node = map->_head;
 	int current_level = map->_height - 1;
-	cap_map *previous[CAP_MAP_MAX_SKIPLIST_SIZE];
-	int cmp = 1;
+	_cap_map_node *previous[CAP_MAP_MAX_SKIPLIST_SIZE];
 	while (current_level >= 0) {
 		previous[current_level] = current_node;
-		if (current_node->_forward[current_level] == NULL) {
+		_cap_map_node *next =
+		    current_node->_links[current_level]._forward;
+		if (next == NULL) {
 			current_level--;
 		} else {
-			cmp = map->_compare_fn(
-			    current_node->_forward[current_level]->_key, key);
+			int cmp = map->_compare_fn(next->_key, key);
 			if (cmp >= 0) {
 				current_level--;
 			} else {
-				current_node =
-				    current_node->_forward[current_level];
+				current_node = next;
 			}
 		}
 	}
-	if (!cmp) {
-		cap_map *free_me = current_node->_forward[0];
-		for (int i = CAP_MAP_MAX_SKIPLIST_SIZE - 1; i >= 0; --i)
-			previous[i]->_forward[i] = free_me->_forward[i];
-		_cap_map_free_node(free_me);
-		map->_size--;
-		return 0;
+	_cap_map_node *free_me = current_node->_links[0]._forward;
+	if (!free_me || map->_compare_fn(free_me->_key, key) != 0) return -1;
+	for (int i = CAP_MAP_MAX_SKIPLIST_SIZE - 1; i >= 0; --i) {
+		_cap_map_link *link = &previous[i]->_links[i];
+		if (i < free_me->_height) {
+			link->_forward = free_me->_links[i]._forward;
+			link->_width += free_me->_links[i]._width - 1;
+		} else {
+			link->_width--;
+		}
 	}
-	return -1;
+	_cap_map_free_node(&map->_allocator, free_me);
+	map->_size--;
+	return 0;
+}
+
+static size_t cap_map_rank(cap_map *map, void *key) {
+	assert(map != NULL && key != NULL);
+	return _cap_map_rank(map, key, false);
+}
+
+static void *cap_map_select(cap_map *map, size_t index) {
+	assert(map != NULL);
+	_cap_map_node *node = _cap_map_select_node(map, index);
+	return node ? node->_value : NULL;
+}
+
+static size_t cap_map_count_range(cap_map *map, void *low_key,
+				  void *high_key) {
+	assert(map != NULL && low_key != NULL && high_key != NULL);
+	size_t low_rank = _cap_map_rank(map, low_key, false);
+	size_t high_rank = _cap_map_rank(map, high_key, true);
+	return high_rank > low_rank ? high_rank - low_rank : 0;
 }
 
 static void cap_map_free(cap_map *map) {
 	assert(map != NULL);
-	if (!map->_size) {
-		free(map);
-		return;
-	}
-	cap_map *free_me = map;
-	map = map->_forward[0];
-	for (int i = free_me->_size - 1; i >= 0; --i) {
-		_cap_map_free_node(free_me);
-		free_me = map;
-		map = map->_forward[0];
+	cap_allocator allocator = map->_allocator;
+	_cap_map_node *node = map->_head;
+	while (node) {
+		_cap_map_node *free_me = node;
+		node = node->_links[0]._forward;
+		_cap_map_free_node(&allocator, free_me);
 	}
+	_cap_allocator_free(&allocator, map, sizeof(cap_map));
 }
 
 static void cap_map_deep_free(cap_map *map) {
 	assert(map != NULL);
-	if (!map->_size) {
-		free(map);
-		return;
-	}
-	cap_map *free_me = map;
-	map = map->_forward[0];
-	for (int i = map->_height - 1; i >= 0; --i) {
-		_cap_map_deep_free_node(free_me);
-		free_me = map;
-		map = map->_forward[0];
+	for (_cap_map_node *node = map->_head->_links[0]._forward; node;
+	     node = node->_links[0]._forward) {
+		free(node->_key);
+		free(node->_value);
 	}
+	cap_map_free(map);
+}
+
+static void _cap_map_seed(void) {
+	if (_cap_map_is_seeded) return;
+	srand(time(NULL));
+	_cap_map_is_seeded = true;
 }
 
 static int _cap_map_get_rand_level(int max_number) {
@@ -392,16 +515,45 @@ static int _cap_map_get_rand_level(int max_number) {
 	return returner;
 }
 
-static void _cap_map_free_node(cap_map *map) {
-	if (map) { free(map); }
+static size_t _cap_map_rank(cap_map *map, void *key, bool inclusive) {
+	_cap_map_node *current_node = map->_head;
+	size_t position = 0;
+	for (int level = map->_height - 1; level >= 0; --level) {
+		_cap_map_link *link;
+		while ((link = &current_node->_links[level])->_forward) {
+			int cmp = map->_compare_fn(link->_forward->_key, key);
+			if (cmp > 0 || (cmp == 0 && !inclusive)) break;
+			position += link->_width;
+			current_node = link->_forward;
+		}
+	}
+	return position;
 }
 
-static void _cap_map_deep_free_node(cap_map *map) {
-	if (map) {
-		free(map->_key);
-		free(map->_value);
-		free(map);
+static _cap_map_node *_cap_map_select_node(cap_map *map, size_t index) {
+	if (index >= map->_size) return NULL;
+	_cap_map_node *current_node = map->_head;
+	size_t position = 0;
+	for (int level = map->_height - 1; level >= 0; --level) {
+		_cap_map_link *link;
+		while ((link = &current_node->_links[level])->_forward &&
+		       position + link->_width <= index + 1) {
+			position += link->_width;
+			current_node = link->_forward;
+		}
 	}
+	return current_node;
+}
+
+static size_t _cap_map_node_size(int height) {
+	return sizeof(_cap_map_node) + sizeof(_cap_map_link) * height;
+}
+
+static void _cap_map_free_node(const cap_allocator *allocator,
+			       _cap_map_node *node) {
+	if (node)
+		_cap_allocator_free(allocator, node,
+				    _cap_map_node_size(node->_height));
 }
 
 static cap_map_iterator *cap_map_iterator_init(cap_map *map) {
@@ -413,13 +565,31 @@ static cap_map_iterator *cap_map_iterator_init(cap_map *map) {
 		return NULL;
 	}
 	iterator->_original_reference = map;
-	iterator->_current_element = map->_forward[0];
+	iterator->_current_element = map->_head->_links[0]._forward;
 	iterator->_current_index = 0;
 	iterator->key = iterator->_current_element->_key;
 	iterator->value = iterator->_current_element->_value;
 	return iterator;
 }
 
+static cap_map_iterator *cap_map_iterator_at(cap_map *map, size_t index) {
+	assert(map != NULL);
+	_cap_map_node *node = _cap_map_select_node(map, index);
+	if (!node) return NULL;
+	cap_map_iterator *iterator =
+	    (cap_map_iterator *)CAP_ALLOCATOR(cap_map_iterator, 1);
+	if (!iterator) {
+		fprintf(stderr, "memory allocation failue\n");
+		return NULL;
+	}
+	iterator->_original_reference = map;
+	iterator->_current_element = node;
+	iterator->_current_index = index;
+	iterator->key = node->_key;
+	iterator->value = node->_value;
+	return iterator;
+}
+
 static bool cap_map_iterator_equals_predicate(cap_map_iterator *iter,
 					      bool (*predicate_fn)(void *)) {
 	assert(iter != NULL && predicate_fn != NULL);
@@ -434,7 +604,8 @@ static void cap_map_iterator_increment(cap_map_iterator *iterator) {
 		iterator->value = NULL;
 		return;
 	}
-	iterator->_current_element = iterator->_current_element->_forward[0];
+	iterator->_current_element =
+	    iterator->_current_element->_links[0]._forward;
 	iterator->key = iterator->_current_element->_key;
 	iterator->value = iterator->_current_element->_value;
 	++iterator->_current_index;
@@ -445,7 +616,7 @@ static void *cap_map_iterator_next(cap_map_iterator *iterator) {
 	if (iterator->_original_reference->_size ==
 	    iterator->_current_index + 1)
 		return NULL;
-	return iterator->_current_element->_forward[0]->_key;
+	return iterator->_current_element->_links[0]._forward->_key;
 }
 
 static cap_map_iterator *cap_map_begin(cap_map *map) {
@@ -455,7 +626,7 @@ static cap_map_iterator *cap_map_begin(cap_map *map) {
 
 static void *cap_map_front(cap_map *map) {
 	assert(map != NULL);
-	return map->_forward[0];
+	return map->_head->_links[0]._forward;
 }
 
 static void cap_map_iterator_free(cap_map_iterator *iterator) {
@@ -463,4 +634,176 @@ static void cap_map_iterator_free(cap_map_iterator *iterator) {
 	free(iterator);
 }
 
+/**
+ * Compare two integer keys by value, for use with CAP_MAP_DEFINE()
+ */
+#define CAP_MAP_CMP_INT(key_one, key_two)                                      \
+	(((key_one) > (key_two)) - ((key_one) < (key_two)))
+/**
+ * Compare two fixed size keys byte by byte, for use with CAP_MAP_DEFINE(). The
+ * size is a compile time constant, so the memcmp() call is inlined.
+ *
+ * The padding bytes of a key are compared too and their value is unspecified,
+ * so only use it with key types without padding, e.g a struct of a single
+ * array, and pass a compare function which compares the members otherwise
+ */
+#define CAP_MAP_CMP_MEMCMP(key_one, key_two)                                   \
+	memcmp(&(key_one), &(key_two), sizeof(key_one))
+/**
+ * Define a cap_map specialized for one key type. The generic cap_map calls the
+ * compare function through a pointer and dereferences each node's key pointer
+ * on every hop, the specialized map stores the key by value within the node and
+ * expands the comparison inline.
+ *
+ * CAP_MAP_DEFINE(name, key_type, cmp) generates the type `name` and these
+ * functions, which behave like their cap_map counterparts but take the key by
+ * value: name_init(), name_init_with_allocator(), name_insert(), name_find(),
+ * name_contains(), name_remove(), name_size(), name_empty(), name_for_each(),
+ * name_free() and name_deep_free(). name_deep_free() only frees the values.
+ *
+ * @param name Name of the generated type, also the prefix of the functions
+ * @param key_type Type of the key, it must be assignable, so wrap arrays
+ * within a struct
+ * @param cmp Function or function-like macro which takes two keys by value and
+ * returns negative, zero or positive value if the first key is less, equal or
+ * greater than the second one, e.g CAP_MAP_CMP_INT or CAP_MAP_CMP_MEMCMP,
+ * which requires a key type without padding
+ */
+#define CAP_MAP_DEFINE(name, key_type, cmp)                                    \
+	typedef struct name##_node {                                           \
+		key_type _key;                                                 \
+		void *_value;                                                  \
+		int _height;                                                   \
+		struct name##_node *_forward[];                                \
+	} name##_node;                                                         \
+	typedef struct {                                                       \
+		name##_node *_head;                                            \
+		int _height;                                                   \
+		size_t _size;                                                  \
+		cap_allocator _allocator;                                      \
+	} name;                                                                \
+	static size_t _##name##_node_size(int height) {                        \
+		return sizeof(name##_node) + sizeof(name##_node *) * height;   \
+	}                                                                      \
+	static name##_node *_##name##_lower_bound(name *map, key_type key,     \
+						 name##_node **previous) {     \
+		name##_node *current_node = map->_head;                        \
+		for (int level = map->_height - 1; level >= 0; --level) {      \
+			name##_node *next;                                     \
+			while ((next = current_node->_forward[level]) &&       \
+			       cmp(next->_key, key) < 0)                       \
+				current_node = next;                           \
+			if (previous) previous[level] = current_node;          \
+		}                                                              \
+		return current_node->_forward[0];                              \
+	}                                                                      \
+	static name *name##_init_with_allocator(                               \
+	    const cap_allocator *allocator) {                                  \
+		_cap_map_seed();                                               \
+		name *map =                                                    \
+		    (name *)_cap_allocator_calloc(allocator, 1, sizeof(name)); \
+		if (!map) {                                                    \
+			fprintf(stderr, "memory allocation failure\n");        \
+			return NULL;                                           \
+		}                                                              \
+		if (allocator) map->_allocator = *allocator;                   \
+		map->_head = (name##_node *)_cap_allocator_calloc(             \
+		    allocator, 1,                                              \
+		    _##name##_node_size(CAP_MAP_MAX_SKIPLIST_SIZE));           \
+		if (!map->_head) {                                             \
+			fprintf(stderr, "memory allocation failure\n");        \
+			_cap_allocator_free(allocator, map, sizeof(name));     \
+			return NULL;                                           \
+		}                                                              \
+		map->_height = CAP_MAP_MAX_SKIPLIST_SIZE;                      \
+		map->_head->_height = CAP_MAP_MAX_SKIPLIST_SIZE;               \
+		return map;                                                    \
+	}                                                                      \
+	static name *name##_init(void) {                                       \
+		return name##_init_with_allocator(NULL);                       \
+	}                                                                      \
+	static int name##_insert(name *map, key_type key, void *value) {       \
+		assert(map != NULL && value != NULL);                          \
+		name##_node *previous[CAP_MAP_MAX_SKIPLIST_SIZE];              \
+		name##_node *next = _##name##_lower_bound(map, key, previous); \
+		if (next && cmp(next->_key, key) == 0) {                       \
+			next->_value = value;                                  \
+			return 0;                                              \
+		}                                                              \
+		int height = _cap_map_get_rand_level(map->_height);            \
+		name##_node *new_node = (name##_node *)_cap_allocator_alloc(   \
+		    &map->_allocator, _##name##_node_size(height));            \
+		if (!new_node) {                                               \
+			fprintf(stderr, "memory allocation failure\n");        \
+			return -1;                                             \
+		}                                                              \
+		new_node->_key = key;                                          \
+		new_node->_value = value;                                      \
+		new_node->_height = height;                                    \
+		for (int i = 0; i < height; ++i) {                             \
+			new_node->_forward[i] = previous[i]->_forward[i];      \
+			previous[i]->_forward[i] = new_node;                   \
+		}                                                              \
+		map->_size++;                                                  \
+		return 0;                                                      \
+	}                                                                      \
+	static void *name##_find(name *map, key_type key) {                    \
+		assert(map != NULL);                                           \
+		name##_node *next = _##name##_lower_bound(map, key, NULL);     \
+		if (next && cmp(next->_key, key) == 0) return next->_value;    \
+		return NULL;                                                   \
+	}                                                                      \
+	static bool name##_contains(name *map, key_type key) {                 \
+		assert(map != NULL);                                           \
+		return name##_find(map, key) != NULL;                          \
+	}                                                                      \
+	static int name##_remove(name *map, key_type key) {                    \
+		assert(map != NULL);                                           \
+		name##_node *previous[CAP_MAP_MAX_SKIPLIST_SIZE];              \
+		name##_node *free_me =                                         \
+		    _##name##_lower_bound(map, key, previous);                 \
+		if (!free_me || cmp(free_me->_key, key) != 0) return -1;       \
+		for (int i = 0; i < free_me->_height; ++i)                     \
+			previous[i]->_forward[i] = free_me->_forward[i];       \
+		_cap_allocator_free(&map->_allocator, free_me,                 \
+				    _##name##_node_size(free_me->_height));    \
+		map->_size--;                                                  \
+		return 0;                                                      \
+	}                                                                      \
+	static size_t name##_size(name *map) {                                 \
+		assert(map != NULL);                                           \
+		return map->_size;                                             \
+	}                                                                      \
+	static bool name##_empty(name *map) {                                  \
+		assert(map != NULL);                                           \
+		return map->_size == 0;                                        \
+	}                                                                      \
+	static void name##_for_each(name *map,                                 \
+				    void (*fn)(key_type * key, void *value)) { \
+		assert(map != NULL && fn != NULL);                             \
+		for (name##_node *node = map->_head->_forward[0]; node;        \
+		     node = node->_forward[0])                                 \
+			fn(&node->_key, node->_value);                         \
+	}                                                                      \
+	static void name##_free(name *map) {                                   \
+		assert(map != NULL);                                           \
+		cap_allocator allocator = map->_allocator;                     \
+		name##_node *node = map->_head;                                \
+		while (node) {                                                 \
+			name##_node *free_me = node;                           \
+			node = node->_forward[0];                              \
+			_cap_allocator_free(                                   \
+			    &allocator, free_me,                               \
+			    _##name##_node_size(free_me->_height));            \
+		}                                                              \
+		_cap_allocator_free(&allocator, map, sizeof(name));            \
+	}                                                                      \
+	static void name##_deep_free(name *map) {                              \
+		assert(map != NULL);                                           \
+		for (name##_node *node = map->_head->_forward[0]; node;        \
+		     node = node->_forward[0])                                 \
+			free(node->_value);                                    \
+		name##_free(map);                                              \
+	}
+
 #endif // !CAP_MAP_H
@@ -0,0 +1,425 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_POOL_ALLOCATOR_H
+#define CAP_POOL_ALLOCATOR_H
+#include "allocator.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+// Size of a slab when the number of objects per slab isn't given, and the
+// number of objects a thread cache moves from or to the pool at once
+#define CAP_POOL_SLAB_SIZE (1 << 16)
+#define CAP_POOL_CACHE_BATCH 32
+
+// Slabs are kept in the order they were allocated, the objects follow the
+// header at the default alignment
+typedef struct _cap_pool_slab {
+	struct _cap_pool_slab *_next;
+} _cap_pool_slab;
+
+typedef struct {
+	size_t _object_size;
+	size_t _objects_per_slab;
+	// A free object holds the next free object in it's first bytes
+	void *_free_list;
+	_cap_pool_slab *_slabs;
+	_cap_pool_slab *_last_slab;
+	// Slab objects are handed out in order, until the current slab is used
+	// up, before the free list is ever used
+	_cap_pool_slab *_current_slab;
+	size_t _next_object;
+	size_t _slab_count;
+	size_t _in_use;
+	// Only taken by the thread caches
+	pthread_mutex_t _lock;
+} cap_pool_allocator;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * Per thread cache of a cap_pool_allocator. It's a plain struct owned by the
+ * caller, e.g a _Thread_local variable, holding a few free objects of the pool
+ * so that most allocations and frees don't touch the shared pool at all
+ */
+typedef struct {
+	cap_pool_allocator *_pool;
+	void *_free_list;
+	size_t _count;
+} cap_pool_cache;
+
+/**
+ * cap_pool_allocator hands out objects of a single size, carved from slabs.
+ * Allocating and freeing an object are O(1): a freed object is pushed on a free
+ * list threaded through the free objects themselves, and the next allocation
+ * pops it, so a container node costs no malloc() call once the pool is warm.
+ * Every object can be released at once with cap_pool_reset(), which keeps the
+ * slabs for reuse without walking the objects.
+ *
+ * The pool isn't thread-safe by itself. Threads sharing a pool each go through
+ * their own cap_pool_cache, which moves objects from and to the pool in
+ * batches of CAP_POOL_CACHE_BATCH under the pool's lock. While caches are in
+ * use, the pool must not be used directly.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_pool_allocator
+ *
+ * @param object_size Size of the objects, rounded up to a multiple of the
+ * pointer size, which is the objects' alignment
+ * @param objects_per_slab Number of objects within each slab, 0 to fit the
+ * slabs in CAP_POOL_SLAB_SIZE bytes
+ * @return Allocated cap_pool_allocator, NULL if there was a memory error
+ */
+static cap_pool_allocator *cap_pool_allocator_init(size_t object_size,
+						   size_t objects_per_slab);
+/**
+ * Allocate an object from the pool
+ *
+ * @param pool cap_pool_allocator object
+ * @return Pointer to the object, NULL if a new slab couldn't be allocated
+ */
+static void *cap_pool_alloc(cap_pool_allocator *pool);
+/**
+ * Free an object back to the pool
+ *
+ * @param pool cap_pool_allocator object
+ * @param object Object allocated from the pool
+ */
+static void cap_pool_free(cap_pool_allocator *pool, void *object);
+/**
+ * Release every object of the pool at once, the slabs are kept and the next
+ * allocations reuse them
+ *
+ * @param pool cap_pool_allocator object
+ */
+static void cap_pool_reset(cap_pool_allocator *pool);
+/**
+ * Get the number of objects allocated from the pool, including the ones held
+ * by thread caches
+ *
+ * @param pool cap_pool_allocator object
+ * @return Number of objects in use
+ */
+static size_t cap_pool_in_use(cap_pool_allocator *pool);
+/**
+ * Get the number of objects the pool's slabs can hold
+ *
+ * @param pool cap_pool_allocator object
+ * @return Capacity of the pool
+ */
+static size_t cap_pool_capacity(cap_pool_allocator *pool);
+/**
+ * Get the size of the pool's objects
+ *
+ * @param pool cap_pool_allocator object
+ * @return Object size, after rounding
+ */
+static size_t cap_pool_object_size(cap_pool_allocator *pool);
+/**
+ * Free the cap_pool_allocator along with all of it's slabs
+ *
+ * @param pool cap_pool_allocator object
+ */
+static void cap_pool_allocator_free(cap_pool_allocator *pool);
+/**
+ * Initilize a thread cache of the pool, it holds no object yet
+ *
+ * @param cache Cache to initilize
+ * @param pool cap_pool_allocator object the cache draws from
+ */
+static void cap_pool_cache_init(cap_pool_cache *cache,
+				cap_pool_allocator *pool);
+/**
+ * Allocate an object through a thread cache
+ *
+ * @param cache Thread cache of the pool
+ * @return Pointer to the object, NULL if a new slab couldn't be allocated
+ */
+static void *cap_pool_cache_alloc(cap_pool_cache *cache);
+/**
+ * Free an object through a thread cache, the object may have been allocated
+ * by another thread
+ *
+ * @param cache Thread cache of the pool
+ * @param object Object allocated from the pool
+ */
+static void cap_pool_cache_free(cap_pool_cache *cache, void *object);
+/**
+ * Give every object held by the thread cache back to the pool, e.g before the
+ * thread exits
+ *
+ * @param cache Thread cache of the pool
+ */
+static void cap_pool_cache_flush(cap_pool_cache *cache);
+/**
+ * Get a cap_allocator which takes the allocations of up to the pool's object
+ * size from the pool and the larger ones from malloc(), for the containers'
+ * *_init_with_allocator() functions. A list, map or tree built on it takes
+ * it's nodes from the pool, while it's larger arrays still come from malloc().
+ * The allocator isn't thread-safe, like the pool itself
+ *
+ * @param pool cap_pool_allocator object, it must outlive the containers
+ * @return Allocator to pass to the containers
+ */
+static cap_allocator cap_pool_allocator_interface(cap_pool_allocator *pool);
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static size_t _cap_pool_slab_header_size(void);
+static bool _cap_pool_next_slab(cap_pool_allocator *pool);
+static void _cap_pool_cache_give_back(cap_pool_cache *cache, size_t count);
+static void *_cap_pool_interface_alloc(void *pool, size_t size);
+static void *_cap_pool_interface_realloc(void *pool, void *ptr,
+					 size_t old_size, size_t new_size);
+static void _cap_pool_interface_free(void *pool, void *ptr, size_t size);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_pool_allocator *cap_pool_allocator_init(size_t object_size,
+						   size_t objects_per_slab) {
+	assert(object_size > 0);
+	cap_pool_allocator *pool =
+	    (cap_pool_allocator *)malloc(sizeof(cap_pool_allocator));
+	if (!pool) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	// A free object must hold the free list's link
+	pool->_object_size = (object_size + sizeof(void *) - 1) &
+			     ~(sizeof(void *) - 1);
+	pool->_objects_per_slab = objects_per_slab
+				      ? objects_per_slab
+				      : CAP_POOL_SLAB_SIZE / pool->_object_size;
+	if (!pool->_objects_per_slab) pool->_objects_per_slab = 1;
+	pool->_free_list = NULL;
+	pool->_slabs = NULL;
+	pool->_last_slab = NULL;
+	pool->_current_slab = NULL;
+	pool->_next_object = 0;
+	pool->_slab_count = 0;
+	pool->_in_use = 0;
+	if (pthread_mutex_init(&pool->_lock, NULL) != 0) {
+		fprintf(stderr, "pthread_mutex_init failure\n");
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+static size_t _cap_pool_slab_header_size(void) {
+	return (sizeof(_cap_pool_slab) + _Alignof(max_align_t) - 1) &
+	       ~(_Alignof(max_align_t) - 1);
+}
+
+static void *cap_pool_alloc(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	void *object = pool->_free_list;
+	if (object) {
+		pool->_free_list = *(void **)object;
+	} else {
+		if ((!pool->_current_slab ||
+		     pool->_next_object == pool->_objects_per_slab) &&
+		    !_cap_pool_next_slab(pool)) {
+			fprintf(stderr, "memory allocation failure\n");
+			return NULL;
+		}
+		object = (unsigned char *)pool->_current_slab +
+			 _cap_pool_slab_header_size() +
+			 pool->_next_object * pool->_object_size;
+		pool->_next_object++;
+	}
+	pool->_in_use++;
+	return object;
+}
+
+// Moves on to the slab after the current one, allocating it if the pool has
+// never been that large
+static bool _cap_pool_next_slab(cap_pool_allocator *pool) {
+	_cap_pool_slab *next =
+	    pool->_current_slab ? pool->_current_slab->_next : pool->_slabs;
+	if (!next) {
+		if (pool->_objects_per_slab >
+		    (SIZE_MAX - _cap_pool_slab_header_size()) /
+			pool->_object_size)
+			return false;
+		next = (_cap_pool_slab *)malloc(
+		    _cap_pool_slab_header_size() +
+		    pool->_object_size * pool->_objects_per_slab);
+		if (!next) return false;
+		next->_next = NULL;
+		if (pool->_last_slab) pool->_last_slab->_next = next;
+		else pool->_slabs = next;
+		pool->_last_slab = next;
+		pool->_slab_count++;
+	}
+	pool->_current_slab = next;
+	pool->_next_object = 0;
+	return true;
+}
+
+static void cap_pool_free(cap_pool_allocator *pool, void *object) {
+	assert(pool != NULL);
+	if (!object) return;
+	*(void **)object = pool->_free_list;
+	pool->_free_list = object;
+	pool->_in_use--;
+}
+
+static void cap_pool_reset(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	pool->_free_list = NULL;
+	pool->_current_slab = NULL;
+	pool->_next_object = 0;
+	pool->_in_use = 0;
+}
+
+static size_t cap_pool_in_use(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	return pool->_in_use;
+}
+
+static size_t cap_pool_capacity(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	return pool->_slab_count * pool->_objects_per_slab;
+}
+
+static size_t cap_pool_object_size(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	return pool->_object_size;
+}
+
+static void cap_pool_allocator_free(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	while (pool->_slabs) {
+		_cap_pool_slab *slab = pool->_slabs;
+		pool->_slabs = slab->_next;
+		free(slab);
+	}
+	pthread_mutex_destroy(&pool->_lock);
+	free(pool);
+}
+
+static void cap_pool_cache_init(cap_pool_cache *cache,
+				cap_pool_allocator *pool) {
+	assert(cache != NULL && pool != NULL);
+	cache->_pool = pool;
+	cache->_free_list = NULL;
+	cache->_count = 0;
+}
+
+static void *cap_pool_cache_alloc(cap_pool_cache *cache) {
+	assert(cache != NULL);
+	if (!cache->_free_list) {
+		// Refill a batch, the last object is handed out directly
+		cap_pool_allocator *pool = cache->_pool;
+		pthread_mutex_lock(&pool->_lock);
+		for (size_t i = 0; i < CAP_POOL_CACHE_BATCH; ++i) {
+			void *object = cap_pool_alloc(pool);
+			if (!object) break;
+			*(void **)object = cache->_free_list;
+			cache->_free_list = object;
+			cache->_count++;
+		}
+		pthread_mutex_unlock(&pool->_lock);
+		if (!cache->_free_list) return NULL;
+	}
+	void *object = cache->_free_list;
+	cache->_free_list = *(void **)object;
+	cache->_count--;
+	return object;
+}
+
+static void cap_pool_cache_free(cap_pool_cache *cache, void *object) {
+	assert(cache != NULL);
+	if (!object) return;
+	*(void **)object = cache->_free_list;
+	cache->_free_list = object;
+	// Keeping one batch after giving one back means a thread which
+	// alternates allocations and frees doesn't bounce on the pool's lock
+	if (++cache->_count == CAP_POOL_CACHE_BATCH * 2)
+		_cap_pool_cache_give_back(cache, CAP_POOL_CACHE_BATCH);
+}
+
+static void cap_pool_cache_flush(cap_pool_cache *cache) {
+	assert(cache != NULL);
+	if (cache->_count) _cap_pool_cache_give_back(cache, cache->_count);
+}
+
+// Splices the first count objects of the cache's list onto the pool's
+static void _cap_pool_cache_give_back(cap_pool_cache *cache, size_t count) {
+	void *first = cache->_free_list;
+	void *last = first;
+	for (size_t i = 1; i < count; ++i) last = *(void **)last;
+	cache->_free_list = *(void **)last;
+	cache->_count -= count;
+	cap_pool_allocator *pool = cache->_pool;
+	pthread_mutex_lock(&pool->_lock);
+	*(void **)last = pool->_free_list;
+	pool->_free_list = first;
+	pool->_in_use -= count;
+	pthread_mutex_unlock(&pool->_lock);
+}
+
+static cap_allocator cap_pool_allocator_interface(cap_pool_allocator *pool) {
+	assert(pool != NULL);
+	cap_allocator allocator = {_cap_pool_interface_alloc,
+				   _cap_pool_interface_realloc,
+				   _cap_pool_interface_free, pool};
+	return allocator;
+}
+
+// The size given back on free tells which of the two the memory came from
+static void *_cap_pool_interface_alloc(void *pool, size_t size) {
+	cap_pool_allocator *p = (cap_pool_allocator *)pool;
+	if (size <= p->_object_size) return cap_pool_alloc(p);
+	return malloc(size);
+}
+
+static void *_cap_pool_interface_realloc(void *pool, void *ptr,
+					 size_t old_size, size_t new_size) {
+	cap_pool_allocator *p = (cap_pool_allocator *)pool;
+	if (!ptr) return _cap_pool_interface_alloc(pool, new_size);
+	if (old_size > p->_object_size && new_size > p->_object_size)
+		return realloc(ptr, new_size);
+	if (old_size <= p->_object_size && new_size <= p->_object_size)
+		return ptr;
+	void *moved = _cap_pool_interface_alloc(pool, new_size);
+	if (!moved) return NULL;
+	memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+	_cap_pool_interface_free(pool, ptr, old_size);
+	return moved;
+}
+
+static void _cap_pool_interface_free(void *pool, void *ptr, size_t size) {
+	cap_pool_allocator *p = (cap_pool_allocator *)pool;
+	if (size <= p->_object_size)
+		cap_pool_free(p, ptr);
+	else
+		free(ptr);
+}
+
+#endif // !CAP_POOL_ALLOCATOR_H
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_PRIORITY_QUEUE_H
 #define CAP_PRIORITY_QUEUE_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +41,7 @@ typedef struct cap_priority_queue {
 	CAP_GENERIC_TYPE_PTR *_internal_buffer;
 	int (*_compare_fn)(void *item_one, void *item_two);
 	int _capacity;
+	cap_allocator _allocator;
 } cap_priority_queue;
 
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
@@ -54,6 +57,17 @@ typedef struct cap_priority_queue {
  */
 static cap_priority_queue *
 cap_priority_queue_init(int (*compare_fn)(void *item_one, void *item_two));
+/**
+ * Initilize a cap_priority_queue container object which takes the container
+ * and it's buffer from the given allocator
+ *
+ * @param compare_fn Compare function for comparing two keys
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return A priority queue container
+ */
+static cap_priority_queue *cap_priority_queue_init_with_allocator(
+    int (*compare_fn)(void *item_one, void *item_two),
+    const cap_allocator *allocator);
 
 /**
  * Query the current size of cap_priority_queue container
@@ -123,20 +137,29 @@ static bool _cap_priority_queue_resize(cap_priority_queue *pqueue,
 
 static cap_priority_queue *
 cap_priority_queue_init(int (*compare_fn)(void *item_one, void *item_two)) {
+	return cap_priority_queue_init_with_allocator(compare_fn, NULL);
+}
+
+static cap_priority_queue *cap_priority_queue_init_with_allocator(
+    int (*compare_fn)(void *item_one, void *item_two),
+    const cap_allocator *allocator) {
 	assert(compare_fn);
 	cap_priority_queue *pqueue =
-	    (cap_priority_queue *)CAP_ALLOCATOR(cap_priority_queue, 1);
+	    (cap_priority_queue *)_cap_allocator_calloc(
+		allocator, 1, sizeof(cap_priority_queue));
 	if (!pqueue) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
+	if (allocator) pqueue->_allocator = *allocator;
 	// Default capacity is 5, but it'll be increased in log(n) times.
 	const size_t default_size = 5;
-	pqueue->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(
-	    CAP_GENERIC_TYPE_PTR, default_size);
+	pqueue->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)_cap_allocator_alloc(
+	    allocator, sizeof(CAP_GENERIC_TYPE_PTR) * default_size);
 	if (!pqueue->_internal_buffer) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(pqueue);
+		_cap_allocator_free(allocator, pqueue,
+				    sizeof(cap_priority_queue));
 		return NULL;
 	}
 	pqueue->_capacity = default_size;
@@ -147,7 +170,8 @@ cap_priority_queue_init(int (*compare_fn)(void *item_one, void *item_two)) {
 
 static bool cap_priority_queue_push(cap_priority_queue *pqueue, void *item) {
 	assert(pqueue && item);
-	if (pqueue->_capacity <= pqueue->_size)
+	// The heap starts at index 1, so the next slot is _size + 1
+	if (pqueue->_capacity <= pqueue->_size + 1)
 		if (!_cap_priority_queue_resize(pqueue, pqueue->_capacity * 2))
 			return false;
 	pqueue->_internal_buffer[++pqueue->_size] = (CAP_GENERIC_TYPE_PTR)item;
@@ -195,12 +219,12 @@ static void _cap_priority_queue_sink(cap_priority_queue *pqueue) {
 
 static bool _cap_priority_queue_resize(cap_priority_queue *pqueue,
 				       int new_capacity) {
-	CAP_GENERIC_TYPE_PTR *temp = (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(
-	    CAP_GENERIC_TYPE_PTR, new_capacity);
+	CAP_GENERIC_TYPE_PTR *temp =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_realloc(
+		&pqueue->_allocator, pqueue->_internal_buffer,
+		sizeof(CAP_GENERIC_TYPE_PTR) * pqueue->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR) * new_capacity);
 	if (!temp) return false;
-	memcpy(temp, pqueue->_internal_buffer,
-	       sizeof(CAP_GENERIC_TYPE_PTR) * (pqueue->_size + 1));
-	free(pqueue->_internal_buffer);
 	pqueue->_internal_buffer = temp;
 	pqueue->_capacity = new_capacity;
 	return true;
@@ -227,8 +251,12 @@ static int cap_priority_queue_size(cap_priority_queue *pqueue) {
 
 static void cap_priority_queue_free(cap_priority_queue *pqueue) {
 	if (pqueue) {
-		free(pqueue->_internal_buffer);
-		free(pqueue);
+		cap_allocator allocator = pqueue->_allocator;
+		_cap_allocator_free(&allocator, pqueue->_internal_buffer,
+				    sizeof(CAP_GENERIC_TYPE_PTR) *
+					pqueue->_capacity);
+		_cap_allocator_free(&allocator, pqueue,
+				    sizeof(cap_priority_queue));
 	}
 }
 
@@ -0,0 +1,396 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_SIZE_CLASS_ALLOCATOR_H
+#define CAP_SIZE_CLASS_ALLOCATOR_H
+#include "arena_allocator.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Largest size served from the size classes, larger ones are mapped on their
+// own
+#define CAP_SIZE_CLASS_MAX_SIZE (1 << 15)
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+// Sizes up to 128 bytes step by 16, the larger ones by a quarter of their
+// power of two, so rounding a size over 128 bytes up to it's class wastes
+// less than a fifth of the class
+#define CAP_SIZE_CLASS_COUNT 40
+// First block of the arena the classes are carved from
+#define CAP_SIZE_CLASS_BLOCK_SIZE (1 << 16)
+
+// Header of a mapped allocation, they're linked so that a reset or the
+// allocator's free can unmap them
+typedef struct _cap_size_class_large {
+	struct _cap_size_class_large *_prev;
+	struct _cap_size_class_large *_next;
+	size_t _map_size;
+} _cap_size_class_large;
+
+typedef struct {
+	cap_arena_allocator *_arena;
+	// A free chunk holds the next free chunk of it's class in it's first
+	// bytes
+	void *_free_lists[CAP_SIZE_CLASS_COUNT];
+	_cap_size_class_large *_large;
+	size_t _in_use;
+	size_t _large_size;
+} cap_size_class_allocator;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_size_class_allocator is a general purpose allocator for values of
+ * varying size. The sizes up to CAP_SIZE_CLASS_MAX_SIZE are rounded up to one
+ * of 40 size classes, from 16 bytes up, and carved from the blocks of a
+ * growable cap_arena_allocator. A freed chunk goes on the free list of it's
+ * class and the next allocation of the class pops it, so allocating and
+ * freeing are O(1) and never call malloc() once the arena is warm. Larger
+ * sizes are mapped with mmap() on their own and unmapped when freed.
+ *
+ * The sizes are passed back on free and realloc, as with cap_allocator, so the
+ * chunks carry no header and the small values are packed within the arena's
+ * blocks. Every allocation is released at once with cap_size_class_reset(),
+ * which keeps the arena's largest block for reuse. With CAP_ARENA_DEBUG, a
+ * freed chunk is poisoned like the arena's free memory, but for it's free list
+ * link. The allocator isn't thread-safe.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_size_class_allocator
+ *
+ * @param block_size Size of the first block of the arena the size classes are
+ * carved from, 0 for CAP_SIZE_CLASS_BLOCK_SIZE
+ * @return Allocated cap_size_class_allocator, NULL if there was a memory error
+ */
+static cap_size_class_allocator *
+cap_size_class_allocator_init(size_t block_size);
+/**
+ * Allocate memory of the given size, aligned to CAP_ARENA_DEFAULT_ALIGNMENT
+ *
+ * @param allocator cap_size_class_allocator object
+ * @param size Size of the memory
+ * @return Pointer to the memory, NULL if there was a memory error
+ */
+static void *cap_size_class_alloc(cap_size_class_allocator *allocator,
+				  size_t size);
+/**
+ * Free memory back to the allocator
+ *
+ * @param allocator cap_size_class_allocator object
+ * @param ptr Memory allocated from the allocator, or NULL
+ * @param size Size the memory was allocated or last reallocated with
+ */
+static void cap_size_class_free(cap_size_class_allocator *allocator, void *ptr,
+				size_t size);
+/**
+ * Resize the given memory. It's returned as is if the new size falls in the
+ * same size class, or fits in the pages of a mapped allocation, otherwise the
+ * contents are moved to a new allocation
+ *
+ * @param allocator cap_size_class_allocator object
+ * @param ptr Memory to resize, NULL to make a new allocation
+ * @param old_size Size the memory was allocated with
+ * @param new_size New size of the memory
+ * @return Pointer to the resized memory, NULL if there was a memory error, in
+ * which case the given memory is left as it is
+ */
+static void *cap_size_class_realloc(cap_size_class_allocator *allocator,
+				    void *ptr, size_t old_size,
+				    size_t new_size);
+/**
+ * Release every allocation at once. The mapped allocations are unmapped and
+ * the arena is reset, keeping it's largest block for the next allocations
+ *
+ * @param allocator cap_size_class_allocator object
+ */
+static void cap_size_class_reset(cap_size_class_allocator *allocator);
+/**
+ * Get the number of bytes in use, each allocation counted at the size of it's
+ * class or of it's mapping
+ *
+ * @param allocator cap_size_class_allocator object
+ * @return Bytes in use
+ */
+static size_t cap_size_class_in_use(cap_size_class_allocator *allocator);
+/**
+ * Get the number of bytes the allocator holds, the capacity of it's arena and
+ * the size of the mapped allocations
+ *
+ * @param allocator cap_size_class_allocator object
+ * @return Capacity of the allocator
+ */
+static size_t cap_size_class_capacity(cap_size_class_allocator *allocator);
+/**
+ * Get the size an allocation of the given size actually takes
+ *
+ * @param size Size of an allocation
+ * @return Size of it's class, or of it's mapping beyond
+ * CAP_SIZE_CLASS_MAX_SIZE
+ */
+static size_t cap_size_class_round(size_t size);
+/**
+ * Free the cap_size_class_allocator, along with it's arena and the mapped
+ * allocations
+ *
+ * @param allocator cap_size_class_allocator object
+ */
+static void
+cap_size_class_allocator_free(cap_size_class_allocator *allocator);
+/**
+ * Get a cap_allocator which takes it's memory from the size class allocator,
+ * for the containers' *_init_with_allocator() functions. The containers'
+ * arrays and nodes share the allocator's blocks, and are dropped along with
+ * them by cap_size_class_reset()
+ *
+ * @param allocator cap_size_class_allocator object, it must outlive the
+ * containers
+ * @return Allocator to pass to the containers
+ */
+static cap_allocator
+cap_size_class_allocator_interface(cap_size_class_allocator *allocator);
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static size_t _cap_size_class_index(size_t size);
+static size_t _cap_size_class_size(size_t index);
+static size_t _cap_size_class_large_header_size(void);
+static size_t _cap_size_class_map_size(size_t size);
+static void *_cap_size_class_map(cap_size_class_allocator *allocator,
+				 size_t size);
+static void _cap_size_class_unmap(cap_size_class_allocator *allocator,
+				  _cap_size_class_large *large);
+static void *_cap_size_class_interface_alloc(void *allocator, size_t size);
+static void *_cap_size_class_interface_realloc(void *allocator, void *ptr,
+					       size_t old_size,
+					       size_t new_size);
+static void _cap_size_class_interface_free(void *allocator, void *ptr,
+					   size_t size);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_size_class_allocator *
+cap_size_class_allocator_init(size_t block_size) {
+	cap_size_class_allocator *allocator =
+	    (cap_size_class_allocator *)malloc(
+		sizeof(cap_size_class_allocator));
+	if (!allocator) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	allocator->_arena = cap_arena_allocator_init_growable(
+	    block_size ? block_size : CAP_SIZE_CLASS_BLOCK_SIZE);
+	if (!allocator->_arena) {
+		fprintf(stderr, "memory allocation failure\n");
+		free(allocator);
+		return NULL;
+	}
+	for (size_t i = 0; i < CAP_SIZE_CLASS_COUNT; ++i)
+		allocator->_free_lists[i] = NULL;
+	allocator->_large = NULL;
+	allocator->_in_use = 0;
+	allocator->_large_size = 0;
+	return allocator;
+}
+
+// Classes 0 to 7 are 16 to 128 bytes, then each power of two from 256 to
+// 32768 is reached in four steps
+static size_t _cap_size_class_index(size_t size) {
+	if (size <= 128) return size ? (size - 1) / 16 : 0;
+	size_t power = 7;
+	while (((size_t)1 << (power + 1)) < size) power++;
+	return 8 + (power - 7) * 4 + ((size - 1) >> (power - 2)) - 4;
+}
+
+static size_t _cap_size_class_size(size_t index) {
+	if (index < 8) return (index + 1) * 16;
+	size_t power = 7 + (index - 8) / 4;
+	return ((size_t)1 << power) +
+	       ((index - 8) % 4 + 1) * ((size_t)1 << (power - 2));
+}
+
+static size_t _cap_size_class_large_header_size(void) {
+	return (sizeof(_cap_size_class_large) + CAP_ARENA_DEFAULT_ALIGNMENT -
+		1) &
+	       ~(CAP_ARENA_DEFAULT_ALIGNMENT - 1);
+}
+
+// A mapping holds the header and the allocation, in whole pages
+static size_t _cap_size_class_map_size(size_t size) {
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t header = _cap_size_class_large_header_size();
+	if (size > SIZE_MAX - header - page) return 0;
+	return (size + header + page - 1) & ~(page - 1);
+}
+
+static size_t cap_size_class_round(size_t size) {
+	if (size > CAP_SIZE_CLASS_MAX_SIZE)
+		return _cap_size_class_map_size(size) -
+		       _cap_size_class_large_header_size();
+	return _cap_size_class_size(_cap_size_class_index(size));
+}
+
+static void *cap_size_class_alloc(cap_size_class_allocator *allocator,
+				  size_t size) {
+	assert(allocator != NULL);
+	if (size > CAP_SIZE_CLASS_MAX_SIZE)
+		return _cap_size_class_map(allocator, size);
+	size_t index = _cap_size_class_index(size);
+	void *chunk = allocator->_free_lists[index];
+	if (chunk) {
+		allocator->_free_lists[index] = *(void **)chunk;
+		_cap_arena_unpoison(chunk, _cap_size_class_size(index));
+	} else {
+		chunk = cap_arena_alloc(allocator->_arena,
+					_cap_size_class_size(index));
+		if (!chunk) return NULL;
+	}
+	allocator->_in_use += _cap_size_class_size(index);
+	return chunk;
+}
+
+static void *_cap_size_class_map(cap_size_class_allocator *allocator,
+				 size_t size) {
+	size_t map_size = _cap_size_class_map_size(size);
+	void *mem = map_size ? mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+				    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+			     : MAP_FAILED;
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	_cap_size_class_large *large = (_cap_size_class_large *)mem;
+	large->_prev = NULL;
+	large->_next = allocator->_large;
+	large->_map_size = map_size;
+	if (allocator->_large) allocator->_large->_prev = large;
+	allocator->_large = large;
+	allocator->_in_use += map_size;
+	allocator->_large_size += map_size;
+	return (unsigned char *)mem + _cap_size_class_large_header_size();
+}
+
+static void _cap_size_class_unmap(cap_size_class_allocator *allocator,
+				  _cap_size_class_large *large) {
+	if (large->_prev) large->_prev->_next = large->_next;
+	else allocator->_large = large->_next;
+	if (large->_next) large->_next->_prev = large->_prev;
+	allocator->_in_use -= large->_map_size;
+	allocator->_large_size -= large->_map_size;
+	munmap(large, large->_map_size);
+}
+
+static void cap_size_class_free(cap_size_class_allocator *allocator, void *ptr,
+				size_t size) {
+	assert(allocator != NULL);
+	if (!ptr) return;
+	if (size > CAP_SIZE_CLASS_MAX_SIZE) {
+		unsigned char *mem =
+		    (unsigned char *)ptr - _cap_size_class_large_header_size();
+		_cap_size_class_unmap(allocator, (_cap_size_class_large *)mem);
+		return;
+	}
+	size_t index = _cap_size_class_index(size);
+	// The debug mode of the arena poisons the chunk but for it's link
+	_cap_arena_poison(ptr, _cap_size_class_size(index));
+	_cap_arena_unpoison(ptr, sizeof(void *));
+	*(void **)ptr = allocator->_free_lists[index];
+	allocator->_free_lists[index] = ptr;
+	allocator->_in_use -= _cap_size_class_size(index);
+}
+
+static void *cap_size_class_realloc(cap_size_class_allocator *allocator,
+				    void *ptr, size_t old_size,
+				    size_t new_size) {
+	assert(allocator != NULL);
+	if (!ptr) return cap_size_class_alloc(allocator, new_size);
+	if (cap_size_class_round(old_size) == cap_size_class_round(new_size) &&
+	    (old_size > CAP_SIZE_CLASS_MAX_SIZE) ==
+		(new_size > CAP_SIZE_CLASS_MAX_SIZE))
+		return ptr;
+	void *moved = cap_size_class_alloc(allocator, new_size);
+	if (!moved) return NULL;
+	memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+	cap_size_class_free(allocator, ptr, old_size);
+	return moved;
+}
+
+static void cap_size_class_reset(cap_size_class_allocator *allocator) {
+	assert(allocator != NULL);
+	while (allocator->_large)
+		_cap_size_class_unmap(allocator, allocator->_large);
+	for (size_t i = 0; i < CAP_SIZE_CLASS_COUNT; ++i)
+		allocator->_free_lists[i] = NULL;
+	cap_arena_reset(allocator->_arena);
+	allocator->_in_use = 0;
+}
+
+static size_t cap_size_class_in_use(cap_size_class_allocator *allocator) {
+	assert(allocator != NULL);
+	return allocator->_in_use;
+}
+
+static size_t cap_size_class_capacity(cap_size_class_allocator *allocator) {
+	assert(allocator != NULL);
+	return cap_arena_capacity(allocator->_arena) + allocator->_large_size;
+}
+
+static void
+cap_size_class_allocator_free(cap_size_class_allocator *allocator) {
+	assert(allocator != NULL);
+	while (allocator->_large)
+		_cap_size_class_unmap(allocator, allocator->_large);
+	cap_arena_free(allocator->_arena);
+	free(allocator);
+}
+
+static cap_allocator
+cap_size_class_allocator_interface(cap_size_class_allocator *allocator) {
+	assert(allocator != NULL);
+	cap_allocator interface = {_cap_size_class_interface_alloc,
+				   _cap_size_class_interface_realloc,
+				   _cap_size_class_interface_free, allocator};
+	return interface;
+}
+
+static void *_cap_size_class_interface_alloc(void *allocator, size_t size) {
+	return cap_size_class_alloc((cap_size_class_allocator *)allocator,
+				    size);
+}
+
+static void *_cap_size_class_interface_realloc(void *allocator, void *ptr,
+					       size_t old_size,
+					       size_t new_size) {
+	return cap_size_class_realloc((cap_size_class_allocator *)allocator,
+				      ptr, old_size, new_size);
+}
+
+static void _cap_size_class_interface_free(void *allocator, void *ptr,
+					   size_t size) {
+	cap_size_class_free((cap_size_class_allocator *)allocator, ptr, size);
+}
+
+#endif // !CAP_SIZE_CLASS_ALLOCATOR_H
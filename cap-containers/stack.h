@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_STACK_H
 #define CAP_STACK_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +40,7 @@ typedef struct {
 	CAP_GENERIC_TYPE_PTR *_internal_buffer;
 	size_t _size;
 	size_t _capacity;
+	cap_allocator _allocator;
 } _cap_vector;
 
 typedef struct {
@@ -52,6 +55,14 @@ typedef struct {
  * @return Allocated cap_stack container
  */
 static cap_stack *cap_stack_init();
+/**
+ * Initilize a cap_stack object which takes it's memory from the given
+ * allocator
+ *
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_stack container
+ */
+static cap_stack *cap_stack_init_with_allocator(const cap_allocator *allocator);
 /**
  * Push an element onto the cap_stack container
  *
@@ -99,21 +110,28 @@ static void cap_stack_swap(cap_stack *stack_one, cap_stack *stack_two);
 // Prototypes (Internal helpers)
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 static bool _cap_vector_push_back(_cap_vector *, void *);
-static _cap_vector *_cap_vector_init(size_t);
+static _cap_vector *_cap_vector_init(size_t, const cap_allocator *);
 static void *_cap_vector_pop_back(_cap_vector *);
 static void *_cap_vector_back(_cap_vector *);
 #endif // !DOXYGEN_SHOULD_SKIP_THIS
 
 static cap_stack *cap_stack_init() {
-	cap_stack *stack = (cap_stack *)CAP_ALLOCATOR(cap_stack, 1);
+	return cap_stack_init_with_allocator(NULL);
+}
+
+static cap_stack *
+cap_stack_init_with_allocator(const cap_allocator *allocator) {
+	cap_stack *stack =
+	    (cap_stack *)_cap_allocator_calloc(allocator, 1, sizeof(cap_stack));
 	if (!stack) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
-	stack->_internal_container = _cap_vector_init(CAP_STACK_INITIAL_SIZE);
+	stack->_internal_container =
+	    _cap_vector_init(CAP_STACK_INITIAL_SIZE, allocator);
 	if (!stack->_internal_container) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(stack);
+		_cap_allocator_free(allocator, stack, sizeof(cap_stack));
 		return NULL;
 	}
 	return stack;
@@ -152,18 +170,22 @@ static void cap_stack_swap(cap_stack *stack_one, cap_stack *stack_two) {
 	stack_two->_internal_container = one_tmp_internal_container;
 }
 
-static _cap_vector *_cap_vector_init(size_t initial_size) {
+static _cap_vector *_cap_vector_init(size_t initial_size,
+				     const cap_allocator *allocator) {
 	assert(initial_size > 0);
-	_cap_vector *vector = (_cap_vector *)CAP_ALLOCATOR(_cap_vector, 1);
+	_cap_vector *vector = (_cap_vector *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(_cap_vector));
 	if (!vector) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
-	vector->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(
-	    CAP_GENERIC_TYPE_PTR, initial_size);
+	if (allocator) vector->_allocator = *allocator;
+	vector->_internal_buffer =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_calloc(
+		allocator, initial_size, sizeof(CAP_GENERIC_TYPE_PTR));
 	if (!vector->_internal_buffer) {
 		fprintf(stderr, "memory allocation failure\n");
-		free(vector);
+		_cap_allocator_free(allocator, vector, sizeof(_cap_vector));
 		return NULL;
 	}
 	vector->_capacity = initial_size;
@@ -173,8 +195,11 @@ static _cap_vector *_cap_vector_init(size_t initial_size) {
 
 static bool _cap_vector_reserve(_cap_vector *vector, size_t new_size) {
 	assert(vector != NULL && new_size > 0);
-	CAP_GENERIC_TYPE_PTR *tmp_ptr = (CAP_GENERIC_TYPE_PTR *)realloc(
-	    vector->_internal_buffer, sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
+	CAP_GENERIC_TYPE_PTR *tmp_ptr =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_realloc(
+		&vector->_allocator, vector->_internal_buffer,
+		sizeof(CAP_GENERIC_TYPE_PTR) * vector->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
 	if (!tmp_ptr) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
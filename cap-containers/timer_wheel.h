@@ -0,0 +1,356 @@
+// cap-containers for pure C
+// Copyright © 2024 Harsath <harsath@fastmail.com>
+// The software is licensed under the MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef CAP_TIMER_WHEEL_H
+#define CAP_TIMER_WHEEL_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CAP_ALLOCATOR(type, number_of_elements)                                \
+	calloc(number_of_elements, sizeof(type))
+// Each level of the wheel has 64 slots and covers 6 more bits of the time,
+// 11 levels cover every 64 bit time
+#define CAP_TIMER_WHEEL_BITS 6
+#define CAP_TIMER_WHEEL_SLOTS_PER_LEVEL (1 << CAP_TIMER_WHEEL_BITS)
+#define CAP_TIMER_WHEEL_LEVELS 11
+// The slot after the last level holds the timers which are already due
+#define CAP_TIMER_WHEEL_DUE_SLOT                                               \
+	(CAP_TIMER_WHEEL_LEVELS * CAP_TIMER_WHEEL_SLOTS_PER_LEVEL)
+
+typedef struct cap_timer_wheel_timer {
+	struct cap_timer_wheel_timer *_next;
+	// Points to the link which points to this timer, NULL if the timer
+	// isn't scheduled
+	struct cap_timer_wheel_timer **_pprev;
+	uint64_t _expires;
+	void *_data;
+	unsigned short _slot;
+} cap_timer_wheel_timer;
+
+typedef struct {
+	// Every slot whose time is at or before _now was processed
+	uint64_t _now;
+	size_t _size;
+	// The timers are allocated by the wheel, unless the wheel is embedded
+	// within another container which owns them
+	bool _owns_timers;
+	// Bit i of _occupied[level] is set if the level's slot i has timers
+	uint64_t _occupied[CAP_TIMER_WHEEL_LEVELS];
+	cap_timer_wheel_timer *_slots[CAP_TIMER_WHEEL_DUE_SLOT + 1];
+} cap_timer_wheel;
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+/**
+ * cap_timer_wheel is a hierarchical timing wheel, holding timers which expire
+ * at a given time. The times are plain 64 bit ticks, the wheel doesn't care
+ * whether they are milliseconds or anything else.
+ *
+ * A timer is placed on the level of the highest 6 bit group in which it's
+ * time differs from the wheel's current time, so adding and cancelling a timer
+ * is O(1). Advancing the wheel skips the empty slots through a bitmap per
+ * level, and a timer moves down at most once per level before it fires, so
+ * advancing is O(expired timers) no matter how much time passes.
+ */
+
+// Prototypes (Public APIs)
+/**
+ * Initilize a cap_timer_wheel container
+ *
+ * @param now Current time of the wheel
+ * @return Allocated cap_timer_wheel container, NULL if there was a memory error
+ */
+static cap_timer_wheel *cap_timer_wheel_init(uint64_t now);
+/**
+ * Add a timer to the wheel. A timer whose time already passed fires on the
+ * next advance
+ *
+ * @param wheel cap_timer_wheel container
+ * @param data Pointer which is passed to the expire function when the timer
+ * fires
+ * @param expires Time at which the timer fires
+ * @return Handle of the timer, which stays valid until the timer fires or is
+ * cancelled. NULL if there was a memory error
+ */
+static cap_timer_wheel_timer *
+cap_timer_wheel_add(cap_timer_wheel *wheel, void *data, uint64_t expires);
+/**
+ * Cancel a timer which hasn't fired yet, the handle is invalid afterwards
+ *
+ * @param wheel cap_timer_wheel container
+ * @param timer Handle returned by cap_timer_wheel_add()
+ */
+static void cap_timer_wheel_cancel(cap_timer_wheel *wheel,
+				   cap_timer_wheel_timer *timer);
+/**
+ * Move a timer which hasn't fired yet to a new time
+ *
+ * @param wheel cap_timer_wheel container
+ * @param timer Handle returned by cap_timer_wheel_add()
+ * @param expires New time at which the timer fires
+ */
+static void cap_timer_wheel_reschedule(cap_timer_wheel *wheel,
+				       cap_timer_wheel_timer *timer,
+				       uint64_t expires);
+/**
+ * Advance the wheel's time and fire every timer which expires at or before
+ * the new time. The slots fire in the order of their times, so a timer fires
+ * before the ones of a later tick. The expire function may add and cancel
+ * other timers
+ *
+ * @param wheel cap_timer_wheel container
+ * @param now New time of the wheel, a time before the current one is ignored
+ * @param expire_fn Function called with the data of each fired timer and arg
+ * @param arg Pointer passed to expire_fn
+ * @return Number of timers fired
+ */
+static size_t cap_timer_wheel_advance(cap_timer_wheel *wheel, uint64_t now,
+				      void (*expire_fn)(void *data, void *arg),
+				      void *arg);
+/**
+ * Get the current time of the wheel
+ *
+ * @param wheel cap_timer_wheel container
+ * @return Time the wheel was last advanced to
+ */
+static uint64_t cap_timer_wheel_now(cap_timer_wheel *wheel);
+/**
+ * Get the number of pending timers
+ *
+ * @param wheel cap_timer_wheel container
+ * @return Number of timers
+ */
+static size_t cap_timer_wheel_size(cap_timer_wheel *wheel);
+/**
+ * Deallocate the cap_timer_wheel container along with the pending timers. The
+ * data of the timers isn't touched
+ *
+ * @param wheel cap_timer_wheel container
+ */
+static void cap_timer_wheel_free(cap_timer_wheel *wheel);
+
+// Prototypes (Internal helpers)
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+static cap_timer_wheel *_cap_timer_wheel_init(uint64_t now, bool owns_timers);
+static void _cap_timer_wheel_schedule(cap_timer_wheel *wheel,
+				      cap_timer_wheel_timer *timer,
+				      uint64_t expires);
+static void _cap_timer_wheel_unlink(cap_timer_wheel *wheel,
+				    cap_timer_wheel_timer *timer);
+static void _cap_timer_wheel_link(cap_timer_wheel *wheel,
+				  cap_timer_wheel_timer *timer);
+static bool _cap_timer_wheel_next_event(cap_timer_wheel *wheel,
+					uint64_t *time, unsigned *slot);
+static cap_timer_wheel_timer *_cap_timer_wheel_pop(cap_timer_wheel *wheel,
+						   uint64_t now);
+#endif // !DOXYGEN_SHOULD_SKIP_THIS
+
+static cap_timer_wheel *cap_timer_wheel_init(uint64_t now) {
+	return _cap_timer_wheel_init(now, true);
+}
+
+static cap_timer_wheel_timer *
+cap_timer_wheel_add(cap_timer_wheel *wheel, void *data, uint64_t expires) {
+	assert(wheel != NULL && wheel->_owns_timers);
+	cap_timer_wheel_timer *timer =
+	    (cap_timer_wheel_timer *)CAP_ALLOCATOR(cap_timer_wheel_timer, 1);
+	if (!timer) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	timer->_data = data;
+	_cap_timer_wheel_schedule(wheel, timer, expires);
+	return timer;
+}
+
+static void cap_timer_wheel_cancel(cap_timer_wheel *wheel,
+				   cap_timer_wheel_timer *timer) {
+	assert(wheel != NULL && timer != NULL && wheel->_owns_timers);
+	_cap_timer_wheel_unlink(wheel, timer);
+	free(timer);
+}
+
+static void cap_timer_wheel_reschedule(cap_timer_wheel *wheel,
+				       cap_timer_wheel_timer *timer,
+				       uint64_t expires) {
+	assert(wheel != NULL && timer != NULL);
+	_cap_timer_wheel_schedule(wheel, timer, expires);
+}
+
+static size_t cap_timer_wheel_advance(cap_timer_wheel *wheel, uint64_t now,
+				      void (*expire_fn)(void *data, void *arg),
+				      void *arg) {
+	assert(wheel != NULL && expire_fn != NULL && wheel->_owns_timers);
+	size_t fired = 0;
+	cap_timer_wheel_timer *timer;
+	// Timers are popped one at a time, so the expire function can cancel
+	// timers which are due but didn't fire yet
+	while ((timer = _cap_timer_wheel_pop(wheel, now))) {
+		void *data = timer->_data;
+		free(timer);
+		expire_fn(data, arg);
+		fired++;
+	}
+	return fired;
+}
+
+static uint64_t cap_timer_wheel_now(cap_timer_wheel *wheel) {
+	assert(wheel != NULL);
+	return wheel->_now;
+}
+
+static size_t cap_timer_wheel_size(cap_timer_wheel *wheel) {
+	assert(wheel != NULL);
+	return wheel->_size;
+}
+
+static void cap_timer_wheel_free(cap_timer_wheel *wheel) {
+	assert(wheel != NULL);
+	if (wheel->_owns_timers) {
+		for (int slot = 0; slot <= CAP_TIMER_WHEEL_DUE_SLOT; ++slot) {
+			cap_timer_wheel_timer *current = wheel->_slots[slot];
+			while (current) {
+				cap_timer_wheel_timer *temp = current;
+				current = current->_next;
+				free(temp);
+			}
+		}
+	}
+	free(wheel);
+}
+
+static cap_timer_wheel *_cap_timer_wheel_init(uint64_t now, bool owns_timers) {
+	cap_timer_wheel *wheel =
+	    (cap_timer_wheel *)CAP_ALLOCATOR(cap_timer_wheel, 1);
+	if (!wheel) {
+		fprintf(stderr, "memory allocation failure\n");
+		return NULL;
+	}
+	wheel->_now = now;
+	wheel->_owns_timers = owns_timers;
+	return wheel;
+}
+
+static void _cap_timer_wheel_schedule(cap_timer_wheel *wheel,
+				      cap_timer_wheel_timer *timer,
+				      uint64_t expires) {
+	_cap_timer_wheel_unlink(wheel, timer);
+	timer->_expires = expires;
+	_cap_timer_wheel_link(wheel, timer);
+	wheel->_size++;
+}
+
+static void _cap_timer_wheel_unlink(cap_timer_wheel *wheel,
+				    cap_timer_wheel_timer *timer) {
+	if (!timer->_pprev) return;
+	*timer->_pprev = timer->_next;
+	if (timer->_next) timer->_next->_pprev = timer->_pprev;
+	unsigned slot = timer->_slot;
+	if (slot != CAP_TIMER_WHEEL_DUE_SLOT && !wheel->_slots[slot])
+		wheel->_occupied[slot / CAP_TIMER_WHEEL_SLOTS_PER_LEVEL] &=
+		    ~(1ULL << (slot % CAP_TIMER_WHEEL_SLOTS_PER_LEVEL));
+	timer->_pprev = NULL;
+	timer->_next = NULL;
+	wheel->_size--;
+}
+
+// Links the timer into the slot of it's time, relative to the wheel's time
+static void _cap_timer_wheel_link(cap_timer_wheel *wheel,
+				  cap_timer_wheel_timer *timer) {
+	unsigned slot = CAP_TIMER_WHEEL_DUE_SLOT;
+	if (timer->_expires > wheel->_now) {
+		// The level of the highest differing 6 bit group, the timer's
+		// group there is greater than the wheel's
+		int bit = 63 - __builtin_clzll(timer->_expires ^ wheel->_now);
+		unsigned level = bit / CAP_TIMER_WHEEL_BITS;
+		unsigned shift = level * CAP_TIMER_WHEEL_BITS;
+		unsigned index = (unsigned)(timer->_expires >> shift) &
+				 (CAP_TIMER_WHEEL_SLOTS_PER_LEVEL - 1);
+		slot = level * CAP_TIMER_WHEEL_SLOTS_PER_LEVEL + index;
+		wheel->_occupied[level] |= 1ULL << index;
+	}
+	timer->_slot = (unsigned short)slot;
+	timer->_next = wheel->_slots[slot];
+	if (timer->_next) timer->_next->_pprev = &timer->_next;
+	wheel->_slots[slot] = timer;
+	timer->_pprev = &wheel->_slots[slot];
+}
+
+// Finds the earliest occupied slot after the wheel's time. Within a level the
+// occupied slots are all after the wheel's group, and every slot of a lower
+// level comes before the next slot of a higher level, so the first level with
+// an occupied slot holds the earliest one
+static bool _cap_timer_wheel_next_event(cap_timer_wheel *wheel,
+					uint64_t *time, unsigned *slot) {
+	for (unsigned level = 0; level < CAP_TIMER_WHEEL_LEVELS; ++level) {
+		unsigned shift = level * CAP_TIMER_WHEEL_BITS;
+		unsigned group = (unsigned)(wheel->_now >> shift) &
+				 (CAP_TIMER_WHEEL_SLOTS_PER_LEVEL - 1);
+		uint64_t later = group == CAP_TIMER_WHEEL_SLOTS_PER_LEVEL - 1
+				     ? 0
+				     : wheel->_occupied[level] &
+					   (~0ULL << (group + 1));
+		if (!later) continue;
+		unsigned index = (unsigned)__builtin_ctzll(later);
+		// Time of the slot, the higher groups are the wheel's
+		unsigned next_shift = shift + CAP_TIMER_WHEEL_BITS;
+		uint64_t base = 0;
+		if (next_shift < 64)
+			base = wheel->_now >> next_shift << next_shift;
+		*time = base | ((uint64_t)index << shift);
+		*slot = level * CAP_TIMER_WHEEL_SLOTS_PER_LEVEL + index;
+		return true;
+	}
+	return false;
+}
+
+// Unlinks and returns a timer which expires at or before now, NULL once there
+// are none left, in which case the wheel's time is moved to now
+static cap_timer_wheel_timer *_cap_timer_wheel_pop(cap_timer_wheel *wheel,
+						   uint64_t now) {
+	while (!wheel->_slots[CAP_TIMER_WHEEL_DUE_SLOT]) {
+		uint64_t time;
+		unsigned slot;
+		if (!_cap_timer_wheel_next_event(wheel, &time, &slot) ||
+		    time > now) {
+			if (now > wheel->_now) wheel->_now = now;
+			return NULL;
+		}
+		// Every timer of the slot is due or moves down to a lower level
+		wheel->_now = time;
+		cap_timer_wheel_timer *current = wheel->_slots[slot];
+		wheel->_slots[slot] = NULL;
+		wheel->_occupied[slot / CAP_TIMER_WHEEL_SLOTS_PER_LEVEL] &=
+		    ~(1ULL << (slot % CAP_TIMER_WHEEL_SLOTS_PER_LEVEL));
+		while (current) {
+			cap_timer_wheel_timer *next = current->_next;
+			_cap_timer_wheel_link(wheel, current);
+			current = next;
+		}
+	}
+	cap_timer_wheel_timer *timer = wheel->_slots[CAP_TIMER_WHEEL_DUE_SLOT];
+	_cap_timer_wheel_unlink(wheel, timer);
+	return timer;
+}
+
+#endif // !CAP_TIMER_WHEEL_H
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CAP_VECTOR_H
 #define CAP_VECTOR_H
+#include "allocator.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +41,7 @@ typedef struct {
 	CAP_GENERIC_TYPE_PTR *_internal_buffer;
 	size_t _size;
 	size_t _capacity;
+	cap_allocator _allocator;
 } cap_vector;
 
 typedef struct {
@@ -57,6 +60,17 @@ typedef struct {
  * @return Allocated cap_vector container
  */
 static cap_vector *cap_vector_init(size_t init_size);
+/**
+ * Initilize a cap_vector which takes the container and it's buffer from the
+ * given allocator
+ *
+ * @param init_size Initial size
+ * @param allocator Allocator to use, NULL for malloc/realloc/free
+ * @return Allocated cap_vector container
+ */
+static cap_vector *
+cap_vector_init_with_allocator(size_t init_size,
+			       const cap_allocator *allocator);
 /**
  * Initilize an Iterator object for iterating over a cap_vector container
  *
@@ -355,14 +369,28 @@ static bool _cap_vector_reserve(cap_vector *, size_t);
 
 // Implementations:
 static cap_vector *cap_vector_init(size_t initial_size) {
+	return cap_vector_init_with_allocator(initial_size, NULL);
+}
+
+static cap_vector *
+cap_vector_init_with_allocator(size_t initial_size,
+			       const cap_allocator *allocator) {
 	assert(initial_size > 0);
-	cap_vector *vector = (cap_vector *)CAP_ALLOCATOR(cap_vector, 1);
+	cap_vector *vector = (cap_vector *)_cap_allocator_calloc(
+	    allocator, 1, sizeof(cap_vector));
 	if (!vector) {
 		fprintf(stderr, "memory allocation failue\n");
 		return NULL;
 	}
-	vector->_internal_buffer = (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(
-	    CAP_GENERIC_TYPE_PTR, initial_size);
+	if (allocator) vector->_allocator = *allocator;
+	vector->_internal_buffer =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_calloc(
+		allocator, initial_size, sizeof(CAP_GENERIC_TYPE_PTR));
+	if (!vector->_internal_buffer) {
+		fprintf(stderr, "memory allocation failue\n");
+		_cap_allocator_free(allocator, vector, sizeof(cap_vector));
+		return NULL;
+	}
 	vector->_capacity = initial_size;
 	vector->_size = 0;
 	return vector;
@@ -385,8 +413,11 @@ static cap_vector_iterator *cap_vector_iterator_init(cap_vector *vector) {
 
 static bool _cap_vector_reserve(cap_vector *vector, size_t new_size) {
 	assert(vector != NULL && new_size > 0);
-	CAP_GENERIC_TYPE_PTR *tmp_ptr = (CAP_GENERIC_TYPE_PTR *)realloc(
-	    vector->_internal_buffer, sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
+	CAP_GENERIC_TYPE_PTR *tmp_ptr =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_realloc(
+		&vector->_allocator, vector->_internal_buffer,
+		sizeof(CAP_GENERIC_TYPE_PTR) * vector->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
 	if (tmp_ptr == NULL) return false;
 	vector->_internal_buffer = tmp_ptr;
 	vector->_capacity = new_size;
@@ -399,21 +430,25 @@ static void cap_vector_deep_free(cap_vector *vector) {
 		for (size_t i = 0; i < vector->_size; i++)
 			if (vector->_internal_buffer[i] != NULL)
 				free(vector->_internal_buffer[i]);
-		free(vector->_internal_buffer);
 	}
-	free(vector);
+	cap_vector_free(vector);
 }
 
 static void cap_vector_free(cap_vector *vector) {
 	assert(vector != NULL);
-	free(vector->_internal_buffer);
-	free(vector);
+	cap_allocator allocator = vector->_allocator;
+	_cap_allocator_free(&allocator, vector->_internal_buffer,
+			    sizeof(CAP_GENERIC_TYPE_PTR) * vector->_capacity);
+	_cap_allocator_free(&allocator, vector, sizeof(cap_vector));
 }
 
 static bool cap_vector_resize(cap_vector *vector, size_t new_size) {
 	assert(vector != NULL && new_size >= 0);
-	CAP_GENERIC_TYPE_PTR *tmp_ptr = (CAP_GENERIC_TYPE_PTR *)realloc(
-	    vector->_internal_buffer, sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
+	CAP_GENERIC_TYPE_PTR *tmp_ptr =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_realloc(
+		&vector->_allocator, vector->_internal_buffer,
+		sizeof(CAP_GENERIC_TYPE_PTR) * vector->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR) * new_size);
 	if (tmp_ptr == NULL) return false;
 	vector->_internal_buffer = tmp_ptr;
 	vector->_capacity = new_size;
@@ -422,7 +457,8 @@ static bool cap_vector_resize(cap_vector *vector, size_t new_size) {
 
 static cap_vector *cap_vector_copy(cap_vector *vector) {
 	assert(vector != NULL);
-	cap_vector *copy_vector = (cap_vector *)CAP_ALLOCATOR(cap_vector, 1);
+	cap_vector *copy_vector = (cap_vector *)_cap_allocator_calloc(
+	    &vector->_allocator, 1, sizeof(cap_vector));
 	if (!copy_vector) {
 		fprintf(stderr, "memory allocation failue\n");
 		return NULL;
@@ -430,25 +466,29 @@ static cap_vector *cap_vector_copy(cap_vector *vector) {
 	copy_vector->_capacity = vector->_capacity;
 	copy_vector->_internal_buffer = vector->_internal_buffer;
 	copy_vector->_size = vector->_size;
+	copy_vector->_allocator = vector->_allocator;
 	return copy_vector;
 }
 
 static cap_vector *cap_vector_deep_copy(cap_vector *vector) {
 	assert(vector != NULL);
-	cap_vector *deep_copy_vector =
-	    (cap_vector *)CAP_ALLOCATOR(cap_vector, 1);
+	cap_vector *deep_copy_vector = (cap_vector *)_cap_allocator_calloc(
+	    &vector->_allocator, 1, sizeof(cap_vector));
 	if (!deep_copy_vector) {
 		fprintf(stderr, "memory allocation failure\n");
 		return NULL;
 	}
 	deep_copy_vector->_capacity = vector->_capacity;
 	deep_copy_vector->_size = vector->_size;
+	deep_copy_vector->_allocator = vector->_allocator;
 	deep_copy_vector->_internal_buffer =
-	    (CAP_GENERIC_TYPE_PTR *)CAP_ALLOCATOR(CAP_GENERIC_TYPE_PTR,
-						  vector->_capacity);
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_calloc(
+		&vector->_allocator, vector->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR));
 	if (!deep_copy_vector->_internal_buffer) {
 		fprintf(stderr, "memory allocation failue\n");
-		free(deep_copy_vector);
+		_cap_allocator_free(&vector->_allocator, deep_copy_vector,
+				    sizeof(cap_vector));
 		return NULL;
 	}
 	memcpy(deep_copy_vector->_internal_buffer, vector->_internal_buffer,
@@ -530,9 +570,11 @@ static void cap_vector_for_each(cap_vector *vector,
 
 static bool cap_vector_shrink_to_fit(cap_vector *vector) {
 	assert(vector != NULL);
-	CAP_GENERIC_TYPE_PTR *tmp_ptr = (CAP_GENERIC_TYPE_PTR *)realloc(
-	    vector->_internal_buffer,
-	    sizeof(CAP_GENERIC_TYPE_PTR) * vector->_size);
+	CAP_GENERIC_TYPE_PTR *tmp_ptr =
+	    (CAP_GENERIC_TYPE_PTR *)_cap_allocator_realloc(
+		&vector->_allocator, vector->_internal_buffer,
+		sizeof(CAP_GENERIC_TYPE_PTR) * vector->_capacity,
+		sizeof(CAP_GENERIC_TYPE_PTR) * vector->_size);
 	if (!tmp_ptr) {
 		fprintf(stderr, "memory allocation failure\n");
 		return false;
@@ -544,6 +586,9 @@ static bool cap_vector_shrink_to_fit(cap_vector *vector) {
 
 static void cap_vector_swap(cap_vector *vector_one, cap_vector *vector_two) {
 	assert(vector_one != NULL && vector_two != NULL);
+	// The buffers change owners, so both have to come from one allocator
+	assert(vector_one->_allocator.alloc == vector_two->_allocator.alloc &&
+	       vector_one->_allocator.ctx == vector_two->_allocator.ctx);
 	CAP_GENERIC_TYPE_PTR *one_temp_internal_ptr =
 	    vector_one->_internal_buffer;
 	size_t one_temp_size = vector_one->_size;
@@ -0,0 +1,81 @@
+#define CAP_ARENA_DEBUG
+#include "internal/test-helper.h"
+#include <arena_allocator.h>
+#include <size_class_allocator.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs the access in a child, true if the child was stopped by it
+static bool access_faults(unsigned char *ptr) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		*(volatile unsigned char *)ptr = 1;
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+void test_arena_allocator_debug(void) {
+	const size_t align = CAP_ARENA_DEFAULT_ALIGNMENT;
+	cap_arena_allocator *allocator = cap_arena_allocator_init(4096);
+	unsigned char *buffer = cap_arena_alloc(allocator, 4096);
+	memset(buffer, 1, 4096);
+	CAP_ASSERT_TRUE(access_faults(buffer + 4096),
+			"ARENA_DEBUG guard page after the block");
+	CAP_ASSERT_TRUE(access_faults(buffer - 4097),
+			"ARENA_DEBUG guard page before the block");
+	CAP_ASSERT_FALSE(cap_arena_alloc(allocator, 1),
+			 "ARENA_DEBUG block size is kept");
+	cap_arena_free(allocator);
+
+	// Growable arenas guard each of their blocks
+	allocator = cap_arena_allocator_init_growable(align * 4);
+	unsigned char *first = cap_arena_alloc(allocator, align * 4);
+	unsigned char *second = cap_arena_alloc(allocator, align * 8);
+	CAP_ASSERT_EQ(cap_arena_block_count(allocator), 2,
+		      "ARENA_DEBUG growable chains a block");
+	CAP_ASSERT_TRUE(access_faults(first + align * 4),
+			"ARENA_DEBUG guard page after the first block");
+	CAP_ASSERT_TRUE(access_faults(allocator->_mem_ptr +
+				      allocator->_block->_size),
+			"ARENA_DEBUG guard page after the chained block");
+	CAP_ASSERT_EQ((uintptr_t)second % align, 0,
+		      "ARENA_DEBUG default alignment");
+	cap_arena_free(allocator);
+
+#ifndef CAP_ARENA_ASAN
+	// The memory given back is poisoned, AddressSanitizer would report the
+	// reads instead
+	allocator = cap_arena_allocator_init(align * 8);
+	unsigned char *stale = cap_arena_alloc(allocator, align);
+	memset(stale, 1, align);
+	cap_arena_reset(allocator);
+	CAP_ASSERT_EQ(stale[0], CAP_ARENA_POISON_BYTE,
+		      "ARENA_DEBUG reset poisons the memory");
+	cap_arena_savepoint mark = cap_arena_mark(allocator);
+	stale = cap_arena_alloc(allocator, align);
+	memset(stale, 1, align);
+	cap_arena_rewind(allocator, mark);
+	CAP_ASSERT_EQ(stale[align - 1], CAP_ARENA_POISON_BYTE,
+		      "ARENA_DEBUG rewind poisons the memory");
+	stale = cap_arena_alloc(allocator, align * 2);
+	memset(stale, 1, align * 2);
+	cap_arena_realloc_last(allocator, stale, align * 2, align);
+	CAP_ASSERT_TRUE(stale[0] == 1 && stale[align] == CAP_ARENA_POISON_BYTE,
+			"ARENA_DEBUG shrinking poisons the tail");
+	cap_arena_free(allocator);
+
+	cap_size_class_allocator *size_class = cap_size_class_allocator_init(0);
+	unsigned char *chunk = cap_size_class_alloc(size_class, 64);
+	memset(chunk, 1, 64);
+	cap_size_class_free(size_class, chunk, 64);
+	CAP_ASSERT_EQ(chunk[63], CAP_ARENA_POISON_BYTE,
+		      "ARENA_DEBUG freed size class chunk is poisoned");
+	cap_size_class_allocator_free(size_class);
+#endif
+}
@@ -1,23 +1,231 @@
+#define CAP_ARENA_STATS
 #include "internal/test-helper.h"
 #include <arena_allocator.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <vector.h>
 
 void test_arena_allocator(void) {
-	cap_arena_allocator *allocator = cap_arena_allocator_init(10);
+	const size_t align = CAP_ARENA_DEFAULT_ALIGNMENT;
+	cap_arena_allocator *allocator = cap_arena_allocator_init(align * 4);
 	unsigned char *ptr_of_size_4 = cap_arena_alloc(allocator, 4);
+	CAP_ASSERT_TRUE(ptr_of_size_4 == allocator->_mem_ptr,
+			"ARENA_ALLOCATOR first allocation at the start");
 	CAP_ASSERT_EQ(cap_arena_size(allocator), 4,
 		      "ARENA_ALLOCATOR current size after first allocation");
-	CAP_ASSERT_EQ(cap_arena_remaining_size(allocator), 6,
+	CAP_ASSERT_EQ(cap_arena_remaining_size(allocator), align * 4 - 4,
 		      "ARENA_ALLOCATOR remaining space after first allocation");
-	CAP_ASSERT_EQ(cap_arena_capacity(allocator), 10,
+	CAP_ASSERT_EQ(cap_arena_capacity(allocator), align * 4,
 		      "ARENA_ALLOCATOR current capacity");
 	unsigned char *ptr_of_size_4_again = cap_arena_alloc(allocator, 4);
-	CAP_ASSERT_EQ(cap_arena_size(allocator), 8,
-		      "ARENA_ALLOCATOR current size after first allocation");
-	CAP_ASSERT_EQ(cap_arena_remaining_size(allocator), 2,
-		      "ARENA_ALLOCATOR remaining space after first allocation");
-	CAP_ASSERT_EQ(ptr_of_size_4_again - ptr_of_size_4, 4,
+	CAP_ASSERT_EQ(cap_arena_size(allocator), align + 4,
+		      "ARENA_ALLOCATOR current size after second allocation");
+	CAP_ASSERT_EQ(cap_arena_remaining_size(allocator), align * 3 - 4,
+		      "ARENA_ALLOCATOR remaining space after padding");
+	CAP_ASSERT_EQ(ptr_of_size_4_again - ptr_of_size_4, align,
 		      "ARENA_ALLOCATOR pointer arithmetic");
-	CAP_ASSERT_FALSE(cap_arena_alloc(allocator, 10),
+	CAP_ASSERT_EQ((uintptr_t)ptr_of_size_4_again % align, 0,
+		      "ARENA_ALLOCATOR default alignment");
+	CAP_ASSERT_FALSE(cap_arena_alloc(allocator, align * 3),
 			 "ARENA_ALLOCATOR allocation failur on large buffer");
+	// An alignment of one packs the allocations
+	unsigned char *packed = cap_arena_alloc_aligned(allocator, 3, 1);
+	CAP_ASSERT_TRUE(packed == ptr_of_size_4_again + 4,
+			"ARENA_ALLOCATOR packed allocation");
+	cap_arena_reset(allocator);
+	CAP_ASSERT_TRUE(cap_arena_alloc(allocator, 1) == allocator->_mem_ptr,
+			"ARENA_ALLOCATOR allocation after reset at the start");
+	cap_arena_free(allocator);
+
+	// Alignments stricter than malloc(), the padding counts as used
+	allocator = cap_arena_allocator_init(256);
+	cap_arena_alloc_aligned(allocator, 1, 1);
+	unsigned char *line = cap_arena_alloc_aligned(allocator, 64, 64);
+	CAP_ASSERT_EQ((uintptr_t)line % 64, 0,
+		      "ARENA_ALLOCATOR cache line alignment");
+	CAP_ASSERT_EQ(cap_arena_size(allocator),
+		      (size_t)(line - allocator->_mem_ptr) + 64,
+		      "ARENA_ALLOCATOR size counts the padding");
+	CAP_ASSERT_FALSE(cap_arena_alloc_aligned(allocator, 200, 1),
+			 "ARENA_ALLOCATOR aligned allocation over capacity");
+	cap_arena_free(allocator);
+
+	// Growable arena chains blocks of doubling size
+	allocator = cap_arena_allocator_init_growable(64);
+	bool all_aligned = true;
+	for (int i = 0; i < 20; ++i) {
+		unsigned char *ptr = cap_arena_alloc(allocator, 24);
+		if (!ptr || (uintptr_t)ptr % align) all_aligned = false;
+		if (ptr) memset(ptr, i, 24);
+	}
+	CAP_ASSERT_TRUE(all_aligned, "ARENA_ALLOCATOR growable allocations");
+	CAP_ASSERT_EQ(cap_arena_capacity(allocator), 64 + 128 + 256 + 512,
+		      "ARENA_ALLOCATOR growable capacity doubles");
+	CAP_ASSERT_EQ(cap_arena_block_count(allocator), 4,
+		      "ARENA_ALLOCATOR growable block count");
+	unsigned char *large = cap_arena_alloc(allocator, 5000);
+	CAP_ASSERT_TRUE(large != NULL,
+			"ARENA_ALLOCATOR growable allocation over the block");
+	CAP_ASSERT_TRUE(cap_arena_capacity(allocator) >= 64 + 128 + 256 +
+							      512 + 5000,
+			"ARENA_ALLOCATOR growable block fits a large buffer");
+	size_t largest = cap_arena_capacity(allocator) - (64 + 128 + 256 + 512);
+	// Reset keeps the largest block, which then holds the whole workload
+	cap_arena_reset(allocator);
+	CAP_ASSERT_EQ(cap_arena_block_count(allocator), 1,
+		      "ARENA_ALLOCATOR growable reset keeps one block");
+	CAP_ASSERT_EQ(cap_arena_capacity(allocator), largest,
+		      "ARENA_ALLOCATOR growable reset keeps the largest block");
+	CAP_ASSERT_EQ(cap_arena_size(allocator), 0,
+		      "ARENA_ALLOCATOR growable size after reset");
+	for (int i = 0; i < 20; ++i) cap_arena_alloc(allocator, 24);
+	cap_arena_alloc(allocator, 5000);
+	CAP_ASSERT_EQ(cap_arena_block_count(allocator), 1,
+		      "ARENA_ALLOCATOR growable reuses the kept block");
+	cap_arena_free(allocator);
+
+	// Save points, rewinding across blocks
+	allocator = cap_arena_allocator_init_growable(128);
+	unsigned char *kept = cap_arena_alloc(allocator, 16);
+	memset(kept, 1, 16);
+	cap_arena_savepoint outer = cap_arena_mark(allocator);
+	cap_arena_alloc(allocator, 64);
+	cap_arena_savepoint inner = cap_arena_mark(allocator);
+	size_t inner_size = cap_arena_size(allocator);
+	for (int i = 0; i < 10; ++i) cap_arena_alloc(allocator, 100);
+	CAP_ASSERT_TRUE(cap_arena_block_count(allocator) > 1,
+			"ARENA_ALLOCATOR allocations after a mark chain");
+	cap_arena_rewind(allocator, inner);
+	CAP_ASSERT_EQ(cap_arena_size(allocator), inner_size,
+		      "ARENA_ALLOCATOR size after rewinding to a mark");
+	CAP_ASSERT_EQ(cap_arena_block_count(allocator), 1,
+		      "ARENA_ALLOCATOR rewind releases the newer blocks");
+	size_t capacity = cap_arena_capacity(allocator);
+	for (int i = 0; i < 4; ++i) cap_arena_alloc(allocator, 100);
+	CAP_ASSERT_EQ(cap_arena_capacity(allocator), capacity,
+		      "ARENA_ALLOCATOR rewind keeps a block for reuse");
+	cap_arena_rewind(allocator, outer);
+	unsigned char *after_rewind = cap_arena_alloc(allocator, 16);
+	CAP_ASSERT_TRUE(after_rewind == kept + align,
+			"ARENA_ALLOCATOR rewind reuses the space");
+	CAP_ASSERT_EQ(kept[15], 1, "ARENA_ALLOCATOR rewind keeps older data");
+
+	// Growing the most recent allocation in place
+	cap_arena_rewind(allocator, outer);
+	unsigned char *buffer = cap_arena_alloc(allocator, 8);
+	memset(buffer, 7, 8);
+	unsigned char *grown = cap_arena_realloc_last(allocator, buffer, 8, 32);
+	CAP_ASSERT_TRUE(grown == buffer,
+			"ARENA_ALLOCATOR realloc of the last allocation");
+	CAP_ASSERT_EQ(cap_arena_size(allocator), align + 32,
+		      "ARENA_ALLOCATOR size after realloc in place");
+	cap_arena_alloc(allocator, 8);
+	unsigned char *moved = cap_arena_realloc_last(allocator, grown, 32, 64);
+	CAP_ASSERT_TRUE(moved != grown && moved[0] == 7 && moved[7] == 7,
+			"ARENA_ALLOCATOR realloc of an older one copies");
+	unsigned char *spilled =
+	    cap_arena_realloc_last(allocator, moved, 64, 4096);
+	CAP_ASSERT_TRUE(spilled != NULL && spilled[7] == 7,
+			"ARENA_ALLOCATOR realloc over the block copies");
+	cap_arena_free(allocator);
+
+	// Mapped arena, a large reservation commits as it's used
+	allocator =
+	    cap_arena_allocator_init_mapped(1UL << 30, CAP_ARENA_MAP_DEFAULT);
+	CAP_ASSERT_TRUE(allocator != NULL, "ARENA_ALLOCATOR mapped init");
+	CAP_ASSERT_EQ(cap_arena_capacity(allocator), 1UL << 30,
+		      "ARENA_ALLOCATOR mapped capacity is the reservation");
+	CAP_ASSERT_EQ(cap_arena_committed_size(allocator), 0,
+		      "ARENA_ALLOCATOR mapped arena commits nothing up front");
+	unsigned char *mapped = cap_arena_alloc(allocator, 100000);
+	memset(mapped, 0x5A, 100000);
+	size_t committed = cap_arena_committed_size(allocator);
+	CAP_ASSERT_TRUE(committed >= 100000 && committed < 1 << 20,
+			"ARENA_ALLOCATOR mapped arena commits on demand");
+	mapped = cap_arena_realloc_last(allocator, mapped, 100000, 300000);
+	memset(mapped + 100000, 0x5A, 200000);
+	CAP_ASSERT_TRUE(cap_arena_committed_size(allocator) >= 300000,
+			"ARENA_ALLOCATOR mapped realloc in place commits");
+	cap_arena_reset(allocator);
+	cap_arena_trim(allocator, 0);
+	CAP_ASSERT_EQ(mapped[200000], 0,
+		      "ARENA_ALLOCATOR mapped trim drops the pages");
+	CAP_ASSERT_FALSE(cap_arena_alloc(allocator, (1UL << 30) + 1),
+			 "ARENA_ALLOCATOR mapped arena is bounded");
+	cap_arena_free(allocator);
+
+	// Huge pages, which fall back when the system has none
+	bool huge_usable = true;
+	int huge_flags[2] = {CAP_ARENA_MAP_HUGETLB, CAP_ARENA_MAP_HUGEPAGE};
+	for (int i = 0; i < 2; ++i) {
+		allocator = cap_arena_allocator_init_mapped(1 << 22,
+							    huge_flags[i]);
+		if (!allocator) {
+			huge_usable = false;
+			continue;
+		}
+		unsigned char *page = cap_arena_alloc(allocator, 1 << 21);
+		if (!page || (uintptr_t)allocator->_mem_ptr % (1 << 21))
+			huge_usable = false;
+		else
+			memset(page, 1, 1 << 21);
+		cap_arena_free(allocator);
+	}
+	CAP_ASSERT_TRUE(huge_usable, "ARENA_ALLOCATOR mapped huge pages");
+
+	// Containers take their memory from the arena through the interface
+	allocator = cap_arena_allocator_init_growable(256);
+	cap_allocator interface = cap_arena_allocator_interface(allocator);
+	cap_vector *vector = cap_vector_init_with_allocator(2, &interface);
+	CAP_ASSERT_TRUE(vector != NULL, "ARENA_ALLOCATOR vector on the arena");
+	for (size_t i = 0; i < 1000; ++i)
+		cap_vector_push_back(vector, (void *)(i + 1));
+	bool vector_intact = true;
+	for (size_t i = 1000; i > 0; --i)
+		if (cap_vector_pop_back(vector) != (void *)i)
+			vector_intact = false;
+	CAP_ASSERT_TRUE(vector_intact,
+			"ARENA_ALLOCATOR vector grows on the arena");
+	CAP_ASSERT_TRUE(cap_arena_size(allocator) >= 1000 * sizeof(void *),
+			"ARENA_ALLOCATOR vector storage comes from the arena");
+	cap_vector_free(vector);
+	cap_arena_free(allocator);
+
+	// Usage accounting
+	allocator = cap_arena_allocator_init(align * 8);
+	cap_arena_alloc(allocator, 4);
+	unsigned char *second = cap_arena_alloc(allocator, 4);
+	CAP_ASSERT_EQ(cap_arena_requested_size(allocator), 8,
+		      "ARENA_ALLOCATOR stats requested size");
+	CAP_ASSERT_EQ(cap_arena_padding_size(allocator), align - 4,
+		      "ARENA_ALLOCATOR stats alignment padding");
+	CAP_ASSERT_EQ(cap_arena_allocation_count(allocator), 2,
+		      "ARENA_ALLOCATOR stats allocation count");
+	cap_arena_realloc_last(allocator, second, 4, 12);
+	CAP_ASSERT_EQ(cap_arena_requested_size(allocator), 16,
+		      "ARENA_ALLOCATOR stats realloc in place");
+	CAP_ASSERT_EQ(cap_arena_allocation_count(allocator), 2,
+		      "ARENA_ALLOCATOR stats realloc isn't an allocation");
+	cap_arena_savepoint stats_mark = cap_arena_mark(allocator);
+	cap_arena_alloc(allocator, align * 4);
+	size_t peak = cap_arena_size(allocator);
+	cap_arena_rewind(allocator, stats_mark);
+	CAP_ASSERT_EQ(cap_arena_allocation_count(allocator), 2,
+		      "ARENA_ALLOCATOR stats count after rewind");
+	CAP_ASSERT_EQ(cap_arena_peak_size(allocator), peak,
+		      "ARENA_ALLOCATOR stats peak after rewind");
+	cap_arena_stats stats = cap_arena_stats_snapshot(allocator);
+	CAP_ASSERT_TRUE(stats.used_size ==
+			    stats.requested_size + stats.padding_size,
+			"ARENA_ALLOCATOR stats used size");
+	CAP_ASSERT_TRUE(stats.capacity == align * 8 && stats.block_count == 1,
+			"ARENA_ALLOCATOR stats capacity");
+	cap_arena_reset(allocator);
+	stats = cap_arena_stats_snapshot(allocator);
+	CAP_ASSERT_TRUE(stats.requested_size == 0 &&
+			    stats.allocation_count == 0 &&
+			    stats.peak_size == peak,
+			"ARENA_ALLOCATOR stats after reset");
+	cap_arena_free(allocator);
 }
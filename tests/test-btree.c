@@ -0,0 +1,210 @@
+#include "internal/test-helper.h"
+#include <btree.h>
+
+#define BTREE_TEST_KEYS 5000
+
+static int compare_fn_int(void *x, void *y) {
+	if (*(int *)x > *(int *)y)
+		return 1;
+	else if (*(int *)x < *(int *)y)
+		return -1;
+	return 0;
+}
+
+static bool predicate_fn_two(void *key) { return *(int *)key == 2; }
+
+static size_t _range_visited = 0;
+static long long _range_sum = 0;
+static void range_fn(void *key, void *value) {
+	(void)key;
+	_range_visited++;
+	_range_sum += *(int *)value;
+}
+
+void test_btree(void) {
+	{
+		cap_btree *tree = cap_btree_init(sizeof(int), compare_fn_int);
+		CAP_ASSERT_EQ(cap_btree_size(tree), 0, "BTREE size after init");
+		CAP_ASSERT_TRUE(cap_btree_empty(tree),
+				"BTREE empty check after init");
+		CAP_ASSERT_EQ(cap_btree_height(tree), 1,
+			      "BTREE height after init");
+		int key_one = 1, key_two = 2, key_three = 3;
+		int value_one = 10, value_two = 20, value_three = 30;
+		CAP_ASSERT_EQ(cap_btree_insert(tree, &key_two, &value_two), 0,
+			      "BTREE insert key two return");
+		cap_btree_insert(tree, &key_three, &value_three);
+		cap_btree_insert(tree, &key_one, &value_one);
+		CAP_ASSERT_EQ(cap_btree_size(tree), 3,
+			      "BTREE size after three inserts");
+		int *two_ptr = cap_btree_find(tree, &key_two);
+		CAP_ASSERT_TRUE(two_ptr != NULL && *two_ptr == value_two,
+				"BTREE find key two");
+		int value_two_updated = 22;
+		cap_btree_insert(tree, &key_two, &value_two_updated);
+		CAP_ASSERT_EQ(cap_btree_size(tree), 3,
+			      "BTREE size after updating an existing key");
+		two_ptr = cap_btree_find(tree, &key_two);
+		CAP_ASSERT_TRUE(two_ptr != NULL && *two_ptr == 22,
+				"BTREE find updated key two");
+		cap_btree_iterator *iterator = cap_btree_begin(tree);
+		CAP_ASSERT_EQ(*(int *)iterator->key, key_one,
+			      "BTREE Iterator init check");
+		cap_btree_iterator_increment(iterator);
+		CAP_ASSERT_TRUE(cap_btree_iterator_equals_predicate(
+				    iterator, predicate_fn_two),
+				"BTREE Iterator true predicate");
+		CAP_ASSERT_EQ(*(int *)cap_btree_iterator_next(iterator),
+			      key_three, "BTREE Iterator next");
+		cap_btree_iterator_increment(iterator);
+		cap_btree_iterator_increment(iterator);
+		CAP_ASSERT_TRUE(iterator->key == NULL && iterator->value == NULL,
+				"BTREE Iterator past the end");
+		cap_btree_iterator_free(iterator);
+		CAP_ASSERT_EQ(cap_btree_remove(tree, &key_one), 0,
+			      "BTREE remove key one");
+		CAP_ASSERT_EQ(cap_btree_remove(tree, &key_one), -1,
+			      "BTREE re-remove key one");
+		CAP_ASSERT_FALSE(cap_btree_contains(tree, &key_one),
+				 "BTREE contains on removed key one");
+		CAP_ASSERT_EQ(*(int *)cap_btree_front(tree), 22,
+			      "BTREE front after removing the smallest key");
+		cap_btree_free(tree);
+	}
+	{ // Splits and merges across many levels
+		static int keys[BTREE_TEST_KEYS];
+		static int values[BTREE_TEST_KEYS];
+		cap_btree *tree = cap_btree_init(sizeof(int), compare_fn_int);
+		for (int i = 0; i < BTREE_TEST_KEYS; ++i) {
+			keys[i] = (int)(((long)i * 7919) % BTREE_TEST_KEYS);
+			values[i] = keys[i] * 2;
+			cap_btree_insert(tree, &keys[i], &values[i]);
+		}
+		CAP_ASSERT_EQ(cap_btree_size(tree), BTREE_TEST_KEYS,
+			      "BTREE size after many inserts");
+		CAP_ASSERT_TRUE(cap_btree_height(tree) > 1,
+				"BTREE height grows with splits");
+		bool sorted = true;
+		int expected_key = 0;
+		cap_btree_iterator *iterator = cap_btree_begin(tree);
+		for (; iterator->key; cap_btree_iterator_increment(iterator))
+			if (*(int *)iterator->key != expected_key++)
+				sorted = false;
+		cap_btree_iterator_free(iterator);
+		CAP_ASSERT_TRUE(sorted && expected_key == BTREE_TEST_KEYS,
+				"BTREE ordered iteration over every key");
+		int low = 100, high = 199;
+		_range_visited = 0;
+		_range_sum = 0;
+		CAP_ASSERT_EQ(cap_btree_range(tree, &low, &high, range_fn), 100,
+			      "BTREE range count");
+		CAP_ASSERT_TRUE(_range_visited == 100 &&
+				    _range_sum == 2 * (100 + 199) * 50,
+				"BTREE range visits the values in the range");
+		// Remove the odd keys, in the same shuffled order
+		for (int i = 0; i < BTREE_TEST_KEYS; ++i)
+			if (keys[i] % 2) cap_btree_remove(tree, &keys[i]);
+		CAP_ASSERT_EQ(cap_btree_size(tree), BTREE_TEST_KEYS / 2,
+			      "BTREE size after removing the odd keys");
+		bool found_all = true;
+		for (int i = 0; i < BTREE_TEST_KEYS; ++i) {
+			int *value = cap_btree_find(tree, &keys[i]);
+			if ((keys[i] % 2) != (value == NULL)) found_all = false;
+		}
+		CAP_ASSERT_TRUE(found_all, "BTREE find after removes");
+		int probe = 301;
+		iterator = cap_btree_lower_bound(tree, &probe);
+		CAP_ASSERT_EQ(*(int *)iterator->key, 302,
+			      "BTREE lower_bound on a removed key");
+		cap_btree_iterator_free(iterator);
+		for (int i = 0; i < BTREE_TEST_KEYS; ++i)
+			cap_btree_remove(tree, &keys[i]);
+		CAP_ASSERT_TRUE(cap_btree_empty(tree) &&
+				    cap_btree_height(tree) == 1,
+				"BTREE shrinks back to a leaf when emptied");
+		cap_btree_free(tree);
+	}
+	{ // int64_t keyed tree
+		cap_btree *tree = cap_btree_init_int64();
+		static int values[BTREE_TEST_KEYS];
+		for (int i = 0; i < BTREE_TEST_KEYS; ++i) {
+			// Keys live on the stack, the tree copies them
+			int64_t key = (int64_t)(((long)i * 7919) %
+						BTREE_TEST_KEYS) -
+				      BTREE_TEST_KEYS / 2;
+			values[i] = (int)key;
+			cap_btree_insert(tree, &key, &values[i]);
+		}
+		int64_t probe = -7;
+		int *value = cap_btree_find(tree, &probe);
+		CAP_ASSERT_TRUE(value != NULL && *value == -7,
+				"BTREE int64 find negative key");
+		probe = BTREE_TEST_KEYS;
+		CAP_ASSERT_FALSE(cap_btree_contains(tree, &probe),
+				 "BTREE int64 contains on a missing key");
+		int64_t low = -10, high = 10;
+		_range_visited = 0;
+		CAP_ASSERT_EQ(cap_btree_range(tree, &low, &high, range_fn), 21,
+			      "BTREE int64 range count");
+		for (int64_t key = -BTREE_TEST_KEYS / 2; key < 0; ++key)
+			cap_btree_remove(tree, &key);
+		cap_btree_iterator *iterator = cap_btree_begin(tree);
+		CAP_ASSERT_TRUE(*(int64_t *)iterator->key == 0,
+				"BTREE int64 smallest key after removes");
+		cap_btree_iterator_free(iterator);
+		CAP_ASSERT_EQ(cap_btree_size(tree), BTREE_TEST_KEYS / 2,
+			      "BTREE int64 size after removes");
+		cap_btree_free(tree);
+	}
+	{
+		// The keys are released right after their removal, so no
+		// separator may keep pointing to one. The lookups go through
+		// the nodes which held the removed key
+		cap_btree *tree = cap_btree_init(sizeof(int), compare_fn_int);
+		static int *keys[BTREE_TEST_KEYS];
+		static int order[BTREE_TEST_KEYS];
+		bool consistent = true;
+		unsigned int seed = 3;
+		for (int round = 0; round < 2; ++round) {
+			for (int i = 0; i < BTREE_TEST_KEYS; ++i) {
+				if (!keys[i]) {
+					keys[i] = (int *)malloc(sizeof(int));
+					*keys[i] = i;
+					cap_btree_insert(tree, keys[i],
+							 keys[i]);
+				}
+				order[i] = i;
+			}
+			for (int i = BTREE_TEST_KEYS - 1; i > 0; --i) {
+				seed = seed * 1103515245u + 12345u;
+				int j = (int)((seed >> 8) %
+					      (unsigned int)(i + 1));
+				int swap = order[i];
+				order[i] = order[j];
+				order[j] = swap;
+			}
+			// The first round removes half of the keys, the second
+			// one all of them
+			int removes =
+			    round ? BTREE_TEST_KEYS : BTREE_TEST_KEYS / 2;
+			for (int i = 0; i < removes; ++i) {
+				int probe = order[i];
+				if (!keys[probe]) continue;
+				cap_btree_remove(tree, &probe);
+				free(keys[probe]);
+				keys[probe] = NULL;
+				if (cap_btree_contains(tree, &probe))
+					consistent = false;
+				probe = order[BTREE_TEST_KEYS - 1 - i];
+				if (cap_btree_contains(tree, &probe) !=
+				    (keys[probe] != NULL))
+					consistent = false;
+			}
+		}
+		CAP_ASSERT_TRUE(consistent,
+				"BTREE lookups with the removed keys freed");
+		CAP_ASSERT_EQ(cap_btree_size(tree), 0,
+			      "BTREE size with the removed keys freed");
+		cap_btree_free(tree);
+	}
+}
@@ -0,0 +1,99 @@
+#include "internal/test-helper.h"
+#include <concurrent-container/concurrent_arena_pool.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+void test_concurrent_arena_pool(void) {
+	{
+		cap_arena_pool *pool = cap_arena_pool_init(2, 64);
+		cap_arena_allocator *arena = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE(arena != NULL, "ARENA_POOL checkout");
+		CAP_ASSERT_TRUE(cap_arena_alloc(arena, 16) != NULL,
+				"ARENA_POOL allocation from checked out arena");
+		CAP_ASSERT_EQ(cap_arena_size(arena), 16,
+			      "ARENA_POOL size of checked out arena");
+		cap_arena_pool_return(pool, arena);
+		cap_arena_allocator *again = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE(again == arena,
+				"ARENA_POOL same arena checked out again");
+		CAP_ASSERT_EQ(cap_arena_size(again), 0,
+			      "ARENA_POOL returned arena is reset");
+		CAP_ASSERT_EQ(cap_arena_pool_high_water(pool), 16,
+			      "ARENA_POOL high-water after a return");
+
+		cap_arena_allocator *second = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE(second != NULL && second != again,
+				"ARENA_POOL checkout of the second slot");
+		CAP_ASSERT_EQ(cap_arena_pool_overflows(pool), 0,
+			      "ARENA_POOL no overflow with free slots");
+		cap_arena_allocator *standalone = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE(standalone != NULL && standalone != again &&
+				    standalone != second,
+				"ARENA_POOL standalone arena when every slot "
+				"is in use");
+		CAP_ASSERT_EQ(cap_arena_pool_overflows(pool), 1,
+			      "ARENA_POOL overflow counted");
+		cap_arena_pool_return(pool, standalone);
+		cap_arena_pool_return(pool, second);
+		cap_arena_pool_return(pool, again);
+		CAP_ASSERT_EQ(cap_arena_pool_overflows(pool), 1,
+			      "ARENA_POOL overflow count after the returns");
+		cap_arena_allocator *pooled[2];
+		pooled[0] = cap_arena_pool_checkout(pool);
+		pooled[1] = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE((pooled[0] == again || pooled[0] == second) &&
+				    (pooled[1] == again ||
+				     pooled[1] == second),
+				"ARENA_POOL slots kept their arenas");
+		CAP_ASSERT_EQ(cap_arena_pool_overflows(pool), 1,
+			      "ARENA_POOL no overflow after the returns");
+		cap_arena_pool_return(pool, pooled[0]);
+		cap_arena_pool_return(pool, pooled[1]);
+		cap_arena_pool_free(pool);
+	}
+	{
+		cap_arena_pool *pool = cap_arena_pool_init(1, 16);
+		cap_arena_allocator *arena = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_TRUE(cap_arena_alloc(arena, 1000) != NULL,
+				"ARENA_POOL allocation past the first block");
+		CAP_ASSERT_TRUE(cap_arena_block_count(arena) > 1,
+				"ARENA_POOL arena chained a block");
+		cap_arena_pool_return(pool, arena);
+		size_t high_water = cap_arena_pool_high_water(pool);
+		CAP_ASSERT_TRUE(high_water >= 1000,
+				"ARENA_POOL high-water of the chained arena");
+		// The chained arena is replaced by a single block which holds
+		// the high-water mark
+		arena = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_EQ(cap_arena_block_count(arena), 1,
+			      "ARENA_POOL replaced arena has one block");
+		CAP_ASSERT_TRUE(cap_arena_capacity(arena) >= high_water,
+				"ARENA_POOL replaced arena holds the mark");
+		CAP_ASSERT_TRUE(cap_arena_alloc(arena, 1000) != NULL &&
+				    cap_arena_block_count(arena) == 1,
+				"ARENA_POOL replaced arena holds the request");
+		cap_arena_pool_return(pool, arena);
+
+		// Two windows of small requests bring the mark down, and the
+		// oversized block is replaced again
+		bool kept = true;
+		for (size_t i = 0; i < CAP_ARENA_POOL_WINDOW * 2 - 2; ++i) {
+			arena = cap_arena_pool_checkout(pool);
+			cap_arena_alloc(arena, 8);
+			if (cap_arena_capacity(arena) < high_water)
+				kept = false;
+			cap_arena_pool_return(pool, arena);
+		}
+		CAP_ASSERT_TRUE(kept,
+				"ARENA_POOL block kept within the window");
+		CAP_ASSERT_EQ(cap_arena_pool_high_water(pool), 8,
+			      "ARENA_POOL high-water of the last window");
+		arena = cap_arena_pool_checkout(pool);
+		CAP_ASSERT_EQ(cap_arena_capacity(arena), 16,
+			      "ARENA_POOL oversized block shrunk to the mark");
+		cap_arena_pool_return(pool, arena);
+		CAP_ASSERT_EQ(cap_arena_pool_overflows(pool), 0,
+			      "ARENA_POOL no overflow with one thread");
+		cap_arena_pool_free(pool);
+	}
+}
@@ -0,0 +1,93 @@
+#include "internal/test-helper.h"
+#include <concurrent-container/concurrent_lru_cache.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CONCURRENT_LRU_CACHE_TEST_LOOKUPS 400
+
+// Sum of the estimated lookups of the tracked keys
+static uint64_t hot_keys_total(cap_concurrent_lru_cache *cache) {
+	int keys[4];
+	uint64_t counts[4];
+	size_t count =
+	    cap_concurrent_lru_cache_hot_keys(cache, keys, counts, 4);
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; ++i) total += counts[i];
+	return total;
+}
+
+void test_concurrent_lru_cache(void) {
+	int keys[2] = {1, 2}, values[2] = {10, 20};
+	{
+		// Every hit of a recently promoted entry is served under the
+		// read lock, the sampled ones go through the write lock
+		cap_concurrent_lru_cache *cache = cap_concurrent_lru_cache_init(
+		    16, 1, sizeof(int), NULL, NULL);
+		cap_concurrent_lru_cache_set_promotion_window(cache, 8);
+		CAP_ASSERT_TRUE(
+		    cap_concurrent_lru_cache_track_hot_keys(cache, 4, 4),
+		    "CONCURRENT_LRU_CACHE track hot keys");
+		cap_concurrent_lru_cache_put(cache, &keys[0], &values[0]);
+		bool found = true;
+		for (int i = 0; i < CONCURRENT_LRU_CACHE_TEST_LOOKUPS; ++i) {
+			int *value =
+			    cap_concurrent_lru_cache_get(cache, &keys[0]);
+			if (!value || *value != 10) found = false;
+		}
+		CAP_ASSERT_TRUE(found, "CONCURRENT_LRU_CACHE read path hits");
+		CAP_ASSERT_TRUE(cap_concurrent_lru_cache_get(cache, &keys[1]) ==
+				    NULL,
+				"CONCURRENT_LRU_CACHE read path miss");
+		cap_cache_stats stats = cap_concurrent_lru_cache_stats(cache);
+		CAP_ASSERT_EQ(stats.hits, CONCURRENT_LRU_CACHE_TEST_LOOKUPS,
+			      "CONCURRENT_LRU_CACHE read path counts the hits");
+		CAP_ASSERT_EQ(stats.misses, 1,
+			      "CONCURRENT_LRU_CACHE read path counts the miss");
+		int hot_key;
+		uint64_t hot_count;
+		CAP_ASSERT_EQ(cap_concurrent_lru_cache_hot_keys(
+				  cache, &hot_key, &hot_count, 1),
+			      1, "CONCURRENT_LRU_CACHE hot key tracked");
+		CAP_ASSERT_TRUE(hot_key == keys[0] &&
+				    hot_count ==
+					CONCURRENT_LRU_CACHE_TEST_LOOKUPS,
+				"CONCURRENT_LRU_CACHE read path hot key count");
+		cap_concurrent_lru_cache_free(cache);
+	}
+	{
+		// With a window of one, alternating keys are never recent, so
+		// each lookup takes the read lock and then the write lock
+		cap_concurrent_lru_cache *cache = cap_concurrent_lru_cache_init(
+		    16, 1, sizeof(int), NULL, NULL);
+		cap_concurrent_lru_cache_set_promotion_window(cache, 1);
+		cap_concurrent_lru_cache_track_hot_keys(cache, 4, 1);
+		cap_concurrent_lru_cache_put(cache, &keys[0], &values[0]);
+		cap_concurrent_lru_cache_put(cache, &keys[1], &values[1]);
+		for (int i = 0; i < CONCURRENT_LRU_CACHE_TEST_LOOKUPS; ++i)
+			cap_concurrent_lru_cache_get(cache, &keys[i % 2]);
+		CAP_ASSERT_EQ(hot_keys_total(cache),
+			      CONCURRENT_LRU_CACHE_TEST_LOOKUPS,
+			      "CONCURRENT_LRU_CACHE each lookup sampled once");
+		cap_concurrent_lru_cache_track_hot_keys(cache, 4, 4);
+		for (int i = 0; i < CONCURRENT_LRU_CACHE_TEST_LOOKUPS; ++i)
+			cap_concurrent_lru_cache_get(cache, &keys[i % 2]);
+		CAP_ASSERT_EQ(hot_keys_total(cache),
+			      CONCURRENT_LRU_CACHE_TEST_LOOKUPS,
+			      "CONCURRENT_LRU_CACHE write path sample rate");
+		cap_concurrent_lru_cache_free(cache);
+	}
+	{
+		// Without a window every lookup takes the write lock
+		cap_concurrent_lru_cache *cache = cap_concurrent_lru_cache_init(
+		    16, 2, sizeof(int), NULL, NULL);
+		cap_concurrent_lru_cache_track_hot_keys(cache, 4, 4);
+		cap_concurrent_lru_cache_put(cache, &keys[0], &values[0]);
+		for (int i = 0; i < CONCURRENT_LRU_CACHE_TEST_LOOKUPS; ++i)
+			cap_concurrent_lru_cache_get(cache, &keys[0]);
+		CAP_ASSERT_EQ(hot_keys_total(cache),
+			      CONCURRENT_LRU_CACHE_TEST_LOOKUPS,
+			      "CONCURRENT_LRU_CACHE sampling without window");
+		cap_concurrent_lru_cache_free(cache);
+	}
+}
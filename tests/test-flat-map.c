@@ -0,0 +1,167 @@
+#include "internal/test-helper.h"
+#include <flat_map.h>
+
+#define FLAT_MAP_TEST_KEYS 2000
+
+static int compare_fn_int(void *x, void *y) {
+	if (*(int *)x > *(int *)y)
+		return 1;
+	else if (*(int *)x < *(int *)y)
+		return -1;
+	return 0;
+}
+
+static bool predicate_fn_two(void *key) { return *(int *)key == 2; }
+
+void test_flat_map(void) {
+	{
+		cap_flat_map *map = cap_flat_map_init(sizeof(int), compare_fn_int);
+		CAP_ASSERT_EQ(cap_flat_map_size(map), 0,
+			      "FLAT_MAP size after init");
+		CAP_ASSERT_TRUE(cap_flat_map_empty(map),
+				"FLAT_MAP empty check after init");
+		int key_one = 1, key_two = 2, key_three = 3, key_four = 4;
+		int value_one = 10, value_two = 20, value_three = 30;
+		int value_two_new = 200;
+		CAP_ASSERT_EQ(cap_flat_map_insert(map, &key_two, &value_two), 0,
+			      "FLAT_MAP insert key two return");
+		cap_flat_map_insert(map, &key_three, &value_three);
+		cap_flat_map_insert(map, &key_one, &value_one);
+		CAP_ASSERT_EQ(cap_flat_map_size(map), 3,
+			      "FLAT_MAP size after three inserts");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_find(map, &key_two), 20,
+			      "FLAT_MAP find key two");
+		CAP_ASSERT_TRUE(cap_flat_map_find(map, &key_four) == NULL,
+				"FLAT_MAP find of a missing key");
+		CAP_ASSERT_TRUE(cap_flat_map_contains(map, &key_one),
+				"FLAT_MAP contains key one");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_key_at(map, 0), 1,
+			      "FLAT_MAP first key in order");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_value_at(map, 2), 30,
+			      "FLAT_MAP last value in order");
+		CAP_ASSERT_TRUE(cap_flat_map_key_at(map, 3) == NULL,
+				"FLAT_MAP key_at out of range");
+		CAP_ASSERT_EQ(cap_flat_map_lower_bound(map, &key_four), 3,
+			      "FLAT_MAP lower_bound past the end");
+		cap_flat_map_insert(map, &key_two, &value_two_new);
+		CAP_ASSERT_EQ(cap_flat_map_size(map), 3,
+			      "FLAT_MAP size after replacing a value");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_find(map, &key_two), 200,
+			      "FLAT_MAP find replaced value");
+
+		cap_flat_map_iterator *iterator = cap_flat_map_begin(map);
+		CAP_ASSERT_EQ(*(int *)iterator->key, 1,
+			      "FLAT_MAP iterator first key");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_iterator_next(iterator), 2,
+			      "FLAT_MAP iterator next key");
+		cap_flat_map_iterator_increment(iterator);
+		CAP_ASSERT_TRUE(cap_flat_map_iterator_equals_predicate(
+				    iterator, predicate_fn_two),
+				"FLAT_MAP iterator predicate on key two");
+		cap_flat_map_iterator_increment(iterator);
+		CAP_ASSERT_TRUE(cap_flat_map_iterator_next(iterator) == NULL,
+				"FLAT_MAP iterator next at the last element");
+		cap_flat_map_iterator_increment(iterator);
+		CAP_ASSERT_TRUE(iterator->key == NULL && iterator->value == NULL,
+				"FLAT_MAP iterator past the end");
+		cap_flat_map_iterator_free(iterator);
+
+		CAP_ASSERT_EQ(cap_flat_map_remove(map, &key_two), 0,
+			      "FLAT_MAP remove key two");
+		CAP_ASSERT_EQ(cap_flat_map_remove(map, &key_two), -1,
+			      "FLAT_MAP remove missing key two");
+		CAP_ASSERT_EQ(cap_flat_map_size(map), 2,
+			      "FLAT_MAP size after remove");
+		CAP_ASSERT_EQ(*(int *)cap_flat_map_key_at(map, 1), 3,
+			      "FLAT_MAP order after remove");
+		cap_flat_map_free(map);
+	}
+	// Tests on bulk construction with duplicates
+	{
+		cap_flat_map *map = cap_flat_map_init(sizeof(int), compare_fn_int);
+		int keys[FLAT_MAP_TEST_KEYS], values[FLAT_MAP_TEST_KEYS];
+		CAP_ASSERT_TRUE(cap_flat_map_reserve(map, FLAT_MAP_TEST_KEYS),
+				"FLAT_MAP reserve");
+		// Every key pushed twice, the second value must win
+		for (int i = 0; i < FLAT_MAP_TEST_KEYS; ++i) {
+			keys[i] = (i * 7919) % (FLAT_MAP_TEST_KEYS / 2);
+			values[i] = i;
+			cap_flat_map_push(map, &keys[i], &values[i]);
+		}
+		CAP_ASSERT_TRUE(cap_flat_map_sort(map), "FLAT_MAP bulk sort");
+		CAP_ASSERT_EQ(cap_flat_map_size(map), FLAT_MAP_TEST_KEYS / 2,
+			      "FLAT_MAP size after dropping duplicates");
+		bool ordered = true, last_wins = true;
+		for (size_t i = 0; i < cap_flat_map_size(map); ++i) {
+			int key = *(int *)cap_flat_map_key_at(map, i);
+			int value = *(int *)cap_flat_map_value_at(map, i);
+			if (key != (int)i) ordered = false;
+			if (value < FLAT_MAP_TEST_KEYS / 2) last_wins = false;
+		}
+		CAP_ASSERT_TRUE(ordered, "FLAT_MAP keys in order after sort");
+		CAP_ASSERT_TRUE(last_wins,
+				"FLAT_MAP last pushed duplicate is kept");
+		cap_flat_map_free(map);
+	}
+	// Tests on int64_t keys
+	{
+		cap_flat_map *map = cap_flat_map_init_int64();
+		int64_t value_store[FLAT_MAP_TEST_KEYS];
+		for (int64_t i = FLAT_MAP_TEST_KEYS - 1; i >= 0; --i) {
+			int64_t key = i * 2;
+			value_store[i] = i;
+			cap_flat_map_push(map, &key, &value_store[i]);
+		}
+		CAP_ASSERT_EQ(cap_flat_map_size(map), FLAT_MAP_TEST_KEYS,
+			      "FLAT_MAP int64 size after push");
+		bool all_found = true, misses = true;
+		for (int64_t i = 0; i < FLAT_MAP_TEST_KEYS; ++i) {
+			int64_t key = i * 2, odd_key = i * 2 + 1;
+			int64_t *value = cap_flat_map_find(map, &key);
+			if (!value || *value != i) all_found = false;
+			if (cap_flat_map_contains(map, &odd_key)) misses = false;
+		}
+		CAP_ASSERT_TRUE(all_found, "FLAT_MAP int64 find every key");
+		CAP_ASSERT_TRUE(misses, "FLAT_MAP int64 odd keys are missing");
+		int64_t below = -5, odd = 7;
+		CAP_ASSERT_EQ(cap_flat_map_lower_bound(map, &below), 0,
+			      "FLAT_MAP int64 lower_bound below the minimum");
+		CAP_ASSERT_EQ(cap_flat_map_lower_bound(map, &odd), 4,
+			      "FLAT_MAP int64 lower_bound between keys");
+		int64_t key_ten = 10;
+		CAP_ASSERT_EQ(cap_flat_map_remove(map, &key_ten), 0,
+			      "FLAT_MAP int64 remove");
+		CAP_ASSERT_FALSE(cap_flat_map_contains(map, &key_ten),
+				 "FLAT_MAP int64 contains after remove");
+		cap_flat_map_free(map);
+	}
+	// Tests on merge
+	{
+		cap_flat_map *map_one = cap_flat_map_init_int64();
+		cap_flat_map *map_two = cap_flat_map_init_int64();
+		int64_t values[6] = {1, 2, 3, 4, 5, 6};
+		int64_t keys_one[3] = {1, 3, 5}, keys_two[3] = {2, 3, 6};
+		for (int i = 0; i < 3; ++i) {
+			cap_flat_map_insert(map_one, &keys_one[i], &values[i]);
+			cap_flat_map_insert(map_two, &keys_two[i],
+					    &values[i + 3]);
+		}
+		cap_flat_map *merged = cap_flat_map_merge(map_one, map_two);
+		CAP_ASSERT_EQ(cap_flat_map_size(merged), 5,
+			      "FLAT_MAP merged size");
+		int64_t key_three = 3;
+		CAP_ASSERT_EQ(*(int64_t *)cap_flat_map_find(merged, &key_three),
+			      5, "FLAT_MAP merge keeps the second map's value");
+		bool ordered = true;
+		for (size_t i = 1; i < cap_flat_map_size(merged); ++i)
+			if (*(int64_t *)cap_flat_map_key_at(merged, i - 1) >=
+			    *(int64_t *)cap_flat_map_key_at(merged, i))
+				ordered = false;
+		CAP_ASSERT_TRUE(ordered, "FLAT_MAP merged keys in order");
+		CAP_ASSERT_EQ(cap_flat_map_size(map_one), 3,
+			      "FLAT_MAP merge leaves the first map untouched");
+		cap_flat_map_free(merged);
+		cap_flat_map_free(map_one);
+		cap_flat_map_free(map_two);
+	}
+}
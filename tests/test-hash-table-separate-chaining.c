@@ -189,9 +189,12 @@ void test_hash_table_separate_chain(void) {
 		cap_hash_table_insert(hash_table_heap_alloc, key_two,
 				      value_two);
 		cap_hash_table_deep_erase(hash_table_heap_alloc, key_two);
+		// The erase freed the key as well
+		int *key_two_re = malloc(sizeof(int));
+		*key_two_re = 20;
 		char *value_two_re = calloc(1, 10);
 		strncpy(value_two_re, "value_two", strlen("value_two"));
-		cap_hash_table_insert(hash_table_heap_alloc, key_two,
+		cap_hash_table_insert(hash_table_heap_alloc, key_two_re,
 				      value_two_re);
 		cap_hash_table_deep_free(hash_table_heap_alloc);
 	}
@@ -0,0 +1,647 @@
+#include "internal/test-helper.h"
+#include <lru_cache.h>
+
+#define LRU_CACHE_TEST_KEYS 100000
+
+static bool compare_fn_int(void *x, void *y) { return *(int *)x == *(int *)y; }
+
+// Sends every key to the same bucket
+static size_t hash_fn_constant(uint8_t *key, size_t key_size) {
+	(void)key;
+	(void)key_size;
+	return 42;
+}
+
+static uint64_t test_now;
+static uint64_t test_clock(void) { return test_now; }
+
+typedef struct {
+	size_t evicted;
+	size_t expired;
+	int last_key;
+} evict_counts;
+
+static void count_evictions(void *key, void *value,
+			    cap_cache_evict_reason reason, void *arg) {
+	evict_counts *counts = (evict_counts *)arg;
+	if (reason == CAP_CACHE_EVICTED) counts->evicted++;
+	if (reason == CAP_CACHE_EXPIRED) counts->expired++;
+	if (*(int *)key != *(int *)value) counts->last_key = -1;
+	else counts->last_key = *(int *)key;
+}
+
+static size_t int_value_size(void *value) {
+	(void)value;
+	return sizeof(int);
+}
+
+// Restores the entries into a static pool of keys and values
+static int restored_keys[1000], restored_values[1000];
+static size_t restored_count;
+
+static bool restore_int(void *key, void *value, size_t value_size,
+			void **key_out, void **value_out, void *arg) {
+	(void)arg;
+	if (value_size != sizeof(int) || restored_count == 1000) return false;
+	memcpy(&restored_keys[restored_count], key, sizeof(int));
+	memcpy(&restored_values[restored_count], value, sizeof(int));
+	*key_out = &restored_keys[restored_count];
+	*value_out = &restored_values[restored_count];
+	restored_count++;
+	return true;
+}
+
+// Restores the entries into copies, freed by release_copy
+static size_t released_count;
+
+static bool restore_copy(void *key, void *value, size_t value_size,
+			 void **key_out, void **value_out, void *arg) {
+	(void)arg;
+	*key_out = malloc(sizeof(int));
+	*value_out = malloc(value_size);
+	memcpy(*key_out, key, sizeof(int));
+	memcpy(*value_out, value, value_size);
+	return true;
+}
+
+static void release_copy(void *key, void *value, void *arg) {
+	(void)arg;
+	free(key);
+	free(value);
+	released_count++;
+}
+
+static bool fail_allocations;
+
+static void *failing_alloc(void *ctx, size_t size) {
+	(void)ctx;
+	return fail_allocations ? NULL : malloc(size);
+}
+
+static void failing_free(void *ctx, void *ptr, size_t size) {
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+void test_lru_cache(void) {
+	{
+		cap_lru_cache *cache = cap_lru_cache_init_with_keys(
+		    2, sizeof(int), compare_fn_int, NULL);
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 0,
+			      "LRU_CACHE size after init");
+		int key_one = 1, key_two = 2, key_three = 3;
+		int value_one = 10, value_two = 20, value_three = 30;
+		CAP_ASSERT_TRUE(cap_lru_cache_put(cache, &key_one, &value_one),
+				"LRU_CACHE put key one");
+		cap_lru_cache_put(cache, &key_two, &value_two);
+		CAP_ASSERT_EQ(*(int *)cap_lru_cache_get(cache, &key_one), 10,
+			      "LRU_CACHE get key one");
+		// Key two is the least recently used one now
+		cap_lru_cache_put(cache, &key_three, &value_three);
+		CAP_ASSERT_TRUE(cap_lru_cache_get(cache, &key_two) == NULL,
+				"LRU_CACHE least recently used key is evicted");
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, &key_one),
+				"LRU_CACHE recently used key is kept");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 2,
+			      "LRU_CACHE size at capacity");
+		cap_lru_cache_put(cache, &key_three, &value_one);
+		CAP_ASSERT_EQ(*(int *)cap_lru_cache_get(cache, &key_three), 10,
+			      "LRU_CACHE put replaces the value");
+		CAP_ASSERT_TRUE(cap_lru_cache_remove(cache, &key_three),
+				"LRU_CACHE remove key three");
+		CAP_ASSERT_FALSE(cap_lru_cache_remove(cache, &key_three),
+				 "LRU_CACHE remove missing key three");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 1,
+			      "LRU_CACHE size after remove");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on colliding keys
+	{
+		cap_lru_cache *cache = cap_lru_cache_init_with_keys(
+		    8, sizeof(int), NULL, hash_fn_constant);
+		int keys[16], values[16];
+		for (int i = 0; i < 16; ++i) {
+			keys[i] = i;
+			values[i] = i * 10;
+			cap_lru_cache_put(cache, &keys[i], &values[i]);
+		}
+		bool recent_kept = true, old_evicted = true;
+		for (int i = 0; i < 16; ++i) {
+			bool cached = cap_lru_cache_contains(cache, &keys[i]);
+			if (i < 8 && cached) old_evicted = false;
+			if (i >= 8 && !cached) recent_kept = false;
+		}
+		CAP_ASSERT_TRUE(old_evicted,
+				"LRU_CACHE colliding old keys are evicted");
+		CAP_ASSERT_TRUE(recent_kept,
+				"LRU_CACHE colliding recent keys are kept");
+		CAP_ASSERT_EQ(*(int *)cap_lru_cache_get(cache, &keys[12]), 120,
+			      "LRU_CACHE get a colliding key");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on a large cache and resizing
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		cap_lru_cache *cache =
+		    cap_lru_cache_init(LRU_CACHE_TEST_KEYS / 2);
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) {
+			keys[i] = i;
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		}
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache),
+			      LRU_CACHE_TEST_KEYS / 2,
+			      "LRU_CACHE size of a large cache");
+		size_t hits = 0;
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i)
+			if (cap_lru_cache_contains(cache, &keys[i])) hits++;
+		CAP_ASSERT_EQ(hits, LRU_CACHE_TEST_KEYS / 2,
+			      "LRU_CACHE large cache keeps every recent key");
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(
+				    cache, &keys[LRU_CACHE_TEST_KEYS / 2]),
+				"LRU_CACHE oldest kept key of a large cache");
+		CAP_ASSERT_TRUE(cap_lru_cache_set_capacity(cache, 100),
+				"LRU_CACHE shrink the capacity");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 100,
+			      "LRU_CACHE size after shrinking");
+		int *newest = &keys[LRU_CACHE_TEST_KEYS - 1];
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, newest),
+				"LRU_CACHE most recent key survives shrinking");
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(
+				     cache, &keys[LRU_CACHE_TEST_KEYS - 101]),
+				 "LRU_CACHE older key is evicted on shrinking");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on the eviction policies
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		cap_cache_policy policies[5] = {
+		    CAP_CACHE_POLICY_LRU, CAP_CACHE_POLICY_CLOCK,
+		    CAP_CACHE_POLICY_S3FIFO, CAP_CACHE_POLICY_TINYLFU,
+		    CAP_CACHE_POLICY_ARC};
+		size_t hot_kept[5];
+		bool consistent = true;
+		for (int p = 0; p < 5; ++p) {
+			cap_lru_cache *cache = cap_lru_cache_init_with_policy(
+			    100, sizeof(int), NULL, NULL, policies[p]);
+			CAP_ASSERT_TRUE(cap_lru_cache_policy(cache) ==
+					    policies[p],
+					"LRU_CACHE policy given at init");
+			// 50 hot keys which are used over and over
+			for (int round = 0; round < 5; ++round) {
+				for (int i = 0; i < 50; ++i) {
+					int *key = &keys[i];
+					if (!cap_lru_cache_get(cache, key))
+						cap_lru_cache_put(cache, key,
+								  key);
+				}
+			}
+			// Followed by a scan of one-time keys
+			for (int i = 1000; i < 2000; ++i) {
+				cap_lru_cache_put(cache, &keys[i], &keys[i]);
+				if (cap_lru_cache_size(cache) > 100)
+					consistent = false;
+			}
+			hot_kept[p] = 0;
+			for (int i = 0; i < 50; ++i) {
+				int *value = cap_lru_cache_get(cache, &keys[i]);
+				if (value) hot_kept[p]++;
+				if (value && *value != i) consistent = false;
+			}
+			cap_lru_cache_free(cache);
+		}
+		CAP_ASSERT_TRUE(consistent,
+				"LRU_CACHE policies stay within the capacity");
+		CAP_ASSERT_EQ(hot_kept[0], 0,
+			      "LRU_CACHE LRU is flushed by a scan");
+		CAP_ASSERT_TRUE(hot_kept[2] >= 45,
+				"LRU_CACHE S3-FIFO keeps the hot keys");
+		CAP_ASSERT_TRUE(hot_kept[3] >= 45,
+				"LRU_CACHE W-TinyLFU keeps the hot keys");
+		CAP_ASSERT_TRUE(hot_kept[4] >= 45,
+				"LRU_CACHE ARC keeps the hot keys");
+
+		// CLOCK gives referenced entries a second chance
+		cap_lru_cache *cache = cap_lru_cache_init_with_policy(
+		    3, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_CLOCK);
+		for (int i = 1; i <= 3; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		cap_lru_cache_get(cache, &keys[1]);
+		cap_lru_cache_put(cache, &keys[4], &keys[4]);
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, &keys[1]),
+				"LRU_CACHE CLOCK keeps a referenced entry");
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[2]),
+				 "LRU_CACHE CLOCK evicts an unused entry");
+		cap_lru_cache_free(cache);
+
+		// ARC sends a key evicted from T1 which comes back to T2, out
+		// of the way of the one-time keys going through T1
+		cache = cap_lru_cache_init_with_policy(
+		    4, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_ARC);
+		for (int i = 1; i <= 2; ++i) {
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+			cap_lru_cache_get(cache, &keys[i]);
+		}
+		for (int i = 3; i <= 5; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[3]),
+				 "LRU_CACHE ARC evicts the oldest T1 entry");
+		cap_lru_cache_put(cache, &keys[3], &keys[3]);
+		for (int i = 10; i < 20; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, &keys[3]),
+				"LRU_CACHE ARC keeps a key back from a ghost");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 4,
+			      "LRU_CACHE ARC size after a ghost hit");
+		cap_lru_cache_free(cache);
+
+		// Random operations on every policy, then shrink the capacity
+		bool all_valid = true;
+		for (int p = 0; p < 5; ++p) {
+			cache = cap_lru_cache_init_with_policy(
+			    256, sizeof(int), NULL, NULL, policies[p]);
+			unsigned seed = 7;
+			for (int i = 0; i < 20000; ++i) {
+				seed = seed * 1103515245 + 12345;
+				int *key = &keys[(seed >> 8) % 1024];
+				if (i % 7 == 0) {
+					cap_lru_cache_remove(cache, key);
+				} else if (i % 2) {
+					int *value =
+					    cap_lru_cache_get(cache, key);
+					if (value && *value != *key)
+						all_valid = false;
+				} else {
+					cap_lru_cache_put(cache, key, key);
+				}
+				if (cap_lru_cache_size(cache) > 256)
+					all_valid = false;
+			}
+			cap_lru_cache_set_capacity(cache, 32);
+			if (cap_lru_cache_size(cache) > 32) all_valid = false;
+			for (int i = 0; i < 100; ++i)
+				cap_lru_cache_put(cache, &keys[i], &keys[i]);
+			if (cap_lru_cache_size(cache) != 32) all_valid = false;
+			cap_lru_cache_free(cache);
+		}
+		CAP_ASSERT_TRUE(all_valid,
+				"LRU_CACHE random operations on every policy");
+	}
+	// Tests on a byte budget
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		cap_lru_cache *cache = cap_lru_cache_init(1000);
+		CAP_ASSERT_TRUE(
+		    cap_lru_cache_put_with_cost(cache, &keys[1], &keys[1], 600),
+		    "LRU_CACHE put with a cost");
+		cap_lru_cache_put_with_cost(cache, &keys[2], &keys[2], 300);
+		CAP_ASSERT_EQ(cap_lru_cache_used(cache), 900,
+			      "LRU_CACHE used sums the costs");
+		CAP_ASSERT_FALSE(cap_lru_cache_put_with_cost(cache, &keys[3],
+							     &keys[3], 1001),
+				 "LRU_CACHE cost over the capacity rejected");
+		// Key one is evicted to make room for key three
+		cap_lru_cache_put_with_cost(cache, &keys[3], &keys[3], 200);
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[1]),
+				 "LRU_CACHE evicts until the cost fits");
+		CAP_ASSERT_EQ(cap_lru_cache_used(cache), 500,
+			      "LRU_CACHE used after eviction");
+		// Growing key three pushes key two out
+		cap_lru_cache_put_with_cost(cache, &keys[3], &keys[3], 900);
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[2]),
+				 "LRU_CACHE growing an entry evicts");
+		CAP_ASSERT_EQ(cap_lru_cache_used(cache), 900,
+			      "LRU_CACHE used after updating the cost");
+		cap_lru_cache_remove(cache, &keys[3]);
+		CAP_ASSERT_EQ(cap_lru_cache_used(cache), 0,
+			      "LRU_CACHE used after remove");
+		cap_lru_cache_free(cache);
+
+		cap_cache_policy policies[5] = {
+		    CAP_CACHE_POLICY_LRU, CAP_CACHE_POLICY_CLOCK,
+		    CAP_CACHE_POLICY_S3FIFO, CAP_CACHE_POLICY_TINYLFU,
+		    CAP_CACHE_POLICY_ARC};
+		bool within_budget = true;
+		for (int p = 0; p < 5; ++p) {
+			cache = cap_lru_cache_init_with_policy(
+			    1 << 16, sizeof(int), NULL, NULL, policies[p]);
+			unsigned seed = 11;
+			for (int i = 0; i < 20000; ++i) {
+				seed = seed * 1103515245 + 12345;
+				int *key = &keys[(seed >> 8) % 4096];
+				size_t cost = 1 + (seed >> 4) % 512;
+				if (i % 2) {
+					int *value =
+					    cap_lru_cache_get(cache, key);
+					if (value && *value != *key)
+						within_budget = false;
+				} else {
+					cap_lru_cache_put_with_cost(cache, key,
+								    key, cost);
+				}
+				if (cap_lru_cache_used(cache) > 1 << 16)
+					within_budget = false;
+			}
+			cap_lru_cache_set_capacity(cache, 4096);
+			if (cap_lru_cache_used(cache) > 4096)
+				within_budget = false;
+			cap_lru_cache_free(cache);
+		}
+		CAP_ASSERT_TRUE(within_budget,
+				"LRU_CACHE policies stay within the budget");
+	}
+	// Tests on the TTL expiry
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		cap_lru_cache *cache = cap_lru_cache_init(10000);
+		cap_lru_cache_set_clock(cache, test_clock);
+		test_now = 1000;
+		CAP_ASSERT_TRUE(
+		    cap_lru_cache_put_with_ttl(cache, &keys[1], &keys[1], 100),
+		    "LRU_CACHE put with a TTL");
+		cap_lru_cache_put(cache, &keys[2], &keys[2]);
+		test_now = 1099;
+		CAP_ASSERT_TRUE(cap_lru_cache_get(cache, &keys[1]) != NULL,
+				"LRU_CACHE entry before it's TTL");
+		test_now = 1100;
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[1]),
+				 "LRU_CACHE expired entry isn't contained");
+		CAP_ASSERT_TRUE(cap_lru_cache_get(cache, &keys[1]) == NULL,
+				"LRU_CACHE expired entry is removed on get");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 1,
+			      "LRU_CACHE size after the lazy expiry");
+		CAP_ASSERT_TRUE(cap_lru_cache_get(cache, &keys[2]) != NULL,
+				"LRU_CACHE entry without a TTL stays");
+
+		// Half of the entries expire at 2000, the others at 3000 but
+		// are put again without a TTL
+		cap_lru_cache_set_default_ttl(cache, 900);
+		for (int i = 10; i < 1010; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		for (int i = 1010; i < 2010; ++i)
+			cap_lru_cache_put_with_ttl(cache, &keys[i], &keys[i],
+						   1900);
+		for (int i = 1510; i < 2010; ++i)
+			cap_lru_cache_put_with_ttl(cache, &keys[i], &keys[i],
+						   0);
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 1999), 0,
+			      "LRU_CACHE expire before any TTL");
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 2000), 1000,
+			      "LRU_CACHE expire the default TTL");
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 1 << 30), 500,
+			      "LRU_CACHE expire the given TTL");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 501,
+			      "LRU_CACHE size after expire now");
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, &keys[1600]),
+				"LRU_CACHE entry whose TTL was cleared stays");
+		cap_lru_cache_free(cache);
+
+		// Expired, evicted and removed entries leave the wheel
+		cache = cap_lru_cache_init_with_policy(
+		    256, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_TINYLFU);
+		cap_lru_cache_set_clock(cache, test_clock);
+		test_now = 0;
+		unsigned seed = 5;
+		bool valid = true;
+		for (int i = 0; i < 20000; ++i) {
+			seed = seed * 1103515245 + 12345;
+			int *key = &keys[(seed >> 8) % 1024];
+			if (i % 5 == 0) {
+				cap_lru_cache_remove(cache, key);
+			} else if (i % 2) {
+				int *value = cap_lru_cache_get(cache, key);
+				if (value && *value != *key) valid = false;
+			} else {
+				uint64_t ttl = 1 + (seed >> 4) % 64;
+				cap_lru_cache_put_with_ttl(cache, key, key,
+							   ttl);
+			}
+			if (i % 100 == 0) cap_lru_cache_expire_now(cache, i);
+			test_now = i;
+		}
+		cap_lru_cache_expire_now(cache, 1 << 30);
+		CAP_ASSERT_TRUE(valid, "LRU_CACHE random operations with TTLs");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 0,
+			      "LRU_CACHE every TTL expires");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on recycled nodes
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		cap_lru_cache *cache = cap_lru_cache_init(64);
+		cap_lru_cache_set_clock(cache, test_clock);
+		test_now = 0;
+		for (int i = 0; i < 64; ++i)
+			cap_lru_cache_put_with_ttl(cache, &keys[i], &keys[i],
+						   10);
+		// The evicted nodes are reused without their TTL and cost
+		for (int i = 64; i < 128; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		test_now = 100;
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 100), 0,
+			      "LRU_CACHE recycled node drops it's TTL");
+		CAP_ASSERT_EQ(cap_lru_cache_used(cache), 64,
+			      "LRU_CACHE recycled node takes the new cost");
+		bool recycled_valid = true;
+		for (int i = 64; i < 128; ++i) {
+			int *value = cap_lru_cache_get(cache, &keys[i]);
+			if (!value || *value != i) recycled_valid = false;
+		}
+		CAP_ASSERT_TRUE(recycled_valid,
+				"LRU_CACHE recycled nodes hold new entries");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on the evict function and the batched functions
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		static void *key_ptrs[1000], *values[1000];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		evict_counts counts = {0, 0, 0};
+		cap_lru_cache *cache = cap_lru_cache_init_with_evict_fn(
+		    100, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_LRU,
+		    count_evictions, &counts);
+		cap_lru_cache_set_clock(cache, test_clock);
+		test_now = 0;
+		for (int i = 0; i < 150; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		CAP_ASSERT_EQ(counts.evicted, 50,
+			      "LRU_CACHE evict function on eviction");
+		CAP_ASSERT_EQ(counts.last_key, 49,
+			      "LRU_CACHE evict function gets the entry");
+		cap_lru_cache_remove(cache, &keys[149]);
+		CAP_ASSERT_EQ(counts.evicted, 50,
+			      "LRU_CACHE no evict function on remove");
+		cap_lru_cache_put_with_ttl(cache, &keys[149], &keys[149], 5);
+		cap_lru_cache_put_with_ttl(cache, &keys[148], &keys[148], 5);
+		test_now = 10;
+		cap_lru_cache_get(cache, &keys[149]);
+		cap_lru_cache_expire_now(cache, 10);
+		CAP_ASSERT_EQ(counts.expired, 2,
+			      "LRU_CACHE evict function on expiry");
+
+		for (int i = 0; i < 1000; ++i) key_ptrs[i] = &keys[i];
+		CAP_ASSERT_EQ(cap_lru_cache_put_many(cache, key_ptrs + 900,
+						     key_ptrs + 900, 100),
+			      100, "LRU_CACHE put many");
+		CAP_ASSERT_EQ(
+		    cap_lru_cache_get_many(cache, key_ptrs + 850, values, 150),
+		    100, "LRU_CACHE get many hits");
+		bool batch_valid = true;
+		for (int i = 0; i < 150; ++i) {
+			if (i < 50 && values[i] != NULL) batch_valid = false;
+			if (i >= 50 && values[i] != &keys[850 + i])
+				batch_valid = false;
+		}
+		CAP_ASSERT_TRUE(batch_valid, "LRU_CACHE get many values");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on the counters and the hot keys
+	{
+		static int keys[LRU_CACHE_TEST_KEYS];
+		for (int i = 0; i < LRU_CACHE_TEST_KEYS; ++i) keys[i] = i;
+		cap_lru_cache *cache = cap_lru_cache_init(10);
+		for (int i = 0; i < 20; ++i)
+			cap_lru_cache_put(cache, &keys[i], &keys[i]);
+		cap_lru_cache_put(cache, &keys[19], &keys[19]);
+		for (int i = 0; i < 20; ++i)
+			cap_lru_cache_get(cache, &keys[i]);
+		cap_cache_stats stats = cap_lru_cache_stats(cache);
+		CAP_ASSERT_EQ(stats.inserts, 20, "LRU_CACHE stats inserts");
+		CAP_ASSERT_EQ(stats.updates, 1, "LRU_CACHE stats updates");
+		CAP_ASSERT_EQ(stats.evictions, 10, "LRU_CACHE stats evictions");
+		CAP_ASSERT_EQ(stats.hits, 10, "LRU_CACHE stats hits");
+		CAP_ASSERT_EQ(stats.misses, 10, "LRU_CACHE stats misses");
+		cap_lru_cache_reset_stats(cache);
+		CAP_ASSERT_EQ(cap_lru_cache_stats(cache).hits, 0,
+			      "LRU_CACHE stats after reset");
+
+		// Key i of the first 8 is looked up 1000 / (i + 1) times, among
+		// a stream of keys looked up once
+		CAP_ASSERT_TRUE(cap_lru_cache_track_hot_keys(cache, 16, 2),
+				"LRU_CACHE track hot keys");
+		unsigned seed = 9;
+		for (int round = 0; round < 1000; ++round) {
+			for (int i = 0; i < 8; ++i)
+				if (round % (i + 1) == 0)
+					cap_lru_cache_get(cache, &keys[i]);
+			seed = seed * 1103515245 + 12345;
+			cap_lru_cache_get(cache,
+					  &keys[100 + (seed >> 8) % 50000]);
+		}
+		int hot_keys[4];
+		uint64_t counts[4];
+		size_t returned =
+		    cap_lru_cache_hot_keys(cache, hot_keys, counts, 4);
+		CAP_ASSERT_EQ(returned, 4, "LRU_CACHE hot keys returned");
+		bool hottest_first = true;
+		for (int i = 0; i < 4; ++i) {
+			if (hot_keys[i] != i) hottest_first = false;
+			if (i && counts[i] > counts[i - 1])
+				hottest_first = false;
+		}
+		CAP_ASSERT_TRUE(hottest_first, "LRU_CACHE hottest keys first");
+		CAP_ASSERT_TRUE(counts[0] >= 1000 && counts[0] <= 1100,
+				"LRU_CACHE hot key count estimate");
+		cap_lru_cache_track_hot_keys(cache, 0, 1);
+		returned = cap_lru_cache_hot_keys(cache, hot_keys, counts, 4);
+		CAP_ASSERT_EQ(returned, 0, "LRU_CACHE hot keys stopped");
+		cap_lru_cache_free(cache);
+	}
+	// Tests on the snapshot
+	{
+		static int keys[1000], values[1000];
+		for (int i = 0; i < 1000; ++i) {
+			keys[i] = i;
+			values[i] = i * 10;
+		}
+		cap_lru_cache *cache = cap_lru_cache_init(100);
+		cap_lru_cache_set_clock(cache, test_clock);
+		test_now = 0;
+		for (int i = 0; i < 100; ++i)
+			cap_lru_cache_put(cache, &keys[i], &values[i]);
+		cap_lru_cache_put_with_ttl(cache, &keys[5], &values[5], 50);
+		// Key 0 becomes the most recently used, key 1 the least
+		cap_lru_cache_get(cache, &keys[0]);
+		FILE *file = tmpfile();
+		test_now = 20;
+		CAP_ASSERT_TRUE(cap_lru_cache_save(cache, file, int_value_size),
+				"LRU_CACHE save a snapshot");
+		cap_lru_cache_free(cache);
+
+		rewind(file);
+		restored_count = 0;
+		test_now = 1000;
+		cache = cap_lru_cache_init(100);
+		cap_lru_cache_set_clock(cache, test_clock);
+		bool loaded =
+		    cap_lru_cache_load(cache, file, restore_int, NULL, NULL);
+		CAP_ASSERT_TRUE(loaded, "LRU_CACHE load a snapshot");
+		CAP_ASSERT_EQ(cap_lru_cache_size(cache), 100,
+			      "LRU_CACHE size after load");
+		int *value = cap_lru_cache_get(cache, &keys[42]);
+		CAP_ASSERT_TRUE(value && *value == 420,
+				"LRU_CACHE value after load");
+		cap_lru_cache_put(cache, &keys[500], &values[500]);
+		CAP_ASSERT_FALSE(cap_lru_cache_contains(cache, &keys[1]),
+				 "LRU_CACHE load keeps the recency order");
+		CAP_ASSERT_TRUE(cap_lru_cache_contains(cache, &keys[0]),
+				"LRU_CACHE load keeps the most recent entry");
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 1029), 0,
+			      "LRU_CACHE load keeps the time left");
+		CAP_ASSERT_EQ(cap_lru_cache_expire_now(cache, 1030), 1,
+			      "LRU_CACHE loaded entry expires");
+		CAP_ASSERT_FALSE(cap_lru_cache_load(cache, file, restore_int,
+						    NULL, NULL),
+				 "LRU_CACHE load into a cache with entries");
+		cap_lru_cache_free(cache);
+
+		// A smaller cache of another policy keeps the most recent ones
+		rewind(file);
+		restored_count = 0;
+		cache = cap_lru_cache_init_with_policy(
+		    10, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_S3FIFO);
+		loaded =
+		    cap_lru_cache_load(cache, file, restore_int, NULL, NULL);
+		CAP_ASSERT_TRUE(loaded, "LRU_CACHE load into a smaller cache");
+		// The saved order ends with keys 92 to 99, 5 and 0
+		bool most_recent_kept =
+		    cap_lru_cache_size(cache) == 10 &&
+		    cap_lru_cache_contains(cache, &keys[5]) &&
+		    cap_lru_cache_contains(cache, &keys[0]);
+		for (int i = 92; i < 100; ++i)
+			if (!cap_lru_cache_contains(cache, &keys[i]))
+				most_recent_kept = false;
+		CAP_ASSERT_TRUE(most_recent_kept,
+				"LRU_CACHE smaller cache keeps recent ones");
+		cap_lru_cache_free(cache);
+
+		rewind(file);
+		cache = cap_lru_cache_init_with_keys(10, sizeof(int) * 2, NULL,
+						     NULL);
+		CAP_ASSERT_FALSE(cap_lru_cache_load(cache, file, restore_int,
+						    NULL, NULL),
+				 "LRU_CACHE load another key size");
+		cap_lru_cache_free(cache);
+
+		// The entry the cache can't store is handed back
+		rewind(file);
+		cap_allocator allocator = {failing_alloc, NULL, failing_free,
+					   NULL};
+		cache = cap_lru_cache_init_with_allocator(
+		    10, sizeof(int), NULL, NULL, CAP_CACHE_POLICY_LRU, NULL,
+		    NULL, &allocator);
+		fail_allocations = true;
+		CAP_ASSERT_FALSE(cap_lru_cache_load(cache, file, restore_copy,
+						    release_copy, NULL),
+				 "LRU_CACHE load with a failing allocator");
+		fail_allocations = false;
+		CAP_ASSERT_EQ(released_count, 1,
+			      "LRU_CACHE load releases the unstored entry");
+		cap_lru_cache_free(cache);
+		fclose(file);
+	}
+}
@@ -11,6 +11,15 @@ extern void test_circular_queue(void);
 extern void test_arena_allocator(void);
 extern void test_priority_queue(void);
 extern void test_hash_table_linear_probing(void);
+extern void test_btree(void);
+extern void test_flat_map(void);
+extern void test_lru_cache(void);
+extern void test_timer_wheel(void);
+extern void test_pool_allocator(void);
+extern void test_size_class_allocator(void);
+extern void test_arena_allocator_debug(void);
+extern void test_concurrent_lru_cache(void);
+extern void test_concurrent_arena_pool(void);
 
 int main(int argc, const char *const argv[]) {
 	test_dynamic_queue();
@@ -25,6 +34,15 @@ int main(int argc, const char *const argv[]) {
 	test_arena_allocator();
 	test_priority_queue();
 	test_hash_table_linear_probing();
+	test_btree();
+	test_flat_map();
+	test_lru_cache();
+	test_timer_wheel();
+	test_pool_allocator();
+	test_size_class_allocator();
+	test_arena_allocator_debug();
+	test_concurrent_lru_cache();
+	test_concurrent_arena_pool();
 
 	return 0;
 }
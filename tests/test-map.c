@@ -1,5 +1,21 @@
 #include "internal/test-helper.h"
 #include <map.h>
+#include <stdint.h>
+
+typedef struct {
+	unsigned char bytes[16];
+} test_map_key16;
+
+CAP_MAP_DEFINE(cap_map_u64, uint64_t, CAP_MAP_CMP_INT)
+CAP_MAP_DEFINE(cap_map_key16, test_map_key16, CAP_MAP_CMP_MEMCMP)
+
+static uint64_t _for_each_previous = 0;
+static bool _for_each_ordered = true;
+static void for_each_fn_u64(uint64_t *key, void *value) {
+	(void)value;
+	if (*key < _for_each_previous) _for_each_ordered = false;
+	_for_each_previous = *key;
+}
 
 static int compare_fn_int(void *x, void *y) {
 	if (*(int *)x > *(int *)y)
@@ -162,4 +178,113 @@ void test_map(void) {
 		cap_map_free(map);
 		cap_map_iterator_free(map_iterator);
 	}
+	{ // Tests on rank, select and count_range
+		cap_map *map = cap_map_init(sizeof(int), compare_fn_int);
+		int keys[1000];
+		int values[1000];
+		// Keys are 0, 2, 4, ... inserted in a shuffled order
+		for (int i = 0; i < 1000; ++i) {
+			keys[i] = ((i * 7) % 1000) * 2;
+			values[i] = keys[i] * 10;
+		}
+		for (int i = 0; i < 1000; ++i)
+			cap_map_insert(map, &keys[i], &values[i]);
+		int probe_one = 500, probe_two = 501, probe_three = -5;
+		CAP_ASSERT_EQ(cap_map_rank(map, &probe_one), 250,
+			      "MAP rank of an existing key");
+		CAP_ASSERT_EQ(cap_map_rank(map, &probe_two), 251,
+			      "MAP rank of a missing key");
+		CAP_ASSERT_EQ(cap_map_rank(map, &probe_three), 0,
+			      "MAP rank below the smallest key");
+		int *selected = cap_map_select(map, 250);
+		CAP_ASSERT_TRUE(selected != NULL && *selected == 5000,
+				"MAP select index 250");
+		CAP_ASSERT_TRUE(cap_map_select(map, 1000) == NULL,
+				"MAP select out of range");
+		int low = 100, high = 200;
+		CAP_ASSERT_EQ(cap_map_count_range(map, &low, &high), 51,
+			      "MAP count_range inclusive bounds");
+		CAP_ASSERT_EQ(cap_map_count_range(map, &high, &low), 0,
+			      "MAP count_range on an empty range");
+		// Remove every key which is a multiple of 4
+		for (int i = 0; i < 1000; ++i)
+			if (keys[i] % 4 == 0) cap_map_remove(map, &keys[i]);
+		CAP_ASSERT_EQ(cap_map_size(map), 500,
+			      "MAP size after removing half the keys");
+		CAP_ASSERT_EQ(cap_map_rank(map, &probe_one), 125,
+			      "MAP rank after removes");
+		CAP_ASSERT_EQ(cap_map_count_range(map, &low, &high), 25,
+			      "MAP count_range after removes");
+		bool all_selected = true;
+		for (size_t i = 0; i < 500; ++i) {
+			int *value = cap_map_select(map, i);
+			if (!value || *value != (int)(i * 4 + 2) * 10)
+				all_selected = false;
+		}
+		CAP_ASSERT_TRUE(all_selected, "MAP select every index");
+		cap_map_iterator *page = cap_map_iterator_at(map, 100);
+		CAP_ASSERT_EQ(*(int *)page->key, 402, "MAP iterator_at key");
+		cap_map_iterator_increment(page);
+		CAP_ASSERT_EQ(*(int *)page->key, 406,
+			      "MAP iterator_at increment");
+		cap_map_iterator_free(page);
+		CAP_ASSERT_TRUE(cap_map_iterator_at(map, 500) == NULL,
+				"MAP iterator_at out of range");
+		cap_map_free(map);
+	}
+	// Tests on the CAP_MAP_DEFINE specializations
+	{
+		cap_map_u64 *map = cap_map_u64_init();
+		CAP_ASSERT_TRUE(cap_map_u64_empty(map),
+				"MAP_DEFINE empty check after init");
+		int values[1000];
+		for (int i = 0; i < 1000; ++i) {
+			values[i] = i;
+			cap_map_u64_insert(map, (uint64_t)(i * 7919 % 1000),
+					   &values[i]);
+		}
+		CAP_ASSERT_EQ(cap_map_u64_size(map), 1000,
+			      "MAP_DEFINE size after inserts");
+		int *found = cap_map_u64_find(map, 7919 % 1000);
+		CAP_ASSERT_TRUE(found != NULL && *found == 1,
+				"MAP_DEFINE find by value key");
+		CAP_ASSERT_TRUE(cap_map_u64_find(map, 1000) == NULL,
+				"MAP_DEFINE find a missing key");
+		int replacement = -1;
+		cap_map_u64_insert(map, 0, &replacement);
+		CAP_ASSERT_EQ(*(int *)cap_map_u64_find(map, 0), -1,
+			      "MAP_DEFINE insert replaces the value");
+		CAP_ASSERT_EQ(cap_map_u64_size(map), 1000,
+			      "MAP_DEFINE size after replacing a value");
+		cap_map_u64_for_each(map, for_each_fn_u64);
+		CAP_ASSERT_TRUE(_for_each_ordered,
+				"MAP_DEFINE for_each visits keys in order");
+		for (uint64_t i = 0; i < 1000; i += 2) cap_map_u64_remove(map, i);
+		CAP_ASSERT_EQ(cap_map_u64_size(map), 500,
+			      "MAP_DEFINE size after removes");
+		CAP_ASSERT_FALSE(cap_map_u64_contains(map, 10),
+				 "MAP_DEFINE contains removed key");
+		CAP_ASSERT_TRUE(cap_map_u64_contains(map, 11),
+				"MAP_DEFINE contains remaining key");
+		CAP_ASSERT_EQ(cap_map_u64_remove(map, 10), -1,
+			      "MAP_DEFINE remove missing key");
+		cap_map_u64_free(map);
+
+		cap_map_key16 *byte_map = cap_map_key16_init();
+		test_map_key16 key_one, key_two;
+		memset(&key_one, 0xab, sizeof(key_one));
+		memset(&key_two, 0xab, sizeof(key_two));
+		key_two.bytes[15] = 0xac;
+		float value_one = 1.0f, value_two = 2.0f;
+		cap_map_key16_insert(byte_map, key_two, &value_two);
+		cap_map_key16_insert(byte_map, key_one, &value_one);
+		CAP_ASSERT_EQ(*(float *)cap_map_key16_find(byte_map, key_one),
+			      1.0f, "MAP_DEFINE find with memcmp keys");
+		CAP_ASSERT_EQ(*(float *)cap_map_key16_find(byte_map, key_two),
+			      2.0f, "MAP_DEFINE find second memcmp key");
+		key_two.bytes[0] = 0;
+		CAP_ASSERT_FALSE(cap_map_key16_contains(byte_map, key_two),
+				 "MAP_DEFINE contains a missing memcmp key");
+		cap_map_key16_free(byte_map);
+	}
 }
@@ -0,0 +1,98 @@
+#include "internal/test-helper.h"
+#include <list.h>
+#include <pool_allocator.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+	int key;
+	double value;
+	void *next;
+} pool_test_node;
+
+void test_pool_allocator(void) {
+	cap_pool_allocator *pool =
+	    cap_pool_allocator_init(sizeof(pool_test_node), 16);
+	CAP_ASSERT_EQ(cap_pool_object_size(pool), sizeof(pool_test_node),
+		      "POOL_ALLOCATOR object size");
+	pool_test_node *nodes[100];
+	bool aligned = true;
+	for (int i = 0; i < 100; ++i) {
+		nodes[i] = (pool_test_node *)cap_pool_alloc(pool);
+		if ((uintptr_t)nodes[i] % sizeof(void *)) aligned = false;
+		nodes[i]->key = i;
+	}
+	CAP_ASSERT_TRUE(aligned, "POOL_ALLOCATOR objects are aligned");
+	CAP_ASSERT_EQ(cap_pool_in_use(pool), 100,
+		      "POOL_ALLOCATOR objects in use");
+	CAP_ASSERT_EQ(cap_pool_capacity(pool), 112,
+		      "POOL_ALLOCATOR capacity in whole slabs");
+	bool intact = true;
+	for (int i = 0; i < 100; ++i)
+		if (nodes[i]->key != i) intact = false;
+	CAP_ASSERT_TRUE(intact, "POOL_ALLOCATOR objects don't overlap");
+
+	// A freed object is the next one handed out
+	cap_pool_free(pool, nodes[42]);
+	cap_pool_free(pool, nodes[7]);
+	CAP_ASSERT_TRUE(cap_pool_alloc(pool) == nodes[7],
+			"POOL_ALLOCATOR reuses the last freed object");
+	CAP_ASSERT_TRUE(cap_pool_alloc(pool) == nodes[42],
+			"POOL_ALLOCATOR free list order");
+	CAP_ASSERT_EQ(cap_pool_in_use(pool), 100,
+		      "POOL_ALLOCATOR in use after reuse");
+
+	// Bulk release keeps the slabs
+	cap_pool_reset(pool);
+	CAP_ASSERT_EQ(cap_pool_in_use(pool), 0,
+		      "POOL_ALLOCATOR in use after reset");
+	CAP_ASSERT_TRUE(cap_pool_alloc(pool) == nodes[0],
+			"POOL_ALLOCATOR reset starts over at the first slab");
+	for (int i = 1; i < 112; ++i) cap_pool_alloc(pool);
+	CAP_ASSERT_EQ(cap_pool_capacity(pool), 112,
+		      "POOL_ALLOCATOR reset reuses the slabs");
+	cap_pool_alloc(pool);
+	CAP_ASSERT_EQ(cap_pool_capacity(pool), 128,
+		      "POOL_ALLOCATOR grows by a slab");
+	cap_pool_allocator_free(pool);
+
+	// Thread caches move objects in batches
+	pool = cap_pool_allocator_init(24, 0);
+	cap_pool_cache cache;
+	cap_pool_cache_init(&cache, pool);
+	void *objects[200];
+	for (int i = 0; i < 200; ++i) {
+		objects[i] = cap_pool_cache_alloc(&cache);
+		memset(objects[i], i, 24);
+	}
+	CAP_ASSERT_EQ(cap_pool_in_use(pool) % CAP_POOL_CACHE_BATCH, 0,
+		      "POOL_ALLOCATOR cache refills in batches");
+	for (int i = 0; i < 200; ++i) cap_pool_cache_free(&cache, objects[i]);
+	CAP_ASSERT_TRUE(cache._count < CAP_POOL_CACHE_BATCH * 2,
+			"POOL_ALLOCATOR cache gives batches back");
+	cap_pool_cache_flush(&cache);
+	CAP_ASSERT_EQ(cap_pool_in_use(pool), 0,
+		      "POOL_ALLOCATOR in use after the cache is flushed");
+	CAP_ASSERT_TRUE(cap_pool_alloc(pool) != NULL,
+			"POOL_ALLOCATOR direct use after the cache");
+	cap_pool_allocator_free(pool);
+
+	// A list takes it's nodes from the pool through the interface
+	pool = cap_pool_allocator_init(sizeof(_cap_list_node), 0);
+	cap_allocator pool_interface = cap_pool_allocator_interface(pool);
+	cap_list *list = cap_list_init_with_allocator(&pool_interface);
+	for (size_t i = 0; i < 100; ++i)
+		cap_list_push_back(list, (void *)(i + 1));
+	CAP_ASSERT_TRUE(cap_pool_in_use(pool) >= 100,
+			"POOL_ALLOCATOR list nodes come from the pool");
+	bool list_intact = true;
+	for (size_t i = 0; i < 100; ++i)
+		if (cap_list_pop_front(list) != (void *)(i + 1))
+			list_intact = false;
+	CAP_ASSERT_TRUE(list_intact, "POOL_ALLOCATOR list on the pool");
+	cap_list_free(list);
+	CAP_ASSERT_EQ(cap_pool_in_use(pool), 0,
+		      "POOL_ALLOCATOR list gives it's nodes back");
+	cap_pool_allocator_free(pool);
+}
@@ -0,0 +1,71 @@
+#include "internal/test-helper.h"
+#include <list.h>
+#include <size_class_allocator.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+void test_size_class_allocator(void) {
+	CAP_ASSERT_EQ(cap_size_class_round(1), 16,
+		      "SIZE_CLASS_ALLOCATOR smallest class");
+	CAP_ASSERT_EQ(cap_size_class_round(100), 112,
+		      "SIZE_CLASS_ALLOCATOR classes step by 16 up to 128");
+	CAP_ASSERT_EQ(cap_size_class_round(129), 160,
+		      "SIZE_CLASS_ALLOCATOR classes step by a quarter");
+	CAP_ASSERT_EQ(cap_size_class_round(CAP_SIZE_CLASS_MAX_SIZE),
+		      CAP_SIZE_CLASS_MAX_SIZE,
+		      "SIZE_CLASS_ALLOCATOR largest class");
+
+	cap_size_class_allocator *allocator = cap_size_class_allocator_init(0);
+	CAP_ASSERT_TRUE(allocator != NULL, "SIZE_CLASS_ALLOCATOR init");
+	unsigned char *small = cap_size_class_alloc(allocator, 24);
+	unsigned char *other = cap_size_class_alloc(allocator, 24);
+	CAP_ASSERT_EQ(other - small, 32,
+		      "SIZE_CLASS_ALLOCATOR chunks are packed in the arena");
+	CAP_ASSERT_EQ((uintptr_t)small % CAP_ARENA_DEFAULT_ALIGNMENT, 0,
+		      "SIZE_CLASS_ALLOCATOR default alignment");
+	CAP_ASSERT_EQ(cap_size_class_in_use(allocator), 64,
+		      "SIZE_CLASS_ALLOCATOR in use counts the classes");
+	cap_size_class_free(allocator, small, 24);
+	CAP_ASSERT_TRUE(cap_size_class_alloc(allocator, 30) == small,
+			"SIZE_CLASS_ALLOCATOR reuses a freed chunk");
+	CAP_ASSERT_TRUE(cap_size_class_realloc(allocator, small, 30, 32) ==
+			    small,
+			"SIZE_CLASS_ALLOCATOR realloc within the class");
+	memset(small, 7, 32);
+	unsigned char *grown =
+	    cap_size_class_realloc(allocator, small, 32, 200);
+	CAP_ASSERT_TRUE(grown != small && grown[31] == 7,
+			"SIZE_CLASS_ALLOCATOR realloc moves to a larger class");
+
+	// Sizes over the largest class are mapped on their own
+	size_t capacity = cap_size_class_capacity(allocator);
+	unsigned char *large =
+	    cap_size_class_alloc(allocator, CAP_SIZE_CLASS_MAX_SIZE + 1);
+	CAP_ASSERT_TRUE(large != NULL, "SIZE_CLASS_ALLOCATOR large allocation");
+	memset(large, 1, CAP_SIZE_CLASS_MAX_SIZE + 1);
+	CAP_ASSERT_TRUE(cap_size_class_capacity(allocator) > capacity,
+			"SIZE_CLASS_ALLOCATOR large allocation is mapped");
+	cap_size_class_free(allocator, large, CAP_SIZE_CLASS_MAX_SIZE + 1);
+	CAP_ASSERT_EQ(cap_size_class_capacity(allocator), capacity,
+		      "SIZE_CLASS_ALLOCATOR large free unmaps");
+	cap_size_class_alloc(allocator, 1 << 20);
+	cap_size_class_reset(allocator);
+	CAP_ASSERT_EQ(cap_size_class_in_use(allocator), 0,
+		      "SIZE_CLASS_ALLOCATOR in use after reset");
+	CAP_ASSERT_EQ(cap_size_class_capacity(allocator),
+		      CAP_SIZE_CLASS_BLOCK_SIZE,
+		      "SIZE_CLASS_ALLOCATOR reset keeps the arena block");
+
+	// A container's nodes live in the allocator
+	cap_allocator interface = cap_size_class_allocator_interface(allocator);
+	cap_list *list = cap_list_init_with_allocator(&interface);
+	for (size_t i = 0; i < 256; ++i)
+		cap_list_push_back(list, (void *)(i + 1));
+	CAP_ASSERT_TRUE(cap_size_class_in_use(allocator) > 256 * 16,
+			"SIZE_CLASS_ALLOCATOR list nodes from the allocator");
+	cap_list_free(list);
+	CAP_ASSERT_EQ(cap_size_class_in_use(allocator), 0,
+		      "SIZE_CLASS_ALLOCATOR list gives it's memory back");
+	cap_size_class_allocator_free(allocator);
+}
@@ -0,0 +1,132 @@
+#include "internal/test-helper.h"
+#include <string.h>
+#include <timer_wheel.h>
+
+#define TIMER_WHEEL_TEST_TIMERS 10000
+
+typedef struct {
+	uint64_t expires;
+	uint64_t fired_at;
+	int fired;
+	cap_timer_wheel_timer *handle;
+} test_timer;
+
+typedef struct {
+	cap_timer_wheel *wheel;
+	uint64_t last_expires;
+	bool in_order;
+} test_state;
+
+static void expire_fn(void *data, void *arg) {
+	test_timer *timer = (test_timer *)data;
+	test_state *state = (test_state *)arg;
+	timer->fired++;
+	timer->fired_at = cap_timer_wheel_now(state->wheel);
+	if (timer->expires < state->last_expires) state->in_order = false;
+	state->last_expires = timer->expires;
+}
+
+static uint64_t next_random(uint64_t *seed) {
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 24;
+}
+
+void test_timer_wheel(void) {
+	{
+		cap_timer_wheel *wheel = cap_timer_wheel_init(100);
+		CAP_ASSERT_EQ(cap_timer_wheel_size(wheel), 0,
+			      "TIMER_WHEEL size after init");
+		test_timer timers[4] = {{.expires = 105},
+					{.expires = 170},
+					{.expires = 100 + (1 << 20)},
+					{.expires = 50}};
+		test_state state = {wheel, 0, true};
+		for (int i = 0; i < 4; ++i)
+			timers[i].handle = cap_timer_wheel_add(
+			    wheel, &timers[i], timers[i].expires);
+		CAP_ASSERT_EQ(cap_timer_wheel_size(wheel), 4,
+			      "TIMER_WHEEL size after add");
+		CAP_ASSERT_EQ(cap_timer_wheel_advance(wheel, 104, expire_fn,
+						      &state),
+			      1, "TIMER_WHEEL past timer fires first");
+		CAP_ASSERT_EQ(timers[3].fired, 1,
+			      "TIMER_WHEEL timer in the past fires");
+		CAP_ASSERT_EQ(cap_timer_wheel_advance(wheel, 105, expire_fn,
+						      &state),
+			      1, "TIMER_WHEEL timer fires at it's time");
+		cap_timer_wheel_cancel(wheel, timers[1].handle);
+		cap_timer_wheel_reschedule(wheel, timers[2].handle, 1000);
+		timers[2].expires = 1000;
+		CAP_ASSERT_EQ(cap_timer_wheel_advance(wheel, 999, expire_fn,
+						      &state),
+			      0, "TIMER_WHEEL cancelled timer doesn't fire");
+		CAP_ASSERT_EQ(cap_timer_wheel_advance(wheel, 5000, expire_fn,
+						      &state),
+			      1, "TIMER_WHEEL rescheduled timer fires");
+		CAP_ASSERT_EQ(timers[2].fired_at, 1000,
+			      "TIMER_WHEEL wheel's time when a timer fires");
+		CAP_ASSERT_EQ(cap_timer_wheel_now(wheel), 5000,
+			      "TIMER_WHEEL time after advance");
+		CAP_ASSERT_EQ(cap_timer_wheel_size(wheel), 0,
+			      "TIMER_WHEEL size after every timer fired");
+		cap_timer_wheel_free(wheel);
+	}
+	// Random times over every level, advanced in random steps
+	{
+		static test_timer timers[TIMER_WHEEL_TEST_TIMERS];
+		cap_timer_wheel *wheel = cap_timer_wheel_init(0);
+		test_state state = {wheel, 0, true};
+		uint64_t seed = 3;
+		for (int i = 0; i < TIMER_WHEEL_TEST_TIMERS; ++i) {
+			// Spread over 1 to 2^40 ticks
+			uint64_t random = next_random(&seed);
+			timers[i].expires = 1 + (random >> (random % 40));
+			timers[i].handle = cap_timer_wheel_add(
+			    wheel, &timers[i], timers[i].expires);
+		}
+		size_t cancelled = 0;
+		for (int i = 0; i < TIMER_WHEEL_TEST_TIMERS; i += 10) {
+			cap_timer_wheel_cancel(wheel, timers[i].handle);
+			timers[i].handle = NULL;
+			cancelled++;
+		}
+		uint64_t now = 0;
+		size_t fired = 0;
+		bool on_time = true;
+		while (cap_timer_wheel_size(wheel)) {
+			uint64_t previous = now;
+			uint64_t random = next_random(&seed);
+			now += 1 + (random >> (random % 48));
+			fired += cap_timer_wheel_advance(wheel, now, expire_fn,
+							 &state);
+			for (int i = 0; i < TIMER_WHEEL_TEST_TIMERS; ++i) {
+				if (!timers[i].handle || !timers[i].fired)
+					continue;
+				if (timers[i].expires <= previous ||
+				    timers[i].expires > now ||
+				    timers[i].fired_at != timers[i].expires)
+					on_time = false;
+				timers[i].handle = NULL;
+			}
+		}
+		bool once = true;
+		for (int i = 0; i < TIMER_WHEEL_TEST_TIMERS; ++i)
+			if (timers[i].fired != (i % 10 != 0)) once = false;
+		CAP_ASSERT_EQ(fired, TIMER_WHEEL_TEST_TIMERS - cancelled,
+			      "TIMER_WHEEL every pending timer fires");
+		CAP_ASSERT_TRUE(once, "TIMER_WHEEL each timer fires once");
+		CAP_ASSERT_TRUE(on_time,
+				"TIMER_WHEEL timers fire within their step");
+		CAP_ASSERT_TRUE(state.in_order,
+				"TIMER_WHEEL timers fire in the order of time");
+		cap_timer_wheel_free(wheel);
+	}
+	// Pending timers are released by free
+	{
+		cap_timer_wheel *wheel = cap_timer_wheel_init(0);
+		int data = 0;
+		for (uint64_t i = 1; i < 1000; ++i)
+			cap_timer_wheel_add(wheel, &data, i * 7919);
+		cap_timer_wheel_free(wheel);
+	}
+}
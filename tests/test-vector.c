@@ -20,6 +20,19 @@ bool predicate_fn_two(void *data) {
 	}
 }
 
+static size_t _moved_bytes = 0;
+
+static void *no_realloc_alloc(void *ctx, size_t size) {
+	(void)ctx;
+	return malloc(size);
+}
+
+static void no_realloc_free(void *ctx, void *ptr, size_t size) {
+	(void)ctx;
+	_moved_bytes += size;
+	free(ptr);
+}
+
 void test_vector(void) {
 	{
 		cap_vector *vector_one = cap_vector_init(5);
@@ -224,4 +237,23 @@ void test_vector(void) {
 		cap_vector_free(vector);
 		cap_vector_iterator_free(vector_iterator);
 	}
+	{ // An allocator without realloc
+		cap_allocator allocator = {no_realloc_alloc, NULL,
+					   no_realloc_free, NULL};
+		cap_vector *vector =
+		    cap_vector_init_with_allocator(2, &allocator);
+		int items[100];
+		for (int i = 0; i < 100; ++i) {
+			items[i] = i;
+			cap_vector_push_back(vector, &items[i]);
+		}
+		CAP_ASSERT_TRUE(_moved_bytes > 0,
+				"VECTOR grows through alloc and free");
+		bool in_order = true;
+		for (int i = 99; i >= 0; --i)
+			if (cap_vector_pop_back(vector) != &items[i])
+				in_order = false;
+		CAP_ASSERT_TRUE(in_order, "VECTOR items kept without realloc");
+		cap_vector_free(vector);
+	}
 }